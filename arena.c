@@ -0,0 +1,84 @@
+#include "vcs.h"
+
+/*
+The arena is a bump allocator for data that lives as long as the repository, such as version metadata.
+Memory is carved out of large blocks by advancing an offset, so an allocation costs a few instructions and
+objects allocated one after another sit next to each other in memory. Nothing is freed individually:
+arena_free releases all blocks at once.
+*/
+
+#define ARENA_ALIGN 8                   // Alignment of every allocation (enough for pointers and 64-bit integers)
+
+// A block of arena memory; the data follows the header
+struct ArenaBlock {
+    struct ArenaBlock* next;            // Previously filled block
+    size_t size;                        // Usable bytes in this block
+    size_t used;                        // Bytes handed out so far
+};
+
+/*
+The function arena_init prepares an empty arena.
+It takes Arena* arena and size_t block_size (size of the blocks memory is taken from).
+*/
+void arena_init(Arena* arena, size_t block_size) {
+    if (!arena) return;
+    arena->head = NULL;
+    arena->block_size = block_size ? block_size : 64 * 1024;
+}
+
+/*
+The function arena_alloc returns zeroed memory from the arena.
+Returns NULL if a new block is needed and cannot be allocated.
+It takes Arena* arena and size_t size (number of bytes needed).
+*/
+void* arena_alloc(Arena* arena, size_t size) {
+    if (!arena) return NULL;
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+    struct ArenaBlock* block = arena->head;
+    if (!block || block->size - block->used < size) {
+        // Start a new block; oversized requests get a block of their own
+        size_t block_size = (size > arena->block_size) ? size : arena->block_size;
+        block = malloc(sizeof(struct ArenaBlock) + block_size);
+        if (!block) return NULL;
+        block->next = arena->head;
+        block->size = block_size;
+        block->used = 0;
+        arena->head = block;
+    }
+
+    void* memory = (char*)(block + 1) + block->used;
+    block->used += size;
+    memset(memory, 0, size);
+    return memory;
+}
+
+/*
+The function arena_strndup copies at most max_len characters of a string into the arena.
+Returns the copy (always NUL-terminated), or NULL if the allocation fails.
+It takes Arena* arena, const char* str and size_t max_len.
+*/
+char* arena_strndup(Arena* arena, const char* str, size_t max_len) {
+    if (!str) str = "";
+    size_t len = strnlen(str, max_len);
+    char* copy = arena_alloc(arena, len + 1);
+    if (!copy) return NULL;
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+/*
+The function arena_free releases all memory of the arena. Everything allocated from it becomes invalid.
+It takes Arena* arena.
+*/
+void arena_free(Arena* arena) {
+    if (!arena) return;
+    struct ArenaBlock* block = arena->head;
+    while (block) {
+        struct ArenaBlock* next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->head = NULL;
+}
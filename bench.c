@@ -0,0 +1,462 @@
+#include "vcs.h"
+#include <fcntl.h>      // Provides open() flags to silence stdout
+
+/*
+Benchmark harness for the core operations, built by "make bench" as vcs-bench and linked against the same
+objects as vcs (everything but main.o).
+
+Each scenario builds a synthetic repository below a scratch directory and times single calls of:
+    small_files     - checkin_file, checkout_file, generate_file_hash and copy_file on many small files
+    large_files     - the same operations on a few large files (throughput)
+    deep_history    - checkin_file of one file edited many times, list_versions, checkout_file of old versions
+    metadata        - load_metadata (through load_repository) of a long history, save_metadata of one version
+Every operation reports its count, total time, operations and megabytes per second, and latency percentiles.
+
+Usage: vcs-bench [-q] [-o output.json] [-d scratch_dir]
+    -q  quick run (a tenth of the default sizes), for a fast smoke test
+Results are written as JSON (to stdout without -o) so runs of different releases can be compared by scripts.
+Files are written just before they are read, so the numbers describe a warm page cache.
+*/
+
+#define BENCH_FORMAT_VERSION 1          // Bumped whenever the layout of the JSON output changes
+
+// Sizes of the synthetic repositories (divided by 10 with -q)
+typedef struct BenchScale {
+    int small_files;            // Number of small files
+    long small_size;            // Average size of a small file in bytes
+    int large_files;            // Number of large files
+    long large_size;            // Size of a large file in bytes
+    int history_versions;       // Versions of the file in the deep history
+    long history_size;          // Size of that file in bytes
+    int metadata_versions;      // Versions in the metadata scenario
+    int metadata_loads;         // Timed loads of that metadata
+    int metadata_saves;         // Timed single-version saves
+} BenchScale;
+
+// Latency samples of one operation
+typedef struct Samples {
+    double* seconds;
+    int count;
+    int cap;
+    long long bytes;            // Bytes processed by all samples (0 if not meaningful)
+} Samples;
+
+// State shared by the scenarios
+typedef struct Bench {
+    FILE* out;                  // JSON output
+    int results;                // Results written so far (to place the commas)
+    unsigned long long random;  // State of the data generator
+    char scratch[MAX_PATH_LEN]; // Scratch directory holding the repositories
+} Bench;
+
+/*
+The function now_seconds returns a monotonic timestamp in seconds.
+*/
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/*
+The function next_random returns the next value of a xorshift64 generator, so every run builds the same data.
+*/
+static unsigned long long next_random(Bench* bench) {
+    bench->random ^= bench->random << 13;
+    bench->random ^= bench->random >> 7;
+    bench->random ^= bench->random << 17;
+    return bench->random;
+}
+
+/*
+The function fill_text fills a buffer with lines of words, which compress and delta like source files do.
+It takes Bench* bench, char* buffer and size_t len.
+*/
+static void fill_text(Bench* bench, char* buffer, size_t len) {
+    static const char* words[] = {
+        "int", "return", "struct", "version", "repository", "file", "if", "else", "for", "while",
+        "const", "char*", "size_t", "NULL", "status", "object", "hash", "metadata", "static", "void"
+    };
+    size_t pos = 0;
+    int column = 0;
+    while (pos < len) {
+        const char* word = words[next_random(bench) % (sizeof(words) / sizeof(words[0]))];
+        for (const char* c = word; *c && pos < len; c++) buffer[pos++] = *c;
+        column += (int)strlen(word) + 1;
+        if (pos < len) buffer[pos++] = (column > 72) ? '\n' : ' ';
+        if (column > 72) column = 0;
+    }
+}
+
+/*
+The function write_text_file writes len bytes of generated text to path.
+Returns 0 on success, -1 on failure.
+*/
+static int write_text_file(Bench* bench, const char* path, size_t len) {
+    char* buffer = malloc(len ? len : 1);
+    if (!buffer) return -1;
+    fill_text(bench, buffer, len);
+    int status = write_file_contents(path, (unsigned char*)buffer, len);
+    free(buffer);
+    return status;
+}
+
+/*
+The function samples_add records the duration of one call.
+*/
+static void samples_add(Samples* samples, double seconds, long long bytes) {
+    if (samples->count == samples->cap) {
+        int cap = samples->cap ? samples->cap * 2 : 256;
+        double* grown = realloc(samples->seconds, cap * sizeof(double));
+        if (!grown) return;
+        samples->seconds = grown;
+        samples->cap = cap;
+    }
+    samples->seconds[samples->count++] = seconds;
+    samples->bytes += bytes;
+}
+
+/*
+The function compare_doubles orders doubles ascending (qsort callback).
+*/
+static int compare_doubles(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/*
+The function percentile returns the q-quantile (0..1) of sorted samples in microseconds.
+*/
+static double percentile(const Samples* samples, double q) {
+    if (samples->count == 0) return 0;
+    int index = (int)((samples->count - 1) * q + 0.5);
+    return samples->seconds[index] * 1e6;
+}
+
+/*
+The function report writes the statistics of one operation as a JSON object and releases the samples.
+It takes Bench* bench, const char* scenario, const char* operation and Samples* samples.
+*/
+static void report(Bench* bench, const char* scenario, const char* operation, Samples* samples) {
+    double total = 0;
+    for (int i = 0; i < samples->count; i++) total += samples->seconds[i];
+    qsort(samples->seconds, samples->count, sizeof(double), compare_doubles);
+
+    fprintf(bench->out, "%s\n    {\"scenario\": \"%s\", \"operation\": \"%s\", \"count\": %d, \"bytes\": %lld, "
+            "\"total_seconds\": %.6f, \"ops_per_second\": %.1f, \"mb_per_second\": %.1f, "
+            "\"p50_us\": %.1f, \"p90_us\": %.1f, \"p99_us\": %.1f, \"max_us\": %.1f}",
+            bench->results ? "," : "", scenario, operation, samples->count, samples->bytes, total,
+            total > 0 ? samples->count / total : 0, total > 0 ? samples->bytes / total / (1024.0 * 1024.0) : 0,
+            percentile(samples, 0.50), percentile(samples, 0.90), percentile(samples, 0.99), percentile(samples, 1.0));
+    bench->results++;
+    fprintf(stderr, "  %-14s %-18s %7d ops  p50 %10.1f us  p99 %10.1f us\n",
+            scenario, operation, samples->count, percentile(samples, 0.50), percentile(samples, 0.99));
+
+    free(samples->seconds);
+    memset(samples, 0, sizeof(*samples));
+}
+
+/*
+The function remove_tree deletes a directory and everything below it (symbolic links are not followed).
+*/
+static void remove_tree(const char* path) {
+    DIR* dir = opendir(path);
+    if (dir) {
+        struct dirent* entry;
+        while ((entry = readdir(dir)) != NULL) {
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+            char child[MAX_PATH_LEN];
+            snprintf(child, sizeof(child), "%s/%s", path, entry->d_name);
+            struct stat st;
+            if (lstat(child, &st) == 0 && S_ISDIR(st.st_mode)) {
+                remove_tree(child);
+            } else {
+                unlink(child);
+            }
+        }
+        closedir(dir);
+    }
+    rmdir(path);
+}
+
+/*
+The function open_scenario creates an empty repository for a scenario below the scratch directory and makes it
+the working directory (the object store is addressed relative to it).
+Returns the loaded repository, or NULL on failure.
+*/
+static Repository* open_scenario(Bench* bench, const char* scenario) {
+    char path[MAX_PATH_LEN];
+    snprintf(path, sizeof(path), "%s/%s", bench->scratch, scenario);
+    if (mkdir(path, 0755) != 0 || chdir(path) != 0 || init_repository(path) != 0) {
+        fprintf(stderr, "Failed to create the %s repository in %s\n", scenario, path);
+        return NULL;
+    }
+    return load_repository(path);
+}
+
+/*
+The function close_scenario releases a scenario's repository and deletes its directory.
+*/
+static void close_scenario(Bench* bench, Repository* repo, const char* scenario) {
+    char path[MAX_PATH_LEN];
+    snprintf(path, sizeof(path), "%s/%s", bench->scratch, scenario);
+    cleanup_repository(repo);
+    if (chdir(bench->scratch) == 0) remove_tree(path);
+}
+
+/*
+The function bench_files times checkin_file, generate_file_hash, copy_file and checkout_file on a set of files.
+Returns 0 on success, -1 if the repository could not be created.
+It takes Bench* bench, const char* scenario, int count (number of files), long size (file size in bytes)
+and int vary (1 to spread the sizes between half and one and a half times size).
+*/
+static int bench_files(Bench* bench, const char* scenario, int count, long size, int vary) {
+    Repository* repo = open_scenario(bench, scenario);
+    if (!repo) return -1;
+
+    char** names = calloc(count, sizeof(char*));
+    long* sizes = calloc(count, sizeof(long));
+    if (!names || !sizes) {
+        free(names);
+        free(sizes);
+        close_scenario(bench, repo, scenario);
+        return -1;
+    }
+    create_directory("src");
+    for (int i = 0; i < count; i++) {
+        char name[64];
+        snprintf(name, sizeof(name), "src/file%05d.txt", i);
+        names[i] = strdup(name);
+        sizes[i] = vary ? size / 2 + (long)(next_random(bench) % (unsigned long long)(size + 1)) : size;
+        if (!names[i] || write_text_file(bench, names[i], (size_t)sizes[i]) != 0) sizes[i] = -1;
+    }
+
+    Samples samples = {0};
+    for (int i = 0; i < count; i++) {
+        if (sizes[i] < 0) continue;
+        double start = now_seconds();
+        checkin_file(repo, names[i], "benchmark");
+        samples_add(&samples, now_seconds() - start, sizes[i]);
+    }
+    report(bench, scenario, "checkin_file", &samples);
+
+    for (int i = 0; i < count; i++) {
+        if (sizes[i] < 0) continue;
+        double start = now_seconds();
+        char* hash = generate_file_hash(names[i]);
+        samples_add(&samples, now_seconds() - start, sizes[i]);
+        free(hash);
+    }
+    report(bench, scenario, "generate_file_hash", &samples);
+
+    for (int i = 0; i < count; i++) {
+        if (sizes[i] < 0) continue;
+        double start = now_seconds();
+        copy_file(names[i], ".vcs/temp/bench-copy");
+        samples_add(&samples, now_seconds() - start, sizes[i]);
+        unlink(".vcs/temp/bench-copy");
+    }
+    report(bench, scenario, "copy_file", &samples);
+
+    for (int i = 0; i < count; i++) {
+        if (sizes[i] < 0) continue;
+        double start = now_seconds();
+        checkout_file(repo, names[i], 1);
+        samples_add(&samples, now_seconds() - start, sizes[i]);
+    }
+    report(bench, scenario, "checkout_file", &samples);
+
+    for (int i = 0; i < count; i++) free(names[i]);
+    free(names);
+    free(sizes);
+    close_scenario(bench, repo, scenario);
+    return 0;
+}
+
+/*
+The function bench_history times the check-ins of one file edited many times, listing its versions and checking
+out old versions (which applies delta chains).
+Returns 0 on success, -1 if the repository could not be created.
+*/
+static int bench_history(Bench* bench, const BenchScale* scale) {
+    const char* scenario = "deep_history";
+    Repository* repo = open_scenario(bench, scenario);
+    if (!repo) return -1;
+
+    // Each version rewrites a few lines in place and appends one, like an edited source file
+    size_t cap = (size_t)scale->history_size + (size_t)scale->history_versions * 32 + 1;
+    char* text = malloc(cap);
+    if (!text) {
+        close_scenario(bench, repo, scenario);
+        return -1;
+    }
+    size_t len = (size_t)scale->history_size;
+    fill_text(bench, text, len);
+
+    Samples samples = {0};
+    for (int v = 1; v <= scale->history_versions; v++) {
+        for (int edit = 0; edit < 3 && len > 64; edit++) {
+            fill_text(bench, text + next_random(bench) % (len - 64), 48);
+        }
+        len += (size_t)snprintf(text + len, cap - len, "version %d\n", v);
+        if (write_file_contents("history.txt", (unsigned char*)text, len) != 0) break;
+        double start = now_seconds();
+        checkin_file(repo, "history.txt", "benchmark edit");
+        samples_add(&samples, now_seconds() - start, (long long)len);
+    }
+    report(bench, scenario, "checkin_file", &samples);
+    free(text);
+
+    // list_versions prints a table; it goes to /dev/null while it is timed
+    int saved_stdout = dup(STDOUT_FILENO);
+    int null_fd = open("/dev/null", O_WRONLY);
+    int lists = scale->history_versions / 10 + 1;
+    for (int i = 0; i < lists; i++) {
+        fflush(stdout);
+        if (null_fd >= 0) dup2(null_fd, STDOUT_FILENO);
+        double start = now_seconds();
+        list_versions(repo, "history.txt", NULL, LIST_TABLE);
+        fflush(stdout);
+        samples_add(&samples, now_seconds() - start, 0);
+        if (saved_stdout >= 0) dup2(saved_stdout, STDOUT_FILENO);
+    }
+    if (null_fd >= 0) close(null_fd);
+    if (saved_stdout >= 0) close(saved_stdout);
+    report(bench, scenario, "list_versions", &samples);
+
+    int latest = get_latest_version(repo, "history.txt");
+    int checkouts = latest / 5 + 1;
+    for (int i = 0; i < checkouts && latest > 0; i++) {
+        int version = 1 + (int)(next_random(bench) % (unsigned long long)latest);
+        FileVersion* file_version = find_file_version(repo, "history.txt", version);
+        double start = now_seconds();
+        checkout_file(repo, "history.txt", version);
+        samples_add(&samples, now_seconds() - start, file_version ? file_version->file_size : 0);
+    }
+    report(bench, scenario, "checkout_file", &samples);
+
+    close_scenario(bench, repo, scenario);
+    return 0;
+}
+
+/*
+The function bench_metadata times loading a long history and saving single versions.
+The versions are synthetic (metadata only), so the numbers isolate the metadata code from the object store.
+Returns 0 on success, -1 if the repository could not be created.
+*/
+static int bench_metadata(Bench* bench, const BenchScale* scale) {
+    const char* scenario = "metadata";
+    Repository* repo = open_scenario(bench, scenario);
+    if (!repo) return -1;
+
+    // Spread the versions over about a hundred versions per file
+    int files = scale->metadata_versions / 100 + 1;
+    for (int i = 0; i < scale->metadata_versions; i++) {
+        char name[64];
+        snprintf(name, sizeof(name), "dir%03d/file%05d.c", i % files % 100, i % files);
+        FileVersion* version = new_file_version(repo, name, "synthetic version for the metadata benchmark");
+        if (!version) break;
+        version->version_number = get_latest_version(repo, name) + 1;
+        version->timestamp = time(NULL);
+        version->file_size = 1000 + i;
+        for (int b = 0; b < HASH_RAW_LEN; b++) version->hash[b] = version->object_id[b] = (unsigned char)next_random(bench);
+        version->flags = VERSION_HAS_HASH | VERSION_HAS_OBJECT;
+        if (add_file_version(repo, version) != 0) break;
+        repo->total_versions++;
+    }
+    compact_metadata(repo);
+
+    Samples samples = {0};
+    for (int i = 0; i < scale->metadata_saves; i++) {
+        FileVersion* version = new_file_version(repo, "saved.c", "benchmark save");
+        if (!version) break;
+        version->version_number = get_latest_version(repo, "saved.c") + 1;
+        version->timestamp = time(NULL);
+        version->file_size = i;
+        version->flags = VERSION_HAS_HASH;
+        if (add_file_version(repo, version) != 0) break;
+        repo->total_versions++;
+        double start = now_seconds();
+        save_metadata(repo);
+        samples_add(&samples, now_seconds() - start, 0);
+    }
+    report(bench, scenario, "save_metadata", &samples);
+
+    // A load maps versions.bin and replays the journal left by the saves
+    char path[MAX_PATH_LEN];
+    snprintf(path, sizeof(path), "%s", repo->base_path);
+    for (int i = 0; i < scale->metadata_loads; i++) {
+        double start = now_seconds();
+        Repository* loaded = load_repository(path);
+        samples_add(&samples, now_seconds() - start, 0);
+        if (loaded) get_latest_version(loaded, "saved.c");
+        cleanup_repository(loaded);
+    }
+    report(bench, scenario, "load_metadata", &samples);
+
+    close_scenario(bench, repo, scenario);
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    BenchScale scale = {2000, 2048, 4, 32L << 20, 1000, 64 * 1024, 100000, 50, 500};
+    const char* output = NULL;
+    const char* parent = "/tmp";
+    int quick = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-q") == 0) {
+            quick = 1;
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            output = argv[++i];
+        } else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            parent = argv[++i];
+        } else {
+            fprintf(stderr, "Usage: %s [-q] [-o output.json] [-d scratch_dir]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (quick) {
+        scale.small_files /= 10;
+        scale.large_files /= 2;
+        scale.large_size /= 10;
+        scale.history_versions /= 10;
+        scale.metadata_versions /= 10;
+        scale.metadata_loads /= 5;
+        scale.metadata_saves /= 10;
+    }
+
+    Bench bench;
+    memset(&bench, 0, sizeof(bench));
+    bench.random = 0x9e3779b97f4a7c15ULL;
+    bench.out = output ? fopen(output, "w") : stdout;
+    if (!bench.out) {
+        perror(output);
+        return 1;
+    }
+
+    // The scenarios run below a fresh scratch directory that is removed afterwards
+    char cwd[MAX_PATH_LEN];
+    if (!getcwd(cwd, sizeof(cwd))) cwd[0] = '\0';
+    snprintf(bench.scratch, sizeof(bench.scratch), "%s/vcs-bench-XXXXXX", parent);
+    if (!mkdtemp(bench.scratch)) {
+        perror(bench.scratch);
+        return 1;
+    }
+
+    fprintf(bench.out, "{\n  \"format_version\": %d,\n  \"timestamp\": %ld,\n  \"quick\": %s,\n  \"cpus\": %d,\n  \"results\": [",
+            BENCH_FORMAT_VERSION, (long)time(NULL), quick ? "true" : "false", parallel_threads(0));
+    fprintf(stderr, "Benchmarking in %s\n", bench.scratch);
+
+    int failed = 0;
+    failed |= bench_files(&bench, "small_files", scale.small_files, scale.small_size, 1);
+    failed |= bench_files(&bench, "large_files", scale.large_files, scale.large_size, 0);
+    failed |= bench_history(&bench, &scale);
+    failed |= bench_metadata(&bench, &scale);
+
+    fprintf(bench.out, "\n  ]\n}\n");
+    if (output) fclose(bench.out);
+    remove_tree(bench.scratch);
+    if (cwd[0] && chdir(cwd) != 0) failed = -1;
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,299 @@
+#include "vcs.h"
+#include <stdint.h>     // Provides fixed-width integers for the gear hash and the chunk list
+#include <fcntl.h>      // Provides open() flags and posix_fadvise()
+#include <pthread.h>    // Provides pthread_once() to set up the gear table
+
+/*
+Files of at least config.chunk_threshold bytes are stored as content-defined chunks instead of a single object.
+The file is cut where a rolling gear hash over the preceding bytes matches a mask (FastCDC), so boundaries depend
+on the contents around them rather than on their offsets: an edit changes only the chunks it touches, even when
+it shifts everything after it, and the other chunks are shared with the previous version. Every chunk is an
+ordinary object named after the SHA-256 of its bytes. The version's object, still named after the hash of the
+whole file, is an OBJECT_CHUNKS object whose payload lists the chunks in order, CHUNK_ENTRY_SIZE bytes each:
+    raw chunk id (32 bytes) | chunk length (8 bytes, little endian)
+Chunks range from a quarter to four times config.chunk_size. Normalized chunking (a stricter mask before the
+average size, a looser one after it) keeps most of them close to the average. Chunks are hashed and compressed on
+config.threads threads; a restore writes them back in order and has the next CHUNK_READAHEAD read ahead.
+The file is read into a window of CHUNK_WINDOW_SIZE bytes at a time and the whole file's digest is taken over
+the window, so the chunks and the list always match the id the list is stored under even if the file is rewritten
+while it is being stored (the list is then not written). Reading rather than mapping the file also keeps a
+truncation meanwhile from raising SIGBUS.
+*/
+
+#define CHUNK_MIN_AVERAGE 256   // Smallest average chunk size accepted from the configuration
+#define CHUNK_READAHEAD 8       // Chunks a restore asks the kernel to read ahead of the one being written
+#define CHUNK_WINDOW_SIZE (64L * 1024 * 1024)   // Bytes of the file read and stored at a time
+
+// One chunk of the file being stored
+typedef struct Chunk {
+    const unsigned char* data;          // Points into the window the file is read into
+    size_t length;
+    unsigned char id[HASH_RAW_LEN];
+    int status;                         // 0 once the chunk is stored
+} Chunk;
+
+// Work shared by the threads storing the chunks of one file
+typedef struct ChunkJob {
+    Chunk* chunks;
+    const RepoConfig* config;
+} ChunkJob;
+
+// The gear table: a pseudo-random 64-bit value per byte value, the same in every build so boundaries are stable
+static uint64_t gear[256];
+static pthread_once_t gear_once = PTHREAD_ONCE_INIT;
+
+/*
+The function gear_init fills the gear table from a fixed seed (splitmix64).
+*/
+static void gear_init(void) {
+    uint64_t state = 0;
+    for (int i = 0; i < 256; i++) {
+        uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        gear[i] = z ^ (z >> 31);
+    }
+}
+
+/*
+The function cut_point finds the end of the chunk starting at data.
+Returns the chunk's length.
+It takes the remaining bytes, the chunk sizes (min, average, max) and the two masks.
+Every step shifts the fingerprint left, so its top bits depend on the last 64 bytes only; the masks test top bits.
+*/
+static size_t cut_point(const unsigned char* data, size_t len, size_t min, size_t average, size_t max,
+                        uint64_t mask_strict, uint64_t mask_loose) {
+    if (len <= min) return len;
+    if (len > max) len = max;
+    size_t normal = (len < average) ? len : average;
+
+    uint64_t fingerprint = 0;
+    size_t i = min;
+    for (; i < normal; i++) {
+        fingerprint = (fingerprint << 1) + gear[data[i]];
+        if (!(fingerprint & mask_strict)) return i + 1;
+    }
+    for (; i < len; i++) {
+        fingerprint = (fingerprint << 1) + gear[data[i]];
+        if (!(fingerprint & mask_loose)) return i + 1;
+    }
+    return len;
+}
+
+/*
+The function store_chunk hashes one chunk and stores it unless it is stored already (parallel_for worker).
+*/
+static void store_chunk(void* context, int index) {
+    ChunkJob* job = context;
+    Chunk* chunk = &job->chunks[index];
+    char chunk_id[MAX_HASH_LEN];
+    chunk->status = -1;
+    if (hash_buffer(chunk->data, chunk->length, chunk_id) != 0 || hash_from_hex(chunk_id, chunk->id) != 0) return;
+    chunk->status = object_store_buffer(chunk_id, chunk->data, chunk->length, job->config);
+}
+
+/*
+The function store_chunked stores a large file as content-defined chunks and a chunk list under object_id.
+Returns 1 if the file was stored as chunks, 0 if it is too small to be split (store it as one object instead),
+-1 on failure (the contents no longer hashing to object_id included).
+It takes const char* filepath, const char* object_id (hash of the whole file, as computed by hash_file) and
+const RepoConfig* config (chunk_size, threads, and the hot codec for new chunks).
+The chunks are stored before the list, so the list never refers to a missing chunk.
+*/
+int store_chunked(const char* filepath, const char* object_id, const RepoConfig* config) {
+    size_t average = (config->chunk_size >= CHUNK_MIN_AVERAGE) ? (size_t)config->chunk_size : CHUNK_MIN_AVERAGE;
+    size_t min = average / 4, max = average * 4;
+
+    int fd = open(filepath, O_RDONLY);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+    // A file that fits in one chunk would be its own only chunk
+    if ((size_t)st.st_size <= max) {
+        close(fd);
+        return 0;
+    }
+    size_t size = (size_t)st.st_size;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    // The masks have one bit more (strict) and one bit less (loose) than the average size calls for
+    int bits = 0;
+    while (((size_t)1 << (bits + 1)) <= average) bits++;
+    uint64_t mask_strict = ~0ULL << (64 - (bits + 1));
+    uint64_t mask_loose = ~0ULL << (64 - (bits - 1));
+    pthread_once(&gear_once, gear_init);
+
+    // Read a window, cut the chunks it holds completely in a quick sequential scan that also digests the whole
+    // file, spread the hashing and storing of those chunks over the threads, and carry the rest over
+    size_t window_size = ((size_t)CHUNK_WINDOW_SIZE > 2 * max) ? (size_t)CHUNK_WINDOW_SIZE : 2 * max;
+    unsigned char* window = malloc(window_size);
+    HashState digest;
+    int status = (window && hash_begin(&digest) == 0) ? 0 : -1;
+    int hashing = status == 0;
+    Chunk* chunks = NULL;
+    size_t count = 0, cap = 0, filled = 0;
+    int at_end = 0;
+    while (status == 0) {
+        while (!at_end && filled < window_size) {
+            ssize_t bytes = read(fd, window + filled, window_size - filled);
+            if (bytes < 0 && errno == EINTR) continue;
+            if (bytes < 0) {
+                status = -1;
+                break;
+            }
+            if (bytes == 0) at_end = 1;
+            filled += (size_t)bytes;
+        }
+        if (status != 0) break;
+
+        // A chunk is complete once max bytes follow its start (boundaries never look further), or at the end
+        size_t first = count, used = 0;
+        while (used < filled && (at_end || filled - used >= max)) {
+            if (count == cap) {
+                cap = cap ? cap * 2 : size / average + 16;
+                Chunk* grown = realloc(chunks, cap * sizeof(Chunk));
+                if (!grown) {
+                    status = -1;
+                    break;
+                }
+                chunks = grown;
+            }
+            size_t length = cut_point(window + used, filled - used, min, average, max, mask_strict, mask_loose);
+            if (hash_update(&digest, window + used, length) != 0) {
+                status = -1;
+                break;
+            }
+            chunks[count].data = window + used;
+            chunks[count].length = length;
+            count++;
+            used += length;
+        }
+        if (status != 0) break;
+
+        ChunkJob job = {chunks + first, config};
+        parallel_for((int)(count - first), config->threads, store_chunk, &job);
+        for (size_t i = first; i < count; i++) {
+            if (chunks[i].status != 0) status = -1;
+        }
+        if (at_end) break;
+        memmove(window, window + used, filled - used);
+        filled -= used;
+    }
+    close(fd);
+    char stored_id[MAX_HASH_LEN];
+    if (hashing && status == 0) {
+        if (hash_finish(&digest, stored_id) != 0 || !stored_id_matches(filepath, stored_id, object_id)) status = -1;
+    } else if (hashing) {
+        hash_abort(&digest);
+    }
+    free(window);
+
+    unsigned char* list = (status == 0) ? malloc(count * CHUNK_ENTRY_SIZE) : NULL;
+    if (!list) status = -1;
+    for (size_t i = 0; status == 0 && i < count; i++) {
+        unsigned char* entry = list + i * CHUNK_ENTRY_SIZE;
+        memcpy(entry, chunks[i].id, HASH_RAW_LEN);
+        for (int b = 0; b < 8; b++) entry[HASH_RAW_LEN + b] = (unsigned char)((uint64_t)chunks[i].length >> (8 * b));
+    }
+    if (status == 0) status = object_store_chunks(object_id, list, count * CHUNK_ENTRY_SIZE);
+    trace("chunk: %s stored as %zu chunks", filepath, count);
+
+    free(list);
+    free(chunks);
+    return (status == 0) ? 1 : -1;
+}
+
+/*
+The function entry_length decodes the length field of a chunk list entry.
+*/
+static uint64_t entry_length(const unsigned char* entry) {
+    uint64_t length = 0;
+    for (int b = 0; b < 8; b++) length |= (uint64_t)entry[HASH_RAW_LEN + b] << (8 * b);
+    return length;
+}
+
+/*
+The function next_chunk loads a chunk listed in a chunk list and checks its length.
+Returns 0 on success, -1 if the chunk is missing or does not match the list.
+*/
+static int next_chunk(const unsigned char* entry, unsigned char** data, size_t* len) {
+    char chunk_id[MAX_HASH_LEN];
+    hash_to_hex(entry, chunk_id);
+    if (object_read(chunk_id, data, len) != 0) return -1;
+    if ((uint64_t)*len != entry_length(entry)) {
+        free(*data);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+The function chunks_read reassembles the contents of a chunked object in memory.
+Returns 0 on success, -1 on failure (a chunk missing or corrupt, or the list malformed).
+It takes the chunk list (const unsigned char* list / size_t len) and unsigned char** data / size_t* data_len
+(receive the malloc'd contents).
+*/
+int chunks_read(const unsigned char* list, size_t len, unsigned char** data, size_t* data_len) {
+    if (len % CHUNK_ENTRY_SIZE != 0) return -1;
+    size_t count = len / CHUNK_ENTRY_SIZE;
+    uint64_t total = 0;
+    for (size_t i = 0; i < count; i++) {
+        total += entry_length(list + i * CHUNK_ENTRY_SIZE);
+        if (total > (uint64_t)SIZE_MAX / 2) return -1;
+    }
+
+    unsigned char* contents = malloc(total ? (size_t)total : 1);
+    if (!contents) return -1;
+    size_t offset = 0;
+    for (size_t i = 0; i < count; i++) {
+        unsigned char* chunk = NULL;
+        size_t chunk_len = 0;
+        if (next_chunk(list + i * CHUNK_ENTRY_SIZE, &chunk, &chunk_len) != 0) {
+            free(contents);
+            return -1;
+        }
+        memcpy(contents + offset, chunk, chunk_len);
+        offset += chunk_len;
+        free(chunk);
+    }
+    *data = contents;
+    *data_len = offset;
+    return 0;
+}
+
+/*
+The function chunks_restore writes the contents of a chunked object to a file, one chunk at a time.
+Returns 0 on success, -1 on failure (a chunk missing or corrupt, or file write errors).
+It takes the chunk list (const unsigned char* list / size_t len) and const char* dest (file to write).
+Only one chunk is held in memory; the kernel is asked to read the next CHUNK_READAHEAD chunks meanwhile.
+*/
+int chunks_restore(const unsigned char* list, size_t len, const char* dest) {
+    if (len % CHUNK_ENTRY_SIZE != 0) return -1;
+    size_t count = len / CHUNK_ENTRY_SIZE;
+    FILE* file = fopen(dest, "wb");
+    if (!file) return -1;
+
+    int status = 0;
+    for (size_t i = 0; i < count && status == 0; i++) {
+        // Keep the readahead window CHUNK_READAHEAD chunks ahead
+        for (size_t ahead = (i == 0) ? 1 : i + CHUNK_READAHEAD; ahead <= i + CHUNK_READAHEAD && ahead < count; ahead++) {
+            char chunk_id[MAX_HASH_LEN];
+            hash_to_hex(list + ahead * CHUNK_ENTRY_SIZE, chunk_id);
+            object_prefetch(chunk_id);
+        }
+
+        unsigned char* chunk = NULL;
+        size_t chunk_len = 0;
+        if (next_chunk(list + i * CHUNK_ENTRY_SIZE, &chunk, &chunk_len) != 0) {
+            status = -1;
+            break;
+        }
+        if (chunk_len > 0 && fwrite(chunk, 1, chunk_len, file) != chunk_len) status = -1;
+        free(chunk);
+    }
+    if (fclose(file) != 0) status = -1;
+    return status;
+}
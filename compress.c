@@ -0,0 +1,436 @@
+#include "vcs.h"
+#include <zlib.h>           // Provides deflate/inflate, always available
+#ifdef VCS_WITH_LZ4
+#include <lz4frame.h>       // Provides the LZ4 frame format (fast, used for hot objects)
+#endif
+#ifdef VCS_WITH_ZSTD
+#include <zstd.h>           // Provides Zstandard (high ratio, used for cold history)
+#endif
+
+/*
+The compression layer encodes object payloads with one of several codecs.
+zlib is always built in; LZ4 and zstd are enabled with "make WITH_LZ4=1 WITH_ZSTD=1".
+Each encoded object records its codec in the object header, so objects written with different codecs coexist.
+Streaming functions work on FILE* handles in COMPRESS_CHUNK_SIZE pieces, so large files never need to fit in memory.
+*/
+
+#define COMPRESS_CHUNK_SIZE (256 * 1024)    // Amount of data moved per streaming step
+
+// Names of the codecs as written in .vcs/config, indexed by CODEC_* value
+static const char* codec_names[] = {"none", "zlib", "lz4", "zstd"};
+
+/*
+The function codec_from_name maps a codec name from .vcs/config to its CODEC_* value.
+Returns the codec value, or -1 if the name is unknown.
+*/
+int codec_from_name(const char* name) {
+    for (int i = 0; i < (int)(sizeof(codec_names) / sizeof(codec_names[0])); i++) {
+        size_t len = strlen(codec_names[i]);
+        // Accept trailing newline or whitespace left over from the config line
+        if (strncmp(name, codec_names[i], len) == 0 && (name[len] == '\0' || name[len] == '\n' || name[len] == ' ')) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/*
+The function codec_name returns the config name of a CODEC_* value ("none" for unknown values).
+*/
+const char* codec_name(int codec) {
+    if (codec < 0 || codec >= (int)(sizeof(codec_names) / sizeof(codec_names[0]))) return codec_names[CODEC_NONE];
+    return codec_names[codec];
+}
+
+/*
+The function codec_available checks whether a codec was compiled into this build.
+Returns 1 if objects can be read and written with the codec, 0 otherwise.
+*/
+int codec_available(int codec) {
+    switch (codec) {
+        case CODEC_NONE:
+        case CODEC_ZLIB:
+            return 1;
+#ifdef VCS_WITH_LZ4
+        case CODEC_LZ4:
+            return 1;
+#endif
+#ifdef VCS_WITH_ZSTD
+        case CODEC_ZSTD:
+            return 1;
+#endif
+        default:
+            return 0;
+    }
+}
+
+/*
+The function compress_buffer compresses an in-memory buffer.
+Returns 0 on success, -1 on failure (unsupported codec or codec errors).
+It takes int codec / int level, const unsigned char* in / size_t len (the data),
+and unsigned char** out / size_t* out_len (receive the malloc'd compressed data, freed by the caller).
+*/
+int compress_buffer(int codec, int level, const unsigned char* in, size_t len,
+                    unsigned char** out, size_t* out_len) {
+    if (codec == CODEC_ZLIB) {
+        uLongf cap = compressBound((uLong)len);
+        unsigned char* buffer = malloc(cap);
+        if (!buffer) return -1;
+        if (level < 1 || level > 9) level = Z_DEFAULT_COMPRESSION;
+        if (compress2(buffer, &cap, in, (uLong)len, level) != Z_OK) {
+            free(buffer);
+            return -1;
+        }
+        *out = buffer;
+        *out_len = cap;
+        return 0;
+    }
+#ifdef VCS_WITH_LZ4
+    if (codec == CODEC_LZ4) {
+        LZ4F_preferences_t prefs;
+        memset(&prefs, 0, sizeof(prefs));
+        prefs.compressionLevel = level;
+        prefs.frameInfo.contentSize = len;
+        size_t cap = LZ4F_compressFrameBound(len, &prefs);
+        unsigned char* buffer = malloc(cap);
+        if (!buffer) return -1;
+        size_t written = LZ4F_compressFrame(buffer, cap, in, len, &prefs);
+        if (LZ4F_isError(written)) {
+            free(buffer);
+            return -1;
+        }
+        *out = buffer;
+        *out_len = written;
+        return 0;
+    }
+#endif
+#ifdef VCS_WITH_ZSTD
+    if (codec == CODEC_ZSTD) {
+        size_t cap = ZSTD_compressBound(len);
+        unsigned char* buffer = malloc(cap);
+        if (!buffer) return -1;
+        size_t written = ZSTD_compress(buffer, cap, in, len, level);
+        if (ZSTD_isError(written)) {
+            free(buffer);
+            return -1;
+        }
+        *out = buffer;
+        *out_len = written;
+        return 0;
+    }
+#endif
+    return -1;
+}
+
+/*
+The function decompress_buffer decompresses an in-memory buffer whose original size is known.
+Returns 0 on success, -1 on failure (unsupported codec, corrupt data or size mismatch).
+It takes int codec, const unsigned char* in / size_t len (the compressed data)
+and unsigned char* out / size_t out_len (buffer of exactly the original size).
+*/
+int decompress_buffer(int codec, const unsigned char* in, size_t len, unsigned char* out, size_t out_len) {
+    if (codec == CODEC_ZLIB) {
+        uLongf dest_len = (uLongf)out_len;
+        if (uncompress(out, &dest_len, in, (uLong)len) != Z_OK) return -1;
+        return (dest_len == out_len) ? 0 : -1;
+    }
+#ifdef VCS_WITH_LZ4
+    if (codec == CODEC_LZ4) {
+        LZ4F_dctx* ctx = NULL;
+        if (LZ4F_isError(LZ4F_createDecompressionContext(&ctx, LZ4F_VERSION))) return -1;
+        size_t in_pos = 0, out_pos = 0, ret = 1;
+        while (ret != 0) {
+            size_t src_size = len - in_pos;
+            size_t dst_size = out_len - out_pos;
+            ret = LZ4F_decompress(ctx, out + out_pos, &dst_size, in + in_pos, &src_size, NULL);
+            if (LZ4F_isError(ret)) break;
+            in_pos += src_size;
+            out_pos += dst_size;
+            if (src_size == 0 && dst_size == 0) break;  // No progress: the frame is truncated
+        }
+        LZ4F_freeDecompressionContext(ctx);
+        return (ret == 0 && out_pos == out_len) ? 0 : -1;
+    }
+#endif
+#ifdef VCS_WITH_ZSTD
+    if (codec == CODEC_ZSTD) {
+        size_t written = ZSTD_decompress(out, out_len, in, len);
+        return (!ZSTD_isError(written) && written == out_len) ? 0 : -1;
+    }
+#endif
+    return -1;
+}
+
+// State of an incremental compression (see compressor_begin)
+struct Compressor {
+    int codec;
+    FILE* out;
+    unsigned char* output;          // Staging buffer for compressed bytes
+    size_t cap;
+    int failed;
+    z_stream zs;
+#ifdef VCS_WITH_LZ4
+    LZ4F_cctx* lz4;
+#endif
+#ifdef VCS_WITH_ZSTD
+    ZSTD_CCtx* zstd;
+#endif
+};
+
+/*
+The function compressor_begin starts compressing a stream of pieces handed over one at a time.
+Returns the compressor (pass it to compressor_update, and always to compressor_finish), or NULL on failure.
+It takes int codec / int level and FILE* out (positioned where the compressed bytes start).
+*/
+Compressor* compressor_begin(int codec, int level, FILE* out) {
+    Compressor* c = calloc(1, sizeof(Compressor));
+    if (!c) return NULL;
+    c->codec = codec;
+    c->out = out;
+    int status = -1;
+
+    if (codec == CODEC_ZLIB) {
+        c->cap = COMPRESS_CHUNK_SIZE;
+        c->output = malloc(c->cap);
+        if (level < 1 || level > 9) level = Z_DEFAULT_COMPRESSION;
+        if (c->output && deflateInit(&c->zs, level) == Z_OK) status = 0;
+        else c->codec = CODEC_NONE;     // Nothing to clean up in zlib
+    }
+#ifdef VCS_WITH_LZ4
+    else if (codec == CODEC_LZ4) {
+        LZ4F_preferences_t prefs;
+        memset(&prefs, 0, sizeof(prefs));
+        prefs.compressionLevel = level;
+        c->cap = LZ4F_compressBound(COMPRESS_CHUNK_SIZE, &prefs);
+        c->output = malloc(c->cap);
+        if (c->output && !LZ4F_isError(LZ4F_createCompressionContext(&c->lz4, LZ4F_VERSION))) {
+            size_t n = LZ4F_compressBegin(c->lz4, c->output, c->cap, &prefs);
+            status = (!LZ4F_isError(n) && fwrite(c->output, 1, n, out) == n) ? 0 : -1;
+        }
+    }
+#endif
+#ifdef VCS_WITH_ZSTD
+    else if (codec == CODEC_ZSTD) {
+        c->cap = ZSTD_CStreamOutSize();
+        c->output = malloc(c->cap);
+        c->zstd = ZSTD_createCCtx();
+        if (c->output && c->zstd) {
+            ZSTD_CCtx_setParameter(c->zstd, ZSTD_c_compressionLevel, level);
+            status = 0;
+        }
+    }
+#endif
+
+    if (status != 0) {
+        c->failed = 1;
+        compressor_finish(c);
+        return NULL;
+    }
+    return c;
+}
+
+/*
+The function compressor_update compresses the next piece of the stream and writes what the codec produces.
+Returns 0 on success, -1 on failure (the compressor must still be passed to compressor_finish).
+It takes Compressor* c and the piece (const unsigned char* data / size_t len).
+*/
+int compressor_update(Compressor* c, const unsigned char* data, size_t len) {
+    // The codecs are fed at most COMPRESS_CHUNK_SIZE at a time, which bounds the staging buffer
+    while (len > 0 && !c->failed) {
+        size_t piece = (len < COMPRESS_CHUNK_SIZE) ? len : COMPRESS_CHUNK_SIZE;
+        if (c->codec == CODEC_ZLIB) {
+            c->zs.next_in = (Bytef*)data;
+            c->zs.avail_in = (uInt)piece;
+            // Drain the compressor until it has consumed this piece of input
+            do {
+                c->zs.next_out = c->output;
+                c->zs.avail_out = (uInt)c->cap;
+                if (deflate(&c->zs, Z_NO_FLUSH) == Z_STREAM_ERROR) { c->failed = 1; break; }
+                size_t have = c->cap - c->zs.avail_out;
+                if (fwrite(c->output, 1, have, c->out) != have) { c->failed = 1; break; }
+            } while (c->zs.avail_out == 0);
+        }
+#ifdef VCS_WITH_LZ4
+        else if (c->codec == CODEC_LZ4) {
+            size_t n = LZ4F_compressUpdate(c->lz4, c->output, c->cap, data, piece, NULL);
+            if (LZ4F_isError(n) || fwrite(c->output, 1, n, c->out) != n) c->failed = 1;
+        }
+#endif
+#ifdef VCS_WITH_ZSTD
+        else if (c->codec == CODEC_ZSTD) {
+            ZSTD_inBuffer zin = {data, piece, 0};
+            // Keep calling the compressor until the piece is consumed
+            while (zin.pos < zin.size) {
+                ZSTD_outBuffer zout = {c->output, c->cap, 0};
+                size_t remaining = ZSTD_compressStream2(c->zstd, &zout, &zin, ZSTD_e_continue);
+                if (ZSTD_isError(remaining) || fwrite(c->output, 1, zout.pos, c->out) != zout.pos) {
+                    c->failed = 1;
+                    break;
+                }
+            }
+        }
+#endif
+        else {
+            c->failed = 1;
+        }
+        data += piece;
+        len -= piece;
+    }
+    return c->failed ? -1 : 0;
+}
+
+/*
+The function compressor_finish flushes the end of the compressed stream and releases the compressor.
+Returns 0 on success, -1 if compressing or writing failed at any point.
+It takes Compressor* c (NULL is ignored).
+*/
+int compressor_finish(Compressor* c) {
+    if (!c) return -1;
+    if (c->codec == CODEC_ZLIB) {
+        int ret = Z_OK;
+        while (!c->failed && ret != Z_STREAM_END) {
+            c->zs.next_out = c->output;
+            c->zs.avail_out = (uInt)c->cap;
+            ret = deflate(&c->zs, Z_FINISH);
+            size_t have = c->cap - c->zs.avail_out;
+            if (ret == Z_STREAM_ERROR || fwrite(c->output, 1, have, c->out) != have) c->failed = 1;
+        }
+        deflateEnd(&c->zs);
+    }
+#ifdef VCS_WITH_LZ4
+    else if (c->codec == CODEC_LZ4) {
+        if (!c->failed) {
+            size_t n = LZ4F_compressEnd(c->lz4, c->output, c->cap, NULL);
+            if (LZ4F_isError(n) || fwrite(c->output, 1, n, c->out) != n) c->failed = 1;
+        }
+        LZ4F_freeCompressionContext(c->lz4);
+    }
+#endif
+#ifdef VCS_WITH_ZSTD
+    else if (c->codec == CODEC_ZSTD) {
+        ZSTD_inBuffer zin = {NULL, 0, 0};
+        size_t remaining = 1;
+        // Flush until the frame is complete
+        while (!c->failed && remaining != 0) {
+            ZSTD_outBuffer zout = {c->output, c->cap, 0};
+            remaining = ZSTD_compressStream2(c->zstd, &zout, &zin, ZSTD_e_end);
+            if (ZSTD_isError(remaining) || fwrite(c->output, 1, zout.pos, c->out) != zout.pos) c->failed = 1;
+        }
+        ZSTD_freeCCtx(c->zstd);
+    }
+#endif
+    int status = c->failed ? -1 : 0;
+    free(c->output);
+    free(c);
+    return status;
+}
+
+/*
+The function compress_stream compresses everything readable from in and writes it to out.
+Returns 0 on success, -1 on failure (unsupported codec, read/write or codec errors).
+It takes int codec / int level and FILE* in / FILE* out (already positioned where reading and writing start).
+*/
+int compress_stream(int codec, int level, FILE* in, FILE* out) {
+    unsigned char* input = malloc(COMPRESS_CHUNK_SIZE);
+    Compressor* c = input ? compressor_begin(codec, level, out) : NULL;
+    if (!c) {
+        free(input);
+        return -1;
+    }
+
+    int status = 0;
+    for (;;) {
+        size_t bytes = fread(input, 1, COMPRESS_CHUNK_SIZE, in);
+        if (ferror(in)) { status = -1; break; }
+        if (bytes == 0) break;
+        if (compressor_update(c, input, bytes) != 0) { status = -1; break; }
+    }
+    if (compressor_finish(c) != 0) status = -1;
+    free(input);
+    return status;
+}
+
+/*
+The function decompress_stream decompresses everything readable from in and writes the original bytes to out.
+Returns 0 on success, -1 on failure (unsupported codec, read/write errors or corrupt data).
+It takes int codec and FILE* in / FILE* out (already positioned at the start of the compressed data).
+*/
+int decompress_stream(int codec, FILE* in, FILE* out) {
+    unsigned char* input = malloc(COMPRESS_CHUNK_SIZE);
+    unsigned char* output = malloc(COMPRESS_CHUNK_SIZE);
+    int status = -1;
+    if (!input || !output) goto done;
+
+    if (codec == CODEC_ZLIB) {
+        z_stream zs;
+        memset(&zs, 0, sizeof(zs));
+        if (inflateInit(&zs) != Z_OK) goto done;
+        int ret = Z_OK;
+        status = 0;
+        while (status == 0 && ret != Z_STREAM_END) {
+            size_t bytes = fread(input, 1, COMPRESS_CHUNK_SIZE, in);
+            if (ferror(in) || bytes == 0) { status = -1; break; }   // Truncated stream
+            zs.next_in = input;
+            zs.avail_in = (uInt)bytes;
+            do {
+                zs.next_out = output;
+                zs.avail_out = COMPRESS_CHUNK_SIZE;
+                ret = inflate(&zs, Z_NO_FLUSH);
+                if (ret != Z_OK && ret != Z_STREAM_END) { status = -1; break; }
+                size_t have = COMPRESS_CHUNK_SIZE - zs.avail_out;
+                if (fwrite(output, 1, have, out) != have) { status = -1; break; }
+            } while (zs.avail_out == 0 && ret != Z_STREAM_END);
+        }
+        inflateEnd(&zs);
+    }
+#ifdef VCS_WITH_LZ4
+    else if (codec == CODEC_LZ4) {
+        LZ4F_dctx* ctx = NULL;
+        if (LZ4F_isError(LZ4F_createDecompressionContext(&ctx, LZ4F_VERSION))) goto done;
+        size_t ret = 1;
+        status = 0;
+        while (status == 0 && ret != 0) {
+            size_t bytes = fread(input, 1, COMPRESS_CHUNK_SIZE, in);
+            if (ferror(in) || bytes == 0) { status = -1; break; }
+            size_t pos = 0;
+            size_t dst_size = 0;
+            // Continue while input is left or the last call filled the output buffer (more may be pending)
+            while ((pos < bytes || dst_size == COMPRESS_CHUNK_SIZE) && ret != 0) {
+                size_t src_size = bytes - pos;
+                dst_size = COMPRESS_CHUNK_SIZE;
+                ret = LZ4F_decompress(ctx, output, &dst_size, input + pos, &src_size, NULL);
+                if (LZ4F_isError(ret) || fwrite(output, 1, dst_size, out) != dst_size) { status = -1; break; }
+                pos += src_size;
+            }
+        }
+        LZ4F_freeDecompressionContext(ctx);
+    }
+#endif
+#ifdef VCS_WITH_ZSTD
+    else if (codec == CODEC_ZSTD) {
+        ZSTD_DCtx* ctx = ZSTD_createDCtx();
+        if (!ctx) goto done;
+        size_t ret = 1;
+        status = 0;
+        while (status == 0 && ret != 0) {
+            size_t bytes = fread(input, 1, COMPRESS_CHUNK_SIZE, in);
+            if (ferror(in) || bytes == 0) { status = -1; break; }
+            ZSTD_inBuffer zin = {input, bytes, 0};
+            int full = 0;
+            // Continue while input is left or the last call filled the output buffer (more may be pending)
+            while ((zin.pos < zin.size || full) && ret != 0) {
+                ZSTD_outBuffer zout = {output, COMPRESS_CHUNK_SIZE, 0};
+                ret = ZSTD_decompressStream(ctx, &zout, &zin);
+                if (ZSTD_isError(ret) || fwrite(output, 1, zout.pos, out) != zout.pos) { status = -1; break; }
+                full = (zout.pos == zout.size);
+            }
+        }
+        ZSTD_freeDCtx(ctx);
+    }
+#endif
+
+done:
+    free(input);
+    free(output);
+    return status;
+}
@@ -0,0 +1,136 @@
+#include "vcs.h"
+
+/*
+The repository configuration lives in .vcs/config as simple KEY=VALUE lines, in the same style as versions.meta.
+Keys that are missing (for example in repositories created by older versions) keep their default values.
+*/
+
+/*
+The function config_defaults fills a RepoConfig with the default settings.
+It takes RepoConfig* config (the configuration to initialize).
+*/
+void config_defaults(RepoConfig* config) {
+    if (!config) return;
+    config->delta_enabled = 1;                      // Store older versions as deltas against newer ones
+    config->delta_max_chain = 16;                   // At most 16 deltas are applied to rebuild a version
+    config->delta_max_size = 64L * 1024 * 1024;     // Files above 64MB are always stored in full
+
+    // Hot objects favour restore speed, cold history favours size; use the best codecs compiled in
+    config->hot_codec = codec_available(CODEC_LZ4) ? CODEC_LZ4 : CODEC_NONE;
+    config->hot_level = 1;
+    config->cold_codec = codec_available(CODEC_ZSTD) ? CODEC_ZSTD : CODEC_ZLIB;
+    config->cold_level = (config->cold_codec == CODEC_ZSTD) ? 19 : 9;
+
+    config->journal_compact = 1024;                 // Rewrite versions.bin after 1024 journaled checkins
+    config->threads = 0;                            // One worker thread per CPU for batch operations
+    config->auto_pack = 10000;                      // Pack loose objects once there are about 10000 of them
+    config->chunk_threshold = 64L * 1024 * 1024;    // Files from 64MB on, too large for deltas, are chunked
+    config->chunk_size = 1024L * 1024;              // Chunks of 1MB on average
+    config->io_uring = 1;                           // Batch restores through io_uring when the kernel has it
+}
+
+/*
+The function parse_codec turns a codec name from .vcs/config into a CODEC_* value usable by this build.
+Returns the requested codec if it is compiled in, otherwise prints a warning and returns fallback.
+*/
+static int parse_codec(const char* name, const char* key, int fallback) {
+    int codec = codec_from_name(name);
+    if (codec >= 0 && codec_available(codec)) return codec;
+
+    fprintf(stderr, "Warning: %s codec '%.*s' is not available in this build, using %s\n",
+            key, (int)strcspn(name, "\n"), name, codec_name(fallback));
+    return fallback;
+}
+
+/*
+The function load_config reads .vcs/config into a RepoConfig.
+Returns 0 on success (including when no config file exists), -1 on invalid input.
+It takes const char* base_path (repository root) and RepoConfig* config (receives the settings).
+*/
+int load_config(const char* base_path, RepoConfig* config) {
+    if (!base_path || !config) return -1;
+    config_defaults(config);
+
+    char config_path[MAX_PATH_LEN];
+    snprintf(config_path, sizeof(config_path), "%s/%s/%s", base_path, VCS_DIR, CONFIG_FILE);
+
+    FILE* file = fopen(config_path, "r");
+    if (!file) return 0;    // No config file yet, the defaults apply
+
+    char line[1024];
+    while (fgets(line, sizeof(line), file)) {
+        // Skip comment lines (starting with #) and empty lines
+        if (line[0] == '#' || line[0] == '\n') continue;
+
+        if (strncmp(line, "DELTA=", 6) == 0) {
+            config->delta_enabled = atoi(line + 6) != 0;
+        } else if (strncmp(line, "DELTA_MAX_CHAIN=", 16) == 0) {
+            config->delta_max_chain = atoi(line + 16);
+        } else if (strncmp(line, "DELTA_MAX_SIZE=", 15) == 0) {
+            config->delta_max_size = atol(line + 15);
+        } else if (strncmp(line, "HOT_CODEC=", 10) == 0) {
+            config->hot_codec = parse_codec(line + 10, "HOT_CODEC", CODEC_NONE);
+        } else if (strncmp(line, "HOT_LEVEL=", 10) == 0) {
+            config->hot_level = atoi(line + 10);
+        } else if (strncmp(line, "COLD_CODEC=", 11) == 0) {
+            config->cold_codec = parse_codec(line + 11, "COLD_CODEC", CODEC_ZLIB);
+        } else if (strncmp(line, "COLD_LEVEL=", 11) == 0) {
+            config->cold_level = atoi(line + 11);
+        } else if (strncmp(line, "JOURNAL_COMPACT=", 16) == 0) {
+            config->journal_compact = atoi(line + 16);
+        } else if (strncmp(line, "THREADS=", 8) == 0) {
+            config->threads = atoi(line + 8);
+        } else if (strncmp(line, "AUTO_PACK=", 10) == 0) {
+            config->auto_pack = atol(line + 10);
+        } else if (strncmp(line, "CHUNK_THRESHOLD=", 16) == 0) {
+            config->chunk_threshold = atol(line + 16);
+        } else if (strncmp(line, "CHUNK_SIZE=", 11) == 0) {
+            config->chunk_size = atol(line + 11);
+        } else if (strncmp(line, "IO_URING=", 9) == 0) {
+            config->io_uring = atoi(line + 9) != 0;
+        }
+    }
+
+    fclose(file);
+    return 0;
+}
+
+/*
+The function save_config writes a RepoConfig to .vcs/config.
+Returns 0 on success, -1 on failure (file write errors).
+It takes const char* base_path (repository root) and const RepoConfig* config (the settings to write).
+*/
+int save_config(const char* base_path, const RepoConfig* config) {
+    if (!base_path || !config) return -1;
+
+    char config_path[MAX_PATH_LEN];
+    snprintf(config_path, sizeof(config_path), "%s/%s/%s", base_path, VCS_DIR, CONFIG_FILE);
+
+    FILE* file = fopen(config_path, "w");
+    if (!file) return -1;
+
+    fprintf(file, "# VCS Repository Configuration\n");
+    fprintf(file, "\n# Delta storage: older versions are stored as deltas against the next newer version\n");
+    fprintf(file, "DELTA=%d\n", config->delta_enabled);
+    fprintf(file, "DELTA_MAX_CHAIN=%d\n", config->delta_max_chain);     // Upper bound on deltas applied per checkout
+    fprintf(file, "DELTA_MAX_SIZE=%ld\n", config->delta_max_size);      // Larger files are always stored in full
+    fprintf(file, "\n# Compression (none, zlib, lz4, zstd): hot for the newest version, cold for history\n");
+    fprintf(file, "HOT_CODEC=%s\n", codec_name(config->hot_codec));
+    fprintf(file, "HOT_LEVEL=%d\n", config->hot_level);
+    fprintf(file, "COLD_CODEC=%s\n", codec_name(config->cold_codec));
+    fprintf(file, "COLD_LEVEL=%d\n", config->cold_level);
+    fprintf(file, "\n# Metadata: checkins are appended to a journal that is folded into versions.bin after this many entries\n");
+    fprintf(file, "JOURNAL_COMPACT=%d\n", config->journal_compact);
+    fprintf(file, "\n# Worker threads for batch operations (0 uses every CPU)\n");
+    fprintf(file, "THREADS=%d\n", config->threads);
+    fprintf(file, "\n# Pack files: a check-in moves the loose objects into a pack once there are more than this (0 never)\n");
+    fprintf(file, "AUTO_PACK=%ld\n", config->auto_pack);
+    fprintf(file, "\n# Chunking: files of at least CHUNK_THRESHOLD bytes are split into chunks of about CHUNK_SIZE bytes (0 never)\n");
+    fprintf(file, "CHUNK_THRESHOLD=%ld\n", config->chunk_threshold);
+    fprintf(file, "CHUNK_SIZE=%ld\n", config->chunk_size);
+    fprintf(file, "\n# Batched I/O: restore small files through io_uring where the kernel supports it (0 never)\n");
+    fprintf(file, "IO_URING=%d\n", config->io_uring);
+
+    fclose(file);
+    return 0;
+}
@@ -0,0 +1,431 @@
+#include "vcs.h"
+#include <stdint.h>         // Provides fixed-width integer types of the request format
+#include <fcntl.h>          // Provides open() flags
+#include <signal.h>         // Provides signal() to ignore SIGPIPE from clients that went away
+#include <sys/socket.h>     // Provides Unix domain sockets and SCM_RIGHTS descriptor passing
+#include <sys/time.h>       // Provides struct timeval for the request timeout
+#include <sys/un.h>         // Provides struct sockaddr_un
+
+/*
+The daemon keeps a repository loaded (mapped metadata, lookup index, materialized versions) and runs commands
+for the CLI, so a command costs one socket round trip instead of loading the repository.
+It listens on .vcs/daemon.sock. A client sends its command line together with its stdout and stderr
+descriptors (SCM_RIGHTS); the daemon runs the command with its output going straight to the client's
+descriptors and replies with the exit status. Commands are run one at a time.
+Before each command the daemon checks whether versions.bin, versions.journal or the config were changed by
+another process (for example a CLI that ran without the daemon) and reloads the repository if so.
+Request:  DaemonHeader, then header.length bytes of NUL-terminated strings: the client's settings of the
+          forwarded environment variables ("" if unset) followed by header.argc arguments
+Reply:    int32 exit status
+*/
+
+#define DAEMON_SOCKET "daemon.sock"     // Name of the socket inside .vcs
+#define DAEMON_MAGIC 0x32534356u        // "VCS2" (changed whenever the request format changes)
+#define DAEMON_REQUEST_MAX (1 << 20)    // Largest accepted request payload
+#define DAEMON_READ_TIMEOUT 5           // Seconds a client may take to send its request
+
+// Environment variables of the client that apply to the command it sends
+static const char* forwarded_variables[] = {"VCS_TRACE", "VCS_STATS"};
+#define FORWARDED_COUNT (int)(sizeof(forwarded_variables) / sizeof(forwarded_variables[0]))
+
+// Fixed header of a request
+typedef struct DaemonHeader {
+    uint32_t magic;
+    uint32_t argc;
+    uint32_t length;        // Bytes of strings that follow
+    uint32_t reserved;
+} DaemonHeader;
+
+// The state of the files a loaded repository was read from (see repository_changed)
+typedef struct RepoStamp {
+    struct stat files[3];   // versions.bin, versions.journal, config (zeroed if missing)
+} RepoStamp;
+
+/*
+The function daemon_socket_address fills in the address of .vcs/daemon.sock, relative to the repository root.
+A relative path keeps it within the length limit of Unix socket names however deep the repository is.
+*/
+static void daemon_socket_address(struct sockaddr_un* address) {
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    snprintf(address->sun_path, sizeof(address->sun_path), "%s/%s", VCS_DIR, DAEMON_SOCKET);
+}
+
+/*
+The function connect_daemon connects to the daemon of the repository in the current directory.
+Returns the connected socket, or -1 if no daemon is running (including a stale socket left by one that died).
+*/
+static int connect_daemon(void) {
+    struct sockaddr_un address;
+    daemon_socket_address(&address);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+The function write_full writes a whole buffer to a descriptor, retrying on short writes.
+Returns 0 on success, -1 on failure.
+*/
+static int write_full(int fd, const void* data, size_t len) {
+    const char* p = data;
+    while (len > 0) {
+        ssize_t written = write(fd, p, len);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += written;
+        len -= (size_t)written;
+    }
+    return 0;
+}
+
+/*
+The function read_full reads exactly len bytes from a descriptor.
+Returns 0 on success, -1 on failure or end of file.
+*/
+static int read_full(int fd, void* data, size_t len) {
+    char* p = data;
+    while (len > 0) {
+        ssize_t bytes = read(fd, p, len);
+        if (bytes < 0 && errno == EINTR) continue;
+        if (bytes <= 0) return -1;
+        p += bytes;
+        len -= (size_t)bytes;
+    }
+    return 0;
+}
+
+/*
+The function daemon_request sends a command to the repository's daemon and waits for it to finish.
+Returns 0 if the daemon ran the command (its exit status is stored in *exit_status), -1 if there is no daemon
+and the caller should run the command itself. Setting VCS_NO_DAEMON=1 always runs commands directly.
+It takes the command line (int argc, char* argv[]) and int* exit_status.
+*/
+int daemon_request(int argc, char* argv[], int* exit_status) {
+    const char* setting = getenv("VCS_NO_DAEMON");
+    if (setting && strcmp(setting, "0") != 0) return -1;
+
+    int fd = connect_daemon();
+    if (fd < 0) return -1;
+
+    // Strings: the forwarded environment settings, then the arguments
+    const char* settings[FORWARDED_COUNT];
+    size_t length = 0;
+    for (int i = 0; i < FORWARDED_COUNT; i++) {
+        settings[i] = getenv(forwarded_variables[i]);
+        if (!settings[i]) settings[i] = "";
+        length += strlen(settings[i]) + 1;
+    }
+    for (int i = 0; i < argc; i++) length += strlen(argv[i]) + 1;
+    char* payload = (length <= DAEMON_REQUEST_MAX) ? malloc(length) : NULL;
+    if (!payload) {
+        close(fd);
+        return -1;
+    }
+    size_t pos = 0;
+    for (int i = 0; i < FORWARDED_COUNT; i++) {
+        memcpy(payload + pos, settings[i], strlen(settings[i]) + 1);
+        pos += strlen(settings[i]) + 1;
+    }
+    for (int i = 0; i < argc; i++) {
+        memcpy(payload + pos, argv[i], strlen(argv[i]) + 1);
+        pos += strlen(argv[i]) + 1;
+    }
+
+    // The header travels with our stdout and stderr, so the command's output goes straight to them
+    DaemonHeader header = {DAEMON_MAGIC, (uint32_t)argc, (uint32_t)length, 0};
+    int fds[2] = {STDOUT_FILENO, STDERR_FILENO};
+    char control[CMSG_SPACE(sizeof(fds))];
+    memset(control, 0, sizeof(control));
+    struct iovec iov = {&header, sizeof(header)};
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&message);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    fflush(stdout);
+    fflush(stderr);
+    int sent = (sendmsg(fd, &message, 0) == (ssize_t)sizeof(header)) && write_full(fd, payload, length) == 0;
+    free(payload);
+    if (!sent) {
+        close(fd);
+        return -1;     // The daemon never saw the command, so it is safe to run it here
+    }
+
+    // Once the request is out the command may have run, so it must not be repeated here
+    int32_t status;
+    if (read_full(fd, &status, sizeof(status)) != 0) {
+        fprintf(stderr, "vcs: lost the connection to the daemon\n");
+        status = 1;
+    }
+    close(fd);
+    *exit_status = status;
+    return 0;
+}
+
+/*
+The function stamp_repository records the state of the files a repository is loaded from.
+*/
+static void stamp_repository(const char* base_path, RepoStamp* stamp) {
+    const char* names[3] = {METADATA_BIN_FILE, JOURNAL_FILE, CONFIG_FILE};
+    for (int i = 0; i < 3; i++) {
+        char path[MAX_PATH_LEN];
+        snprintf(path, sizeof(path), "%s/%s/%s", base_path, VCS_DIR, names[i]);
+        if (stat(path, &stamp->files[i]) != 0) memset(&stamp->files[i], 0, sizeof(stamp->files[i]));
+    }
+}
+
+/*
+The function repository_changed checks whether another process changed the repository since it was stamped.
+Returns 1 if it must be reloaded, 0 otherwise.
+*/
+static int repository_changed(const char* base_path, const RepoStamp* stamp) {
+    RepoStamp now;
+    stamp_repository(base_path, &now);
+    for (int i = 0; i < 3; i++) {
+        const struct stat* a = &stamp->files[i];
+        const struct stat* b = &now.files[i];
+        if (a->st_ino != b->st_ino || a->st_dev != b->st_dev || a->st_size != b->st_size ||
+            a->st_mtim.tv_sec != b->st_mtim.tv_sec || a->st_mtim.tv_nsec != b->st_mtim.tv_nsec) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+The function receive_request reads one request from a client.
+Returns the payload (malloc'd, freed by the caller) or NULL on a malformed request.
+It takes int client, DaemonHeader* header (receives the header) and int* fds (receives the client's stdout and
+stderr, -1 if they were not sent).
+*/
+static char* receive_request(int client, DaemonHeader* header, int* fds) {
+    fds[0] = fds[1] = -1;
+    char control[CMSG_SPACE(2 * sizeof(int))];
+    struct iovec iov = {header, sizeof(*header)};
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    ssize_t bytes = recvmsg(client, &message, 0);
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&message); bytes > 0 && cmsg; cmsg = CMSG_NXTHDR(&message, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS && cmsg->cmsg_len == CMSG_LEN(2 * sizeof(int))) {
+            memcpy(fds, CMSG_DATA(cmsg), 2 * sizeof(int));
+        }
+    }
+    if (bytes <= 0) return NULL;
+    if (bytes < (ssize_t)sizeof(*header) && read_full(client, (char*)header + bytes, sizeof(*header) - (size_t)bytes) != 0) {
+        return NULL;
+    }
+    if (header->magic != DAEMON_MAGIC || header->argc < 2 || header->length > DAEMON_REQUEST_MAX || fds[0] < 0) return NULL;
+
+    char* payload = malloc(header->length + 1);
+    if (!payload) return NULL;
+    if (read_full(client, payload, header->length) != 0) {
+        free(payload);
+        return NULL;
+    }
+    payload[header->length] = '\0';
+    return payload;
+}
+
+/*
+The function serve_client runs the command of one client.
+Returns 1 if the client asked the daemon to stop, 0 otherwise.
+It takes int client, Repository** repo (reloaded when another process changed it), const char* base_path,
+RepoStamp* stamp and the command handler.
+*/
+static int serve_client(int client, Repository** repo, const char* base_path, RepoStamp* stamp,
+                        int (*handler)(Repository* repo, int argc, char* argv[])) {
+    struct timeval timeout = {DAEMON_READ_TIMEOUT, 0};
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    DaemonHeader header;
+    int fds[2];
+    char* payload = receive_request(client, &header, fds);
+    char** argv = payload ? calloc(header.argc + 1, sizeof(char*)) : NULL;
+    int32_t status = 1;
+    int stop = 0;
+    if (!argv) goto done;
+
+    // Split the strings: the environment settings first, then the arguments
+    char* p = payload;
+    char* end = payload + header.length;
+    const char* settings[FORWARDED_COUNT];
+    for (int i = 0; i < FORWARDED_COUNT; i++) {
+        if (p >= end) goto done;
+        settings[i] = p;
+        p += strlen(p) + 1;
+    }
+    for (uint32_t i = 0; i < header.argc; i++) {
+        if (p >= end) goto done;
+        argv[i] = p;
+        p += strlen(p) + 1;
+    }
+    for (int i = 0; i < FORWARDED_COUNT; i++) {
+        if (settings[i][0]) setenv(forwarded_variables[i], settings[i], 1);
+        else unsetenv(forwarded_variables[i]);
+    }
+
+    if (strcmp(argv[1], "daemon") == 0) {
+        // Only "daemon stop" and "daemon status" reach a running daemon
+        stop = header.argc >= 3 && strcmp(argv[2], "stop") == 0;
+        dprintf(fds[0], stop ? "Daemon stopped\n" : "Daemon is running (pid %d)\n", (int)getpid());
+        status = 0;
+        goto done;
+    }
+
+    // Run the command with its output going to the client
+    int saved_out = dup(STDOUT_FILENO), saved_err = dup(STDERR_FILENO);
+    dup2(fds[0], STDOUT_FILENO);
+    dup2(fds[1] >= 0 ? fds[1] : fds[0], STDERR_FILENO);
+
+    // Statistics cover this command only (including a reload it causes)
+    stats_enable(stats_from_environment());
+    if (!*repo || repository_changed(base_path, stamp)) {
+        trace("daemon: reloading the repository");
+        if (*repo) cleanup_repository(*repo);
+        *repo = load_repository(base_path);
+        stamp_repository(base_path, stamp);
+    }
+    if (*repo) {
+        status = handler(*repo, (int)header.argc, argv);
+    } else {
+        printf("Failed to load repository.\n");
+    }
+    fflush(stdout);
+    stats_report(stderr);
+    fflush(stderr);
+    dup2(saved_out, STDOUT_FILENO);
+    dup2(saved_err, STDERR_FILENO);
+    close(saved_out);
+    close(saved_err);
+
+    // The command's own changes do not require a reload
+    stamp_repository(base_path, stamp);
+
+done:
+    write_full(client, &status, sizeof(status));
+    if (fds[0] >= 0) close(fds[0]);
+    if (fds[1] >= 0) close(fds[1]);
+    free(argv);
+    free(payload);
+    return stop;
+}
+
+/*
+The function run_daemon implements "daemon [-f] | daemon stop | daemon status".
+Without -f the daemon detaches and keeps running in the background; with -f it stays in the foreground.
+Returns the process exit status.
+It takes const char* base_path (repository root, the current directory), the arguments after "daemon"
+and the function that runs a command against the loaded repository.
+*/
+int run_daemon(const char* base_path, int argc, char* argv[], int (*handler)(Repository* repo, int argc, char* argv[])) {
+    int foreground = 0;
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "-f") == 0) {
+            foreground = 1;
+        } else if (strcmp(argv[i], "stop") == 0 || strcmp(argv[i], "status") == 0) {
+            // Handled by the running daemon
+            char* request[] = {"vcs", "daemon", argv[i], NULL};
+            int status;
+            if (daemon_request(3, request, &status) == 0) return status;
+            printf("No daemon is running for this repository.\n");
+            return 1;
+        } else {
+            printf("Usage: vcs daemon [-f] | stop | status\n");
+            return 1;
+        }
+    }
+
+    // One daemon per repository; a socket nobody answers on is left over from a daemon that died
+    int probe = connect_daemon();
+    if (probe >= 0) {
+        close(probe);
+        printf("A daemon is already running for this repository.\n");
+        return 1;
+    }
+
+    struct sockaddr_un address;
+    daemon_socket_address(&address);
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server < 0) return 1;
+    unlink(address.sun_path);
+    if (bind(server, (struct sockaddr*)&address, sizeof(address)) != 0 || chmod(address.sun_path, 0600) != 0 ||
+        listen(server, 64) != 0) {
+        printf("Failed to create %s: %s\n", address.sun_path, strerror(errno));
+        close(server);
+        return 1;
+    }
+
+    Repository* repo = load_repository(base_path);
+    if (!repo) {
+        printf("Failed to load repository.\n");
+        close(server);
+        unlink(address.sun_path);
+        return 1;
+    }
+    RepoStamp stamp;
+    stamp_repository(base_path, &stamp);
+
+    if (!foreground) {
+        fflush(stdout);
+        pid_t pid = fork();
+        if (pid != 0) {
+            // The daemon process has its own copy of everything
+            close(server);
+            cleanup_repository(repo);
+            if (pid < 0) {
+                unlink(address.sun_path);
+                printf("Failed to start the daemon.\n");
+                return 1;
+            }
+            printf("Daemon started (pid %d)\n", (int)pid);
+            return 0;
+        }
+        setsid();
+        int null_fd = open("/dev/null", O_RDWR);
+        if (null_fd >= 0) {
+            dup2(null_fd, STDIN_FILENO);
+            dup2(null_fd, STDOUT_FILENO);
+            dup2(null_fd, STDERR_FILENO);
+            if (null_fd > STDERR_FILENO) close(null_fd);
+        }
+    } else {
+        printf("Daemon listening on %s\n", address.sun_path);
+        fflush(stdout);
+    }
+
+    signal(SIGPIPE, SIG_IGN);      // A client that went away must not kill the daemon
+    for (;;) {
+        int client = accept(server, NULL, NULL);
+        if (client < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            break;
+        }
+        int stop = serve_client(client, &repo, base_path, &stamp, handler);
+        close(client);
+        if (stop) break;
+    }
+
+    close(server);
+    unlink(address.sun_path);
+    if (repo) cleanup_repository(repo);
+    return 0;
+}
@@ -0,0 +1,227 @@
+#include "vcs.h"
+#include <stdint.h>     // Provides fixed-width integer types used by the block hash
+
+/*
+The delta encoder describes a target buffer as a sequence of instructions against a base buffer:
+    COPY   offset length   - append base[offset .. offset+length) to the output
+    INSERT length bytes    - append the literal bytes that follow
+Numbers are stored as variable-length integers (7 bits per byte, high bit set on all but the last byte).
+The encoded delta starts with the size of the target so the decoder can allocate the output once.
+Matches are found by indexing the base in DELTA_BLOCK_SIZE-byte blocks and probing the index at every
+target offset, similar to rsync and xdelta.
+*/
+
+#define DELTA_BLOCK_SIZE 16     // Size of the blocks indexed in the base buffer
+#define DELTA_OP_INSERT 0x00    // Instruction code for literal bytes
+#define DELTA_OP_COPY 0x01      // Instruction code for a copy from the base
+
+// Growable output buffer used while encoding a delta
+typedef struct DeltaBuffer {
+    unsigned char* data;
+    size_t len;
+    size_t cap;
+} DeltaBuffer;
+
+/*
+The function buffer_reserve makes room for at least extra more bytes in a DeltaBuffer.
+Returns 0 on success, -1 if the allocation fails.
+*/
+static int buffer_reserve(DeltaBuffer* buf, size_t extra) {
+    if (buf->len + extra <= buf->cap) return 0;
+    size_t cap = buf->cap ? buf->cap : 4096;
+    while (cap < buf->len + extra) cap *= 2;
+    unsigned char* data = realloc(buf->data, cap);
+    if (!data) return -1;
+    buf->data = data;
+    buf->cap = cap;
+    return 0;
+}
+
+/*
+The function put_varint appends an unsigned number in variable-length form.
+Returns 0 on success, -1 if the allocation fails.
+*/
+static int put_varint(DeltaBuffer* buf, uint64_t value) {
+    if (buffer_reserve(buf, 10) != 0) return -1;
+    while (value >= 0x80) {
+        buf->data[buf->len++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    buf->data[buf->len++] = (unsigned char)value;
+    return 0;
+}
+
+/*
+The function get_varint reads a variable-length number from an encoded delta.
+Returns 0 on success, -1 if the number runs past the end of the delta.
+It advances *pos past the number.
+*/
+static int get_varint(const unsigned char* data, size_t len, size_t* pos, uint64_t* value) {
+    uint64_t result = 0;
+    int shift = 0;
+    while (*pos < len && shift < 64) {
+        unsigned char byte = data[(*pos)++];
+        result |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            *value = result;
+            return 0;
+        }
+        shift += 7;
+    }
+    return -1;
+}
+
+/*
+The function put_insert appends an INSERT instruction followed by its literal bytes.
+Returns 0 on success, -1 if the allocation fails.
+*/
+static int put_insert(DeltaBuffer* buf, const unsigned char* bytes, size_t len) {
+    if (len == 0) return 0;
+    if (buffer_reserve(buf, 1) != 0) return -1;
+    buf->data[buf->len++] = DELTA_OP_INSERT;
+    if (put_varint(buf, len) != 0 || buffer_reserve(buf, len) != 0) return -1;
+    memcpy(buf->data + buf->len, bytes, len);
+    buf->len += len;
+    return 0;
+}
+
+/*
+The function put_copy appends a COPY instruction.
+Returns 0 on success, -1 if the allocation fails.
+*/
+static int put_copy(DeltaBuffer* buf, size_t offset, size_t len) {
+    if (buffer_reserve(buf, 1) != 0) return -1;
+    buf->data[buf->len++] = DELTA_OP_COPY;
+    if (put_varint(buf, offset) != 0) return -1;
+    return put_varint(buf, len);
+}
+
+/*
+The function block_hash hashes DELTA_BLOCK_SIZE bytes starting at data.
+The block is loaded as two 64-bit words, so hashing a block costs a few instructions regardless of alignment.
+*/
+static uint32_t block_hash(const unsigned char* data) {
+    uint64_t a, b;
+    memcpy(&a, data, sizeof(a));
+    memcpy(&b, data + 8, sizeof(b));
+    uint64_t h = (a * 0x9E3779B97F4A7C15ULL) ^ (b * 0xC2B2AE3D27D4EB4FULL);
+    return (uint32_t)(h ^ (h >> 29));
+}
+
+/*
+The function delta_create encodes target as a delta against base.
+Returns 0 on success, -1 on failure (allocation errors).
+It takes const unsigned char* base / size_t base_len (the buffer the delta refers to),
+const unsigned char* target / size_t target_len (the buffer to describe),
+and unsigned char** delta / size_t* delta_len (receive the malloc'd encoded delta, freed by the caller).
+*/
+int delta_create(const unsigned char* base, size_t base_len,
+                 const unsigned char* target, size_t target_len,
+                 unsigned char** delta, size_t* delta_len) {
+    DeltaBuffer out = {NULL, 0, 0};
+    if (put_varint(&out, target_len) != 0) goto fail;
+
+    // Index the base: hash table of block offsets, sized to a power of two above twice the block count
+    size_t blocks = base_len / DELTA_BLOCK_SIZE;
+    size_t table_size = 1;
+    while (table_size < blocks * 2) table_size <<= 1;
+    size_t* table = calloc(table_size, sizeof(size_t));   // Stores offset + 1, 0 marks an empty slot
+    if (!table) goto fail;
+    for (size_t i = 0; i < blocks; i++) {
+        size_t offset = i * DELTA_BLOCK_SIZE;
+        table[block_hash(base + offset) & (table_size - 1)] = offset + 1;
+    }
+
+    size_t pos = 0;         // Current position in the target
+    size_t literal = 0;     // Start of the pending literal run in the target
+    while (blocks > 0 && pos + DELTA_BLOCK_SIZE <= target_len) {
+        size_t slot = table[block_hash(target + pos) & (table_size - 1)];
+        if (slot == 0 || memcmp(base + slot - 1, target + pos, DELTA_BLOCK_SIZE) != 0) {
+            pos++;          // No match starts here, the byte becomes part of the literal run
+            continue;
+        }
+
+        // Extend the match forwards, then backwards into the pending literal run
+        size_t base_pos = slot - 1;
+        size_t len = DELTA_BLOCK_SIZE;
+        while (base_pos + len < base_len && pos + len < target_len &&
+               base[base_pos + len] == target[pos + len]) {
+            len++;
+        }
+        while (pos > literal && base_pos > 0 && base[base_pos - 1] == target[pos - 1]) {
+            pos--;
+            base_pos--;
+            len++;
+        }
+
+        if (put_insert(&out, target + literal, pos - literal) != 0 ||
+            put_copy(&out, base_pos, len) != 0) {
+            free(table);
+            goto fail;
+        }
+        pos += len;
+        literal = pos;
+    }
+    free(table);
+
+    // Whatever is left after the last match is emitted literally
+    if (put_insert(&out, target + literal, target_len - literal) != 0) goto fail;
+
+    *delta = out.data;
+    *delta_len = out.len;
+    return 0;
+
+fail:
+    free(out.data);
+    return -1;
+}
+
+/*
+The function delta_apply rebuilds a target buffer from its base and an encoded delta.
+Returns 0 on success, -1 on failure (corrupt delta or allocation errors).
+It takes const unsigned char* base / size_t base_len, const unsigned char* delta / size_t delta_len,
+and unsigned char** target / size_t* target_len (receive the malloc'd result, freed by the caller).
+*/
+int delta_apply(const unsigned char* base, size_t base_len,
+                const unsigned char* delta, size_t delta_len,
+                unsigned char** target, size_t* target_len) {
+    size_t pos = 0;
+    uint64_t size;
+    if (get_varint(delta, delta_len, &pos, &size) != 0) return -1;
+
+    unsigned char* out = malloc(size ? size : 1);
+    if (!out) return -1;
+    size_t written = 0;
+
+    while (pos < delta_len) {
+        unsigned char op = delta[pos++];
+        uint64_t offset = 0, len = 0;
+        if (op == DELTA_OP_COPY) {
+            if (get_varint(delta, delta_len, &pos, &offset) != 0 ||
+                get_varint(delta, delta_len, &pos, &len) != 0 ||
+                offset > base_len || len > base_len - offset || len > size - written) {
+                goto corrupt;
+            }
+            memcpy(out + written, base + offset, len);
+        } else if (op == DELTA_OP_INSERT) {
+            if (get_varint(delta, delta_len, &pos, &len) != 0 ||
+                len > delta_len - pos || len > size - written) {
+                goto corrupt;
+            }
+            memcpy(out + written, delta + pos, len);
+            pos += len;
+        } else {
+            goto corrupt;   // Unknown instruction
+        }
+        written += len;
+    }
+    if (written != size) goto corrupt;
+
+    *target = out;
+    *target_len = size;
+    return 0;
+
+corrupt:
+    free(out);
+    return -1;
+}
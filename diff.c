@@ -0,0 +1,442 @@
+#include "vcs.h"
+#include <stdint.h>     // Provides fixed-width integer types used by the line hash
+
+/*
+The diff engine compares two versions of a file line by line and prints the differences as a unified diff.
+Both sides are split into lines and every distinct line gets a small integer id, so the diff itself compares
+integers instead of strings. Lines are found with memchr and hashed a 64-bit word at a time; only lines with
+equal hashes and lengths are compared byte by byte.
+The longest common subsequence of the two id sequences is found with Myers' O(ND) algorithm in its linear
+space form: the middle snake of the edit path is searched from both ends at once and the two halves are
+solved recursively. Common leading and trailing lines are stripped at every step, so a small edit in a large
+file costs little more than reading it. Like GNU diff and git, the search gives up on an exact middle snake
+after about sqrt(N) edits and splits at the furthest point reached instead, which keeps the diff of two
+unrelated files fast at the price of a diff that may be slightly longer than the shortest one.
+*/
+
+#define DIFF_CONTEXT 3              // Unchanged lines shown around each change
+#define DIFF_BINARY_PROBE 8000      // Leading bytes searched for a NUL to detect binary contents
+#define DIFF_MIN_COST 256           // Edits searched for the middle snake before settling for a good-enough split
+
+// One line of a file being compared
+typedef struct DiffLine {
+    const unsigned char* start;
+    size_t len;                 // Including the newline, if the line has one
+    uint64_t hash;
+} DiffLine;
+
+// One side of a comparison
+typedef struct DiffFile {
+    const unsigned char* data;
+    size_t len;
+    DiffLine* lines;
+    int count;
+    int* ids;                   // Id of each line (equal lines share an id)
+    char* changed;              // 1 for lines that are not part of the common subsequence
+} DiffFile;
+
+/*
+The function line_hash hashes a line a 64-bit word at a time.
+*/
+static uint64_t line_hash(const unsigned char* p, size_t len) {
+    uint64_t h = len * 0x9E3779B97F4A7C15ULL;
+    while (len >= 8) {
+        uint64_t word;
+        memcpy(&word, p, sizeof(word));
+        h = (h ^ word) * 0xFF51AFD7ED558CCDULL;
+        h ^= h >> 32;
+        p += 8;
+        len -= 8;
+    }
+    if (len > 0) {
+        uint64_t word = 0;
+        memcpy(&word, p, len);
+        h = (h ^ word) * 0xC4CEB9FE1A85EC53ULL;
+        h ^= h >> 29;
+    }
+    return h;
+}
+
+/*
+The function split_lines fills in the lines of a DiffFile from its contents.
+Returns 0 on success, -1 if memory allocation fails.
+*/
+static int split_lines(DiffFile* file) {
+    int cap = 64;
+    file->lines = malloc(cap * sizeof(DiffLine));
+    if (!file->lines) return -1;
+
+    const unsigned char* p = file->data;
+    const unsigned char* end = file->data + file->len;
+    while (p < end) {
+        const unsigned char* newline = memchr(p, '\n', (size_t)(end - p));
+        size_t len = newline ? (size_t)(newline - p) + 1 : (size_t)(end - p);
+        if (file->count == cap) {
+            cap *= 2;
+            DiffLine* lines = realloc(file->lines, cap * sizeof(DiffLine));
+            if (!lines) return -1;
+            file->lines = lines;
+        }
+        file->lines[file->count].start = p;
+        file->lines[file->count].len = len;
+        file->lines[file->count].hash = line_hash(p, len);
+        file->count++;
+        p += len;
+    }
+    return 0;
+}
+
+/*
+The function assign_line_ids gives every distinct line of both files an integer id.
+Returns 0 on success, -1 if memory allocation fails.
+Lines are interned in an open-addressing hash table keyed by their hash.
+*/
+static int assign_line_ids(DiffFile* a, DiffFile* b) {
+    size_t total = (size_t)a->count + (size_t)b->count;
+    size_t size = 16;
+    while (size < total * 2) size <<= 1;
+
+    const DiffLine** table = calloc(size, sizeof(DiffLine*));
+    int* table_ids = malloc(size * sizeof(int));
+    a->ids = malloc((a->count + 1) * sizeof(int));
+    b->ids = malloc((b->count + 1) * sizeof(int));
+    if (!table || !table_ids || !a->ids || !b->ids) {
+        free(table);
+        free(table_ids);
+        return -1;
+    }
+
+    int next_id = 0;
+    DiffFile* files[2] = {a, b};
+    for (int f = 0; f < 2; f++) {
+        for (int i = 0; i < files[f]->count; i++) {
+            const DiffLine* line = &files[f]->lines[i];
+            size_t slot = (size_t)line->hash & (size - 1);
+            while (table[slot] && (table[slot]->hash != line->hash || table[slot]->len != line->len ||
+                                   memcmp(table[slot]->start, line->start, line->len) != 0)) {
+                slot = (slot + 1) & (size - 1);
+            }
+            if (!table[slot]) {
+                table[slot] = line;
+                table_ids[slot] = next_id++;
+            }
+            files[f]->ids[i] = table_ids[slot];
+        }
+    }
+
+    free(table);
+    free(table_ids);
+    return 0;
+}
+
+/*
+The function find_middle_snake finds a point on an optimal edit path between a[off1..lim1) and b[off2..lim2)
+by running Myers' search forwards from the start and backwards from the end until the two meet.
+It takes the id sequences and ranges, the diagonal arrays forward / backward (indexable from -(lines of b) - 1
+to (lines of a) + 1), int max_cost (edits to search before splitting at the furthest point reached)
+and int* mid_a / int* mid_b (receive the split point).
+Both ranges must be non-empty and must not start or end with equal lines.
+*/
+static void find_middle_snake(const int* a, int off1, int lim1, const int* b, int off2, int lim2,
+                              int* forward, int* backward, int max_cost, int* mid_a, int* mid_b) {
+    // Diagonal k holds the points with x - y = k; x is stored, y follows from it
+    int dmin = off1 - lim2, dmax = lim1 - off2;
+    int fmid = off1 - off2, bmid = lim1 - lim2;
+    int odd = (fmid - bmid) & 1;
+    int fmin = fmid, fmax = fmid, bmin = bmid, bmax = bmid;
+    forward[fmid] = off1;
+    backward[bmid] = lim1;
+
+    for (int cost = 1;; cost++) {
+        // Extend the forward paths by one edit
+        if (fmin > dmin) forward[--fmin - 1] = -1;
+        else ++fmin;
+        if (fmax < dmax) forward[++fmax + 1] = -1;
+        else --fmax;
+        for (int d = fmax; d >= fmin; d -= 2) {
+            int x = (forward[d - 1] >= forward[d + 1]) ? forward[d - 1] + 1 : forward[d + 1];
+            int y = x - d;
+            while (x < lim1 && y < lim2 && a[x] == b[y]) {
+                x++;
+                y++;
+            }
+            forward[d] = x;
+            if (odd && bmin <= d && d <= bmax && backward[d] <= x) {
+                *mid_a = x;
+                *mid_b = y;
+                return;
+            }
+        }
+
+        // Extend the backward paths by one edit
+        if (bmin > dmin) backward[--bmin - 1] = INT32_MAX;
+        else ++bmin;
+        if (bmax < dmax) backward[++bmax + 1] = INT32_MAX;
+        else --bmax;
+        for (int d = bmax; d >= bmin; d -= 2) {
+            int x = (backward[d - 1] < backward[d + 1]) ? backward[d - 1] : backward[d + 1] - 1;
+            int y = x - d;
+            while (x > off1 && y > off2 && a[x - 1] == b[y - 1]) {
+                x--;
+                y--;
+            }
+            backward[d] = x;
+            if (!odd && fmin <= d && d <= fmax && x <= forward[d]) {
+                *mid_a = x;
+                *mid_b = y;
+                return;
+            }
+        }
+        if (cost < max_cost) continue;
+
+        // Too expensive: split at whichever path got furthest from its end of the ranges
+        int best_forward = -1, forward_x = off1;
+        for (int d = fmax; d >= fmin; d -= 2) {
+            int x = (forward[d] < lim1) ? forward[d] : lim1;
+            int y = x - d;
+            if (y > lim2) {
+                x = lim2 + d;
+                y = lim2;
+            }
+            if (x + y > best_forward) {
+                best_forward = x + y;
+                forward_x = x;
+            }
+        }
+        int best_backward = INT32_MAX, backward_x = lim1;
+        for (int d = bmax; d >= bmin; d -= 2) {
+            int x = (backward[d] > off1) ? backward[d] : off1;
+            int y = x - d;
+            if (y < off2) {
+                x = off2 + d;
+                y = off2;
+            }
+            if (x + y < best_backward) {
+                best_backward = x + y;
+                backward_x = x;
+            }
+        }
+        if ((lim1 + lim2) - best_backward < best_forward - (off1 + off2)) {
+            *mid_a = forward_x;
+            *mid_b = best_forward - forward_x;
+        } else {
+            *mid_a = backward_x;
+            *mid_b = best_backward - backward_x;
+        }
+        return;
+    }
+}
+
+/*
+The function compare_ranges marks the lines of a[off1..lim1) and b[off2..lim2) that are not part of their
+longest common subsequence.
+*/
+static void compare_ranges(DiffFile* a, int off1, int lim1, DiffFile* b, int off2, int lim2,
+                           int* forward, int* backward, int max_cost) {
+    for (;;) {
+        // Equal lines at either end are always part of the common subsequence
+        while (off1 < lim1 && off2 < lim2 && a->ids[off1] == b->ids[off2]) {
+            off1++;
+            off2++;
+        }
+        while (off1 < lim1 && off2 < lim2 && a->ids[lim1 - 1] == b->ids[lim2 - 1]) {
+            lim1--;
+            lim2--;
+        }
+
+        if (off1 == lim1) {
+            memset(b->changed + off2, 1, lim2 - off2);
+            return;
+        }
+        if (off2 == lim2) {
+            memset(a->changed + off1, 1, lim1 - off1);
+            return;
+        }
+
+        int mid_a, mid_b;
+        find_middle_snake(a->ids, off1, lim1, b->ids, off2, lim2, forward, backward, max_cost, &mid_a, &mid_b);
+
+        // Recurse into the first half, loop on the second
+        compare_ranges(a, off1, mid_a, b, off2, mid_b, forward, backward, max_cost);
+        off1 = mid_a;
+        off2 = mid_b;
+    }
+}
+
+/*
+The function print_lines prints lines first..last of a file with a prefix character.
+*/
+static void print_lines(const DiffFile* file, int first, int last, char prefix) {
+    for (int i = first; i < last; i++) {
+        const DiffLine* line = &file->lines[i];
+        putchar(prefix);
+        fwrite(line->start, 1, line->len, stdout);
+        if (line->len == 0 || line->start[line->len - 1] != '\n') printf("\n\\ No newline at end of file\n");
+    }
+}
+
+/*
+The function print_range prints the "start,count" part of a hunk header (the count is left out when it is 1).
+*/
+static void print_range(int first, int count) {
+    if (count == 1) printf("%d", first + 1);
+    else printf("%d,%d", count ? first + 1 : first, count);
+}
+
+/*
+The function print_hunks prints the marked lines of both files as unified diff hunks.
+Changes separated by at most 2 * DIFF_CONTEXT unchanged lines share a hunk.
+*/
+static void print_hunks(const DiffFile* a, const DiffFile* b) {
+    int i = 0, j = 0;
+    while (i < a->count || j < b->count) {
+        // Skip to the next change; unchanged lines pair up one to one
+        while (i < a->count && j < b->count && !a->changed[i] && !b->changed[j]) {
+            i++;
+            j++;
+        }
+        if (i >= a->count && j >= b->count) break;
+
+        // Extend the hunk over every change that is close enough to the previous one
+        int start_a = (i > DIFF_CONTEXT) ? i - DIFF_CONTEXT : 0;
+        int start_b = j - (i - start_a);
+        int end_a = i, end_b = j;
+        for (;;) {
+            while (end_a < a->count && a->changed[end_a]) end_a++;
+            while (end_b < b->count && b->changed[end_b]) end_b++;
+            int gap = 0;
+            while (end_a + gap < a->count && end_b + gap < b->count &&
+                   !a->changed[end_a + gap] && !b->changed[end_b + gap] && gap <= 2 * DIFF_CONTEXT) {
+                gap++;
+            }
+            int at_end = (end_a + gap >= a->count && end_b + gap >= b->count);
+            if (gap > 2 * DIFF_CONTEXT || at_end) {
+                int context = (gap < DIFF_CONTEXT) ? gap : DIFF_CONTEXT;
+                end_a += context;
+                end_b += context;
+                break;
+            }
+            end_a += gap;
+            end_b += gap;
+        }
+
+        printf("@@ -");
+        print_range(start_a, end_a - start_a);
+        printf(" +");
+        print_range(start_b, end_b - start_b);
+        printf(" @@\n");
+
+        // Within the hunk, removed lines of a change are printed before the added ones
+        int x = start_a, y = start_b;
+        while (x < end_a || y < end_b) {
+            if (x < end_a && y < end_b && !a->changed[x] && !b->changed[y]) {
+                print_lines(a, x, x + 1, ' ');
+                x++;
+                y++;
+                continue;
+            }
+            int run_a = x, run_b = y;
+            while (run_a < end_a && a->changed[run_a]) run_a++;
+            while (run_b < end_b && b->changed[run_b]) run_b++;
+            print_lines(a, x, run_a, '-');
+            print_lines(b, y, run_b, '+');
+            x = run_a;
+            y = run_b;
+        }
+        i = end_a;
+        j = end_b;
+    }
+}
+
+/*
+The function is_binary checks whether contents look binary (a NUL byte near the start, as git and diff do).
+*/
+static int is_binary(const unsigned char* data, size_t len) {
+    return memchr(data, '\0', (len < DIFF_BINARY_PROBE) ? len : DIFF_BINARY_PROBE) != NULL;
+}
+
+/*
+The function diff_buffers prints a unified diff between two buffers under the given labels.
+Returns 0 on success, -1 if memory allocation fails.
+It takes the old contents / label and the new contents / label.
+*/
+static int diff_buffers(const unsigned char* old_data, size_t old_len, const char* old_label,
+                        const unsigned char* new_data, size_t new_len, const char* new_label) {
+    if (old_len == new_len && memcmp(old_data, new_data, old_len) == 0) return 0;
+
+    if (is_binary(old_data, old_len) || is_binary(new_data, new_len)) {
+        printf("Binary files %s and %s differ\n", old_label, new_label);
+        return 0;
+    }
+
+    DiffFile a = {old_data, old_len, NULL, 0, NULL, NULL};
+    DiffFile b = {new_data, new_len, NULL, 0, NULL, NULL};
+    int status = -1;
+    int* diagonals = NULL;
+    if (split_lines(&a) != 0 || split_lines(&b) != 0 || assign_line_ids(&a, &b) != 0) goto done;
+
+    a.changed = calloc(a.count + 1, 1);
+    b.changed = calloc(b.count + 1, 1);
+    size_t diagonal_count = (size_t)a.count + (size_t)b.count + 3;
+    diagonals = malloc(2 * diagonal_count * sizeof(int));
+    if (!a.changed || !b.changed || !diagonals) goto done;
+
+    // Diagonals run from -(b.count + 1) to a.count + 1
+    int* forward = diagonals + b.count + 1;
+    int* backward = diagonals + diagonal_count + b.count + 1;
+    int max_cost = 1;
+    while ((size_t)max_cost * (size_t)max_cost < diagonal_count) max_cost++;
+    if (max_cost < DIFF_MIN_COST) max_cost = DIFF_MIN_COST;
+    compare_ranges(&a, 0, a.count, &b, 0, b.count, forward, backward, max_cost);
+
+    printf("--- %s\n", old_label);
+    printf("+++ %s\n", new_label);
+    print_hunks(&a, &b);
+    status = 0;
+
+done:
+    free(diagonals);
+    free(a.lines);
+    free(a.ids);
+    free(a.changed);
+    free(b.lines);
+    free(b.ids);
+    free(b.changed);
+    return status;
+}
+
+/*
+The function diff_file prints the differences between two versions of a file as a unified diff.
+Both versions are read from the version store, the working file is never written.
+Returns 0 on success (nothing is printed when the contents are equal), -1 on failure (unknown version or read errors).
+It takes Repository* repo, const char* filename, int from_version (0 for the latest version)
+and int to_version (0 for the working file).
+*/
+int diff_file(Repository* repo, const char* filename, int from_version, int to_version) {
+    if (!repo || !filename) return -1;
+    if (from_version == 0) from_version = get_latest_version(repo, filename);
+
+    const FileVersion* from = find_file_version(repo, filename, from_version);
+    const FileVersion* to = (to_version > 0) ? find_file_version(repo, filename, to_version) : NULL;
+    if (!from || (to_version > 0 && !to)) return -1;
+
+    unsigned char* old_data = NULL;
+    unsigned char* new_data = NULL;
+    size_t old_len = 0, new_len = 0;
+    if (read_version_contents(from, &old_data, &old_len) != 0) return -1;
+    int loaded = to ? read_version_contents(to, &new_data, &new_len) : read_file_contents(filename, &new_data, &new_len);
+    if (loaded != 0) {
+        free(old_data);
+        return -1;
+    }
+
+    char old_label[MAX_PATH_LEN], new_label[MAX_PATH_LEN];
+    snprintf(old_label, sizeof(old_label), "%s (version %d)", filename, from_version);
+    if (to) snprintf(new_label, sizeof(new_label), "%s (version %d)", filename, to_version);
+    else snprintf(new_label, sizeof(new_label), "%s (working copy)", filename);
+
+    int status = diff_buffers(old_data, old_len, old_label, new_data, new_len, new_label);
+    free(old_data);
+    free(new_data);
+    return status;
+}
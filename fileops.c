@@ -1,152 +1,348 @@
+#define _GNU_SOURCE     // copy_file_range() is a GNU extension
 #include "vcs.h"
+#include <fcntl.h>          // Provides open() flags and posix_fadvise()
+#ifdef __linux__
+#include <sys/ioctl.h>      // Provides ioctl() for the reflink clone
+#include <sys/sendfile.h>   // Provides sendfile()
+#include <linux/fs.h>       // Provides FICLONE
+#endif
+
+#define COPY_CHUNK_SIZE (1L << 30)      // Bytes requested per copy_file_range()/sendfile() call
+#define COPY_BUFFER_SIZE (1 << 20)      // Buffer size of the read()/write() fallback
 
 /*
-The function generate_file_hash generates a unique hash (djb2) for a file based on its contents and size, 
-used to detect changes and identify versions in the VCS. Returns a dynamically allocated string or NULL on failure.
+The function generate_file_hash generates the SHA-256 hash of a file's contents, used to detect changes
+and identify versions in the VCS. Returns a dynamically allocated string or NULL on failure.
 It takes a const char* filepath and returns a char* (the hash string).
-The hash is stored in a dynamically allocated string, up to MAX_HASH_LEN (64) characters.
+The hash is deterministic (it depends only on the file's bytes) and is stored as MAX_HASH_LEN - 1 hex characters.
 */
 char* generate_file_hash(const char* filepath) {
-    // Opening the file in binary read mode ("rb") to read its bytes (Binary read mode to ensure consistent reading across platforms)
-    FILE* file = fopen(filepath, "rb");
-    // Returns a FILE* pointer or NULL if the file can't be opened
-    if (!file) return NULL;
-    
-    // Simple hash function based on file content and size
-    unsigned long hash = 5381;
-    int c;                  // Stores each byte read from the file
-    
-    // Reads the file byte-by-byte using fgetc(), which returns the next byte or EOF (end-of-file)
-    // Loops until the end of the file
-    while ((c = fgetc(file)) != EOF) {
-        // Updates the hash using the djb2 algorithm: hash = (hash * 33) + c
-        // hash << 5 shifts the hash left by 5 bits (equivalent to multiplying by 32), then adds hash (making it 33) and the current byte c
-        hash = ((hash << 5) + hash) + c;
+    char* hash_str = malloc(MAX_HASH_LEN);
+    if (!hash_str) return NULL;
+
+    // Stream the file through the hash engine in large blocks
+    if (hash_file(filepath, hash_str, NULL) != 0) {
+        free(hash_str);
+        return NULL;
     }
     
-    fclose(file);
-    
-    // Add file size to hash
-    struct stat st;
-    if (stat(filepath, &st) == 0) {
-        hash = ((hash << 5) + hash) + st.st_size;
+    return hash_str;    // Returning the hash string (the caller frees it)
+}
+
+/*
+Files are copied by the cheapest mechanism the filesystem supports, trying in order:
+    reflink          - FICLONE shares the source's blocks (XFS, btrfs): instant and uses no extra space
+    copy_file_range  - the kernel copies the data, or the filesystem offloads it (NFS, SMB, ...)
+    sendfile         - kernel-side copy for filesystems without copy_file_range
+    buffered         - read()/write() through a COPY_BUFFER_SIZE buffer
+Each tier falls back to the next when the filesystem does not support it, continuing where the previous one
+stopped. With VCS_TRACE set in the environment the mechanism used for every copy is reported on stderr.
+*/
+
+/*
+The function copy_method_name returns a printable name for a COPY_* method.
+*/
+const char* copy_method_name(int method) {
+    switch (method) {
+        case COPY_REFLINK: return "reflink";
+        case COPY_RANGE: return "copy_file_range";
+        case COPY_SENDFILE: return "sendfile";
+        case COPY_BUFFERED: return "buffered";
+        default: return "failed";
     }
-    
-    char* hash_str = malloc(MAX_HASH_LEN);
-    if (hash_str) {
-        snprintf(hash_str, MAX_HASH_LEN, "%08lx%ld", hash, (long)time(NULL) % 10000);
+}
+
+/*
+The function copy_unsupported checks whether a kernel copy failed only because the files do not support it,
+in which case the next tier is tried.
+*/
+static int copy_unsupported(int error) {
+    return error == ENOSYS || error == EXDEV || error == EINVAL || error == EOPNOTSUPP ||
+           error == ENOTSUP || error == ENOTTY || error == EBADF || error == EPERM;
+}
+
+/*
+The function copy_tiers copies everything from the current position of in_fd to out_fd (see copy_fd).
+Returns the COPY_* method that finished the copy, or -1 on failure.
+It takes int in_fd, int out_fd and long long* bytes_copied / long long* calls (incremented by the bytes copied
+and the system calls issued, for the statistics).
+*/
+static int copy_tiers(int in_fd, int out_fd, long long* bytes_copied, long long* calls) {
+#ifdef __linux__
+    // Whole-file clone: only possible while nothing has been written yet (no data is copied)
+    (*calls)++;
+    if (lseek(in_fd, 0, SEEK_CUR) == 0) {
+        (*calls)++;
+        if (ioctl(out_fd, FICLONE, in_fd) == 0) return COPY_REFLINK;
     }
-    
-    return hash_str;    // Returning the hash string or NULL if allocation failed
+
+    // Kernel-side copy; a return of 0 means the end of the source was reached
+    for (;;) {
+        ssize_t copied = copy_file_range(in_fd, NULL, out_fd, NULL, COPY_CHUNK_SIZE, 0);
+        (*calls)++;
+        if (copied > 0) *bytes_copied += copied;
+        if (copied == 0) return COPY_RANGE;
+        if (copied < 0) {
+            if (errno == EINTR) continue;
+            if (!copy_unsupported(errno)) return -1;
+            break;      // Not supported here, try sendfile
+        }
+    }
+    for (;;) {
+        ssize_t copied = sendfile(out_fd, in_fd, NULL, COPY_CHUNK_SIZE);
+        (*calls)++;
+        if (copied > 0) *bytes_copied += copied;
+        if (copied == 0) return COPY_SENDFILE;
+        if (copied < 0) {
+            if (errno == EINTR) continue;
+            if (!copy_unsupported(errno)) return -1;
+            break;      // Not supported here, copy through a buffer
+        }
+    }
+#endif
+
+    unsigned char* buffer = malloc(COPY_BUFFER_SIZE);
+    if (!buffer) return -1;
+    int method = COPY_BUFFERED;
+    for (;;) {
+        ssize_t bytes = read(in_fd, buffer, COPY_BUFFER_SIZE);
+        (*calls)++;
+        if (bytes < 0 && errno == EINTR) continue;
+        if (bytes <= 0) {
+            if (bytes < 0) method = -1;
+            break;
+        }
+        // Write the read bytes to the destination, retrying short writes
+        for (ssize_t done = 0; done < bytes; ) {
+            ssize_t written = write(out_fd, buffer + done, bytes - done);
+            (*calls)++;
+            if (written < 0 && errno == EINTR) continue;
+            if (written <= 0) {
+                free(buffer);
+                return -1;
+            }
+            done += written;
+        }
+        *bytes_copied += bytes;
+    }
+    free(buffer);
+    return method;
+}
+
+/*
+The function copy_fd copies everything from the current position of in_fd to out_fd.
+Returns the COPY_* method that finished the copy, or -1 on failure.
+It takes int in_fd (source, open for reading) and int out_fd (destination, open for writing and empty).
+*/
+int copy_fd(int in_fd, int out_fd) {
+    long long started = stats_clock();
+    long long bytes = 0, calls = 0;
+    int method = copy_tiers(in_fd, out_fd, &bytes, &calls);
+    stats_add(STAT_COPY, started, bytes, bytes, calls);
+    return method;
 }
 
 /*
-The function copy_file copies a file from source path to destination path in binary mode.
+The function copy_file copies a file from source path to destination path.
 Used internally by other VCS functions to create file copies for versioning.
 Returns 0 on success, -1 on failure (file open/read/write errors).
 It takes const char* source (source file path) and const char* dest (destination file path).
-Reads and writes files in 4KB chunks for efficient memory usage.
+The copy uses the fastest mechanism available (see copy_fd).
 */
 int copy_file(const char* source, const char* dest) {
-    // Open source file in binary read mode
-    FILE* src = fopen(source, "rb");
-    if (!src) return -1;    // Return error if source file cannot be opened
+    // Open source file for reading
+    int src = open(source, O_RDONLY);
+    if (src < 0) return -1;     // Return error if source file cannot be opened
     
-    // Opens the destination file in binary write mode, creating or overwriting it
-    FILE* dst = fopen(dest, "wb");
-    if (!dst) {
-        fclose(src);    // If fopen() fails, close source file before returning error
+    // Opens the destination file for writing, creating or overwriting it
+    int dst = open(dest, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (dst < 0) {
+        close(src);     // If open() fails, close source file before returning error
         return -1;
     }
     
-    char buffer[4096];  // 4KB buffer for reading/writing file data
-    size_t bytes;       // Variable to store the number of bytes read/written
+    // Tell the kernel the source will be read front to back (matters for the buffered tier)
+    posix_fadvise(src, 0, 0, POSIX_FADV_SEQUENTIAL);
+    int method = copy_fd(src, dst);
     
-    // Copy file contents in chunks until end of file
-    while ((bytes = fread(buffer, 1, sizeof(buffer), src)) > 0) {
-        // Write the read bytes to destination file
-        if (fwrite(buffer, 1, bytes, dst) != bytes) {
-            // On write failure, close both files and returns -1
-            fclose(src);
-            fclose(dst);
-            return -1;
-        }
+    // Close both files; a failed close can mean the data never reached the disk
+    close(src);
+    if (close(dst) != 0) method = -1;
+    trace("copy %s -> %s: %s", source, dest, copy_method_name(method));
+    return (method < 0) ? -1 : 0;
+}
+
+/*
+The function create_version_file stores the contents of a file in the VCS object store.
+Identical contents are stored only once, no matter how many versions or files refer to them.
+Returns 0 on success, -1 on failure (object store errors).
+It takes const char* filepath (path to the file to version), const char* object_id (the file's content hash,
+which becomes the id of the stored object and is recorded in the version's metadata)
+and const RepoConfig* config (compression settings for the new object).
+*/
+int create_version_file(const char* filepath, const char* object_id, const RepoConfig* config) {
+    long long started = stats_clock();
+    // Copy the file into .vcs/objects unless the same content is already stored
+    int status = store_object(filepath, object_id, config);
+    if (started) {
+        // The sizes are only looked up while statistics are collected
+        struct stat source, object;
+        char path[MAX_PATH_LEN];
+        long long read_bytes = (stat(filepath, &source) == 0) ? (long long)source.st_size : 0;
+        long long written = (object_path(object_id, path, sizeof(path)) == 0 && stat(path, &object) == 0) ? (long long)object.st_size : 0;
+        stats_add(STAT_STORE, started, read_bytes, written, 0);
     }
-    
-    // Close both files after successful copy
-    fclose(src);
-    fclose(dst);
-    return 0;   // Return success
+    return status;
 }
 
 /*
-The function create_version_file creates a versioned copy of a file in the VCS directory structure.
-Organizes versions by filename in separate directories under .vcs/versions/filename/vN.
-Returns 0 on success, -1 on failure (directory creation or file copy errors).
-It takes const char* filepath (path to the file to version) and int version (version number).
-Creates necessary directory structure and copies the file to the versioned location.
+The function read_version_contents loads the contents of a version into memory without touching the working file.
+Returns 0 on success, -1 on failure (the version's contents are missing or unreadable).
+It takes const FileVersion* version and unsigned char** data / size_t* len (receive the malloc'd contents, freed by the caller).
 */
-int create_version_file(const char* filepath, int version) {
-    // Buffers for constructing various paths
-    char version_dir[MAX_PATH_LEN];     // Array for the directory path for a file's versions (e.g., .vcs/versions/filename)
-    char version_file[MAX_PATH_LEN];    // Array for the specific version file path (e.g., .vcs/versions/filename/vN)
-    char current_dir[MAX_PATH_LEN];     // Array for current working directory path
-    
-    // Get the current working directory to build absolute paths
-    getcwd(current_dir, sizeof(current_dir));   // Stores the current working directory in current_dir
-    
-    // Extract filename from the full filepath. strrchr() finds the last occurrence of the character '/' in the path.
-    // Returns a pointer to the last occurrence of the character '/' in the string, or NULL if not found
-    const char* filename = strrchr(filepath, '/');
-    // If '/' is found, move past it to get the filename; otherwise use the entire input filepath as the filename
-    filename = filename ? filename + 1 : filepath;
-
-    // Construct the version directory path: current_dir/.vcs/versions/filename
-    snprintf(version_dir, sizeof(version_dir), "%s/%s/versions/%s", current_dir, VCS_DIR, filename);
-    
-    // Create directory for this file's versions if it doesn't exist
-    // 0755 sets permissions: owner can read/write/execute, group and others can read/execute
-    if (mkdir(version_dir, 0755) != 0) {
-        // Check if the error is because the directory already exists
-        if (errno != EEXIST) {
-            // If it's a different error (not "already exists")
-            perror("Failed to create file's versions directory");
-            return -1;
-        }
-        // If errno == EEXIST, the directory already exists, which is fine
+int read_version_contents(const FileVersion* version, unsigned char** data, size_t* len) {
+    if (!version || !data || !len) return -1;
+
+    if (version->flags & VERSION_HAS_OBJECT) {
+        char object_id[MAX_HASH_LEN];
+        hash_to_hex(version->object_id, object_id);
+        return object_read(object_id, data, len);
+    }
+
+    // Versions of older repositories are plain copies in .vcs/versions/filename/vN
+    char version_file[MAX_PATH_LEN];
+    snprintf(version_file, sizeof(version_file), "%s/versions/%s/v%d", VCS_DIR, version->filename, version->version_number);
+    return read_file_contents(version_file, data, len);
+}
+
+/*
+The function file_creation_mask returns the process umask.
+The umask can only be read by setting it, so it is read once and remembered; call this before starting threads.
+*/
+mode_t file_creation_mask(void) {
+    static int known = 0;
+    static mode_t mask;
+    if (!known) {
+        mask = umask(022);
+        umask(mask);
+        known = 1;
+    }
+    return mask;
+}
+
+/*
+The function default_file_mode returns the permissions a newly created file gets (0666 minus the umask).
+Like file_creation_mask, call it once before starting threads.
+*/
+mode_t default_file_mode(void) {
+    return 0666 & ~file_creation_mask();
+}
+
+/*
+The function sibling_temp_path builds the mkstemp() template of a temporary file in the same directory as path.
+It takes const char* path and char* temp_path / size_t size (receives the template, ending in XXXXXX).
+*/
+void sibling_temp_path(const char* path, char* temp_path, size_t size) {
+    const char* slash = strrchr(path, '/');
+    if (slash) {
+        snprintf(temp_path, size, "%.*s/.%s.vcs-XXXXXX", (int)(slash - path), path, slash + 1);
+    } else {
+        snprintf(temp_path, size, ".%s.vcs-XXXXXX", path);
     }
-    
-    // Construct the full path to this specific version file: version_dir/vN
-    snprintf(version_file, sizeof(version_file), "%s/v%d", version_dir, version);
-    
-    // Copy the original file to the versioned location
-    return copy_file(filepath, version_file);
+}
+
+/*
+The function create_parent_directories creates the missing directories on the way to a file.
+*/
+void create_parent_directories(const char* filename) {
+    char path[MAX_PATH_LEN];
+    snprintf(path, sizeof(path), "%s", filename);
+    for (char* slash = strchr(path + 1, '/'); slash; slash = strchr(slash + 1, '/')) {
+        *slash = '\0';
+        mkdir(path, 0777);      // Fails harmlessly if the directory exists
+        *slash = '/';
+    }
+}
+
+/*
+The function create_sibling_temp reserves a temporary file in the same directory as path, so it can later be
+renamed over path (a rename is only atomic within one filesystem).
+Returns the open descriptor, or -1 on failure.
+It takes const char* path and char* temp_path / size_t size (receives the temporary file's path).
+*/
+static int create_sibling_temp(const char* path, char* temp_path, size_t size) {
+    sibling_temp_path(path, temp_path, size);
+    return mkstemp(temp_path);
 }
 
 /*
 The function restore_version_file restores a specific version of a file from the VCS back to the working directory.
 Replaces the current file with the contents of the specified version.
 Returns 0 on success, -1 on failure (version doesn't exist or file copy errors).
-It takes const char* filename (name of the file to restore) and int version (version number to restore).
-Checks if the version exists before attempting to restore it.
+It takes const FileVersion* version (the version record to restore).
+The contents are written to a temporary file next to the working file, flushed to disk and renamed over it, so
+readers see either the old or the new file but never a partly written one. The file keeps its permissions.
+Missing directories on the way to the file are created.
+Versions created before the object store existed have no object id and are read from .vcs/versions/filename/vN.
 */
-int restore_version_file(const char* filename, int version) {
-    // Buffers for constructing paths
-    char version_file[MAX_PATH_LEN];    // Array for the version file path (e.g., .vcs/versions/filename/vN)
-    char current_dir[MAX_PATH_LEN];     // Array for the current working directory path
-    
-    // Get the current working directory to build absolute paths
-    getcwd(current_dir, sizeof(current_dir));
-    
-    // Construct the full path to the version file: current_dir/.vcs/versions/filename/vN
-    snprintf(version_file, sizeof(version_file), "%s/%s/versions/%s/v%d", 
-             current_dir, VCS_DIR, filename, version);
-    
-    // Check if the requested version file exists
-    if (!file_exists(version_file)) {
-        return -1;  // Return error if version doesn't exist
+int restore_version_file(const FileVersion* version) {
+    if (!version) return -1;
+    long long started = stats_clock();
+
+    // A symbolic link is kept and the file it points to is replaced
+    char target[MAX_PATH_LEN];
+    struct stat st;
+    int exists = lstat(version->filename, &st) == 0;
+    if (exists && S_ISLNK(st.st_mode) && realpath(version->filename, target) && stat(target, &st) == 0) {
+        // target now holds the resolved path
+    } else {
+        snprintf(target, sizeof(target), "%s", version->filename);
+        exists = exists && !S_ISLNK(st.st_mode);
     }
-    
-    // Copy the version file back to the working directory, overwriting the current file
-    return copy_file(version_file, filename);
+    mode_t mode = exists ? (st.st_mode & 07777) : default_file_mode();
+
+    char temp_path[MAX_PATH_LEN];
+    int fd = create_sibling_temp(target, temp_path, sizeof(temp_path));
+    if (fd < 0 && errno == ENOENT && strchr(target, '/')) {
+        // The file's directory is missing (a pulled file, or one from a snapshot), so create it first
+        create_parent_directories(target);
+        fd = create_sibling_temp(target, temp_path, sizeof(temp_path));
+    }
+    if (fd < 0) return -1;
+    close(fd);
+
+    int status;
+    if (version->flags & VERSION_HAS_OBJECT) {
+        // Resolve the version through the object store when it refers to an object
+        char object_id[MAX_HASH_LEN];
+        hash_to_hex(version->object_id, object_id);
+        status = restore_object(object_id, temp_path);
+    } else {
+        // Buffers for constructing paths
+        char version_file[MAX_PATH_LEN];    // Array for the legacy version file path (e.g., .vcs/versions/filename/vN)
+        char current_dir[MAX_PATH_LEN];     // Array for the current working directory path
+        
+        // Get the current working directory to build absolute paths
+        getcwd(current_dir, sizeof(current_dir));
+        
+        // Construct the full path to the version file: current_dir/.vcs/versions/filename/vN
+        snprintf(version_file, sizeof(version_file), "%s/%s/versions/%s/v%d", 
+                 current_dir, VCS_DIR, version->filename, version->version_number);
+        
+        // Copy the version file (if it exists) into the temporary file
+        status = file_exists(version_file) ? copy_file(version_file, temp_path) : -1;
+    }
+
+    // Make the contents durable with the final permissions, then swap the file into place
+    long long written = 0;
+    if (status == 0) {
+        fd = open(temp_path, O_WRONLY);
+        if (fd < 0 || fchmod(fd, mode) != 0 || fsync(fd) != 0) status = -1;
+        if (started && fd >= 0 && fstat(fd, &st) == 0) written = (long long)st.st_size;
+        if (fd >= 0 && close(fd) != 0) status = -1;
+    }
+    if (status == 0 && rename(temp_path, target) != 0) status = -1;
+    if (status != 0) unlink(temp_path);
+    stats_add(STAT_RESTORE, started, 0, written, 0);
+    return status;
 }
\ No newline at end of file
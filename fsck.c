@@ -0,0 +1,544 @@
+#include "vcs.h"
+#include <pthread.h>    // Provides the lock and condition guarding the memory budget
+#include <stdint.h>     // Provides fixed-width integers for chunk list lengths
+#include <stdarg.h>     // Provides va_list for the problem descriptions
+
+/*
+fsck_repository checks that every stored version can still be read back and is what the metadata says it is.
+Each object is read through the object store (deltas applied, chunks reassembled, compression undone) and its
+contents hashed again: the SHA-256 must equal the object id, and the size and content hash recorded for every
+version stored in it must match. Snapshot manifests are checked the same way, and the chunks of chunked files
+are checked one by one as they are hashed, so a large file never has to be held in memory. Objects are checked
+on config.threads threads; the contents held in memory by all of them together stay within FSCK_MEMORY_BUDGET
+(an object larger than that is checked on its own).
+A full check also lists the orphaned objects: loose or packed objects that no version, snapshot, delta chain or
+chunk list refers to (gc removes them). Objects written after the check started are not counted, since a check-in
+running at the same time may not have recorded its version yet. A gc removing versions while fsck runs makes
+their objects show up as missing.
+--sample checks a random share of the objects. --incremental only checks the versions and snapshots recorded
+since the last clean full or incremental run, whose start time is kept in .vcs/fsck.
+Versions of older repositories that are plain copies in .vcs/versions are checked for presence and size; their
+hash is only checked if it is a content hash (the oldest ones mixed in the check-in time).
+*/
+
+#define FSCK_STATE_FILE "fsck"                      // .vcs/fsck: start time of the last clean run
+#define FSCK_MEMORY_BUDGET (256LL * 1024 * 1024)    // Contents held in memory by all threads together
+#define FSCK_MAX_CHAIN 4096                         // Hard stop for delta chains that loop back on themselves
+
+// One object (or legacy version copy) to check
+typedef struct FsckObject {
+    unsigned char id[HASH_RAW_LEN];
+    FileVersion** versions;         // Versions stored in this object (a run of the sorted version array)
+    int version_count;
+    int legacy;                     // versions[0] is a copy in .vcs/versions, not an object
+    int snapshot;                   // Id of the snapshot whose manifest this is (0 if none)
+    int state;                      // FSCK_OK, FSCK_MISSING or FSCK_CORRUPT
+    char* problem;                  // Description of what is wrong (malloc'd), NULL if nothing is
+    unsigned char (*refs)[HASH_RAW_LEN];    // Delta bases and chunks the object depends on
+    size_t ref_count;
+    size_t ref_cap;
+    long long bytes;                // Size of the contents that were hashed
+} FsckObject;
+
+// State shared by the threads of one check
+typedef struct FsckRun {
+    FsckObject* objects;
+    int count;                      // Objects sorted by id come first (see is_object)
+    int sorted;
+    pthread_mutex_t lock;           // Protects in_use
+    pthread_cond_t released;
+    long long in_use;               // Bytes of contents the threads hold
+} FsckRun;
+
+// Object ids collected while looking for orphans
+typedef struct IdList {
+    unsigned char (*ids)[HASH_RAW_LEN];
+    size_t count;
+    size_t cap;
+    int failed;                     // Memory allocation failed
+} IdList;
+
+enum { FSCK_OK, FSCK_MISSING, FSCK_CORRUPT };
+
+/*
+The function id_list_add appends an id to a list.
+*/
+static void id_list_add(IdList* list, const unsigned char* id) {
+    if (list->count == list->cap) {
+        size_t cap = list->cap ? list->cap * 2 : 1024;
+        unsigned char (*grown)[HASH_RAW_LEN] = realloc(list->ids, cap * HASH_RAW_LEN);
+        if (!grown) {
+            list->failed = 1;
+            return;
+        }
+        list->ids = grown;
+        list->cap = cap;
+    }
+    memcpy(list->ids[list->count++], id, HASH_RAW_LEN);
+}
+
+/*
+The function compare_ids orders raw object ids (qsort and bsearch callback).
+*/
+static int compare_ids(const void* a, const void* b) {
+    return memcmp(a, b, HASH_RAW_LEN);
+}
+
+/*
+The function compare_by_object orders versions by object id (qsort callback).
+*/
+static int compare_by_object(const void* a, const void* b) {
+    const FileVersion* va = *(FileVersion* const*)a;
+    const FileVersion* vb = *(FileVersion* const*)b;
+    return memcmp(va->object_id, vb->object_id, HASH_RAW_LEN);
+}
+
+/*
+The function report sets the state of an object and describes the problem (the first one found is kept).
+*/
+static void report(FsckObject* object, int state, const char* format, ...) {
+    if (object->state != FSCK_OK) return;
+    object->state = state;
+    char message[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    object->problem = strdup(message);
+}
+
+/*
+The function add_ref records an object the checked object depends on.
+Returns 0 on success, -1 if memory allocation fails.
+*/
+static int add_ref(FsckObject* object, const unsigned char* id) {
+    if (object->ref_count == object->ref_cap) {
+        size_t cap = object->ref_cap ? object->ref_cap * 2 : 4;
+        unsigned char (*grown)[HASH_RAW_LEN] = realloc(object->refs, cap * HASH_RAW_LEN);
+        if (!grown) return -1;
+        object->refs = grown;
+        object->ref_cap = cap;
+    }
+    memcpy(object->refs[object->ref_count++], id, HASH_RAW_LEN);
+    return 0;
+}
+
+/*
+The function is_object checks whether an id belongs to one of the objects being checked.
+*/
+static int is_object(const FsckRun* run, const unsigned char* id) {
+    return bsearch(id, run->objects, (size_t)run->sorted, sizeof(FsckObject), compare_ids) != NULL;
+}
+
+/*
+The function budget_acquire waits until bytes more of contents fit into FSCK_MEMORY_BUDGET and reserves them.
+*/
+static void budget_acquire(FsckRun* run, long long bytes) {
+    pthread_mutex_lock(&run->lock);
+    while (run->in_use > 0 && run->in_use + bytes > FSCK_MEMORY_BUDGET) pthread_cond_wait(&run->released, &run->lock);
+    run->in_use += bytes;
+    pthread_mutex_unlock(&run->lock);
+}
+
+/*
+The function budget_release returns bytes reserved with budget_acquire.
+*/
+static void budget_release(FsckRun* run, long long bytes) {
+    pthread_mutex_lock(&run->lock);
+    run->in_use -= bytes;
+    pthread_cond_broadcast(&run->released);
+    pthread_mutex_unlock(&run->lock);
+}
+
+/*
+The function hash_chunks hashes the contents of a chunked object one chunk at a time, checking every chunk.
+Returns 0 on success (digest_out receives the hash of the whole contents), -1 if a problem was reported.
+*/
+static int hash_chunks(FsckObject* object, const unsigned char* list, size_t count, char* digest_out) {
+    HashState state;
+    if (hash_begin(&state) != 0) {
+        report(object, FSCK_CORRUPT, "out of memory");
+        return -1;
+    }
+    for (size_t i = 0; i < count; i++) {
+        const unsigned char* entry = list + i * CHUNK_ENTRY_SIZE;
+        uint64_t expected = 0;
+        for (int b = 0; b < 8; b++) expected |= (uint64_t)entry[HASH_RAW_LEN + b] << (8 * b);
+        char chunk_id[MAX_HASH_LEN], digest[MAX_HASH_LEN];
+        hash_to_hex(entry, chunk_id);
+        add_ref(object, entry);
+
+        unsigned char* data = NULL;
+        size_t len = 0;
+        if (!object_exists(chunk_id)) {
+            report(object, FSCK_MISSING, "chunk %s is missing", chunk_id);
+        } else if (object_read(chunk_id, &data, &len) != 0) {
+            report(object, FSCK_CORRUPT, "chunk %s cannot be read", chunk_id);
+        } else if (hash_buffer(data, len, digest) != 0 || strcmp(digest, chunk_id) != 0 || len != expected) {
+            report(object, FSCK_CORRUPT, "chunk %s does not match its id or length", chunk_id);
+        } else {
+            hash_update(&state, data, len);
+            object->bytes += (long long)len;
+        }
+        free(data);
+        if (object->state != FSCK_OK) {
+            hash_abort(&state);
+            return -1;
+        }
+    }
+    return hash_finish(&state, digest_out);
+}
+
+/*
+The function check_versions compares the hashed contents with what the metadata records for each version.
+*/
+static void check_versions(FsckObject* object, const char* digest) {
+    unsigned char raw[HASH_RAW_LEN];
+    if (hash_from_hex(digest, raw) != 0) return;
+    for (int i = 0; i < object->version_count; i++) {
+        const FileVersion* v = object->versions[i];
+        if (v->file_size != (long)object->bytes) {
+            report(object, FSCK_CORRUPT, "%s version %d: %lld bytes stored, %ld recorded",
+                   v->filename, v->version_number, object->bytes, v->file_size);
+        } else if ((v->flags & VERSION_HAS_HASH) && memcmp(v->hash, raw, HASH_RAW_LEN) != 0) {
+            report(object, FSCK_CORRUPT, "%s version %d: contents do not match the recorded hash",
+                   v->filename, v->version_number);
+        }
+    }
+}
+
+/*
+The function check_legacy checks a version stored as a plain copy in .vcs/versions.
+*/
+static void check_legacy(FsckRun* run, FsckObject* object) {
+    const FileVersion* v = object->versions[0];
+    long long expected = (v->file_size > 0) ? v->file_size : 0;
+    budget_acquire(run, expected);
+    unsigned char* data = NULL;
+    size_t len = 0;
+    char digest[MAX_HASH_LEN];
+    if (read_version_contents(v, &data, &len) != 0) {
+        report(object, FSCK_MISSING, "%s version %d: copy in %s/versions is missing", v->filename, v->version_number, VCS_DIR);
+    } else if (hash_buffer(data, len, digest) == 0) {
+        object->bytes = (long long)len;
+        check_versions(object, digest);     // Skips the hash of versions that only have a legacy one
+    }
+    free(data);
+    budget_release(run, expected);
+}
+
+/*
+The function check_object reads one object back, hashes it and compares it with the metadata (parallel_for worker).
+*/
+static void check_object(void* context, int index) {
+    FsckRun* run = context;
+    FsckObject* object = &run->objects[index];
+    if (object->legacy) {
+        check_legacy(run, object);
+        return;
+    }
+
+    char hex[MAX_HASH_LEN], digest[MAX_HASH_LEN] = "";
+    hash_to_hex(object->id, hex);
+    if (!object_exists(hex)) {
+        report(object, FSCK_MISSING, "object is missing");
+        return;
+    }
+
+    unsigned char* list = NULL;
+    size_t chunks = 0;
+    int chunked = object_chunk_list(hex, &list, &chunks);
+    if (chunked < 0) {
+        report(object, FSCK_CORRUPT, "header or chunk list is corrupt");
+        return;
+    }
+    if (chunked) {
+        int status = hash_chunks(object, list, chunks, digest);
+        free(list);
+        if (status != 0) return;
+    } else {
+        // Remember the delta chain up to the first base that is checked as an object of its own
+        char base[MAX_HASH_LEN], current[MAX_HASH_LEN];
+        snprintf(current, sizeof(current), "%s", hex);
+        for (int depth = 0; depth < FSCK_MAX_CHAIN && object_delta_base(current, base) == 1; depth++) {
+            unsigned char raw[HASH_RAW_LEN];
+            if (hash_from_hex(base, raw) != 0 || add_ref(object, raw) != 0 || is_object(run, raw)) break;
+            snprintf(current, sizeof(current), "%s", base);
+        }
+
+        // The raw object and the rebuilt contents are held at the same time
+        long long expected = 0;
+        for (int i = 0; i < object->version_count; i++) {
+            if (object->versions[i]->file_size > expected) expected = object->versions[i]->file_size;
+        }
+        expected *= 2;
+        budget_acquire(run, expected);
+        unsigned char* data = NULL;
+        size_t len = 0;
+        if (object_read(hex, &data, &len) != 0) {
+            report(object, FSCK_CORRUPT, "contents cannot be rebuilt (corrupt data or broken delta chain)");
+        } else if (hash_buffer(data, len, digest) != 0) {
+            report(object, FSCK_CORRUPT, "out of memory");
+        }
+        object->bytes = (long long)len;
+        free(data);
+        budget_release(run, expected);
+        if (object->state != FSCK_OK) return;
+    }
+
+    if (strcmp(digest, hex) != 0) {
+        report(object, FSCK_CORRUPT, "contents do not match the object id");
+        return;
+    }
+    check_versions(object, digest);
+}
+
+// Context of collect_snapshot
+typedef struct SnapshotScan {
+    FsckRun* run;
+    time_t since;
+    int cap;
+    IdList* referenced;             // Objects snapshot manifests refer to
+} SnapshotScan;
+
+/*
+The function collect_snapshot adds a snapshot's manifest to the objects to check (visit_snapshots callback).
+*/
+static void collect_snapshot(void* context, const Snapshot* snapshot, const ManifestEntry* entries, int count) {
+    SnapshotScan* scan = context;
+    FsckRun* run = scan->run;
+    unsigned char id[HASH_RAW_LEN];
+    if (hash_from_hex(snapshot->manifest, id) != 0) return;
+    for (int i = 0; i < count; i++) {
+        unsigned char object[HASH_RAW_LEN];
+        if (hash_from_hex(entries[i].object, object) == 0) id_list_add(scan->referenced, object);
+    }
+    id_list_add(scan->referenced, id);
+    if (snapshot->timestamp < scan->since) return;
+
+    FsckObject* known = bsearch(id, run->objects, (size_t)run->sorted, sizeof(FsckObject), compare_ids);
+    if (known) {
+        known->snapshot = snapshot->id;
+        return;
+    }
+    if (run->count == scan->cap) {
+        int cap = scan->cap * 2 + 16;
+        FsckObject* grown = realloc(run->objects, (size_t)cap * sizeof(FsckObject));
+        if (!grown) return;
+        run->objects = grown;
+        scan->cap = cap;
+    }
+    FsckObject* object = &run->objects[run->count++];
+    memset(object, 0, sizeof(*object));
+    memcpy(object->id, id, HASH_RAW_LEN);
+    object->snapshot = snapshot->id;
+}
+
+// Context of the orphan search
+typedef struct OrphanScan {
+    IdList* referenced;             // Sorted
+    FsckStats* stats;
+    time_t started;
+} OrphanScan;
+
+/*
+The function visit_orphan reports an object nothing refers to (pack_visit callback, also used for loose objects).
+*/
+static void visit_orphan(void* context, const unsigned char* id) {
+    OrphanScan* scan = context;
+    if (bsearch(id, scan->referenced->ids, scan->referenced->count, HASH_RAW_LEN, compare_ids)) return;
+    char hex[MAX_HASH_LEN];
+    hash_to_hex(id, hex);
+    printf("orphaned object %s\n", hex);
+    scan->stats->orphaned++;
+}
+
+/*
+The function find_orphans lists the loose and packed objects that were not referenced when the check started.
+*/
+static void find_orphans(Repository* repo, OrphanScan* scan) {
+    for (int fanout = 0; fanout < 256; fanout++) {
+        char dir_path[MAX_PATH_LEN];
+        snprintf(dir_path, sizeof(dir_path), "%s/%s/%s/%02x", repo->base_path, VCS_DIR, OBJECTS_DIR, fanout);
+        DIR* dir = opendir(dir_path);
+        if (!dir) continue;
+        struct dirent* entry;
+        while ((entry = readdir(dir)) != NULL) {
+            char hex[MAX_HASH_LEN], path[MAX_PATH_LEN];
+            unsigned char id[HASH_RAW_LEN];
+            struct stat st;
+            if (strlen(entry->d_name) != MAX_HASH_LEN - 3) continue;
+            snprintf(hex, sizeof(hex), "%02x%s", fanout, entry->d_name);
+            snprintf(path, sizeof(path), "%s/%s", dir_path, entry->d_name);
+            if (hash_from_hex(hex, id) != 0 || lstat(path, &st) != 0 || st.st_mtime >= scan->started) continue;
+            visit_orphan(scan, id);
+        }
+        closedir(dir);
+    }
+    pack_visit(scan->started, visit_orphan, scan);
+}
+
+/*
+The function read_state returns the start time of the last clean run recorded in .vcs/fsck (0 if there is none).
+*/
+static time_t read_state(const Repository* repo) {
+    char path[MAX_PATH_LEN];
+    snprintf(path, sizeof(path), "%s/%s/%s", repo->base_path, VCS_DIR, FSCK_STATE_FILE);
+    FILE* file = fopen(path, "r");
+    if (!file) return 0;
+    long long value = 0;
+    if (fscanf(file, "LAST_CHECK=%lld", &value) != 1) value = 0;
+    fclose(file);
+    return (time_t)value;
+}
+
+/*
+The function write_state records the start time of a clean run in .vcs/fsck.
+*/
+static void write_state(const Repository* repo, time_t started) {
+    char path[MAX_PATH_LEN];
+    snprintf(path, sizeof(path), "%s/%s/%s", repo->base_path, VCS_DIR, FSCK_STATE_FILE);
+    FILE* file = fopen(path, "w");
+    if (!file) return;
+    fprintf(file, "LAST_CHECK=%lld\n", (long long)started);
+    fclose(file);
+}
+
+/*
+The function fsck_repository checks the stored versions against the metadata and reports what is wrong.
+Returns 0 if the check ran (problems are printed and counted in stats), -1 on failure (metadata or memory errors).
+It takes Repository* repo, const FsckOptions* options (sample_percent below 100 checks a random share of the
+objects, incremental only what was recorded since the last clean run) and FsckStats* stats (receives the counts).
+Orphaned objects are only looked for when every object is checked.
+*/
+int fsck_repository(Repository* repo, const FsckOptions* options, FsckStats* stats) {
+    if (!repo || !options || !stats) return -1;
+    memset(stats, 0, sizeof(*stats));
+    time_t started = time(NULL);
+    time_t since = options->incremental ? read_state(repo) : 0;
+    int sampled = options->sample_percent > 0 && options->sample_percent < 100;
+
+    FileVersion** all = NULL;
+    int total = collect_all_versions(repo, &all);
+    if (total < 0) return -1;
+
+    // Group the versions to check by object; copies in .vcs/versions are checked one by one
+    FileVersion** versions = malloc(((size_t)total + 1) * sizeof(FileVersion*));
+    FsckRun run;
+    memset(&run, 0, sizeof(run));
+    run.objects = malloc(((size_t)total + 1) * sizeof(FsckObject));
+    IdList referenced = {NULL, 0, 0, 0};
+    int status = -1;
+    if (!versions || !run.objects) goto done;
+    int selected = 0, plain = 0;
+    for (int i = 0; i < total; i++) {
+        if (all[i]->timestamp < since) continue;
+        if (all[i]->flags & VERSION_HAS_OBJECT) versions[selected++] = all[i];
+        else versions[total - 1 - plain++] = all[i];     // Legacy copies are gathered at the end
+    }
+    qsort(versions, (size_t)selected, sizeof(FileVersion*), compare_by_object);
+    for (int i = 0; i < selected; ) {
+        int end = i + 1;
+        while (end < selected && memcmp(versions[end]->object_id, versions[i]->object_id, HASH_RAW_LEN) == 0) end++;
+        FsckObject* object = &run.objects[run.count++];
+        memset(object, 0, sizeof(*object));
+        memcpy(object->id, versions[i]->object_id, HASH_RAW_LEN);
+        object->versions = &versions[i];
+        object->version_count = end - i;
+        i = end;
+    }
+    run.sorted = run.count;
+
+    // Snapshot manifests are objects as well
+    SnapshotScan scan = {&run, since, total + 1, &referenced};
+    if (visit_snapshots(repo, collect_snapshot, &scan) < 0) {
+        printf("corrupt  snapshot list or manifest cannot be read\n");
+        stats->corrupt++;
+    }
+    for (int i = 0; i < plain; i++) {
+        FsckObject* object = &run.objects[run.count];
+        FsckObject* grown = NULL;
+        if (run.count == scan.cap) {
+            grown = realloc(run.objects, ((size_t)scan.cap + plain) * sizeof(FsckObject));
+            if (!grown) goto done;
+            run.objects = grown;
+            scan.cap += plain;
+            object = &run.objects[run.count];
+        }
+        memset(object, 0, sizeof(*object));
+        object->versions = &versions[total - 1 - i];
+        object->version_count = 1;
+        object->legacy = 1;
+        run.count++;
+    }
+
+    // A sample keeps each object with the requested probability
+    if (sampled) {
+        unsigned int seed = (unsigned int)started ^ (unsigned int)getpid();
+        int kept = 0, kept_sorted = 0;
+        for (int i = 0; i < run.count; i++) {
+            if (rand_r(&seed) % 100 >= options->sample_percent) continue;
+            run.objects[kept++] = run.objects[i];
+            if (i < run.sorted) kept_sorted++;
+        }
+        run.count = kept;
+        run.sorted = kept_sorted;
+    }
+
+    pthread_mutex_init(&run.lock, NULL);
+    pthread_cond_init(&run.released, NULL);
+    parallel_for(run.count, repo->config.threads, check_object, &run);
+    pthread_cond_destroy(&run.released);
+    pthread_mutex_destroy(&run.lock);
+
+    for (int i = 0; i < run.count; i++) {
+        FsckObject* object = &run.objects[i];
+        stats->objects_checked++;
+        stats->versions_checked += object->version_count;
+        stats->bytes_hashed += object->bytes;
+        if (object->state == FSCK_OK) continue;
+        if (object->state == FSCK_MISSING) stats->missing++;
+        else stats->corrupt++;
+
+        // Name the object by a version stored in it, or the snapshot it is the manifest of
+        char hex[MAX_HASH_LEN], what[MAX_PATH_LEN];
+        hash_to_hex(object->id, hex);
+        if (object->legacy) {
+            snprintf(what, sizeof(what), "%s version %d", object->versions[0]->filename, object->versions[0]->version_number);
+        } else if (object->version_count > 0) {
+            snprintf(what, sizeof(what), "object %.12s (%s version %d%s)", hex, object->versions[0]->filename,
+                     object->versions[0]->version_number, object->version_count > 1 ? " and others" : "");
+        } else {
+            snprintf(what, sizeof(what), "object %.12s (manifest of snapshot %d)", hex, object->snapshot);
+        }
+        printf("%-8s %s: %s\n", object->state == FSCK_MISSING ? "missing" : "corrupt", what, object->problem ? object->problem : "");
+    }
+
+    // Orphans: everything the check reached counts as referenced
+    if (!sampled && !options->incremental) {
+        for (int i = 0; i < run.count; i++) {
+            if (!run.objects[i].legacy) id_list_add(&referenced, run.objects[i].id);
+            for (size_t r = 0; r < run.objects[i].ref_count; r++) id_list_add(&referenced, run.objects[i].refs[r]);
+        }
+        if (referenced.failed) goto done;
+        qsort(referenced.ids, referenced.count, HASH_RAW_LEN, compare_ids);
+        OrphanScan orphans = {&referenced, stats, started};
+        find_orphans(repo, &orphans);
+    }
+
+    if (!sampled && stats->missing == 0 && stats->corrupt == 0) write_state(repo, started);
+    status = 0;
+
+done:
+    if (run.objects) {
+        for (int i = 0; i < run.count; i++) {
+            free(run.objects[i].problem);
+            free(run.objects[i].refs);
+        }
+    }
+    free(run.objects);
+    free(referenced.ids);
+    free(versions);
+    free(all);
+    return status;
+}
@@ -0,0 +1,543 @@
+#include "vcs.h"
+#include <stdint.h>     // Provides fixed-width integers for the object id hash
+
+/*
+Garbage collection expires old versions according to a retention policy and removes the objects nothing
+refers to any more. It runs in three steps:
+    1. Under the exclusive metadata lock the policy picks the versions to keep and the metadata is rewritten
+       in one pass (rewrite_metadata), which also folds the journal into versions.bin.
+    2. Kept versions whose delta chain runs through objects of expired versions are rewritten against the next
+       kept version of their file (object_rebase, under the object lock), so those objects are freed.
+       Then, without any lock, the objects of the kept versions, of every snapshot (manifests included), the
+       bases of their delta chains and the chunks of chunked files are marked as reachable. Delta bases are read on config.threads threads.
+    3. The object store is swept one fan-out directory (.vcs/objects/xx) at a time, each under the exclusive
+       metadata lock, so other commands only ever wait for one directory. Before each directory the metadata
+       is refreshed and the objects of versions recorded in the meantime are marked as well. Packs holding
+       unreachable objects are rewritten without them last, the same way (see prune_packs).
+An object is only removed if it is unmarked and was last modified before the gc started: store_object touches
+objects it reuses, or the pack holding them (see freshen_object), and a check-in notices under the metadata lock when its object has
+been removed and stores the file again (see checkin_record).
+The latest version of every file and every version a snapshot refers to are always kept.
+*/
+
+#define GC_TEMP_AGE (24 * 60 * 60)  // Files left in .vcs/temp (by crashed processes) older than this are removed
+
+// Set of raw object ids, with open addressing; the all-zero id marks an empty slot
+typedef struct ObjectSet {
+    unsigned char (*slots)[HASH_RAW_LEN];
+    size_t capacity;                // Always a power of two
+    size_t count;
+} ObjectSet;
+
+// State of one gc run
+typedef struct GcState {
+    Repository* repo;
+    const GcPolicy* policy;
+    GcStats* stats;
+    time_t started;
+    ObjectSet reachable;
+    unsigned char (*frontier)[HASH_RAW_LEN];    // Marked objects whose delta base has not been looked at yet
+    int frontier_count;
+    int frontier_cap;
+    FileVersion** kept;                         // Versions that survive, by filename and version
+    int kept_count;
+    FileVersion** snapshot_versions;            // Versions referred to by snapshots, sorted by address
+    int snapshot_count;
+    int snapshot_cap;
+    int failed;                                 // Memory allocation failed, or a chunk list was unreadable, while marking
+} GcState;
+
+// State shared by the workers looking up delta bases and chunks
+typedef struct BaseScan {
+    unsigned char (*ids)[HASH_RAW_LEN];
+    unsigned char (*bases)[HASH_RAW_LEN];
+    int* found;                     // 1 if ids[i] is a delta whose base is in bases[i]
+    unsigned char** chunks;         // Chunk list of ids[i] if it is a chunked object, else NULL
+    size_t* chunk_counts;
+    int* errors;                    // 1 if the chunk list of ids[i] could not be read
+} BaseScan;
+
+/*
+The function id_slot returns the first slot to probe for an object id. SHA-256 ids are uniformly distributed,
+so their first bytes serve as the hash.
+*/
+static size_t id_slot(const ObjectSet* set, const unsigned char* id) {
+    uint64_t hash = 0;
+    memcpy(&hash, id, sizeof(hash));
+    return (size_t)hash & (set->capacity - 1);
+}
+
+/*
+The function object_set_find returns the slot holding an id, or the empty slot where it belongs.
+*/
+static unsigned char* object_set_find(const ObjectSet* set, const unsigned char* id) {
+    static const unsigned char empty[HASH_RAW_LEN];
+    for (size_t i = id_slot(set, id);; i = (i + 1) & (set->capacity - 1)) {
+        unsigned char* slot = set->slots[i];
+        if (memcmp(slot, id, HASH_RAW_LEN) == 0 || memcmp(slot, empty, HASH_RAW_LEN) == 0) return slot;
+    }
+}
+
+/*
+The function object_set_contains checks whether an id is in the set.
+*/
+static int object_set_contains(const ObjectSet* set, const unsigned char* id) {
+    return set->capacity && memcmp(object_set_find(set, id), id, HASH_RAW_LEN) == 0;
+}
+
+/*
+The function object_set_add inserts an id, growing the table at half load.
+Returns 1 if the id was added, 0 if it was already there, -1 if memory allocation fails.
+*/
+static int object_set_add(ObjectSet* set, const unsigned char* id) {
+    if (set->count * 2 >= set->capacity) {
+        ObjectSet grown = {NULL, set->capacity ? set->capacity * 2 : 1024, 0};
+        grown.slots = calloc(grown.capacity, HASH_RAW_LEN);
+        if (!grown.slots) return -1;
+        static const unsigned char empty[HASH_RAW_LEN];
+        for (size_t i = 0; i < set->capacity; i++) {
+            if (memcmp(set->slots[i], empty, HASH_RAW_LEN) != 0) {
+                memcpy(object_set_find(&grown, set->slots[i]), set->slots[i], HASH_RAW_LEN);
+                grown.count++;
+            }
+        }
+        free(set->slots);
+        *set = grown;
+    }
+    unsigned char* slot = object_set_find(set, id);
+    if (memcmp(slot, id, HASH_RAW_LEN) == 0) return 0;
+    memcpy(slot, id, HASH_RAW_LEN);
+    set->count++;
+    return 1;
+}
+
+/*
+The function mark_object marks an object as reachable and queues it for the delta base scan.
+*/
+static void mark_object(GcState* gc, const unsigned char* id) {
+    int added = object_set_add(&gc->reachable, id);
+    if (added <= 0) {
+        if (added < 0) gc->failed = 1;
+        return;
+    }
+    if (gc->frontier_count == gc->frontier_cap) {
+        int cap = gc->frontier_cap ? gc->frontier_cap * 2 : 1024;
+        void* grown = realloc(gc->frontier, (size_t)cap * HASH_RAW_LEN);
+        if (!grown) {
+            gc->failed = 1;
+            return;
+        }
+        gc->frontier = grown;
+        gc->frontier_cap = cap;
+    }
+    memcpy(gc->frontier[gc->frontier_count++], id, HASH_RAW_LEN);
+}
+
+/*
+The function mark_object_hex marks an object given by its hex id (ids that are not SHA-256 digests are ignored).
+*/
+static void mark_object_hex(GcState* gc, const char* hex) {
+    unsigned char id[HASH_RAW_LEN];
+    if (hash_from_hex(hex, id) == 0) mark_object(gc, id);
+}
+
+/*
+The function mark_version marks the object a version is stored in.
+*/
+static void mark_version(GcState* gc, const FileVersion* version) {
+    if (version->flags & VERSION_HAS_OBJECT) mark_object(gc, version->object_id);
+}
+
+/*
+The function scan_delta_base looks up the delta base, or the chunks, of one object (parallel_for worker).
+*/
+static void scan_delta_base(void* context, int index) {
+    BaseScan* scan = context;
+    char hex[MAX_HASH_LEN], base[MAX_HASH_LEN];
+    ObjectHeader header;
+    hash_to_hex(scan->ids[index], hex);
+    if (object_read_header(hex, &header) != 1) return;
+    if (header.type == OBJECT_DELTA) {
+        scan->found[index] = object_delta_base(hex, base) == 1 && hash_from_hex(base, scan->bases[index]) == 0;
+    } else if (header.type == OBJECT_CHUNKS) {
+        scan->errors[index] = object_chunk_list(hex, &scan->chunks[index], &scan->chunk_counts[index]) != 1;
+    }
+}
+
+/*
+The function mark_delta_bases follows the delta chains of every queued object and marks their bases, and the
+chunks of chunked objects, round by round until no new object turns up. A chunk list that cannot be read fails
+the run, since its chunks would look unreferenced.
+*/
+static void mark_delta_bases(GcState* gc) {
+    while (gc->frontier_count > 0 && !gc->failed) {
+        int count = gc->frontier_count;
+        BaseScan scan = {gc->frontier, malloc((size_t)count * HASH_RAW_LEN), calloc((size_t)count, sizeof(int)),
+                         calloc((size_t)count, sizeof(unsigned char*)), calloc((size_t)count, sizeof(size_t)),
+                         calloc((size_t)count, sizeof(int))};
+        gc->frontier = NULL;
+        gc->frontier_count = gc->frontier_cap = 0;
+        if (!scan.bases || !scan.found || !scan.chunks || !scan.chunk_counts || !scan.errors) {
+            gc->failed = 1;
+        } else {
+            parallel_for(count, gc->repo->config.threads, scan_delta_base, &scan);
+            for (int i = 0; i < count; i++) {
+                if (scan.found[i]) mark_object(gc, scan.bases[i]);
+                if (scan.errors[i]) gc->failed = 1;
+                for (size_t c = 0; scan.chunks[i] && c < scan.chunk_counts[i]; c++) {
+                    mark_object(gc, scan.chunks[i] + c * CHUNK_ENTRY_SIZE);
+                }
+                free(scan.chunks[i]);
+            }
+        }
+        free(scan.ids);
+        free(scan.bases);
+        free(scan.found);
+        free(scan.chunks);
+        free(scan.chunk_counts);
+        free(scan.errors);
+    }
+}
+
+/*
+The function keep_snapshot marks a snapshot's manifest and objects and remembers its versions (visit_snapshots callback).
+*/
+static void keep_snapshot(void* context, const Snapshot* snapshot, const ManifestEntry* entries, int count) {
+    GcState* gc = context;
+    mark_object_hex(gc, snapshot->manifest);
+    for (int i = 0; i < count; i++) {
+        if (strcmp(entries[i].object, "-") != 0) mark_object_hex(gc, entries[i].object);
+        FileVersion* version = find_file_version(gc->repo, entries[i].filename, entries[i].version);
+        if (!version) continue;
+        if (gc->snapshot_count == gc->snapshot_cap) {
+            int cap = gc->snapshot_cap ? gc->snapshot_cap * 2 : 256;
+            FileVersion** grown = realloc(gc->snapshot_versions, (size_t)cap * sizeof(FileVersion*));
+            if (!grown) {
+                gc->failed = 1;
+                return;
+            }
+            gc->snapshot_versions = grown;
+            gc->snapshot_cap = cap;
+        }
+        gc->snapshot_versions[gc->snapshot_count++] = version;
+    }
+}
+
+/*
+The function compare_pointers orders FileVersion pointers by address (qsort and bsearch callback).
+*/
+static int compare_pointers(const void* a, const void* b) {
+    const FileVersion* x = *(FileVersion* const*)a;
+    const FileVersion* y = *(FileVersion* const*)b;
+    return (x > y) - (x < y);
+}
+
+/*
+The function local_day returns a number identifying the local calendar day of a timestamp.
+*/
+static long local_day(time_t timestamp) {
+    struct tm tm_info;
+    localtime_r(&timestamp, &tm_info);
+    return (tm_info.tm_year + 1900L) * 1000 + tm_info.tm_yday;
+}
+
+/*
+The function select_kept applies the retention policy to the versions of one file.
+It takes GcState* gc, FileVersion** versions / int count (the file's versions, oldest first) and int* keep
+(receives 1 for every version to keep).
+*/
+static void select_kept(GcState* gc, FileVersion** versions, int count, int* keep) {
+    const GcPolicy* policy = gc->policy;
+    int pruning = policy->keep_last > 0 || policy->keep_since > 0 || policy->keep_daily;
+    long covered_day = -1;      // Newest day that already has a kept version
+
+    for (int i = count - 1; i >= 0; i--) {
+        FileVersion* v = versions[i];
+        int rank = count - 1 - i;   // 0 for the latest version
+        keep[i] = !pruning || rank == 0 ||
+                  (policy->keep_last > 0 && rank < policy->keep_last) ||
+                  (policy->keep_since > 0 && v->timestamp >= policy->keep_since) ||
+                  (gc->snapshot_count > 0 && bsearch(&v, gc->snapshot_versions, (size_t)gc->snapshot_count,
+                                                     sizeof(FileVersion*), compare_pointers) != NULL);
+        long day = policy->keep_daily ? local_day(v->timestamp) : 0;
+        if (keep[i]) {
+            covered_day = day;
+        } else if (policy->keep_daily && day != covered_day) {
+            // The newest version of each older day survives
+            keep[i] = 1;
+            covered_day = day;
+        }
+    }
+}
+
+/*
+The function remove_legacy_version deletes the .vcs/versions/filename/vN copy of an expired version of an older
+repository. Returns the number of bytes freed, or -1 if there is no such copy.
+*/
+static long long remove_legacy_version(GcState* gc, const FileVersion* version) {
+    char path[MAX_PATH_LEN];
+    struct stat st;
+    snprintf(path, sizeof(path), "%s/%s/versions/%s/v%d", gc->repo->base_path, VCS_DIR, version->filename, version->version_number);
+    if (lstat(path, &st) != 0) return -1;
+    if (!gc->policy->dry_run && unlink(path) != 0) return -1;
+    return (long long)st.st_size;
+}
+
+/*
+The function expire_versions applies the retention policy, rewrites the metadata without the expired versions
+and marks the objects of the kept ones. Called with the exclusive metadata lock held.
+Returns 0 on success, -1 on failure (nothing has been removed then).
+*/
+static int expire_versions(GcState* gc) {
+    Repository* repo = gc->repo;
+    FileVersion** versions = NULL;
+    int count = collect_all_versions(repo, &versions);
+    if (count < 0) return -1;
+    int* keep = calloc((size_t)count + 1, sizeof(int));
+    if (!keep) {
+        free(versions);
+        return -1;
+    }
+
+    // Versions come sorted by filename, then version number: apply the policy to each file's run
+    for (int start = 0; start < count;) {
+        int end = start + 1;
+        while (end < count && strcmp(versions[end]->filename, versions[start]->filename) == 0) end++;
+        select_kept(gc, versions + start, end - start, keep + start);
+        start = end;
+    }
+
+    // Compact the kept versions to the front of the array, keeping the expired ones behind them
+    FileVersion** expired = malloc(((size_t)count + 1) * sizeof(FileVersion*));
+    int kept = 0, removed = 0;
+    if (!expired) {
+        free(keep);
+        free(versions);
+        return -1;
+    }
+    for (int i = 0; i < count; i++) {
+        if (keep[i]) versions[kept++] = versions[i];
+        else expired[removed++] = versions[i];
+    }
+    gc->stats->versions_kept = kept;
+    gc->stats->versions_removed = removed;
+
+    int status = 0;
+    if (!gc->policy->dry_run) {
+        // One pass writes the kept versions and folds the journal
+        if (removed > 0 || repo->journal_entries > 0) status = rewrite_metadata(repo, versions, kept);
+    }
+    if (status == 0) {
+        for (int i = 0; i < removed; i++) {
+            trace("gc: expiring version %d of %s", expired[i]->version_number, expired[i]->filename);
+            long long freed = (expired[i]->flags & VERSION_HAS_OBJECT) ? -1 : remove_legacy_version(gc, expired[i]);
+            if (freed >= 0) {
+                gc->stats->bytes_freed += freed;
+                gc->stats->files_removed++;
+            }
+        }
+        for (int i = 0; i < kept; i++) mark_version(gc, versions[i]);
+    }
+
+    // The kept versions stay valid in the arena after the metadata was rewritten
+    gc->kept = versions;
+    gc->kept_count = kept;
+    free(expired);
+    free(keep);
+    return (status == 0 && !gc->failed) ? 0 : -1;
+}
+
+/*
+The function rebase_kept_versions rewrites kept versions whose delta base is no longer referenced directly,
+against the next newer kept version of the same file. Files are walked from the newest version down, so every
+base has its final form before the versions depending on it are rewritten.
+Called with the object lock held, after the objects of kept versions and snapshots are marked (and before their
+delta chains are followed).
+*/
+static void rebase_kept_versions(GcState* gc) {
+    for (int i = gc->kept_count - 2; i >= 0; i--) {
+        const FileVersion* version = gc->kept[i];
+        const FileVersion* newer = gc->kept[i + 1];
+        if (strcmp(version->filename, newer->filename) != 0) continue;
+        if (!(version->flags & VERSION_HAS_OBJECT) || !(newer->flags & VERSION_HAS_OBJECT)) continue;
+
+        char object_id[MAX_HASH_LEN], base_id[MAX_HASH_LEN];
+        unsigned char base[HASH_RAW_LEN];
+        hash_to_hex(version->object_id, object_id);
+        if (object_delta_base(object_id, base_id) != 1 || hash_from_hex(base_id, base) != 0) continue;
+        if (object_set_contains(&gc->reachable, base)) continue;   // The base is still needed anyway
+
+        hash_to_hex(newer->object_id, base_id);
+        if (strcmp(object_id, base_id) == 0) continue;
+        trace("gc: rebasing version %d of %s", version->version_number, version->filename);
+        if (object_rebase(object_id, base_id, &gc->repo->config) >= 0) gc->stats->objects_rebased++;
+    }
+}
+
+/*
+The function mark_recorded_versions marks the objects of versions other processes recorded since the last call.
+Called with the exclusive metadata lock held, right after refresh_metadata.
+It takes GcState* gc, int* generation (metadata generation seen so far) and FileVersion** seen (newest journal
+entry already marked; new versions are added in front of it).
+*/
+static void mark_recorded_versions(GcState* gc, int* generation, FileVersion** seen) {
+    Repository* repo = gc->repo;
+    if (repo->metadata_generation != *generation) {
+        // Another process compacted the metadata, so anything may have moved into versions.bin
+        FileVersion** versions = NULL;
+        int count = collect_all_versions(repo, &versions);
+        if (count < 0) gc->failed = 1;
+        for (int i = 0; i < count; i++) mark_version(gc, versions[i]);
+        free(versions);
+    } else {
+        for (FileVersion* v = repo->version_list; v && v != *seen; v = v->next) mark_version(gc, v);
+    }
+    *generation = repo->metadata_generation;
+    *seen = repo->version_list;
+}
+
+/*
+The function sweep_directory removes the unreachable objects of one fan-out directory.
+Returns 0 on success, -1 if the directory cannot be read (a missing directory is not an error).
+*/
+static int sweep_directory(GcState* gc, int fanout) {
+    char dir_path[MAX_PATH_LEN];
+    snprintf(dir_path, sizeof(dir_path), "%s/%s/%s/%02x", gc->repo->base_path, VCS_DIR, OBJECTS_DIR, fanout);
+    DIR* dir = opendir(dir_path);
+    if (!dir) return (errno == ENOENT) ? 0 : -1;
+
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        // Object files are named after the 62 remaining hex characters of their id
+        char hex[MAX_HASH_LEN];
+        unsigned char id[HASH_RAW_LEN];
+        if (strlen(entry->d_name) != MAX_HASH_LEN - 3) continue;
+        snprintf(hex, sizeof(hex), "%02x%s", fanout, entry->d_name);
+        if (hash_from_hex(hex, id) != 0) continue;
+        if (object_set_contains(&gc->reachable, id)) {
+            gc->stats->objects_kept++;
+            continue;
+        }
+
+        char path[MAX_PATH_LEN];
+        struct stat st;
+        snprintf(path, sizeof(path), "%s/%s", dir_path, entry->d_name);
+        if (lstat(path, &st) != 0 || !S_ISREG(st.st_mode)) continue;
+        if (st.st_mtime >= gc->started) {
+            gc->stats->objects_kept++;     // Stored or reused while the gc runs
+            continue;
+        }
+        if (!gc->policy->dry_run && unlink(path) != 0) continue;
+        trace("gc: removing object %s", hex);
+        gc->stats->objects_removed++;
+        gc->stats->bytes_freed += (long long)st.st_size;
+    }
+    closedir(dir);
+    return 0;
+}
+
+/*
+The function packed_reachable checks whether a packed object is marked (prune_packs callback).
+*/
+static int packed_reachable(void* context, const unsigned char* id) {
+    GcState* gc = context;
+    return object_set_contains(&gc->reachable, id);
+}
+
+/*
+The function sweep_temp removes files left in .vcs/temp by processes that crashed while writing them.
+*/
+static void sweep_temp(GcState* gc) {
+    char dir_path[MAX_PATH_LEN];
+    snprintf(dir_path, sizeof(dir_path), "%s/%s/temp", gc->repo->base_path, VCS_DIR);
+    DIR* dir = opendir(dir_path);
+    if (!dir) return;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        char path[MAX_PATH_LEN];
+        struct stat st;
+        if (entry->d_name[0] == '.') continue;
+        snprintf(path, sizeof(path), "%s/%s", dir_path, entry->d_name);
+        if (lstat(path, &st) != 0 || !S_ISREG(st.st_mode) || st.st_mtime >= gc->started - GC_TEMP_AGE) continue;
+        if (!gc->policy->dry_run && unlink(path) != 0) continue;
+        gc->stats->files_removed++;
+        gc->stats->bytes_freed += (long long)st.st_size;
+    }
+    closedir(dir);
+}
+
+/*
+The function collect_garbage expires versions according to a retention policy and removes unreferenced objects.
+Returns 0 on success, -1 on failure (lock, unreadable snapshot manifest, metadata write or memory errors);
+versions are only expired once everything that refers to them is known.
+It takes Repository* repo, const GcPolicy* policy (what to keep; dry_run only counts) and
+GcStats* stats (receives what was removed and kept).
+*/
+int collect_garbage(Repository* repo, const GcPolicy* policy, GcStats* stats) {
+    if (!repo || !policy || !stats) return -1;
+    memset(stats, 0, sizeof(*stats));
+
+    GcState gc;
+    memset(&gc, 0, sizeof(gc));
+    gc.repo = repo;
+    gc.policy = policy;
+    gc.stats = stats;
+    gc.started = time(NULL);
+
+    // Step 1: expire versions, with other check-ins held off
+    int lock = lock_repository(repo->base_path, LOCK_FILE, 1);
+    int status = (lock >= 0 && refresh_metadata(repo) == 0) ? 0 : -1;
+    if (status == 0 && visit_snapshots(repo, keep_snapshot, &gc) < 0) {
+        fprintf(stderr, "gc: a snapshot manifest cannot be read, nothing was removed\n");
+        status = -1;
+    }
+    if (status == 0 && !gc.failed) {
+        if (gc.snapshot_count > 0) qsort(gc.snapshot_versions, (size_t)gc.snapshot_count, sizeof(FileVersion*), compare_pointers);
+        status = expire_versions(&gc);
+    }
+    int generation = repo->metadata_generation;
+    FileVersion* seen = repo->version_list;
+    unlock_repository(lock);
+
+    // Step 2: cut the kept versions loose from expired objects, then follow delta chains without holding any lock
+    if (status == 0 && !policy->dry_run && stats->versions_removed > 0) {
+        lock = lock_repository(repo->base_path, OBJECTS_LOCK_FILE, 1);
+        if (lock >= 0) rebase_kept_versions(&gc);
+        unlock_repository(lock);
+    }
+    if (status == 0) mark_delta_bases(&gc);
+
+    // Step 3: sweep one fan-out directory at a time
+    for (int fanout = 0; status == 0 && fanout < 256; fanout++) {
+        lock = lock_repository(repo->base_path, LOCK_FILE, 1);
+        if (lock < 0 || refresh_metadata(repo) != 0) {
+            status = -1;
+        } else {
+            mark_recorded_versions(&gc, &generation, &seen);
+            mark_delta_bases(&gc);
+            if (gc.failed || sweep_directory(&gc, fanout) != 0) status = -1;
+        }
+        unlock_repository(lock);
+    }
+    if (status == 0) {
+        lock = lock_repository(repo->base_path, LOCK_FILE, 1);
+        if (lock < 0 || refresh_metadata(repo) != 0) {
+            status = -1;
+        } else {
+            mark_recorded_versions(&gc, &generation, &seen);
+            mark_delta_bases(&gc);
+            if (gc.failed || prune_packs(repo, packed_reachable, &gc, gc.started, policy->dry_run, &stats->objects_removed,
+                                         &stats->bytes_freed, &stats->objects_kept) != 0) {
+                status = -1;
+            }
+        }
+        unlock_repository(lock);
+    }
+    if (status == 0) sweep_temp(&gc);
+
+    free(gc.reachable.slots);
+    free(gc.frontier);
+    free(gc.kept);
+    free(gc.snapshot_versions);
+    return status;
+}
@@ -0,0 +1,168 @@
+#include "vcs.h"
+#include <fcntl.h>          // Provides open() flags and posix_fadvise() for sequential read hints
+#include <openssl/evp.h>    // Provides the EVP digest interface (uses SHA extensions of the CPU when available)
+
+/*
+The content hash engine computes SHA-256 digests of file contents.
+The digest depends only on the bytes of the file, so equal contents always produce equal hashes.
+That makes the hash usable both for change detection and as the object id in the object store.
+Files are read with large read() calls instead of per-byte stdio, which keeps the digest itself as the bottleneck.
+*/
+
+/*
+The function hash_begin starts a new streaming digest.
+Returns 0 on success, -1 if the digest context could not be created.
+It takes HashState* state (the digest state to initialize).
+*/
+int hash_begin(HashState* state) {
+    if (!state) return -1;
+
+    EVP_MD_CTX* ctx = EVP_MD_CTX_new();
+    if (!ctx) return -1;
+    if (EVP_DigestInit_ex(ctx, EVP_sha256(), NULL) != 1) {
+        EVP_MD_CTX_free(ctx);
+        return -1;
+    }
+    state->ctx = ctx;
+    return 0;
+}
+
+/*
+The function hash_update feeds a block of data into a streaming digest.
+Returns 0 on success, -1 on failure.
+It takes HashState* state (digest started with hash_begin), const void* data and size_t len (the block to hash).
+*/
+int hash_update(HashState* state, const void* data, size_t len) {
+    if (!state || !state->ctx) return -1;
+    return (EVP_DigestUpdate((EVP_MD_CTX*)state->ctx, data, len) == 1) ? 0 : -1;
+}
+
+/*
+The function hash_finish completes a streaming digest and writes it as lowercase hex.
+Returns 0 on success, -1 on failure. The digest state is released in both cases.
+It takes HashState* state and char* hex_out (output buffer of MAX_HASH_LEN bytes).
+*/
+int hash_finish(HashState* state, char* hex_out) {
+    if (!state || !state->ctx) return -1;
+
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digest_len = 0;
+    int ok = EVP_DigestFinal_ex((EVP_MD_CTX*)state->ctx, digest, &digest_len) == 1;
+    hash_abort(state);
+    if (!ok) return -1;
+
+    if (digest_len != HASH_RAW_LEN) return -1;
+    hash_to_hex(digest, hex_out);
+    return 0;
+}
+
+/*
+The function hash_to_hex converts a raw SHA-256 digest to lowercase hex, two characters per byte.
+It takes const unsigned char* raw (HASH_RAW_LEN bytes) and char* hex_out (output buffer of MAX_HASH_LEN bytes).
+*/
+void hash_to_hex(const unsigned char* raw, char* hex_out) {
+    static const char hex[] = "0123456789abcdef";
+    for (int i = 0; i < HASH_RAW_LEN; i++) {
+        hex_out[i * 2] = hex[raw[i] >> 4];
+        hex_out[i * 2 + 1] = hex[raw[i] & 0x0f];
+    }
+    hex_out[HASH_RAW_LEN * 2] = '\0';
+}
+
+/*
+The function hash_from_hex parses a hex SHA-256 digest (either case) into raw bytes.
+Returns 0 on success, -1 if hex is not exactly HASH_RAW_LEN * 2 hex digits.
+It takes const char* hex and unsigned char* raw_out (HASH_RAW_LEN bytes).
+*/
+int hash_from_hex(const char* hex, unsigned char* raw_out) {
+    if (!hex || strlen(hex) != HASH_RAW_LEN * 2) return -1;
+    for (int i = 0; i < HASH_RAW_LEN * 2; i++) {
+        char c = hex[i];
+        int nibble = (c >= '0' && c <= '9') ? c - '0' :
+                     (c >= 'a' && c <= 'f') ? c - 'a' + 10 :
+                     (c >= 'A' && c <= 'F') ? c - 'A' + 10 : -1;
+        if (nibble < 0) return -1;
+        if (i % 2 == 0) raw_out[i / 2] = (unsigned char)(nibble << 4);
+        else raw_out[i / 2] |= (unsigned char)nibble;
+    }
+    return 0;
+}
+
+/*
+The function hash_abort releases a streaming digest without producing a result.
+It takes HashState* state. Safe to call on a state that was already finished.
+*/
+void hash_abort(HashState* state) {
+    if (!state || !state->ctx) return;
+    EVP_MD_CTX_free((EVP_MD_CTX*)state->ctx);
+    state->ctx = NULL;
+}
+
+/*
+The function hash_buffer computes the digest of an in-memory buffer.
+Returns 0 on success, -1 on failure.
+It takes const void* data and size_t len (the bytes to hash) and char* hex_out (output buffer of MAX_HASH_LEN bytes).
+*/
+int hash_buffer(const void* data, size_t len, char* hex_out) {
+    HashState state;
+    if (hash_begin(&state) != 0) return -1;
+    if (hash_update(&state, data, len) != 0) {
+        hash_abort(&state);
+        return -1;
+    }
+    return hash_finish(&state, hex_out);
+}
+
+/*
+The function hash_file computes the digest of a file's contents, reading it in HASH_BLOCK_SIZE blocks.
+Returns 0 on success, -1 on failure (file open/read errors or digest errors).
+It takes const char* filepath (file to hash), char* hex_out (output buffer of MAX_HASH_LEN bytes)
+and long* size_out (optional, receives the number of bytes hashed).
+*/
+int hash_file(const char* filepath, char* hex_out, long* size_out) {
+    long long started = stats_clock();
+    int fd = open(filepath, O_RDONLY);
+    if (fd < 0) return -1;
+
+    // Tell the kernel the file will be read front to back so it can read ahead aggressively
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    unsigned char* buffer = malloc(HASH_BLOCK_SIZE);
+    HashState state;
+    if (!buffer || hash_begin(&state) != 0) {
+        free(buffer);
+        close(fd);
+        return -1;
+    }
+
+    long total = 0;
+    long long reads = 0;
+    int status = 0;
+    for (;;) {
+        ssize_t bytes = read(fd, buffer, HASH_BLOCK_SIZE);
+        reads++;
+        if (bytes < 0) {
+            if (errno == EINTR) continue;  // Interrupted by a signal, just retry
+            status = -1;
+            break;
+        }
+        if (bytes == 0) break;             // End of file
+        if (hash_update(&state, buffer, (size_t)bytes) != 0) {
+            status = -1;
+            break;
+        }
+        total += bytes;
+    }
+
+    free(buffer);
+    close(fd);
+
+    if (status != 0) {
+        hash_abort(&state);
+        return -1;
+    }
+    if (size_out) *size_out = total;
+    status = hash_finish(&state, hex_out);
+    stats_add(STAT_HASH, started, total, 0, reads);
+    return status;
+}
@@ -0,0 +1,56 @@
+#include "vcs.h"
+#include <fcntl.h>      // Provides open() flags
+#include <sys/file.h>   // Provides flock()
+
+/*
+Processes working on the same repository coordinate through advisory flock() locks on small files in .vcs:
+    .vcs/lock           - the metadata (versions.bin, versions.journal and .vcs/snapshots)
+    .vcs/objects.lock   - rewriting objects that are already stored (turning versions into deltas)
+Loading the metadata takes the metadata lock shared, so any number of readers (list, checkout, status, diff)
+run side by side. A check-in hashes and stores its files without holding any lock; only assigning the version
+numbers and appending them to the journal happens under the exclusive metadata lock, after picking up what
+other processes recorded in the meantime (see refresh_metadata). Locks belong to the open file, so they are
+released when the process exits, however it ends.
+*/
+
+/*
+The function lock_repository takes one of the repository's locks, waiting until it is available.
+Returns the descriptor holding the lock (release it with unlock_repository), or -1 on failure.
+It takes const char* base_path (root of the repository), const char* name (LOCK_FILE or OBJECTS_LOCK_FILE)
+and int exclusive (1 for an exclusive lock, 0 for a shared one).
+The same process must not take a lock it already holds: a second descriptor would wait for the first.
+*/
+int lock_repository(const char* base_path, const char* name, int exclusive) {
+    char path[MAX_PATH_LEN];
+    snprintf(path, sizeof(path), "%s/%s/%s", base_path, VCS_DIR, name);
+    int fd = open(path, O_RDWR | O_CREAT, 0666);
+    if (fd < 0 && !exclusive) fd = open(path, O_RDONLY);    // A read-only repository can still be read
+    if (fd < 0) return -1;
+
+    long long started = stats_clock();
+    long long calls = 1;
+    int operation = exclusive ? LOCK_EX : LOCK_SH;
+    if (flock(fd, operation | LOCK_NB) != 0) {
+        trace("lock: waiting for %s", name);
+        while (flock(fd, operation) != 0) {
+            if (errno != EINTR) {
+                close(fd);
+                return -1;
+            }
+            calls++;
+        }
+        calls++;
+    }
+    stats_add(STAT_LOCK, started, 0, 0, calls);
+    return fd;
+}
+
+/*
+The function unlock_repository releases a lock taken with lock_repository.
+It takes int fd (the descriptor returned by lock_repository; negative values are ignored).
+*/
+void unlock_repository(int fd) {
+    if (fd < 0) return;
+    flock(fd, LOCK_UN);
+    close(fd);
+}
@@ -1,74 +1,475 @@
 #include "vcs.h"
 
-int main(int argc, char* argv[]) {
-    if (argc < 2) {
-        print_help();
-        return 1;
+/*
+The function run_checkin implements "checkin [-m comment] [-r dir]... <file>...".
+The older form "checkin <file> [comment]" still works: a second argument that is not an existing file is the comment.
+Returns the process exit status.
+*/
+static int run_checkin(Repository* repo, int argc, char* argv[]) {
+    const char* comment = NULL;
+    char** files = NULL;    // Files found under -r directories (owned)
+    int file_count = 0;
+    char** named = malloc((argc + 1) * sizeof(char*));     // Files named on the command line
+    int named_count = 0;
+    if (!named) return 1;
+    
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+            comment = argv[++i];
+        } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            if (collect_files(argv[++i], &files, &file_count) != 0) {
+                printf("Failed to read directory '%s'\n", argv[i]);
+            }
+        } else {
+            named[named_count++] = argv[i];
+        }
     }
     
-    char current_dir[MAX_PATH_LEN];
-    getcwd(current_dir, sizeof(current_dir));
+    // Older form: checkin <file> <comment>
+    if (!comment && file_count == 0 && named_count == 2 && !file_exists(named[1])) {
+        comment = named[1];
+        named_count = 1;
+    }
+    if (!comment) comment = "No comment provided";
     
-    Repository* repo = NULL;
+    // One list of every file to check in
+    char** all = realloc(named, (named_count + file_count + 1) * sizeof(char*));
+    if (!all) {
+        free(named);
+        return 1;
+    }
+    int count = named_count;
+    for (int i = 0; i < file_count; i++) all[count++] = files[i];
     
-    // Handle init command separately
-    if (strcmp(argv[1], "init") == 0) {
-        if (repository_exists(current_dir)) {
-            printf("Repository already exists in this directory.\n");
-            return 1;
+    int failed = 0;
+    if (count == 1) {
+        // A single file keeps the messages of the single-file command
+        if (!file_exists(all[0])) {
+            printf("File '%s' does not exist.\n", all[0]);
+            failed = 1;
+        } else {
+            int version = checkin_file(repo, all[0], comment);
+            if (version > 0) {
+                printf("Checked in '%s' as version %d\n", all[0], version);
+            } else if (version == CHECKIN_UNCHANGED) {
+                printf("'%s' is unchanged since version %d\n", all[0], get_latest_version(repo, all[0]));
+            } else {
+                printf("Failed to check in file.\n");
+            }
         }
-        
-        if (init_repository(current_dir) == 0) {
-            printf("Initialized empty repository in %s\n", current_dir);
+    } else if (count > 1) {
+        CheckinItem* items = calloc(count, sizeof(CheckinItem));
+        int added = items ? checkin_files(repo, all, count, comment, items) : -1;
+        if (added < 0) {
+            printf("Failed to check in files.\n");
+            failed = 1;
         } else {
-            printf("Failed to initialize repository.\n");
-            return 1;
+            int unchanged = 0, errors = 0;
+            for (int i = 0; i < count; i++) {
+                if (items[i].status > 0) {
+                    printf("Checked in '%s' as version %d\n", all[i], items[i].status);
+                } else if (items[i].status == CHECKIN_UNCHANGED) {
+                    unchanged++;
+                } else {
+                    printf("Failed to check in '%s'\n", all[i]);
+                    errors++;
+                }
+            }
+            printf("%d checked in, %d unchanged, %d failed\n", added, unchanged, errors);
         }
+        free(items);
+    } else {
+        printf("No files to check in.\n");
+    }
+    
+    for (int i = 0; i < file_count; i++) free(files[i]);
+    free(files);
+    free(all);
+    return failed;
+}
+
+/*
+The function run_snapshot implements "snapshot [-m comment] [-r dir]... [file]...".
+Returns the process exit status.
+*/
+static int run_snapshot(Repository* repo, int argc, char* argv[]) {
+    const char* comment = "No comment provided";
+    char** files = NULL;    // New files named on the command line or found under -r directories (owned)
+    int count = 0;
+    
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+            comment = argv[++i];
+        } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            if (collect_files(argv[++i], &files, &count) != 0) {
+                printf("Failed to read directory '%s'\n", argv[i]);
+            }
+        } else {
+            char** grown = realloc(files, (count + 1) * sizeof(char*));
+            char* name = strdup(argv[i]);
+            if (!grown || !name) {
+                free(name);
+                free(grown ? grown : files);
+                return 1;
+            }
+            files = grown;
+            files[count++] = name;
+        }
+    }
+    
+    int checked_in = 0;
+    int id = create_snapshot(repo, files, count, comment, &checked_in);
+    if (id > 0) {
+        Snapshot snapshot;
+        find_snapshot(repo, id, &snapshot);
+        printf("Created snapshot %d of %d files (%d checked in)\n", id, snapshot.file_count, checked_in);
+    } else {
+        printf("Failed to create snapshot.\n");
+    }
+    
+    for (int i = 0; i < count; i++) free(files[i]);
+    free(files);
+    return (id > 0) ? 0 : 1;
+}
+
+/*
+The function parse_time_option reads the time given to --since or --until.
+Accepts "@<seconds since the epoch>", a local date "YYYY-MM-DD" with an optional time "HH:MM[:SS]"
+(separated by a space or 'T'), or an age such as "30m", "12h", "7d" or "2w" counted back from now.
+A date without a time means the start of that day, or its end when int end_of_day is set (for --until).
+Returns 0 on success, -1 if the text is not a time.
+*/
+static int parse_time_option(const char* text, int end_of_day, time_t* out) {
+    char* end;
+    if (text[0] == '@') {
+        long long seconds = strtoll(text + 1, &end, 10);
+        if (end == text + 1 || *end) return -1;
+        *out = (time_t)seconds;
         return 0;
     }
     
-    // Check if repository exists for other commands
-    if (!repository_exists(current_dir)) {
-        printf("No repository found. Use 'init' to create one.\n");
+    struct tm tm_info;
+    memset(&tm_info, 0, sizeof(tm_info));
+    char separator = 0, extra;
+    int fields = sscanf(text, "%d-%d-%d%c%d:%d:%d%c", &tm_info.tm_year, &tm_info.tm_mon, &tm_info.tm_mday,
+                        &separator, &tm_info.tm_hour, &tm_info.tm_min, &tm_info.tm_sec, &extra);
+    if (fields == 3 || ((fields == 6 || fields == 7) && (separator == ' ' || separator == 'T'))) {
+        if (fields == 3 && end_of_day) {
+            tm_info.tm_hour = 23;
+            tm_info.tm_min = 59;
+            tm_info.tm_sec = 59;
+        }
+        tm_info.tm_year -= 1900;
+        tm_info.tm_mon -= 1;
+        tm_info.tm_isdst = -1;
+        time_t t = mktime(&tm_info);
+        if (t == (time_t)-1) return -1;
+        *out = t;
+        return 0;
+    }
+    
+    long amount = strtol(text, &end, 10);
+    if (end == text || amount < 0 || end[0] == '\0' || end[1] != '\0') return -1;
+    long unit = (*end == 'm') ? 60 : (*end == 'h') ? 3600 : (*end == 'd') ? 86400 : (*end == 'w') ? 604800 : 0;
+    if (!unit) return -1;
+    *out = time(NULL) - (time_t)(amount * unit);
+    return 0;
+}
+
+/*
+The function run_list implements "list [--limit N] [--since time] [--until time] [--grep text] [--format table|tsv|json] <file>".
+Returns the process exit status.
+*/
+static int run_list(const char* program, Repository* repo, int argc, char* argv[]) {
+    VersionFilter filter = {0, 0, 0, NULL};
+    int format = LIST_TABLE;
+    const char* filename = NULL;
+    
+    for (int i = 0; i < argc; i++) {
+        const char* option = argv[i];
+        const char* value = (i + 1 < argc) ? argv[i + 1] : NULL;
+        if (strcmp(option, "--limit") == 0 || strcmp(option, "-n") == 0) {
+            filter.limit = value ? atoi(value) : 0;
+            if (filter.limit <= 0) {
+                fprintf(stderr, "%s: --limit needs a positive number\n", program);
+                return 1;
+            }
+            i++;
+        } else if (strcmp(option, "--since") == 0 || strcmp(option, "--until") == 0) {
+            int until = (option[2] == 'u');
+            if (!value || parse_time_option(value, until, until ? &filter.until : &filter.since) != 0) {
+                fprintf(stderr, "%s: %s needs a time (@seconds, YYYY-MM-DD[ HH:MM[:SS]] or an age like 7d)\n", program, option);
+                return 1;
+            }
+            i++;
+        } else if (strcmp(option, "--grep") == 0 && value) {
+            filter.grep = value;
+            i++;
+        } else if (strcmp(option, "--format") == 0 && value) {
+            if (strcmp(value, "table") == 0) format = LIST_TABLE;
+            else if (strcmp(value, "tsv") == 0) format = LIST_TSV;
+            else if (strcmp(value, "json") == 0) format = LIST_JSON;
+            else {
+                fprintf(stderr, "%s: unknown list format '%s' (table, tsv or json)\n", program, value);
+                return 1;
+            }
+            i++;
+        } else if (!filename) {
+            filename = option;
+        } else {
+            filename = NULL;
+            break;
+        }
+    }
+    
+    if (!filename) {
+        printf("Usage: %s list [--limit N] [--since time] [--until time] [--grep text] [--format table|tsv|json] <filename>\n", program);
         return 1;
     }
     
-    repo = load_repository(current_dir);
+    if (list_versions(repo, filename, &filter, format) != 0) {
+        // Machine-readable output stays clean on stdout
+        fprintf((format == LIST_TABLE) ? stdout : stderr, "No versions found for '%s'\n", filename);
+        return (format == LIST_TABLE) ? 0 : 1;
+    }
+    return 0;
+}
+
+/*
+The function run_gc implements "gc [--keep-last N] [--keep-since time] [--keep-daily] [--dry-run]".
+Returns the process exit status.
+*/
+static int run_gc(const char* program, Repository* repo, int argc, char* argv[]) {
+    GcPolicy policy = {0, 0, 0, 0};
+    for (int i = 0; i < argc; i++) {
+        const char* value = (i + 1 < argc) ? argv[i + 1] : NULL;
+        if (strcmp(argv[i], "--keep-last") == 0) {
+            policy.keep_last = value ? atoi(value) : 0;
+            if (policy.keep_last <= 0) {
+                fprintf(stderr, "%s: --keep-last needs a positive number\n", program);
+                return 1;
+            }
+            i++;
+        } else if (strcmp(argv[i], "--keep-since") == 0) {
+            if (!value || parse_time_option(value, 0, &policy.keep_since) != 0) {
+                fprintf(stderr, "%s: --keep-since needs a time (@seconds, YYYY-MM-DD[ HH:MM[:SS]] or an age like 30d)\n", program);
+                return 1;
+            }
+            i++;
+        } else if (strcmp(argv[i], "--keep-daily") == 0) {
+            policy.keep_daily = 1;
+        } else if (strcmp(argv[i], "--dry-run") == 0 || strcmp(argv[i], "-n") == 0) {
+            policy.dry_run = 1;
+        } else {
+            printf("Usage: %s gc [--keep-last N] [--keep-since time] [--keep-daily] [--dry-run]\n", program);
+            return 1;
+        }
+    }
+    
+    GcStats stats;
+    if (collect_garbage(repo, &policy, &stats) != 0) {
+        printf("Garbage collection failed.\n");
+        return 1;
+    }
+    printf("%s %d of %d versions, %ld objects and %ld other files (%lld bytes); %ld objects kept, %ld rewritten\n",
+           policy.dry_run ? "Would remove" : "Removed", stats.versions_removed,
+           stats.versions_removed + stats.versions_kept, stats.objects_removed, stats.files_removed,
+           stats.bytes_freed, stats.objects_kept, stats.objects_rebased);
+    return 0;
+}
+
+/*
+The function run_pack implements "pack [--all]".
+Returns the process exit status.
+*/
+static int run_pack(const char* program, Repository* repo, int argc, char* argv[]) {
+    int all = 0;
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "--all") == 0 || strcmp(argv[i], "-a") == 0) {
+            all = 1;
+        } else {
+            printf("Usage: %s pack [--all]\n", program);
+            return 1;
+        }
+    }
+
+    PackStats stats;
+    if (pack_objects(repo, all, &stats) != 0) {
+        printf("Packing failed.\n");
+        return 1;
+    }
+    if (stats.objects_packed == 0) {
+        printf("Nothing to pack.\n");
+    } else {
+        printf("Packed %ld objects (%lld bytes), removed %ld loose objects and merged %ld packs\n",
+               stats.objects_packed, stats.pack_bytes, stats.loose_removed, stats.packs_removed);
+    }
+    return 0;
+}
+
+/*
+The function run_fsck implements "fsck [--sample percent] [--incremental]".
+Returns the process exit status (1 if missing or corrupt objects were found).
+*/
+static int run_fsck(const char* program, Repository* repo, int argc, char* argv[]) {
+    FsckOptions options = {100, 0};
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "--sample") == 0) {
+            options.sample_percent = (i + 1 < argc) ? atoi(argv[i + 1]) : 0;
+            if (options.sample_percent <= 0 || options.sample_percent > 100) {
+                fprintf(stderr, "%s: --sample needs a percentage from 1 to 100\n", program);
+                return 1;
+            }
+            i++;
+        } else if (strcmp(argv[i], "--incremental") == 0 || strcmp(argv[i], "-i") == 0) {
+            options.incremental = 1;
+        } else {
+            printf("Usage: %s fsck [--sample percent] [--incremental]\n", program);
+            return 1;
+        }
+    }
+
+    FsckStats stats;
+    if (fsck_repository(repo, &options, &stats) != 0) {
+        printf("Integrity check failed.\n");
+        return 1;
+    }
+    printf("Checked %ld objects of %ld versions (%lld bytes): %ld missing, %ld corrupt",
+           stats.objects_checked, stats.versions_checked, stats.bytes_hashed, stats.missing, stats.corrupt);
+    if (options.sample_percent == 100 && !options.incremental) printf(", %ld orphaned", stats.orphaned);
+    printf("\n");
+    return (stats.missing > 0 || stats.corrupt > 0) ? 1 : 0;
+}
+
+/*
+The function run_watch implements "watch [-m comment] [--debounce ms] [dir]...".
+Returns the process exit status.
+*/
+static int run_watch(const char* program, Repository* repo, int argc, char* argv[]) {
+    WatchOptions options = {"Captured by vcs watch", 200, 1000};
+    char** dirs = malloc((argc + 1) * sizeof(char*));
+    int count = 0;
+    if (!dirs) return 1;
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+            options.comment = argv[++i];
+        } else if (strcmp(argv[i], "--debounce") == 0 && i + 1 < argc) {
+            options.debounce_ms = atoi(argv[++i]);
+            if (options.debounce_ms < 0) options.debounce_ms = 0;
+            if (options.max_delay_ms < options.debounce_ms) options.max_delay_ms = options.debounce_ms;
+        } else if (argv[i][0] == '-') {
+            printf("Usage: %s watch [-m comment] [--debounce ms] [dir]...\n", program);
+            free(dirs);
+            return 1;
+        } else {
+            dirs[count++] = argv[i];
+        }
+    }
+    if (count == 0) dirs[count++] = ".";
+    int status = watch_tree(repo, dirs, count, &options);
+    free(dirs);
+    return status != 0;
+}
+
+/*
+The function run_sync implements "push [-j connections] <remote>" and "pull [-j connections] <remote>".
+Returns the process exit status (1 if the copy failed or a file's histories differ).
+*/
+static int run_sync(const char* program, const char* command, Repository* repo, int argc, char* argv[]) {
+    int connections = 1;
+    const char* remote = NULL;
+    for (int i = 0; i < argc; i++) {
+        if ((strcmp(argv[i], "-j") == 0 || strcmp(argv[i], "--connections") == 0) && i + 1 < argc) {
+            connections = atoi(argv[++i]);
+        } else if (!remote && argv[i][0] != '-') {
+            remote = argv[i];
+        } else {
+            remote = NULL;
+            break;
+        }
+    }
+    if (!remote || connections < 1) {
+        printf("Usage: %s %s [-j connections] <remote>\n", program, command);
+        return 1;
+    }
+
+    SyncStats stats;
+    int push = strcmp(command, "push") == 0;
+    int status = push ? remote_push(repo, remote, connections, &stats) : remote_pull(repo, remote, connections, &stats);
+    if (status != 0) {
+        printf("Failed to %s %s.\n", command, remote);
+        return 1;
+    }
+    printf("%s %ld versions (%ld objects, %lld bytes, %lld bytes transferred)",
+           push ? "Pushed" : "Pulled", stats.records, stats.objects, stats.bytes, stats.wire_bytes);
+    if (stats.conflicts > 0) printf(", %ld conflicting files left alone", stats.conflicts);
+    if (stats.skipped > 0) printf(", %ld versions without objects skipped", stats.skipped);
+    printf("\n");
+    return stats.conflicts > 0;
+}
+
+/*
+The function run_serve implements "serve <path>", the other side of a push or pull (see remote.c).
+The conversation uses stdin and stdout, so everything the code prints goes to stderr instead.
+Returns the process exit status.
+*/
+static int run_serve(const char* program, int argc, char* argv[]) {
+    if (argc != 1) {
+        fprintf(stderr, "Usage: %s serve <path>\n", program);
+        return 1;
+    }
+    int protocol = dup(STDOUT_FILENO);
+    if (protocol < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) return 1;
+    char path[MAX_PATH_LEN];
+    if (chdir(argv[0]) != 0 || !getcwd(path, sizeof(path)) || !repository_exists(path)) {
+        fprintf(stderr, "%s: no repository found at %s\n", program, argv[0]);
+        return 1;
+    }
+    Repository* repo = load_repository(path);
     if (!repo) {
-        printf("Failed to load repository.\n");
+        fprintf(stderr, "%s: failed to load the repository at %s\n", program, argv[0]);
         return 1;
     }
-    
+    int status = remote_serve(repo, STDIN_FILENO, protocol);
+    cleanup_repository(repo);
+    return status != 0;
+}
+
+/*
+The function run_command runs one command (argv[1]) against a loaded repository.
+Returns the process exit status.
+It takes Repository* repo and the command line (int argc, char* argv[]).
+The repository stays loaded afterwards, so the daemon can run many commands against it.
+*/
+static int run_command(Repository* repo, int argc, char* argv[]) {
     // Handle different commands
     if (strcmp(argv[1], "checkin") == 0) {
         if (argc < 3) {
-            printf("Usage: %s checkin <filename> [comment]\n", argv[0]);
-            cleanup_repository(repo);
-            return 1;
-        }
-        
-        char* comment = (argc >= 4) ? argv[3] : "No comment provided";
-        
-        if (!file_exists(argv[2])) {
-            printf("File '%s' does not exist.\n", argv[2]);
-            cleanup_repository(repo);
+            printf("Usage: %s checkin [-m comment] [-r dir]... <file>... (or: checkin <file> [comment])\n", argv[0]);
             return 1;
         }
         
-        int version = checkin_file(repo, argv[2], comment);
-        if (version > 0) {
-            printf("Checked in '%s' as version %d\n", argv[2], version);
-        } else {
-            printf("Failed to check in file.\n");
-        }
+        return run_checkin(repo, argc - 2, argv + 2);
     }
     else if (strcmp(argv[1], "checkout") == 0) {
         if (argc < 3) {
             printf("Usage: %s checkout <filename> [version]\n", argv[0]);
-            cleanup_repository(repo);
             return 1;
         }
         
+        // checkout -s <snapshot> restores every file of a snapshot
+        if (strcmp(argv[2], "-s") == 0) {
+            int restored = 0, unchanged = 0;
+            int id = (argc >= 4) ? atoi(argv[3]) : 0;
+            int failed = restore_snapshot(repo, id, &restored, &unchanged);
+            if (failed < 0) {
+                printf("Snapshot %d not found.\n", id);
+            } else {
+                printf("Checked out snapshot %d: %d restored, %d unchanged, %d failed\n", id, restored, unchanged, failed);
+            }
+            return failed != 0;
+        }
+        
         int version = (argc >= 4) ? atoi(argv[3]) : get_latest_version(repo, argv[2]);
         
         if (checkout_file(repo, argv[2], version) == 0) {
@@ -77,24 +478,35 @@ int main(int argc, char* argv[]) {
             printf("Failed to check out file.\n");
         }
     }
-    else if (strcmp(argv[1], "list") == 0) {
-        if (argc < 3) {
-            printf("Usage: %s list <filename>\n", argv[0]);
-            cleanup_repository(repo);
-            return 1;
-        }
-        
-        if (list_versions(repo, argv[2]) != 0) {
-            printf("No versions found for '%s'\n", argv[2]);
+    else if (strcmp(argv[1], "snapshot") == 0) {
+        return run_snapshot(repo, argc - 2, argv + 2);
+    }
+    else if (strcmp(argv[1], "snapshots") == 0) {
+        if (list_snapshots(repo) != 0) {
+            printf("No snapshots found.\n");
         }
     }
+    else if (strcmp(argv[1], "list") == 0) {
+        return run_list(argv[0], repo, argc - 2, argv + 2);
+    }
     else if (strcmp(argv[1], "rollback") == 0) {
         if (argc < 4) {
             printf("Usage: %s rollback <filename> <version>\n", argv[0]);
-            cleanup_repository(repo);
             return 1;
         }
         
+        // rollback -s <snapshot> rolls back every file of a snapshot at once
+        if (strcmp(argv[2], "-s") == 0) {
+            int restored = 0;
+            int id = rollback_snapshot(repo, atoi(argv[3]), &restored);
+            if (id > 0) {
+                printf("Rolled back to snapshot %s (%d files restored), recorded as snapshot %d\n", argv[3], restored, id);
+            } else {
+                printf("Failed to rollback to snapshot %s.\n", argv[3]);
+            }
+            return id <= 0;
+        }
+        
         int version = atoi(argv[3]);
         if (rollback_to_version(repo, argv[2], version) == 0) {
             printf("Rolled back '%s' to version %d\n", argv[2], version);
@@ -102,13 +514,140 @@ int main(int argc, char* argv[]) {
             printf("Failed to rollback file.\n");
         }
     }
+    else if (strcmp(argv[1], "gc") == 0) {
+        return run_gc(argv[0], repo, argc - 2, argv + 2);
+    }
+    else if (strcmp(argv[1], "pack") == 0) {
+        return run_pack(argv[0], repo, argc - 2, argv + 2);
+    }
+    else if (strcmp(argv[1], "fsck") == 0) {
+        return run_fsck(argv[0], repo, argc - 2, argv + 2);
+    }
+    else if (strcmp(argv[1], "watch") == 0) {
+        return run_watch(argv[0], repo, argc - 2, argv + 2);
+    }
+    else if (strcmp(argv[1], "push") == 0 || strcmp(argv[1], "pull") == 0) {
+        return run_sync(argv[0], argv[1], repo, argc - 2, argv + 2);
+    }
+    else if (strcmp(argv[1], "status") == 0) {
+        if (show_status(repo) != 0) {
+            printf("Failed to read the working tree status.\n");
+        }
+    }
+    else if (strcmp(argv[1], "diff") == 0) {
+        if (argc < 3) {
+            printf("Usage: %s diff <filename> [version] [version]\n", argv[0]);
+            return 1;
+        }
+        
+        // Without versions the latest one is compared with the working file
+        int from = (argc >= 4) ? atoi(argv[3]) : 0;
+        int to = (argc >= 5) ? atoi(argv[4]) : 0;
+        if (diff_file(repo, argv[2], from, to) != 0) {
+            printf("Failed to diff '%s'.\n", argv[2]);
+        }
+    }
+    else if (strcmp(argv[1], "export-meta") == 0 || strcmp(argv[1], "import-meta") == 0) {
+        // The text format defaults to the old versions.meta location
+        char default_path[MAX_PATH_LEN];
+        snprintf(default_path, sizeof(default_path), "%s/%s/%s", repo->base_path, VCS_DIR, METADATA_FILE);
+        const char* path = (argc >= 3) ? argv[2] : default_path;
+        
+        if (strcmp(argv[1], "export-meta") == 0) {
+            if (export_metadata_text(repo, path) == 0) {
+                printf("Exported metadata to %s\n", path);
+            } else {
+                printf("Failed to export metadata.\n");
+            }
+        } else {
+            // Importing replaces all metadata, so no check-in may run at the same time
+            int lock = lock_repository(repo->base_path, LOCK_FILE, 1);
+            if (lock >= 0 && import_metadata_text(repo, path) == 0) {
+                printf("Imported %d versions from %s\n", repo->total_versions, path);
+            } else {
+                printf("Failed to import metadata from %s\n", path);
+            }
+            unlock_repository(lock);
+        }
+    }
     else {
         printf("Unknown command: %s\n", argv[1]);
         print_help();
-        cleanup_repository(repo);
         return 1;
     }
     
-    cleanup_repository(repo);
+    
     return 0;
+}
+
+int main(int argc, char* argv[]) {
+    // The global option --stats[=json] comes before the command; the daemon receives it as VCS_STATS
+    int stats = (argc >= 2) ? stats_option(argv[1]) : 0;
+    if (stats) {
+        setenv("VCS_STATS", (stats == STATS_JSON) ? "json" : "1", 1);
+        argv[1] = argv[0];
+        argv++;
+        argc--;
+    }
+    
+    if (argc < 2) {
+        print_help();
+        return 1;
+    }
+    
+    // serve runs in the repository it is given, which need not be the current directory
+    if (strcmp(argv[1], "serve") == 0) {
+        return run_serve(argv[0], argc - 2, argv + 2);
+    }
+    
+    char current_dir[MAX_PATH_LEN];
+    getcwd(current_dir, sizeof(current_dir));
+    
+    Repository* repo = NULL;
+    
+    // Handle init command separately
+    if (strcmp(argv[1], "init") == 0) {
+        if (repository_exists(current_dir)) {
+            printf("Repository already exists in this directory.\n");
+            return 1;
+        }
+        
+        if (init_repository(current_dir) == 0) {
+            printf("Initialized empty repository in %s\n", current_dir);
+        } else {
+            printf("Failed to initialize repository.\n");
+            return 1;
+        }
+        return 0;
+    }
+    
+    // Check if repository exists for other commands
+    if (!repository_exists(current_dir)) {
+        printf("No repository found. Use 'init' to create one.\n");
+        return 1;
+    }
+    
+    if (strcmp(argv[1], "daemon") == 0) {
+        return run_daemon(current_dir, argc - 2, argv + 2, run_command);
+    }
+    
+    // A running daemon serves the command from its resident repository
+    // push and pull run here: they talk to another process for a long time, and ssh may have to ask for a password.
+    // watch runs until it is stopped and keeps its own copy of the repository loaded
+    int status;
+    int direct = strcmp(argv[1], "push") == 0 || strcmp(argv[1], "pull") == 0 || strcmp(argv[1], "watch") == 0;
+    if (!direct && daemon_request(argc, argv, &status) == 0) return status;
+    
+    // Statistics include loading the repository
+    stats_enable(stats_from_environment());
+    repo = load_repository(current_dir);
+    if (!repo) {
+        printf("Failed to load repository.\n");
+        return 1;
+    }
+    
+    status = run_command(repo, argc, argv);
+    cleanup_repository(repo);
+    stats_report(stderr);
+    return status;
 }
\ No newline at end of file
@@ -1,73 +1,1272 @@
 #include "vcs.h"
+#include <stdint.h>     // Provides fixed-width integer types for the on-disk layout
+#include <fcntl.h>      // Provides open() flags
+#include <sys/mman.h>   // Provides mmap() to map versions.bin into memory
+#include <zlib.h>       // Provides crc32() to detect torn journal entries
 
 /*
-The function save_metadata writes the repository's version metadata to versions.meta.
-Saves all file versions, their metadata, and repository statistics to disk for later retrieval.
+Version metadata is stored in the binary file .vcs/versions.bin, which is memory-mapped when the repository is loaded.
+Loading therefore costs the same no matter how long the history is; records are only turned into FileVersion
+structures (allocated from the repository's arena) when a command actually looks at them.
+
+Layout (all integers in host byte order):
+    MetaHeader                      - magic, format version, counts and section offsets
+    MetaFileEntry[file_count]       - one entry per tracked file, sorted by filename
+    MetaRecord[record_count]        - fixed-size version records, sorted by filename, then version number
+    string table                    - NUL-terminated filenames, hashes, object ids and comments
+Each file entry points at the contiguous run of its records, so lookups are two binary searches over the mapping.
+
+Versions added since versions.bin was written live in repo->version_list. save_metadata does not rewrite
+versions.bin: it appends the new versions to the journal .vcs/versions.journal and fsyncs it, so a checkin
+costs the same regardless of the history size. The journal is replayed on load. Once it holds
+config.journal_compact entries, compact_metadata folds it into a new versions.bin (written to .vcs/temp, then
+renamed into place) and removes it.
+
+Lookups go through an in-memory hash index from filename to a FileIndexEntry, created the first time a file is
+looked up or versioned. An entry remembers the file's run of records in the mapping and keeps the file's
+unpersisted versions in an array sorted by version number, so the latest version is known without scanning and
+an exact version is a binary search over that file only. The text format of versions.meta stays available
+through export_metadata_text and import_metadata_text; repositories that still only have versions.meta are
+imported automatically on first load.
+*/
+
+#define META_MAGIC "VCSMETA"            // 8 bytes including the terminator
+#define META_FORMAT_VERSION 1           // Bumped whenever the layout changes
+#define JOURNAL_MAGIC "VCSJRNL1"        // First 8 bytes of versions.journal
+
+/*
+Journal layout: JOURNAL_MAGIC followed by one entry per version:
+    u32 length, u32 crc32 of the record, record (a text metadata record as in versions.meta, without newline)
+An entry cut short by a crash fails its length or CRC check; replay stops there and the next append
+overwrites it.
+*/
+
+// Header at the start of versions.bin (64 bytes)
+typedef struct MetaHeader {
+    char magic[8];
+    uint32_t format_version;
+    uint32_t header_size;
+    uint32_t file_count;
+    uint32_t record_count;
+    int32_t total_versions;
+    uint32_t reserved;
+    uint64_t files_offset;
+    uint64_t records_offset;
+    uint64_t strings_offset;
+    uint64_t strings_size;
+} MetaHeader;
+
+// One entry per tracked file
+typedef struct MetaFileEntry {
+    uint32_t name_offset;       // Filename in the string table
+    uint32_t first_record;      // Index of the file's first (lowest version) record
+    uint32_t record_count;      // Number of records belonging to the file
+    int32_t latest_version;     // Highest version number of the file
+} MetaFileEntry;
+
+// One fixed-size record per version (48 bytes)
+typedef struct MetaRecord {
+    int64_t timestamp;
+    int64_t file_size;
+    int64_t mtime;
+    uint32_t file_index;        // Index of the owning MetaFileEntry
+    int32_t version_number;
+    int32_t mtime_nsec;
+    uint32_t hash_offset;       // Strings are referenced by offset into the string table (0 is the empty string)
+    uint32_t object_offset;
+    uint32_t comment_offset;
+} MetaRecord;
+
+// In-memory view of a mapped versions.bin
+struct MetadataMap {
+    void* base;                     // Start of the mapping
+    size_t size;                    // Length of the mapping
+    const MetaHeader* header;
+    const MetaFileEntry* files;
+    const MetaRecord* records;
+    const char* strings;
+    dev_t device;                   // Identity of the mapped file; a compaction by another process replaces it
+    ino_t inode;
+};
+
+// Per-file entry of the in-memory lookup index
+typedef struct FileIndexEntry {
+    const char* filename;               // Interned filename (in the arena)
+    uint32_t hash;                      // Hash of filename, kept to skip string compares and for rehashing
+    const MetaFileEntry* persisted;     // The file's entry in the mapped metadata, NULL if it has none
+    FileVersion** materialized;         // FileVersion built for each of the file's records so far (allocated on first use)
+    FileVersion** pending;              // Versions not in versions.bin, sorted by version number
+    int pending_count;
+    int pending_cap;
+    struct FileIndexEntry* next;        // Next entry in the same bucket
+} FileIndexEntry;
+
+// Hash table from filename to FileIndexEntry
+struct FileIndex {
+    FileIndexEntry** buckets;
+    size_t bucket_count;                // Always a power of two
+    size_t count;
+};
+
+static void file_index_free(Repository* repo);
+
+/*
+The function metadata_file_path builds the path of a file inside the repository's .vcs directory.
+*/
+static void metadata_file_path(const Repository* repo, const char* name, char* path, size_t size) {
+    snprintf(path, size, "%s/%s/%s", repo->base_path, VCS_DIR, name);
+}
+
+/*
+The function meta_string returns a string from the mapped string table ("" for offsets outside the table).
+*/
+static const char* meta_string(const struct MetadataMap* map, uint32_t offset) {
+    if (offset >= map->header->strings_size) return "";
+    return map->strings + offset;
+}
+
+/*
+The function map_metadata memory-maps versions.bin and validates its header.
+Returns 0 on success, 1 if versions.bin does not exist, -1 if it is unreadable or corrupt.
+It takes Repository* repo (receives the mapping in repo->metadata_map and the total version count).
+*/
+static int map_metadata(Repository* repo) {
+    char path[MAX_PATH_LEN];
+    metadata_file_path(repo, METADATA_BIN_FILE, path, sizeof(path));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return (errno == ENOENT) ? 1 : -1;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(MetaHeader)) {
+        close(fd);
+        return -1;
+    }
+
+    void* base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);  // The mapping stays valid after the descriptor is closed
+    if (base == MAP_FAILED) return -1;
+
+    // Check that the header is ours and every section lies inside the file
+    const MetaHeader* header = base;
+    size_t size = (size_t)st.st_size;
+    int valid = memcmp(header->magic, META_MAGIC, sizeof(header->magic)) == 0 &&
+                header->format_version == META_FORMAT_VERSION &&
+                header->files_offset + (uint64_t)header->file_count * sizeof(MetaFileEntry) <= size &&
+                header->records_offset + (uint64_t)header->record_count * sizeof(MetaRecord) <= size &&
+                header->strings_offset + header->strings_size <= size &&
+                header->strings_size > 0;
+    if (!valid) {
+        munmap(base, size);
+        fprintf(stderr, "Corrupt metadata file: %s\n", path);
+        return -1;
+    }
+
+    struct MetadataMap* map = calloc(1, sizeof(struct MetadataMap));
+    if (!map) {
+        munmap(base, size);
+        return -1;
+    }
+    map->base = base;
+    map->size = size;
+    map->header = header;
+    map->files = (const MetaFileEntry*)((const char*)base + header->files_offset);
+    map->records = (const MetaRecord*)((const char*)base + header->records_offset);
+    map->strings = (const char*)base + header->strings_offset;
+    map->device = st.st_dev;
+    map->inode = st.st_ino;
+
+    repo->metadata_map = map;
+    repo->metadata_generation++;
+    repo->total_versions = header->total_versions;
+    return 0;
+}
+
+/*
+The function close_metadata unmaps versions.bin and drops the lookup index. FileVersion structures already
+handed out stay valid (they live in the repository's arena) until cleanup_repository.
+It takes Repository* repo.
+*/
+void close_metadata(Repository* repo) {
+    if (!repo) return;
+    file_index_free(repo);     // Its entries point into the mapping
+    if (!repo->metadata_map) return;
+    struct MetadataMap* map = repo->metadata_map;
+    munmap(map->base, map->size);
+    free(map);
+    repo->metadata_map = NULL;
+}
+
+/*
+The function materialize_record builds (once) the FileVersion for a record of the mapped metadata.
+Returns the FileVersion, or NULL if memory allocation fails.
+It takes Repository* repo, FileIndexEntry* entry (the record's file, with persisted set) and uint32_t index
+(record index in the mapping).
+The cache of built versions belongs to the file's index entry, so memory grows with the histories a command
+touches, not with the whole repository.
+*/
+static FileVersion* materialize_record(Repository* repo, FileIndexEntry* entry, uint32_t index) {
+    struct MetadataMap* map = repo->metadata_map;
+    uint32_t slot = index - entry->persisted->first_record;
+    if (!entry->materialized) {
+        entry->materialized = calloc(entry->persisted->record_count, sizeof(FileVersion*));
+        if (!entry->materialized) return NULL;
+    }
+    if (entry->materialized[slot]) return entry->materialized[slot];
+    const char* filename = entry->filename;
+
+    // Everything is copied into the arena so the structure outlives remapping
+    const MetaRecord* record = &map->records[index];
+    FileVersion* version = arena_alloc(&repo->arena, sizeof(FileVersion));
+    if (!version) return NULL;
+    version->filename = filename;
+    version->comment = arena_strndup(&repo->arena, meta_string(map, record->comment_offset), MAX_COMMENT_LEN - 1);
+    if (!version->comment) return NULL;
+    const char* hash = meta_string(map, record->hash_offset);
+    if (hash_from_hex(hash, version->hash) == 0) {
+        version->flags |= VERSION_HAS_HASH;
+    } else if (hash[0] != '\0') {
+        version->legacy_hash = arena_strndup(&repo->arena, hash, MAX_HASH_LEN - 1);
+    }
+    if (hash_from_hex(meta_string(map, record->object_offset), version->object_id) == 0) version->flags |= VERSION_HAS_OBJECT;
+    version->version_number = record->version_number;
+    version->timestamp = (time_t)record->timestamp;
+    version->file_size = (long)record->file_size;
+    version->mtime = (time_t)record->mtime;
+    version->mtime_nsec = record->mtime_nsec;
+
+    entry->materialized[slot] = version;
+    return version;
+}
+
+/*
+The function find_file_entry looks up a file in the mapped file table by binary search.
+Returns the entry, or NULL if the file has no persisted versions.
+*/
+static const MetaFileEntry* find_file_entry(const struct MetadataMap* map, const char* filename) {
+    if (!map) return NULL;
+    uint32_t low = 0, high = map->header->file_count;
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        int cmp = strcmp(meta_string(map, map->files[mid].name_offset), filename);
+        if (cmp == 0) return &map->files[mid];
+        if (cmp < 0) low = mid + 1;
+        else high = mid;
+    }
+    return NULL;
+}
+
+/*
+The function filename_hash computes the FNV-1a hash of a filename for the lookup index.
+*/
+static uint32_t filename_hash(const char* filename) {
+    uint32_t hash = 2166136261u;
+    for (const unsigned char* p = (const unsigned char*)filename; *p; p++) {
+        hash = (hash ^ *p) * 16777619u;
+    }
+    return hash;
+}
+
+/*
+The function file_index_free releases the lookup index. It is rebuilt on demand by later lookups.
+It takes Repository* repo.
+*/
+static void file_index_free(Repository* repo) {
+    struct FileIndex* index = repo->file_index;
+    if (!index) return;
+    for (size_t i = 0; i < index->bucket_count; i++) {
+        FileIndexEntry* entry = index->buckets[i];
+        while (entry) {
+            FileIndexEntry* next = entry->next;
+            free(entry->pending);     // The entry and its filename live in the arena
+            free(entry->materialized);
+            entry = next;
+        }
+    }
+    free(index->buckets);
+    free(index);
+    repo->file_index = NULL;
+}
+
+/*
+The function file_index_grow doubles the number of buckets of the lookup index.
+Returns 0 on success, -1 if the allocation fails (the index stays usable, only slower).
+*/
+static int file_index_grow(struct FileIndex* index) {
+    size_t bucket_count = index->bucket_count * 2;
+    FileIndexEntry** buckets = calloc(bucket_count, sizeof(FileIndexEntry*));
+    if (!buckets) return -1;
+    for (size_t i = 0; i < index->bucket_count; i++) {
+        FileIndexEntry* entry = index->buckets[i];
+        while (entry) {
+            FileIndexEntry* next = entry->next;
+            size_t slot = entry->hash & (bucket_count - 1);
+            entry->next = buckets[slot];
+            buckets[slot] = entry;
+            entry = next;
+        }
+    }
+    free(index->buckets);
+    index->buckets = buckets;
+    index->bucket_count = bucket_count;
+    return 0;
+}
+
+/*
+The function file_index_lookup returns the lookup index entry of a file.
+A file seen for the first time is looked up once in the mapped file table and then cached.
+Returns the entry, or NULL if the file has no versions (and create is 0) or memory allocation fails.
+It takes Repository* repo, const char* filename and int create (1 to create an entry for a new file).
+*/
+static FileIndexEntry* file_index_lookup(Repository* repo, const char* filename, int create) {
+    struct FileIndex* index = repo->file_index;
+    if (!index) {
+        index = calloc(1, sizeof(struct FileIndex));
+        if (!index) return NULL;
+        index->bucket_count = 64;
+        index->buckets = calloc(index->bucket_count, sizeof(FileIndexEntry*));
+        if (!index->buckets) {
+            free(index);
+            return NULL;
+        }
+        repo->file_index = index;
+    }
+
+    uint32_t hash = filename_hash(filename);
+    for (FileIndexEntry* entry = index->buckets[hash & (index->bucket_count - 1)]; entry; entry = entry->next) {
+        if (entry->hash == hash && strcmp(entry->filename, filename) == 0) return entry;
+    }
+
+    // Not cached yet: files with persisted versions get an entry, unknown files only when asked to
+    const MetaFileEntry* persisted = find_file_entry(repo->metadata_map, filename);
+    if (!persisted && !create) return NULL;
+
+    // The entry's copy of the filename is the interned name shared by the file's FileVersions
+    FileIndexEntry* entry = arena_alloc(&repo->arena, sizeof(FileIndexEntry));
+    if (!entry) return NULL;
+    entry->filename = arena_strndup(&repo->arena, filename, MAX_FILENAME_LEN - 1);
+    if (!entry->filename) return NULL;
+    entry->hash = hash;
+    entry->persisted = persisted;
+
+    if (index->count >= index->bucket_count) file_index_grow(index);
+    size_t slot = hash & (index->bucket_count - 1);
+    entry->next = index->buckets[slot];
+    index->buckets[slot] = entry;
+    index->count++;
+    return entry;
+}
+
+/*
+The function add_file_version adds a version that is not in versions.bin yet to the repository.
+Links it into repo->version_list and the lookup index; save_metadata persists it.
+Returns 0 on success, -1 if memory allocation fails (the version is not added in that case).
+It takes Repository* repo and FileVersion* version (allocated by the caller, owned by the repository afterwards).
+*/
+int add_file_version(Repository* repo, FileVersion* version) {
+    if (!repo || !version) return -1;
+
+    FileIndexEntry* entry = file_index_lookup(repo, version->filename, 1);
+    if (!entry) return -1;
+    if (entry->pending_count == entry->pending_cap) {
+        int cap = entry->pending_cap ? entry->pending_cap * 2 : 4;
+        FileVersion** pending = realloc(entry->pending, cap * sizeof(FileVersion*));
+        if (!pending) return -1;
+        entry->pending = pending;
+        entry->pending_cap = cap;
+    }
+
+    // Versions nearly always arrive in increasing order, so this is an append
+    int i = entry->pending_count++;
+    while (i > 0 && entry->pending[i - 1]->version_number > version->version_number) {
+        entry->pending[i] = entry->pending[i - 1];
+        i--;
+    }
+    entry->pending[i] = version;
+
+    version->next = repo->version_list;
+    repo->version_list = version;
+    return 0;
+}
+
+/*
+The function new_file_version allocates an empty FileVersion in the repository's arena.
+The filename is interned and the comment copied (both truncated to the limits of the metadata format).
+Returns the FileVersion, or NULL if memory allocation fails.
+It takes Repository* repo, const char* filename and const char* comment.
+*/
+FileVersion* new_file_version(Repository* repo, const char* filename, const char* comment) {
+    if (!repo || !filename) return NULL;
+
+    char name[MAX_FILENAME_LEN];
+    snprintf(name, sizeof(name), "%s", filename);
+    FileIndexEntry* entry = file_index_lookup(repo, name, 1);
+    FileVersion* version = entry ? arena_alloc(&repo->arena, sizeof(FileVersion)) : NULL;
+    if (!version) return NULL;
+
+    version->filename = entry->filename;
+    version->comment = arena_strndup(&repo->arena, comment, MAX_COMMENT_LEN - 1);
+    return version->comment ? version : NULL;
+}
+
+/*
+The function version_hash_string writes the hash of a version as text: the hex SHA-256, the hash string of a
+version from an older repository, or "" if the version has no hash.
+It takes const FileVersion* version and char* out (output buffer of MAX_HASH_LEN bytes).
+*/
+void version_hash_string(const FileVersion* version, char* out) {
+    if (version->flags & VERSION_HAS_HASH) {
+        hash_to_hex(version->hash, out);
+    } else {
+        snprintf(out, MAX_HASH_LEN, "%s", version->legacy_hash ? version->legacy_hash : "");
+    }
+}
+
+/*
+The function format_version_record writes one version as a text metadata record (without the trailing newline).
+Returns the length of the record, which is truncated if it does not fit into size bytes.
+It takes const FileVersion* version, char* buffer and size_t size.
+*/
+int format_version_record(const FileVersion* version, char* buffer, size_t size) {
+    char hash[MAX_HASH_LEN];
+    char object_id[MAX_HASH_LEN];
+    version_hash_string(version, hash);
+    
+    // Format: FILE=name|VERSION=num|TIMESTAMP=time|SIZE=bytes|MTIME=sec.nsec|HASH=sha256|OBJECT=id|COMMENT=text
+    // The OBJECT field is omitted for versions stored as .vcs/versions/filename/vN
+    int len = snprintf(buffer, size, "FILE=%s|VERSION=%d|TIMESTAMP=%ld|SIZE=%ld|MTIME=%ld.%09ld|HASH=%s|",
+                       version->filename,          // Name of the versioned file
+                       version->version_number,    // Version number (1, 2, 3, etc.)
+                       (long)version->timestamp,   // Unix timestamp when version was created
+                       version->file_size,         // File size in bytes
+                       (long)version->mtime,       // Modification time of the file when it was checked in
+                       version->mtime_nsec,
+                       hash);                      // SHA-256 of the contents, checked by fsck
+    if ((version->flags & VERSION_HAS_OBJECT) && (size_t)len < size) {
+        hash_to_hex(version->object_id, object_id);
+        len += snprintf(buffer + len, size - len, "OBJECT=%s|", object_id);     // Id of the stored content in .vcs/objects
+    }
+    if ((size_t)len < size) {
+        len += snprintf(buffer + len, size - len, "COMMENT=%s", version->comment);     // User comment describing the changes
+    }
+    return ((size_t)len < size) ? len : (int)size - 1;
+}
+
+/*
+The function parse_version_record parses the fields of one text metadata record (the part after "FILE=").
+Returns a FileVersion allocated in the repository's arena, or NULL if memory allocation fails.
+It takes Repository* repo and char* record (modified while splitting the fields).
+*/
+FileVersion* parse_version_record(Repository* repo, char* record) {
+    // The fields are collected first; the strings point into record until they are copied into the arena
+    FileVersion fields;
+    memset(&fields, 0, sizeof(fields));
+    FileVersion* version = &fields;
+    const char* filename = "";
+    const char* comment = "";
+    
+    // Parse filename field (first token after FILE=)
+    char* token = strtok(record, "|");      // Split the fields by |
+    if (token) filename = token;
+    
+    // Parse version number field
+    token = strtok(NULL, "|");      // Get next token
+    if (token && strncmp(token, "VERSION=", 8) == 0) {
+        version->version_number = atoi(token + 8);  // Skip "VERSION=" and convert
+    }
+    
+    // Parse timestamp field
+    token = strtok(NULL, "|");
+    if (token && strncmp(token, "TIMESTAMP=", 10) == 0) {
+        version->timestamp = atol(token + 10);      // Skip "TIMESTAMP=" and convert to long
+    }
+    
+    // Parse file size field
+    token = strtok(NULL, "|");
+    if (token && strncmp(token, "SIZE=", 5) == 0) {
+        version->file_size = atol(token + 5);       // Skip "SIZE=" and convert to long
+    }
+    
+    // Parse the optional modification time field (sec.nsec, absent in older records)
+    token = strtok(NULL, "|");
+    if (token && strncmp(token, "MTIME=", 6) == 0) {
+        char* fraction = NULL;
+        version->mtime = strtol(token + 6, &fraction, 10);
+        if (fraction && *fraction == '.') version->mtime_nsec = strtol(fraction + 1, NULL, 10);
+        token = strtok(NULL, "|");
+    }
+    
+    // Parse hash field
+    // Hashes that are not SHA-256 (written by older versions) are kept as text
+    const char* legacy_hash = NULL;
+    if (token && strncmp(token, "HASH=", 5) == 0) {
+        if (hash_from_hex(token + 5, version->hash) == 0) version->flags |= VERSION_HAS_HASH;
+        else if (token[5] != '\0') legacy_hash = token + 5;
+    }
+    
+    // Parse the optional object id field (absent in records written before the object store)
+    token = strtok(NULL, "|");
+    if (token && strncmp(token, "OBJECT=", 7) == 0) {
+        if (hash_from_hex(token + 7, version->object_id) == 0) version->flags |= VERSION_HAS_OBJECT;
+        token = strtok(NULL, "|");
+    }
+    
+    // Parse comment field (last field, may contain the line's newline)
+    if (token && strncmp(token, "COMMENT=", 8) == 0) {
+        // Remove trailing newline character if present
+        char* newline = strchr(token + 8, '\n');
+        if (newline) *newline = '\0';
+        comment = token + 8;
+    }
+    
+    // Allocate the version in the arena and copy the parsed fields over
+    FileVersion* parsed = new_file_version(repo, filename, comment);
+    if (!parsed) return NULL;
+    fields.filename = parsed->filename;
+    fields.comment = parsed->comment;
+    if (legacy_hash) {
+        fields.legacy_hash = arena_strndup(&repo->arena, legacy_hash, MAX_HASH_LEN - 1);
+        if (!fields.legacy_hash) return NULL;
+    }
+    *parsed = fields;
+    return parsed;
+}
+
+// Flattened view of one version used while writing versions.bin
+typedef struct SaveEntry {
+    const char* filename;
+    const char* comment;
+    char hash[MAX_HASH_LEN];
+    char object_id[MAX_HASH_LEN];
+    int version_number;
+    int64_t timestamp;
+    int64_t file_size;
+    int64_t mtime;
+    int32_t mtime_nsec;
+} SaveEntry;
+
+/*
+The function compare_save_entries orders entries by filename, then version number (qsort callback).
+*/
+static int compare_save_entries(const void* a, const void* b) {
+    const SaveEntry* x = a;
+    const SaveEntry* y = b;
+    int cmp = strcmp(x->filename, y->filename);
+    if (cmp != 0) return cmp;
+    return (x->version_number > y->version_number) - (x->version_number < y->version_number);
+}
+
+// Growable string table used while writing versions.bin
+typedef struct StringTable {
+    char* data;
+    size_t len;
+    size_t cap;
+} StringTable;
+
+/*
+The function string_table_add appends a string and returns its offset (0 for the empty string).
+Returns UINT32_MAX if the allocation fails.
+*/
+static uint32_t string_table_add(StringTable* table, const char* str) {
+    if (!str || str[0] == '\0') return 0;
+    size_t len = strlen(str) + 1;
+    if (table->len + len > table->cap) {
+        size_t cap = table->cap ? table->cap : 4096;
+        while (cap < table->len + len) cap *= 2;
+        char* data = realloc(table->data, cap);
+        if (!data) return UINT32_MAX;
+        table->data = data;
+        table->cap = cap;
+    }
+    uint32_t offset = (uint32_t)table->len;
+    memcpy(table->data + table->len, str, len);
+    table->len += len;
+    return offset;
+}
+
+// write() calls made and bytes written by write_all (for the statistics; the metadata is written from one thread)
+static long long metadata_writes;
+static long long metadata_written;
+
+/*
+The function write_all writes a whole buffer to a file descriptor, retrying on short writes.
+Returns 0 on success, -1 on failure.
+*/
+static int write_all(int fd, const void* data, size_t len) {
+    const char* p = data;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        metadata_writes++;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        metadata_written += n;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+/*
+The function sync_directory flushes the .vcs directory itself, making renames and new files in it durable.
+*/
+static void sync_directory(const Repository* repo) {
+    char path[MAX_PATH_LEN];
+    snprintf(path, sizeof(path), "%s/%s", repo->base_path, VCS_DIR);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return;
+    fsync(fd);
+    close(fd);
+}
+
+/*
+The function fill_save_entry copies a FileVersion into the flattened form written to versions.bin.
+*/
+static void fill_save_entry(SaveEntry* e, const FileVersion* v) {
+    e->filename = v->filename;
+    e->object_id[0] = '\0';
+    version_hash_string(v, e->hash);
+    if (v->flags & VERSION_HAS_OBJECT) hash_to_hex(v->object_id, e->object_id);
+    e->comment = v->comment;
+    e->version_number = v->version_number;
+    e->timestamp = v->timestamp;
+    e->file_size = v->file_size;
+    e->mtime = v->mtime;
+    e->mtime_nsec = (int32_t)v->mtime_nsec;
+}
+
+static int write_metadata(Repository* repo, SaveEntry* entries, size_t count);
+
+/*
+The function compact_metadata writes all persisted, journaled and newly added versions to a new versions.bin
+and removes the journal. The file is written to .vcs/temp, flushed to disk and renamed over the old one, so a
+crash leaves either the old or the new metadata intact (journal entries that are already in versions.bin are
+skipped on replay). Returns 0 on success, -1 on failure (file write errors).
+It takes Repository* repo (the VCS repository to compact the metadata of).
+*/
+int compact_metadata(Repository* repo) {
+    // Validate input parameter
+    if (!repo) return -1;
+
+    struct MetadataMap* map = repo->metadata_map;
+    size_t persisted = map ? map->header->record_count : 0;
+    size_t pending = 0;
+    for (FileVersion* v = repo->version_list; v; v = v->next) pending++;
+
+    SaveEntry* entries = malloc((persisted + pending + 1) * sizeof(SaveEntry));
+    if (!entries) return -1;
+
+    // Gather the mapped records (their strings point into the mapping) and the pending versions
+    size_t count = 0;
+    for (size_t i = 0; i < persisted; i++) {
+        const MetaRecord* r = &map->records[i];
+        SaveEntry* e = &entries[count++];
+        e->filename = (r->file_index < map->header->file_count) ? meta_string(map, map->files[r->file_index].name_offset) : "";
+        snprintf(e->hash, sizeof(e->hash), "%s", meta_string(map, r->hash_offset));
+        snprintf(e->object_id, sizeof(e->object_id), "%s", meta_string(map, r->object_offset));
+        e->comment = meta_string(map, r->comment_offset);
+        e->version_number = r->version_number;
+        e->timestamp = r->timestamp;
+        e->file_size = r->file_size;
+        e->mtime = r->mtime;
+        e->mtime_nsec = r->mtime_nsec;
+    }
+    for (FileVersion* v = repo->version_list; v; v = v->next) {
+        fill_save_entry(&entries[count++], v);
+    }
+
+    int status = write_metadata(repo, entries, count);
+    free(entries);
+    return status;
+}
+
+/*
+The function rewrite_metadata replaces the repository's metadata with exactly the given versions, in one pass:
+everything else (including the journal) is dropped. Used by gc to expire versions.
+Returns 0 on success, -1 on failure (the old metadata is left in place).
+It takes Repository* repo and FileVersion** versions / int count (versions of this repository, in any order).
+Call it with the exclusive metadata lock held and the metadata refreshed.
+*/
+int rewrite_metadata(Repository* repo, FileVersion** versions, int count) {
+    if (!repo || count < 0) return -1;
+
+    SaveEntry* entries = malloc(((size_t)count + 1) * sizeof(SaveEntry));
+    if (!entries) return -1;
+    for (int i = 0; i < count; i++) {
+        fill_save_entry(&entries[i], versions[i]);
+    }
+
+    // The strings of materialized versions live in the arena, so they survive the remapping
+    int total = repo->total_versions;
+    repo->total_versions = count;
+    int status = write_metadata(repo, entries, (size_t)count);
+    if (status != 0) repo->total_versions = total;
+    free(entries);
+    return status;
+}
+
+/*
+The function write_metadata writes entries as a new versions.bin (see compact_metadata) and maps it.
+Returns 0 on success, -1 on failure.
+It takes Repository* repo and SaveEntry* entries / size_t count (sorted here).
+*/
+static int write_metadata(Repository* repo, SaveEntry* entries, size_t count) {
+    qsort(entries, count, sizeof(SaveEntry), compare_save_entries);
+
+    MetaFileEntry* files = malloc((count + 1) * sizeof(MetaFileEntry));
+    MetaRecord* records = malloc((count + 1) * sizeof(MetaRecord));
+    StringTable strings = {calloc(1, 4096), 1, 4096};   // Offset 0 holds the empty string
+    int status = (files && records && strings.data) ? 0 : -1;
+
+    // Build the file table and records; equal filenames are adjacent after sorting and share one string
+    uint32_t file_count = 0;
+    for (size_t i = 0; status == 0 && i < count; i++) {
+        SaveEntry* e = &entries[i];
+        if (file_count == 0 || strcmp(e->filename, entries[i - 1].filename) != 0) {
+            MetaFileEntry* f = &files[file_count++];
+            f->name_offset = string_table_add(&strings, e->filename);
+            f->first_record = (uint32_t)i;
+            f->record_count = 0;
+            f->latest_version = 0;
+        }
+        MetaFileEntry* f = &files[file_count - 1];
+        f->record_count++;
+        if (e->version_number > f->latest_version) f->latest_version = e->version_number;
+
+        MetaRecord* r = &records[i];
+        memset(r, 0, sizeof(*r));
+        r->timestamp = e->timestamp;
+        r->file_size = e->file_size;
+        r->mtime = e->mtime;
+        r->file_index = file_count - 1;
+        r->version_number = e->version_number;
+        r->mtime_nsec = e->mtime_nsec;
+        r->hash_offset = string_table_add(&strings, e->hash);
+        // The object id is normally the content hash, so reuse its string
+        r->object_offset = (strcmp(e->object_id, e->hash) == 0) ? r->hash_offset : string_table_add(&strings, e->object_id);
+        r->comment_offset = string_table_add(&strings, e->comment);
+        if (f->name_offset == UINT32_MAX || r->hash_offset == UINT32_MAX ||
+            r->object_offset == UINT32_MAX || r->comment_offset == UINT32_MAX) {
+            status = -1;
+        }
+    }
+
+    MetaHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, META_MAGIC, sizeof(header.magic));
+    header.format_version = META_FORMAT_VERSION;
+    header.header_size = sizeof(MetaHeader);
+    header.file_count = file_count;
+    header.record_count = (uint32_t)count;
+    header.total_versions = repo->total_versions;
+    header.files_offset = sizeof(MetaHeader);
+    header.records_offset = header.files_offset + (uint64_t)file_count * sizeof(MetaFileEntry);
+    header.strings_offset = header.records_offset + (uint64_t)count * sizeof(MetaRecord);
+    header.strings_size = strings.len;
+
+    // Write everything to a temporary file first
+    char temp_path[MAX_PATH_LEN];
+    char final_path[MAX_PATH_LEN];
+    snprintf(temp_path, sizeof(temp_path), "%s/%s/temp", repo->base_path, VCS_DIR);
+    create_directory(temp_path);    // Repositories created by older versions may lack .vcs/temp
+    snprintf(temp_path, sizeof(temp_path), "%s/%s/temp/versions.XXXXXX", repo->base_path, VCS_DIR);
+    metadata_file_path(repo, METADATA_BIN_FILE, final_path, sizeof(final_path));
+
+    int fd = (status == 0) ? mkstemp(temp_path) : -1;
+    if (fd < 0) {
+        status = -1;
+    } else {
+        if (write_all(fd, &header, sizeof(header)) != 0 ||
+            write_all(fd, files, file_count * sizeof(MetaFileEntry)) != 0 ||
+            write_all(fd, records, count * sizeof(MetaRecord)) != 0 ||
+            write_all(fd, strings.data, strings.len) != 0 ||
+            fsync(fd) != 0) {
+            status = -1;
+        }
+        if (close(fd) != 0) status = -1;
+        if (status == 0 && rename(temp_path, final_path) != 0) status = -1;
+        if (status != 0) unlink(temp_path);
+    }
+    
+    // versions.bin now contains everything the journal held
+    if (status == 0) {
+        char journal_path[MAX_PATH_LEN];
+        metadata_file_path(repo, JOURNAL_FILE, journal_path, sizeof(journal_path));
+        if (unlink(journal_path) != 0 && errno != ENOENT) status = -1;
+        sync_directory(repo);
+        repo->journal_head = NULL;
+        repo->journal_entries = 0;
+        repo->journal_size = 0;
+    }
+
+    free(files);
+    free(records);
+    free(strings.data);
+    if (status != 0) return -1;
+
+    // The pending versions are now persisted (they stay allocated in the arena): map the new file
+    repo->version_list = NULL;
+    close_metadata(repo);
+    int total = repo->total_versions;
+    status = map_metadata(repo);
+    repo->total_versions = total;
+    return (status == 0) ? 0 : -1;
+}
+
+/*
+The function replay_journal loads the versions recorded in versions.journal into repo->version_list.
+Entries before repo->journal_size are already loaded and skipped, so it also picks up entries appended by
+other processes. Stops at the first incomplete or corrupt entry (left behind by a crash during an append).
+Returns 0 on success (including when there is no journal), -1 on read errors.
+It takes Repository* repo.
+*/
+static int replay_journal(Repository* repo) {
+    char path[MAX_PATH_LEN];
+    metadata_file_path(repo, JOURNAL_FILE, path, sizeof(path));
+
+    if (!file_exists(path)) return 0;
+    unsigned char* bytes = NULL;
+    size_t size = 0;
+    if (read_file_contents(path, &bytes, &size) != 0) return -1;
+    const char* data = (const char*)bytes;
+
+    size_t magic_len = strlen(JOURNAL_MAGIC);
+    size_t pos = magic_len;
+    if (size < magic_len || memcmp(data, JOURNAL_MAGIC, magic_len) != 0) {
+        // Not a journal written by us (or cut short before the magic): start a new one
+        free(bytes);
+        repo->journal_size = 0;
+        return 0;
+    }
+    if (repo->journal_size > (long)magic_len && (size_t)repo->journal_size <= size) pos = (size_t)repo->journal_size;
+
+    while (pos + 8 <= size) {
+        uint32_t len, crc;
+        memcpy(&len, data + pos, sizeof(len));
+        memcpy(&crc, data + pos + 4, sizeof(crc));
+        if (len >= METADATA_LINE_MAX || len > size - pos - 8 ||
+            crc32(0L, (const Bytef*)data + pos + 8, len) != crc) {
+            break;  // Torn or corrupt entry: everything from here on is discarded
+        }
+
+        char record[METADATA_LINE_MAX];
+        memcpy(record, data + pos + 8, len);
+        record[len] = '\0';
+        pos += 8 + len;
+
+        if (strncmp(record, "FILE=", 5) != 0) continue;
+        FileVersion* version = parse_version_record(repo, record + 5);
+        if (!version) continue;
+
+        // A crash between writing versions.bin and removing the journal leaves entries that are already persisted
+        const MetaFileEntry* entry = find_file_entry(repo->metadata_map, version->filename);
+        if (entry && version->version_number <= entry->latest_version) continue;
+        if (add_file_version(repo, version) != 0) continue;
+        repo->total_versions++;
+        repo->journal_entries++;
+    }
+    free(bytes);
+
+    repo->journal_head = repo->version_list;   // Everything loaded so far is already in the journal
+    repo->journal_size = (long)pos;
+    return 0;
+}
+
+/*
+The function append_journal does the work of save_metadata.
+*/
+static int append_journal(Repository* repo) {
+    // New versions are at the head of version_list, up to the first one already journaled
+    int count = 0;
+    for (FileVersion* v = repo->version_list; v && v != repo->journal_head; v = v->next) count++;
+    if (count == 0) return 0;
+
+    if (repo->config.journal_compact <= 0 || repo->journal_entries + count > repo->config.journal_compact) {
+        return compact_metadata(repo);
+    }
+
+    FileVersion** versions = malloc(count * sizeof(FileVersion*));
+    char* buffer = malloc((size_t)count * (METADATA_LINE_MAX + 8) + strlen(JOURNAL_MAGIC));
+    if (!versions || !buffer) {
+        free(versions);
+        free(buffer);
+        return -1;
+    }
+
+    // Encode the entries oldest first, so replay sees them in checkin order
+    int n = count;
+    for (FileVersion* v = repo->version_list; n > 0; v = v->next) versions[--n] = v;
+
+    size_t len = 0;
+    if (repo->journal_size == 0) {
+        memcpy(buffer, JOURNAL_MAGIC, strlen(JOURNAL_MAGIC));
+        len = strlen(JOURNAL_MAGIC);
+    }
+    for (int i = 0; i < count; i++) {
+        uint32_t record_len = (uint32_t)format_version_record(versions[i], buffer + len + 8, METADATA_LINE_MAX);
+        uint32_t crc = (uint32_t)crc32(0L, (const Bytef*)buffer + len + 8, record_len);
+        memcpy(buffer + len, &record_len, sizeof(record_len));
+        memcpy(buffer + len + 4, &crc, sizeof(crc));
+        len += 8 + record_len;
+    }
+    free(versions);
+
+    char path[MAX_PATH_LEN];
+    metadata_file_path(repo, JOURNAL_FILE, path, sizeof(path));
+    int fd = open(path, O_WRONLY | O_CREAT, 0644);
+    int status = (fd >= 0) ? 0 : -1;
+    // Write after the last intact entry, which also drops a torn tail left by a crash
+    if (status == 0 && (ftruncate(fd, repo->journal_size) != 0 ||
+                        lseek(fd, repo->journal_size, SEEK_SET) < 0 ||
+                        write_all(fd, buffer, len) != 0 || fsync(fd) != 0)) {
+        status = -1;
+    }
+    if (fd >= 0 && close(fd) != 0) status = -1;
+    free(buffer);
+    if (status != 0) return -1;
+
+    if (repo->journal_size == 0) sync_directory(repo);     // Make the new journal file itself durable
+    repo->journal_head = repo->version_list;
+    repo->journal_entries += count;
+    repo->journal_size += (long)len;
+    return 0;
+}
+
+/*
+The function save_metadata makes the versions added since the last save durable.
+Appends them to versions.journal in one write followed by fsync, or compacts the metadata into versions.bin
+once the journal has grown past config.journal_compact entries.
 Returns 0 on success, -1 on failure (file write errors).
 It takes Repository* repo (the VCS repository to save metadata for).
-Creates a human-readable metadata file for easy parsing. This ensures persistence across program runs.
 */
 int save_metadata(Repository* repo) {
     // Validate input parameter
     if (!repo) return -1;
-    
-    // Construct the full path to the metadata file within the VCS directory
-    char metadata_path[MAX_PATH_LEN];   // Array to store the path to versions.meta
-    snprintf(metadata_path, sizeof(metadata_path), "%s/%s/%s", 
-             repo->base_path, VCS_DIR, METADATA_FILE);
-    
+
+    long long started = stats_clock();
+    long long writes = metadata_writes, written = metadata_written;
+    int status = append_journal(repo);
+    stats_add(STAT_SAVE_METADATA, started, 0, metadata_written - written, metadata_writes - writes);
+    return status;
+}
+
+/*
+The function load_metadata opens the repository's metadata.
+Maps versions.bin if present; a repository that only has the older versions.meta text file is imported into
+versions.bin first. Returns 0 on success (including when no metadata exists yet), -1 on failure.
+It takes Repository* repo (the VCS repository to load metadata into).
+*/
+int load_metadata(Repository* repo) {
+    // Validate input parameter
+    if (!repo) return -1;
+
+    long long started = stats_clock();
+    int status = map_metadata(repo);
+    if (status < 0) return -1;          // versions.bin exists but is unusable
+    if (status == 1) {
+        // No binary metadata yet: import the text format if this repository still uses it
+        char text_path[MAX_PATH_LEN];
+        metadata_file_path(repo, METADATA_FILE, text_path, sizeof(text_path));
+        if (file_exists(text_path) && import_metadata_text(repo, text_path) != 0) return -1;
+    }
+
+    // Add the versions checked in since the last compaction
+    status = replay_journal(repo);
+
+    // The mapping is paged in on demand, so only the journal counts as read; one mmap() and one read()
+    stats_add(STAT_LOAD_METADATA, started, repo->journal_size, 0, (repo->metadata_map ? 1 : 0) + (repo->journal_size > 0 ? 1 : 0));
+    return status;
+}
+
+/*
+The function refresh_metadata brings the loaded metadata up to date with what other processes recorded since it
+was loaded: entries appended to the journal are replayed, and if versions.bin was replaced by a compaction the
+metadata is loaded again. FileVersion structures already handed out stay valid.
+Returns 0 on success, -1 on failure.
+It takes Repository* repo, which must not hold unsaved versions. Call it with the exclusive metadata lock held
+(see lock.c) before assigning version numbers, so no other process can record versions in between.
+*/
+int refresh_metadata(Repository* repo) {
+    if (!repo) return -1;
+
+    // The mapping keeps the old versions.bin alive, so a replaced file always has a different inode
+    char path[MAX_PATH_LEN];
+    struct stat st;
+    metadata_file_path(repo, METADATA_BIN_FILE, path, sizeof(path));
+    int present = (stat(path, &st) == 0);
+    struct MetadataMap* map = repo->metadata_map;
+    if (map ? (!present || st.st_dev != map->device || st.st_ino != map->inode) : present) {
+        trace("metadata: reloading after a compaction by another process");
+        close_metadata(repo);
+        repo->version_list = NULL;
+        repo->journal_head = NULL;
+        repo->journal_entries = 0;
+        repo->journal_size = 0;
+        repo->total_versions = 0;
+        return load_metadata(repo);
+    }
+
+    // Otherwise only the journal can have grown
+    metadata_file_path(repo, JOURNAL_FILE, path, sizeof(path));
+    if (stat(path, &st) != 0 || st.st_size <= repo->journal_size) return 0;
+    return replay_journal(repo);
+}
+
+/*
+The function compare_versions orders FileVersion pointers by filename, then version number (qsort callback).
+*/
+static int compare_versions(const void* a, const void* b) {
+    const FileVersion* x = *(FileVersion* const*)a;
+    const FileVersion* y = *(FileVersion* const*)b;
+    int cmp = strcmp(x->filename, y->filename);
+    if (cmp != 0) return cmp;
+    return (x->version_number > y->version_number) - (x->version_number < y->version_number);
+}
+
+/*
+The function collect_file_versions gathers every version of one file, sorted by version number (oldest first).
+Returns the number of versions (0 if none), or -1 if memory allocation fails.
+It takes Repository* repo, const char* filename and FileVersion*** out (receives a malloc'd array the caller frees;
+the FileVersion structures themselves belong to the repository).
+Only the records of the requested file are read from the mapped metadata.
+*/
+int collect_file_versions(Repository* repo, const char* filename, FileVersion*** out) {
+    if (!repo || !filename || !out) return -1;
+
+    long long started = stats_clock();
+    FileIndexEntry* entry = file_index_lookup(repo, filename, 0);
+    size_t persisted = (entry && entry->persisted) ? entry->persisted->record_count : 0;
+    size_t count = persisted + (entry ? entry->pending_count : 0);
+
+    FileVersion** versions = malloc((count + 1) * sizeof(FileVersion*));
+    if (!versions) return -1;
+
+    // Persisted records come first; unpersisted versions are newer and already sorted
+    size_t n = 0;
+    for (uint32_t i = 0; i < persisted; i++) {
+        FileVersion* v = materialize_record(repo, entry, entry->persisted->first_record + i);
+        if (!v) {
+            free(versions);
+            return -1;
+        }
+        versions[n++] = v;
+    }
+    for (int i = 0; entry && i < entry->pending_count; i++) versions[n++] = entry->pending[i];
+    if (persisted > 0 && n > persisted && versions[persisted]->version_number < versions[persisted - 1]->version_number) {
+        qsort(versions, n, sizeof(FileVersion*), compare_versions);     // Only after importing out-of-order records
+    }
+
+    stats_add(STAT_LOOKUP, started, 0, 0, 0);
+    *out = versions;
+    return (int)n;
+}
+
+/*
+The function version_selected checks a version's creation time and comment against a filter.
+*/
+static int version_selected(const VersionFilter* filter, time_t timestamp, const char* comment) {
+    if (filter->since && timestamp < filter->since) return 0;
+    if (filter->until && timestamp > filter->until) return 0;
+    return !filter->grep || strstr(comment, filter->grep) != NULL;
+}
+
+/*
+The function select_file_versions gathers the versions of a file that pass a filter, newest first.
+Mapped records are tested before they are materialized and the walk stops once filter->limit versions are
+selected, so showing a page of a long history only builds the versions on that page.
+Returns the number of versions selected, or -1 if the file has no versions or memory allocation fails.
+It takes Repository* repo, const char* filename, const VersionFilter* filter (NULL selects every version)
+and FileVersion*** out (receives a malloc'd array the caller frees).
+*/
+int select_file_versions(Repository* repo, const char* filename, const VersionFilter* filter, FileVersion*** out) {
+    if (!repo || !filename || !out) return -1;
+    VersionFilter all = {0, 0, 0, NULL};
+    if (!filter) filter = &all;
+
+    long long started = stats_clock();
+    FileIndexEntry* entry = file_index_lookup(repo, filename, 0);
+    if (!entry) return -1;
+    size_t persisted = entry->persisted ? entry->persisted->record_count : 0;
+    size_t count = persisted + entry->pending_count;
+    if (filter->limit > 0 && (size_t)filter->limit < count) count = (size_t)filter->limit;
+
+    FileVersion** versions = malloc((count + 1) * sizeof(FileVersion*));
+    if (!versions) return -1;
+
+    // Unpersisted versions are the newest, then the mapped records from the highest version down
+    size_t n = 0;
+    for (int i = entry->pending_count - 1; i >= 0 && n < count; i--) {
+        FileVersion* v = entry->pending[i];
+        if (version_selected(filter, v->timestamp, v->comment)) versions[n++] = v;
+    }
+    struct MetadataMap* map = repo->metadata_map;
+    for (size_t i = persisted; i > 0 && n < count; i--) {
+        uint32_t index = entry->persisted->first_record + (uint32_t)(i - 1);
+        const MetaRecord* record = &map->records[index];
+        if (!version_selected(filter, (time_t)record->timestamp, meta_string(map, record->comment_offset))) continue;
+        FileVersion* v = materialize_record(repo, entry, index);
+        if (!v) {
+            free(versions);
+            return -1;
+        }
+        versions[n++] = v;
+    }
+
+    stats_add(STAT_LOOKUP, started, 0, 0, 0);
+    *out = versions;
+    return (int)n;
+}
+
+/*
+The function collect_all_versions gathers every version of every file, sorted by filename and version number.
+Returns the number of versions, or -1 if memory allocation fails.
+It takes Repository* repo and FileVersion*** out (receives a malloc'd array the caller frees).
+This touches the whole history, so it is meant for export and maintenance commands.
+*/
+int collect_all_versions(Repository* repo, FileVersion*** out) {
+    if (!repo || !out) return -1;
+
+    struct MetadataMap* map = repo->metadata_map;
+    size_t persisted = map ? map->header->record_count : 0;
+    size_t count = persisted;
+    for (FileVersion* v = repo->version_list; v; v = v->next) count++;
+
+    FileVersion** versions = malloc((count + 1) * sizeof(FileVersion*));
+    if (!versions) return -1;
+
+    size_t n = 0;
+    for (size_t i = 0; i < persisted; i++) {
+        const MetaRecord* r = &map->records[i];
+        const char* name = (r->file_index < map->header->file_count) ? meta_string(map, map->files[r->file_index].name_offset) : "";
+        FileIndexEntry* entry = file_index_lookup(repo, name, 1);
+        FileVersion* v = (entry && entry->persisted) ? materialize_record(repo, entry, (uint32_t)i) : NULL;
+        if (!v) {
+            free(versions);
+            return -1;
+        }
+        versions[n++] = v;
+    }
+    for (FileVersion* v = repo->version_list; v; v = v->next) versions[n++] = v;
+    qsort(versions, n, sizeof(FileVersion*), compare_versions);
+
+    *out = versions;
+    return (int)n;
+}
+
+/*
+The function collect_latest_versions gathers the latest version of every file, sorted by filename.
+Returns the number of files, or -1 if memory allocation fails.
+It takes Repository* repo and FileVersion*** out (receives a malloc'd array the caller frees).
+Only one record per file is materialized, so this stays cheap on long histories.
+*/
+int collect_latest_versions(Repository* repo, FileVersion*** out) {
+    if (!repo || !out) return -1;
+
+    long long started = stats_clock();
+    struct MetadataMap* map = repo->metadata_map;
+    size_t persisted = map ? map->header->file_count : 0;
+    size_t count = persisted;
+    for (FileVersion* v = repo->version_list; v; v = v->next) count++;
+
+    FileVersion** versions = malloc((count + 1) * sizeof(FileVersion*));
+    if (!versions) return -1;
+
+    // Files in versions.bin, unless a newer version of the file is pending
+    size_t n = 0;
+    for (size_t i = 0; i < persisted; i++) {
+        const MetaFileEntry* file = &map->files[i];
+        FileIndexEntry* entry = file_index_lookup(repo, meta_string(map, file->name_offset), 1);
+        if (!entry) {
+            free(versions);
+            return -1;
+        }
+        if (entry->pending_count > 0 && entry->pending[entry->pending_count - 1]->version_number > file->latest_version) continue;
+        if (file->record_count == 0) continue;
+        FileVersion* v = materialize_record(repo, entry, file->first_record + file->record_count - 1);
+        if (!v) {
+            free(versions);
+            return -1;
+        }
+        versions[n++] = v;
+    }
+
+    // Pending versions that are the newest of their file
+    for (FileVersion* v = repo->version_list; v; v = v->next) {
+        FileIndexEntry* entry = file_index_lookup(repo, v->filename, 0);
+        if (entry && entry->pending_count > 0 && entry->pending[entry->pending_count - 1] == v &&
+            v->version_number > (entry->persisted ? entry->persisted->latest_version : 0)) {
+            versions[n++] = v;
+        }
+    }
+    qsort(versions, n, sizeof(FileVersion*), compare_versions);
+
+    stats_add(STAT_LOOKUP, started, 0, 0, 0);
+    *out = versions;
+    return (int)n;
+}
+
+/*
+The function export_metadata_text writes the repository's metadata in the text format of versions.meta.
+Returns 0 on success, -1 on failure (file write errors).
+It takes Repository* repo and const char* path (the text file to write).
+The text format is easy to read and edit by hand, and import_metadata_text reads it back.
+*/
+int export_metadata_text(Repository* repo, const char* path) {
+    if (!repo || !path) return -1;
+
+    FileVersion** versions = NULL;
+    int count = collect_all_versions(repo, &versions);
+    if (count < 0) return -1;
+
     // Open metadata file for writing (creates new file or overwrites existing)
-    FILE* file = fopen(metadata_path, "w");
-    if (!file) return -1;   // Return error if file cannot be opened for writing
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        free(versions);
+        return -1;   // Return error if file cannot be opened for writing
+    }
     
     // Write header comment and total version count for quick repository statistics
     fprintf(file, "# VCS Metadata File\n");
     fprintf(file, "TOTAL_VERSIONS=%d\n", repo->total_versions);
     fprintf(file, "\n# File Versions\n");
     
-    // Traverse the repository's version list and write each version's metadata
-    FileVersion* current = repo->version_list;
-    while (current) {
-        // Write version metadata for easy parsing
-        // Format: FILE=name|VERSION=num|TIMESTAMP=time|SIZE=bytes|HASH=sha256|COMMENT=text
-        fprintf(file, "FILE=%s|VERSION=%d|TIMESTAMP=%ld|SIZE=%ld|HASH=%s|COMMENT=%s\n",
-                current->filename,          // Name of the versioned file
-                current->version_number,    // Version number (1, 2, 3, etc.)
-                current->timestamp,         // Unix timestamp when version was created
-                current->file_size,         // File size in bytes
-                current->hash,              // SHA-256 hash for integrity verification
-                current->comment);          // User comment describing the changes
-        current = current->next;            // Move to next version in linked list
+    // Write each version's metadata, file by file in version order
+    for (int i = 0; i < count; i++) {
+        FileVersion* current = versions[i];
+        char line[METADATA_LINE_MAX];
+        format_version_record(current, line, sizeof(line));
+        fprintf(file, "%s\n", line);
     }
     
+    free(versions);
     // Close the file to ensure all data is written to disk
-    fclose(file);
-    return 0;   // Return success
+    return (fclose(file) == 0) ? 0 : -1;
 }
 
 /*
-The function load_metadata reads repository metadata from disk and rebuilds the in-memory version list.
-Parses the metadata file and reconstructs FileVersion entries in the repository's linked list.
-Returns 0 on success (including when no metadata file exists), -1 on failure.
-It takes Repository* repo (the VCS repository to load metadata into).
+The function import_metadata_text replaces the repository's metadata with the contents of a text metadata file.
+Parses the file and rebuilds versions.bin from its FileVersion records.
+Returns 0 on success, -1 on failure (file read or write errors).
+It takes Repository* repo (the VCS repository to import into) and const char* path (the text file to read).
 Handles both repository statistics and individual file version records.
-This restores version history when the VCS program starts up.
 */
-int load_metadata(Repository* repo) {
-    // Validate input parameter
-    if (!repo) return -1;
-    
-    // Construct the full path to the metadata file
-    char metadata_path[MAX_PATH_LEN];       // Array for the versions.meta path
-    snprintf(metadata_path, sizeof(metadata_path), "%s/%s/%s", 
-             repo->base_path, VCS_DIR, METADATA_FILE);
+int import_metadata_text(Repository* repo, const char* path) {
+    // Validate input parameters
+    if (!repo || !path) return -1;
     
     // Open metadata file for reading
-    FILE* file = fopen(metadata_path, "r");
-    if (!file) return 0; // Return success if no metadata file exists yet (new repository)
+    FILE* file = fopen(path, "r");
+    if (!file) return -1;
+    
+    // Drop the current metadata; the text file describes the complete history
+    close_metadata(repo);
+    repo->version_list = NULL;
+    repo->journal_head = NULL;
+    repo->total_versions = 0;
     
-    // Buffer for reading lines from the metadata file versions.meta
-    char line[1024];
+    // Buffer for reading lines from the text metadata file
+    char line[METADATA_LINE_MAX];
     
     // Read the metadata file line by line
     while (fgets(line, sizeof(line), file)) {
@@ -81,67 +1280,58 @@ int load_metadata(Repository* repo) {
         }
         // Parse file version record lines. Checks if the line starts with "FILE=", indicating a version record
         else if (strncmp(line, "FILE=", 5) == 0) {
-            // Allocate memory for new version entry
-            FileVersion* version = malloc(sizeof(FileVersion));
+            FileVersion* version = parse_version_record(repo, line + 5);   // Skip "FILE="
             if (!version) continue;     // Skip this entry if allocation fails
             
-            // Parse filename field (first token after FILE=)
-            char* token = strtok(line + 5, "|");    // Skip "FILE=" and split by |
-            if (token) {
-                strncpy(version->filename, token, MAX_FILENAME_LEN - 1);
-                version->filename[MAX_FILENAME_LEN - 1] = '\0';     // Ensure null termination
-            }
-            
-            // Parse version number field
-            token = strtok(NULL, "|");      // Get next token
-            if (token && strncmp(token, "VERSION=", 8) == 0) {
-                version->version_number = atoi(token + 8);  // Skip "VERSION=" and convert
-            }
-            
-            // Parse timestamp field
-            token = strtok(NULL, "|");
-            if (token && strncmp(token, "TIMESTAMP=", 10) == 0) {
-                version->timestamp = atol(token + 10);      // Skip "TIMESTAMP=" and convert to long
-            }
-            
-            // Parse file size field
-            token = strtok(NULL, "|");
-            if (token && strncmp(token, "SIZE=", 5) == 0) {
-                version->file_size = atol(token + 5);       // Skip "SIZE=" and convert to long
-            }
-            
-            // Parse hash field
-            token = strtok(NULL, "|");
-            if (token && strncmp(token, "HASH=", 5) == 0) {
-                strncpy(version->hash, token + 5, MAX_HASH_LEN - 1);
-                version->hash[MAX_HASH_LEN - 1] = '\0';     // Ensure null termination
-            }
-            
-            // Parse comment field (last field, may contain the line's newline)
-            token = strtok(NULL, "|");
-            if (token && strncmp(token, "COMMENT=", 8) == 0) {
-                strncpy(version->comment, token + 8, MAX_COMMENT_LEN - 1);
-                version->comment[MAX_COMMENT_LEN - 1] = '\0';
-                
-                // Remove trailing newline character if present
-                char* newline = strchr(version->comment, '\n');
-                if (newline) *newline = '\0';
-            }
-            
-            // Add the loaded version to the front of the repository's linked list
-            version->next = repo->version_list;     // Point to current head
-            repo->version_list = version;          // Make this the new head
+            // Add the loaded version to the repository
+            add_file_version(repo, version);
         }
     }
     
+    
     // Close the metadata file
     fclose(file);
-    return 0;   // Return success
+    
+    // Persist the imported versions as versions.bin (this also drops the journal)
+    return compact_metadata(repo);
+}
+
+/*
+The function lookup_version does the work of find_file_version.
+*/
+static FileVersion* lookup_version(Repository* repo, const char* filename, int version) {
+    FileIndexEntry* entry = file_index_lookup(repo, filename, 0);
+    if (!entry) return NULL;
+    
+    // Versions not in versions.bin yet, sorted by version number
+    int low = 0, high = entry->pending_count;
+    while (low < high) {
+        int mid = low + (high - low) / 2;
+        int number = entry->pending[mid]->version_number;
+        if (number == version) return entry->pending[mid];
+        if (number < version) low = mid + 1;
+        else high = mid;
+    }
+    
+    // Persisted versions: the file's records are sorted by version number
+    if (!entry->persisted) return NULL;
+    struct MetadataMap* map = repo->metadata_map;
+    uint32_t first = entry->persisted->first_record, last = first + entry->persisted->record_count;
+    while (first < last) {
+        uint32_t mid = first + (last - first) / 2;
+        int number = map->records[mid].version_number;
+        if (number == version) return materialize_record(repo, entry, mid);
+        if (number < version) first = mid + 1;
+        else last = mid;
+    }
+    
+    // Return NULL if no matching version was found
+    return NULL;
 }
 
 /*
 The function find_file_version searches for a specific version of a file in the repository.
-Traverses the version list to find an exact match for both filename and version number.
+Finds the file through the lookup index, then binary-searches its unpersisted versions and its mapped records.
 Returns pointer to the FileVersion if found, NULL if not found or on error.
 It takes Repository* repo (the VCS repository to search), const char* filename (file to find),
 and int version (specific version number to locate).
@@ -151,24 +1341,15 @@ FileVersion* find_file_version(Repository* repo, const char* filename, int versi
     // Validate input parameters
     if (!repo || !filename) return NULL;
     
-    // Start traversing from the head of the repository's version list
-    FileVersion* current = repo->version_list;
-    while (current) {
-        // Check if both filename and version number match exactly
-        if (strcmp(current->filename, filename) == 0 && 
-            current->version_number == version) {
-            return current;     // Return pointer to the matching version
-        }
-        current = current->next;    // Move to next version in the list
-    }
-    
-    // Return NULL if no matching version was found
-    return NULL;
+    long long started = stats_clock();
+    FileVersion* found = lookup_version(repo, filename, version);
+    stats_add(STAT_LOOKUP, started, 0, 0, 0);
+    return found;
 }
 
 /*
 The function get_latest_version finds the highest version number for a specific file.
-Searches through all versions of a file to determine the most recent version number.
+Takes constant time once the file is in the lookup index.
 Returns the latest version number (0 if no versions exist), always >= 0.
 It takes Repository* repo (the VCS repository to search) and const char* filename (file to check).
 Used when checking in new versions to determine the next version number.
@@ -178,22 +1359,14 @@ int get_latest_version(Repository* repo, const char* filename) {
     // Validate input parameters
     if (!repo || !filename) return 0;
     
-    // Initialize latest version counter
-    int latest = 0;
-    FileVersion* current = repo->version_list;
+    long long started = stats_clock();
+    FileIndexEntry* entry = file_index_lookup(repo, filename, 0);
     
-    // Traverse all versions in the repository
-    while (current) {
-        // Check if this version belongs to the requested file
-        if (strcmp(current->filename, filename) == 0) {
-            // Update latest if this version number is higher
-            if (current->version_number > latest) {
-                latest = current->version_number;
-            }
-        }
-        current = current->next;    // Move to next version in the list
+    // The newest version is either the last unpersisted one or the latest recorded in the file table
+    int latest = (entry && entry->persisted) ? entry->persisted->latest_version : 0;
+    if (entry && entry->pending_count > 0 && entry->pending[entry->pending_count - 1]->version_number > latest) {
+        latest = entry->pending[entry->pending_count - 1]->version_number;
     }
-    
-    // Return the highest version number found (0 if no versions exist)
+    stats_add(STAT_LOOKUP, started, 0, 0, 0);
     return latest;
 }
\ No newline at end of file
@@ -0,0 +1,1055 @@
+#include "vcs.h"
+#include <stdint.h>     // Provides fixed-width integer types for the object header
+#include <fcntl.h>      // Provides AT_FDCWD for utimensat() and posix_fadvise()
+#include <sys/mman.h>   // Provides posix_madvise() for packed objects
+
+/*
+The object store keeps every distinct file content exactly once under .vcs/objects/xx/yyyy...,
+where xx is the first two hex characters of the content's SHA-256 digest and yyyy... the rest.
+Versions refer to their content by this object id, so identical contents across versions and
+across files share a single stored copy.
+
+Plain objects are the file contents byte for byte. Encoded objects start with an OBJECT_HEADER_SIZE header:
+    magic (8 bytes "VCSOBJ1\n") | type (1 byte) | codec (1 byte) | reserved (6 bytes) | payload size (8 bytes, little endian)
+The payload size is the size before compression; the codec byte says how the rest of the file is compressed.
+A DELTA object's payload is the 64-character id of its base object followed by an encoded delta (see delta.c).
+A CHUNKS object's payload lists the objects a large file was split into (see chunk.c).
+The newest version of a file is written with the hot codec, history is rewritten with the cold codec.
+Plain contents that happen to begin with the magic are stored as a FULL object with a header, so the
+magic alone tells the two forms apart.
+Objects moved into a pack keep exactly these bytes (see pack.c); every lookup tries the loose file first.
+*/
+
+static const char object_magic[8] = {'V', 'C', 'S', 'O', 'B', 'J', '1', '\n'};
+
+#define DELTA_BASE_ID_LEN (MAX_HASH_LEN - 1)    // The base id is stored as its 64 hex characters
+#define MAX_DELTA_DEPTH 4096                    // Hard stop for corrupt chains that loop back on themselves
+
+/*
+The function object_path builds the on-disk path of an object from its id.
+Returns 0 on success, -1 if the id is too short to be a valid object id.
+It takes const char* object_id (hex digest), char* path (output buffer) and size_t size (buffer size).
+Objects are fanned out into 256 sub-directories so no single directory grows too large.
+*/
+int object_path(const char* object_id, char* path, size_t size) {
+    // An object id must at least contain the two fan-out characters plus the remainder
+    if (!object_id || strlen(object_id) < 3) return -1;
+
+    char current_dir[MAX_PATH_LEN];
+    getcwd(current_dir, sizeof(current_dir));
+
+    // Construct the path: current_dir/.vcs/objects/xx/yyyy...
+    snprintf(path, size, "%s/%s/%s/%.2s/%s",
+             current_dir, VCS_DIR, OBJECTS_DIR, object_id, object_id + 2);
+    return 0;
+}
+
+/*
+The function object_exists checks whether an object with the given id is already stored.
+Returns 1 if the object exists, 0 otherwise.
+It takes const char* object_id (hex digest of the content).
+*/
+int object_exists(const char* object_id) {
+    char path[MAX_PATH_LEN];
+    if (object_path(object_id, path, sizeof(path)) != 0) return 0;
+    if (file_exists(path)) return 1;
+
+    const unsigned char* bytes;
+    size_t len;
+    return pack_lookup(object_id, &bytes, &len);
+}
+
+/*
+The function load_object_bytes gets at the stored bytes of an object, loose or packed.
+Returns 0 on success, -1 if the object is missing.
+It takes const char* object_id, const unsigned char** bytes / size_t* len (receive the stored bytes) and
+unsigned char** owned (receives the malloc'd buffer to free for a loose object, NULL for a packed one,
+whose bytes stay in the pack mapping).
+*/
+static int load_object_bytes(const char* object_id, const unsigned char** bytes, size_t* len, unsigned char** owned) {
+    char object_file[MAX_PATH_LEN];
+    *owned = NULL;
+    if (object_path(object_id, object_file, sizeof(object_file)) != 0) return -1;
+    if (read_file_contents(object_file, owned, len) == 0) {
+        *bytes = *owned;
+        return 0;
+    }
+    *owned = NULL;
+    return pack_lookup(object_id, bytes, len) ? 0 : -1;
+}
+
+/*
+The function copy_bytes returns a malloc'd copy of a buffer (NULL if memory allocation fails).
+*/
+static unsigned char* copy_bytes(const unsigned char* bytes, size_t len) {
+    unsigned char* copy = malloc(len ? len : 1);
+    if (copy && len > 0) memcpy(copy, bytes, len);
+    return copy;
+}
+
+/*
+The function create_fanout_directory makes sure the directories an object will be stored in exist.
+Returns 0 on success, -1 on failure.
+It takes const char* object_id (id of the object about to be stored).
+*/
+static int create_fanout_directory(const char* object_id) {
+    char current_dir[MAX_PATH_LEN];
+    char objects_dir[MAX_PATH_LEN];
+    char fanout_dir[MAX_PATH_LEN];
+
+    getcwd(current_dir, sizeof(current_dir));
+    snprintf(objects_dir, sizeof(objects_dir), "%s/%s/%s", current_dir, VCS_DIR, OBJECTS_DIR);
+    snprintf(fanout_dir, sizeof(fanout_dir), "%s/%.2s", objects_dir, object_id);
+
+    // Repositories created before the object store have no objects directory yet
+    if (create_directory(objects_dir) != 0 || create_directory(fanout_dir) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+The function create_temp_file reserves a unique, empty temporary file inside .vcs/temp.
+Returns 0 on success, -1 on failure.
+It takes char* path and size_t size (buffer receiving the path of the new file).
+*/
+static int create_temp_file(char* path, size_t size) {
+    char current_dir[MAX_PATH_LEN];
+    getcwd(current_dir, sizeof(current_dir));
+    snprintf(path, size, "%s/%s/temp/object.XXXXXX", current_dir, VCS_DIR);
+
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror("Failed to create temporary object file");
+        return -1;
+    }
+    close(fd);
+    return 0;
+}
+
+/*
+The function encode_header fills an OBJECT_HEADER_SIZE buffer with the magic, type, codec and payload size.
+*/
+static void encode_header(unsigned char* header, int type, int codec, uint64_t size) {
+    memset(header, 0, OBJECT_HEADER_SIZE);
+    memcpy(header, object_magic, sizeof(object_magic));
+    header[8] = (unsigned char)type;
+    header[9] = (unsigned char)codec;
+    for (int i = 0; i < 8; i++) {
+        header[16 + i] = (unsigned char)(size >> (8 * i));
+    }
+}
+
+/*
+The function decode_header parses an object header from raw bytes.
+Returns 1 if the bytes start with a valid header, 0 if they are plain contents.
+*/
+static int decode_header(const unsigned char* raw, size_t len, ObjectHeader* header) {
+    if (len < OBJECT_HEADER_SIZE || memcmp(raw, object_magic, sizeof(object_magic)) != 0) return 0;
+    header->type = raw[8];
+    header->codec = raw[9];
+    header->size = 0;
+    for (int i = 0; i < 8; i++) {
+        header->size |= (uint64_t)raw[16 + i] << (8 * i);
+    }
+    return 1;
+}
+
+/*
+The function publish_object moves a finished temporary file into place under the object's id.
+Returns 0 on success, -1 on failure (the temporary file is removed in that case).
+*/
+static int publish_object(const char* temp_file, const char* object_id) {
+    char object_file[MAX_PATH_LEN];
+    object_path(object_id, object_file, sizeof(object_file));
+    if (rename(temp_file, object_file) != 0) {
+        perror("Failed to store object");
+        unlink(temp_file);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+The function write_encoded_object writes an object with a header, replacing any existing object with the same id.
+Returns 0 on success, -1 on failure.
+It takes const char* object_id, int type (OBJECT_FULL, OBJECT_DELTA or OBJECT_CHUNKS), int codec / int level (compression to use)
+and the uncompressed payload bytes.
+If compression does not make the payload smaller it is stored uncompressed instead.
+The object is written to .vcs/temp first and renamed into place, so readers see either the old or the new form.
+*/
+static int write_encoded_object(const char* object_id, int type, int codec, int level,
+                                const unsigned char* payload, size_t len) {
+    char temp_file[MAX_PATH_LEN];
+
+    // Compress the payload, keeping the uncompressed form when compression does not pay off
+    unsigned char* compressed = NULL;
+    size_t compressed_len = 0;
+    const unsigned char* body = payload;
+    size_t body_len = len;
+    if (codec != CODEC_NONE && compress_buffer(codec, level, payload, len, &compressed, &compressed_len) == 0 &&
+        compressed_len < len) {
+        body = compressed;
+        body_len = compressed_len;
+    } else {
+        codec = CODEC_NONE;
+    }
+
+    if (create_fanout_directory(object_id) != 0 || create_temp_file(temp_file, sizeof(temp_file)) != 0) {
+        free(compressed);
+        return -1;
+    }
+
+    unsigned char header[OBJECT_HEADER_SIZE];
+    encode_header(header, type, codec, len);
+
+    FILE* file = fopen(temp_file, "wb");
+    int status = -1;
+    if (file) {
+        if (fwrite(header, 1, sizeof(header), file) == sizeof(header) &&
+            fwrite(body, 1, body_len, file) == body_len) {
+            status = 0;
+        }
+        if (fclose(file) != 0) status = -1;
+    }
+    free(compressed);
+
+    if (status != 0) {
+        unlink(temp_file);
+        return -1;
+    }
+    return publish_object(temp_file, object_id);
+}
+
+/*
+The function object_read_header reads the header of a stored object.
+Returns 1 if the object has a header (filled into *header), 0 if it is stored as plain contents, -1 if it is missing.
+It takes const char* object_id and ObjectHeader* header (receives type, codec and payload size).
+*/
+int object_read_header(const char* object_id, ObjectHeader* header) {
+    char object_file[MAX_PATH_LEN];
+    if (object_path(object_id, object_file, sizeof(object_file)) != 0) return -1;
+
+    FILE* file = fopen(object_file, "rb");
+    if (!file) {
+        const unsigned char* bytes;
+        size_t len;
+        return pack_lookup(object_id, &bytes, &len) ? decode_header(bytes, len, header) : -1;
+    }
+
+    unsigned char raw[OBJECT_HEADER_SIZE];
+    size_t len = fread(raw, 1, sizeof(raw), file);
+    fclose(file);
+
+    return decode_header(raw, len, header);
+}
+
+/*
+The function object_is_delta checks whether a stored object is kept as a delta against another object.
+Returns 1 for delta objects, 0 for objects stored in full or missing objects.
+It takes const char* object_id.
+*/
+int object_is_delta(const char* object_id) {
+    ObjectHeader header;
+    return object_read_header(object_id, &header) == 1 && header.type == OBJECT_DELTA;
+}
+
+/*
+The function is_chunked checks whether a stored object lists the chunks of a large file.
+*/
+static int is_chunked(const char* object_id) {
+    ObjectHeader header;
+    return object_read_header(object_id, &header) == 1 && header.type == OBJECT_CHUNKS;
+}
+
+/*
+The function object_chunk_list loads the chunk list of a chunked object.
+Returns 1 if the object is chunked (*list receives the malloc'd entries, CHUNK_ENTRY_SIZE bytes each, and *count
+their number), 0 if it is not, -1 if it is missing or corrupt.
+It takes const char* object_id, unsigned char** list and size_t* count.
+*/
+int object_chunk_list(const char* object_id, unsigned char** list, size_t* count) {
+    ObjectHeader header;
+    int encoded = object_read_header(object_id, &header);
+    if (encoded <= 0) return encoded;
+    if (header.type != OBJECT_CHUNKS) return 0;
+    if (header.size % CHUNK_ENTRY_SIZE != 0) return -1;
+
+    const unsigned char* raw = NULL;
+    unsigned char* owned = NULL;
+    size_t raw_len = 0;
+    if (load_object_bytes(object_id, &raw, &raw_len, &owned) != 0 || raw_len < OBJECT_HEADER_SIZE) {
+        free(owned);
+        return -1;
+    }
+    unsigned char* entries = malloc(header.size ? header.size : 1);
+    int status = entries ? 0 : -1;
+    if (status == 0 && header.codec != CODEC_NONE) {
+        status = decompress_buffer(header.codec, raw + OBJECT_HEADER_SIZE, raw_len - OBJECT_HEADER_SIZE,
+                                   entries, header.size);
+    } else if (status == 0) {
+        if (raw_len - OBJECT_HEADER_SIZE != header.size) status = -1;
+        else memcpy(entries, raw + OBJECT_HEADER_SIZE, header.size);
+    }
+    free(owned);
+    if (status != 0) {
+        free(entries);
+        return -1;
+    }
+    *list = entries;
+    *count = header.size / CHUNK_ENTRY_SIZE;
+    return 1;
+}
+
+/*
+The function object_prefetch asks the kernel to start reading an object, so it is in the page cache by the time
+it is needed. Missing objects are ignored.
+It takes const char* object_id.
+*/
+void object_prefetch(const char* object_id) {
+    char object_file[MAX_PATH_LEN];
+    if (object_path(object_id, object_file, sizeof(object_file)) != 0) return;
+    int fd = open(object_file, O_RDONLY);
+    if (fd >= 0) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+        close(fd);
+        return;
+    }
+
+    // A packed object: advise the pages of the mapping that hold it
+    const unsigned char* bytes;
+    size_t len;
+    if (!pack_lookup(object_id, &bytes, &len) || len == 0) return;
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)bytes & ~(page - 1);
+    posix_madvise((void*)start, (uintptr_t)bytes + len - start, POSIX_MADV_WILLNEED);
+}
+
+/*
+The function object_delta_base finds the object a delta object is based on.
+Returns 1 if the object is a delta (its base id is written to base_id, MAX_HASH_LEN bytes), 0 if it is stored
+in full, -1 if it is missing or corrupt.
+It takes const char* object_id and char* base_id.
+*/
+int object_delta_base(const char* object_id, char* base_id) {
+    ObjectHeader header;
+    int encoded = object_read_header(object_id, &header);
+    if (encoded <= 0) return encoded;
+    if (header.type != OBJECT_DELTA) return 0;
+    if (header.size < DELTA_BASE_ID_LEN) return -1;
+
+    const unsigned char* raw = NULL;
+    unsigned char* owned = NULL;
+    size_t raw_len = 0;
+    if (load_object_bytes(object_id, &raw, &raw_len, &owned) != 0) return -1;
+    if (raw_len < OBJECT_HEADER_SIZE) {
+        free(owned);
+        return -1;
+    }
+
+    // The base id starts the payload, which has to be decompressed to get at it
+    const unsigned char* payload = raw + OBJECT_HEADER_SIZE;
+    unsigned char* plain = NULL;
+    int status = 0;
+    if (header.codec != CODEC_NONE) {
+        plain = malloc(header.size);
+        status = (plain && decompress_buffer(header.codec, payload, raw_len - OBJECT_HEADER_SIZE, plain, header.size) == 0) ? 0 : -1;
+        payload = plain;
+    } else if (raw_len - OBJECT_HEADER_SIZE < DELTA_BASE_ID_LEN) {
+        status = -1;
+    }
+    if (status == 0) {
+        memcpy(base_id, payload, DELTA_BASE_ID_LEN);
+        base_id[DELTA_BASE_ID_LEN] = '\0';
+    }
+    free(plain);
+    free(owned);
+    return (status == 0) ? 1 : -1;
+}
+
+/*
+The function object_decode_full finds the contents in the raw bytes of a plain or full object.
+Returns 0 if data / len receive the contents, 1 if the object is a delta or a chunk list (restore_object rebuilds
+those), -1 if it is corrupt.
+It takes the raw object bytes (const unsigned char* raw / size_t raw_len), const unsigned char** data / size_t* len
+and unsigned char** owned (receives the malloc'd contents if they had to be decompressed, NULL otherwise).
+Uncompressed contents point into raw.
+*/
+int object_decode_full(const unsigned char* raw, size_t raw_len, const unsigned char** data, size_t* len,
+                       unsigned char** owned) {
+    *owned = NULL;
+    ObjectHeader header;
+    if (!decode_header(raw, raw_len, &header)) {
+        *data = raw;
+        *len = raw_len;
+        return 0;
+    }
+    if (header.type != OBJECT_FULL) return 1;
+
+    const unsigned char* payload = raw + OBJECT_HEADER_SIZE;
+    size_t payload_len = raw_len - OBJECT_HEADER_SIZE;
+    if (header.codec == CODEC_NONE) {
+        *data = payload;
+        *len = payload_len;
+        return 0;
+    }
+    unsigned char* plain = malloc(header.size ? header.size : 1);
+    if (!plain || decompress_buffer(header.codec, payload, payload_len, plain, header.size) != 0) {
+        free(plain);
+        return -1;
+    }
+    *owned = plain;
+    *data = plain;
+    *len = header.size;
+    return 0;
+}
+
+/*
+The function read_object_depth loads an object's contents into memory, applying delta chains as needed.
+Returns 0 on success, -1 on failure (missing objects, corrupt deltas or chains deeper than MAX_DELTA_DEPTH).
+It takes const char* object_id, unsigned char** data / size_t* len (receive the malloc'd contents)
+and int depth (number of deltas already being resolved above this call).
+*/
+static int read_object_depth(const char* object_id, unsigned char** data, size_t* len, int depth) {
+    if (depth > MAX_DELTA_DEPTH) return -1;
+
+    const unsigned char* raw = NULL;
+    unsigned char* owned = NULL;    // Loose objects are read into memory, packed ones are used in place
+    size_t raw_len = 0;
+    if (load_object_bytes(object_id, &raw, &raw_len, &owned) != 0) return -1;
+
+    // Plain contents are returned as they are
+    ObjectHeader header;
+    if (!decode_header(raw, raw_len, &header)) {
+        *data = owned ? owned : copy_bytes(raw, raw_len);
+        *len = raw_len;
+        return *data ? 0 : -1;
+    }
+
+    int type = header.type;
+    size_t payload_len = raw_len - OBJECT_HEADER_SIZE;
+    const unsigned char* payload = raw + OBJECT_HEADER_SIZE;
+
+    // Decompress the payload to the size recorded in the header
+    if (header.codec != CODEC_NONE) {
+        unsigned char* plain = malloc(header.size ? header.size : 1);
+        if (!plain || decompress_buffer(header.codec, payload, payload_len, plain, header.size) != 0) {
+            free(plain);
+            free(owned);
+            return -1;
+        }
+        free(owned);
+        owned = plain;
+        payload = plain;
+        payload_len = header.size;
+    }
+
+    if (type == OBJECT_FULL) {
+        if (owned) {
+            memmove(owned, payload, payload_len);
+            *data = owned;
+        } else {
+            *data = copy_bytes(payload, payload_len);
+        }
+        *len = payload_len;
+        return *data ? 0 : -1;
+    }
+
+    if (type == OBJECT_CHUNKS) {
+        int status = chunks_read(payload, payload_len, data, len);
+        free(owned);
+        return status;
+    }
+
+    if (type != OBJECT_DELTA || payload_len < DELTA_BASE_ID_LEN) {
+        free(owned);
+        return -1;
+    }
+
+    // Rebuild the base first, then apply this object's delta on top of it
+    char base_id[MAX_HASH_LEN];
+    memcpy(base_id, payload, DELTA_BASE_ID_LEN);
+    base_id[DELTA_BASE_ID_LEN] = '\0';
+
+    unsigned char* base = NULL;
+    size_t base_len = 0;
+    int status = read_object_depth(base_id, &base, &base_len, depth + 1);
+    if (status == 0) {
+        status = delta_apply(base, base_len, payload + DELTA_BASE_ID_LEN, payload_len - DELTA_BASE_ID_LEN,
+                             data, len);
+    }
+    free(base);
+    free(owned);
+    return status;
+}
+
+/*
+The function object_read loads the full contents of a stored object into memory.
+Returns 0 on success, -1 on failure.
+It takes const char* object_id and unsigned char** data / size_t* len (receive the malloc'd contents, freed by the caller).
+*/
+int object_read(const char* object_id, unsigned char** data, size_t* len) {
+    return read_object_depth(object_id, data, len, 0);
+}
+
+/*
+The function object_read_stored loads the bytes of an object exactly as they are stored (encoded, possibly a delta).
+Returns 0 on success, -1 if the object is missing or memory allocation fails.
+It takes const char* object_id and unsigned char** data / size_t* len (receive a malloc'd copy, freed by the caller).
+*/
+int object_read_stored(const char* object_id, unsigned char** data, size_t* len) {
+    const unsigned char* bytes = NULL;
+    unsigned char* owned = NULL;
+    size_t length = 0;
+    if (load_object_bytes(object_id, &bytes, &length, &owned) != 0) return -1;
+    if (!owned) owned = copy_bytes(bytes, length);     // Packed bytes stay in the mapping
+    if (!owned) return -1;
+    *data = owned;
+    *len = length;
+    return 0;
+}
+
+/*
+The function object_make_full rewrites a delta object as a full object with the same contents, using the hot codec.
+Returns 0 on success (or if the object already is full), -1 on failure.
+It takes const char* object_id and const RepoConfig* config (compression settings).
+Deltas that use this object as their base stay valid, since the contents do not change.
+*/
+int object_make_full(const char* object_id, const RepoConfig* config) {
+    if (!object_is_delta(object_id)) return 0;
+
+    unsigned char* data = NULL;
+    size_t len = 0;
+    if (object_read(object_id, &data, &len) != 0) return -1;
+
+    int status = write_encoded_object(object_id, OBJECT_FULL, config->hot_codec, config->hot_level, data, len);
+    free(data);
+    return status;
+}
+
+/*
+The function object_make_cold recompresses a full object with the cold codec once it is no longer the newest version.
+Returns 0 on success (or if nothing had to change), -1 on failure.
+It takes const char* object_id and const RepoConfig* config (compression settings).
+*/
+int object_make_cold(const char* object_id, const RepoConfig* config) {
+    ObjectHeader header;
+    int encoded = object_read_header(object_id, &header);
+    if (encoded < 0) return -1;
+    if (config->cold_codec == CODEC_NONE) return 0;
+    if (encoded == 1 && (header.type != OBJECT_FULL || header.codec == config->cold_codec)) return 0;
+
+    unsigned char* data = NULL;
+    size_t len = 0;
+    if (object_read(object_id, &data, &len) != 0) return -1;
+
+    int status = write_encoded_object(object_id, OBJECT_FULL, config->cold_codec, config->cold_level, data, len);
+    free(data);
+    return status;
+}
+
+/*
+The function full_object_size returns the size of a full object's contents without reading them.
+Returns the size in bytes, or -1 if the object is missing.
+*/
+static long full_object_size(const char* object_id) {
+    ObjectHeader header;
+    int encoded = object_read_header(object_id, &header);
+    if (encoded < 0) return -1;
+    if (encoded == 1) return (long)header.size;
+
+    char object_file[MAX_PATH_LEN];
+    struct stat st;
+    object_path(object_id, object_file, sizeof(object_file));
+    if (stat(object_file, &st) == 0) return (long)st.st_size;
+
+    const unsigned char* bytes;
+    size_t len;
+    return pack_lookup(object_id, &bytes, &len) ? (long)len : -1;
+}
+
+/*
+The function object_deltify replaces a full object with a delta against another full object.
+Returns 1 if the object was rewritten as a delta, 0 if it was left alone, -1 on failure.
+It takes const char* object_id (object to shrink), const char* base_id (newer object the delta refers to)
+and const RepoConfig* config (delta_max_size bounds memory use, the cold codec compresses the delta).
+The object is only rewritten when the delta is clearly smaller than the contents. The base must be a full object,
+so delta chains always point towards newer versions and can never loop.
+*/
+int object_deltify(const char* object_id, const char* base_id, const RepoConfig* config) {
+    if (strcmp(object_id, base_id) == 0) return 0;
+    if (strlen(base_id) != DELTA_BASE_ID_LEN) return 0;
+    if (object_is_delta(object_id) || object_is_delta(base_id)) return 0;
+    if (is_chunked(object_id) || is_chunked(base_id)) return 0;     // Chunked files share chunks instead
+
+    // Both contents are held in memory while the delta is computed, so large objects stay in full
+    if (full_object_size(object_id) > config->delta_max_size || full_object_size(base_id) > config->delta_max_size) {
+        return 0;
+    }
+
+    unsigned char* target = NULL;
+    unsigned char* base = NULL;
+    size_t target_len = 0, base_len = 0;
+    if (object_read(object_id, &target, &target_len) != 0) return -1;
+    if (object_read(base_id, &base, &base_len) != 0) {
+        free(target);
+        return -1;
+    }
+
+    unsigned char* delta = NULL;
+    size_t delta_len = 0;
+    int status = delta_create(base, base_len, target, target_len, &delta, &delta_len);
+    free(base);
+    if (status != 0) {
+        free(target);
+        return -1;
+    }
+
+    // Keep the full copy unless the delta saves at least a quarter of the space
+    status = 0;
+    if (DELTA_BASE_ID_LEN + delta_len < target_len - target_len / 4) {
+        unsigned char* payload = malloc(DELTA_BASE_ID_LEN + delta_len);
+        if (payload) {
+            memcpy(payload, base_id, DELTA_BASE_ID_LEN);
+            memcpy(payload + DELTA_BASE_ID_LEN, delta, delta_len);
+            status = (write_encoded_object(object_id, OBJECT_DELTA, config->cold_codec, config->cold_level,
+                                           payload, DELTA_BASE_ID_LEN + delta_len) == 0) ? 1 : -1;
+            free(payload);
+        } else {
+            status = -1;
+        }
+    }
+    free(delta);
+    free(target);
+    return status;
+}
+
+/*
+The function object_rebase rewrites an object as a delta against a different base, or in full with the cold codec
+when that is not possible or does not pay off. Used by gc when the versions between an object and its old base
+expire, so the versions that remain stop depending on the objects of the expired ones.
+Returns 1 if the object is now a delta against base_id, 0 if it was stored in full, -1 on failure (the object is
+left as it was).
+It takes const char* object_id, const char* base_id (object of a newer version; unlike object_deltify it may
+itself be a delta) and const RepoConfig* config. The delta is only written if the chain through base_id stays
+within delta_max_chain and does not lead back to the object.
+*/
+int object_rebase(const char* object_id, const char* base_id, const RepoConfig* config) {
+    if (strcmp(object_id, base_id) == 0 || strlen(base_id) != DELTA_BASE_ID_LEN) return -1;
+
+    // Length of the chain the new delta would extend
+    int usable = config->delta_enabled;
+    char id[MAX_HASH_LEN], next[MAX_HASH_LEN];
+    snprintf(id, sizeof(id), "%s", base_id);
+    for (int depth = 1; usable; depth++) {
+        int delta = object_delta_base(id, next);
+        if (delta < 0 || depth > config->delta_max_chain || strcmp(id, object_id) == 0) usable = 0;
+        if (delta <= 0) break;
+        memcpy(id, next, sizeof(id));
+    }
+    if (usable && (is_chunked(base_id) || full_object_size(base_id) > config->delta_max_size)) usable = 0;
+
+    unsigned char* target = NULL;
+    size_t target_len = 0;
+    if (object_read(object_id, &target, &target_len) != 0) return -1;
+    if (target_len > (size_t)config->delta_max_size) usable = 0;
+
+    // Keep the delta only if it saves at least a quarter of the space, as object_deltify does
+    int status = -1;
+    unsigned char* base = NULL;
+    size_t base_len = 0;
+    if (usable && object_read(base_id, &base, &base_len) == 0) {
+        unsigned char* delta = NULL;
+        size_t delta_len = 0;
+        if (delta_create(base, base_len, target, target_len, &delta, &delta_len) == 0 &&
+            DELTA_BASE_ID_LEN + delta_len < target_len - target_len / 4) {
+            unsigned char* payload = malloc(DELTA_BASE_ID_LEN + delta_len);
+            if (payload) {
+                memcpy(payload, base_id, DELTA_BASE_ID_LEN);
+                memcpy(payload + DELTA_BASE_ID_LEN, delta, delta_len);
+                if (write_encoded_object(object_id, OBJECT_DELTA, config->cold_codec, config->cold_level,
+                                         payload, DELTA_BASE_ID_LEN + delta_len) == 0) status = 1;
+                free(payload);
+            }
+        }
+        free(delta);
+        free(base);
+    }
+    if (status != 1) {
+        status = (write_encoded_object(object_id, OBJECT_FULL, config->cold_codec, config->cold_level,
+                                       target, target_len) == 0) ? 0 : -1;
+    }
+    free(target);
+    return status;
+}
+
+/*
+The function stored_id_matches checks that the contents actually written have the id they are published under.
+A file rewritten while it was being stored has another id; publishing it would break content addressing, and
+every later check-in of the real contents would trust the wrong object.
+Returns 1 if the ids match, 0 otherwise (reported on stderr).
+It takes const char* filepath (the file stored, for the message), const char* stored_id (hash of the bytes
+written) and const char* object_id (the id the caller asked for).
+*/
+int stored_id_matches(const char* filepath, const char* stored_id, const char* object_id) {
+    if (strcmp(stored_id, object_id) == 0) return 1;
+    fprintf(stderr, "vcs: '%s' changed while it was being stored, not storing it\n", filepath);
+    return 0;
+}
+
+/*
+The function store_compressed writes a file as a FULL object compressed with the given codec, streaming it
+from the source so large files never have to fit in memory.
+Returns 1 if the compressed object was stored, 0 if compression did not make it smaller, -1 on failure (the
+contents read no longer hash to object_id included).
+The contents are hashed as they are compressed, so the object is checked against exactly the bytes it holds.
+*/
+static int store_compressed(const char* filepath, const char* object_id, int codec, int level) {
+    char temp_file[MAX_PATH_LEN];
+    FILE* src = fopen(filepath, "rb");
+    if (!src) return -1;
+    unsigned char* block = malloc(HASH_BLOCK_SIZE);
+    if (!block || create_temp_file(temp_file, sizeof(temp_file)) != 0) {
+        free(block);
+        fclose(src);
+        return -1;
+    }
+
+    FILE* dst = fopen(temp_file, "wb");
+    HashState digest;
+    int status = -1;
+    long total = 0;
+    if (dst && hash_begin(&digest) == 0) {
+        // The header carries the size of the contents, filled in once they have been read
+        unsigned char header[OBJECT_HEADER_SIZE];
+        encode_header(header, OBJECT_FULL, codec, 0);
+        Compressor* compressor = (fwrite(header, 1, sizeof(header), dst) == sizeof(header))
+                                 ? compressor_begin(codec, level, dst) : NULL;
+        if (compressor) {
+            status = 0;
+            for (;;) {
+                size_t bytes = fread(block, 1, HASH_BLOCK_SIZE, src);
+                if (ferror(src)) status = -1;
+                if (status != 0 || bytes == 0) break;
+                total += (long)bytes;
+                if (hash_update(&digest, block, bytes) != 0 || compressor_update(compressor, block, bytes) != 0) status = -1;
+            }
+            if (compressor_finish(compressor) != 0) status = -1;
+        }
+        char stored_id[MAX_HASH_LEN];
+        if (status == 0) {
+            if (hash_finish(&digest, stored_id) != 0 || !stored_id_matches(filepath, stored_id, object_id)) status = -1;
+        } else {
+            hash_abort(&digest);
+        }
+        encode_header(header, OBJECT_FULL, codec, (uint64_t)total);
+        if (status == 0 && (fseek(dst, 0, SEEK_SET) != 0 || fwrite(header, 1, sizeof(header), dst) != sizeof(header))) {
+            status = -1;
+        }
+        // The compressed object is only worth keeping if it is smaller than the original
+        if (status == 0 && fseek(dst, 0, SEEK_END) == 0 && ftell(dst) >= total) status = 1;
+    }
+    if (dst && fclose(dst) != 0) status = -1;
+    fclose(src);
+    free(block);
+
+    if (status != 0) {
+        unlink(temp_file);
+        return (status == 1) ? 0 : -1;
+    }
+    return (publish_object(temp_file, object_id) == 0) ? 1 : -1;
+}
+
+static int freshen_chunks(const char* object_id);
+
+/*
+The function freshen_object touches an existing object and the bases of its delta chain, so a gc running at the
+same time sees them as new and keeps them (see gc.c).
+Returns 0 if the object and every base it needs exist, -1 otherwise (the object has to be stored again).
+It takes const char* object_id.
+*/
+static int freshen_object(const char* object_id) {
+    char id[MAX_HASH_LEN], base[MAX_HASH_LEN];
+    snprintf(id, sizeof(id), "%s", object_id);
+    for (int depth = 0; depth <= MAX_DELTA_DEPTH; depth++) {
+        char path[MAX_PATH_LEN];
+        if (object_path(id, path, sizeof(path)) != 0) return -1;
+        if (utimensat(AT_FDCWD, path, NULL, 0) != 0 && pack_freshen(id) != 0) return -1;
+        int delta = object_delta_base(id, base);
+        if (delta < 0) return -1;
+        if (delta == 0) return freshen_chunks(id);
+        memcpy(id, base, sizeof(id));
+    }
+    return -1;
+}
+
+/*
+The function freshen_chunks freshens the chunks of a chunked object.
+Returns 0 if every chunk exists (or the object is not chunked), -1 otherwise.
+A chunk is always smaller than the file it belongs to, so the recursion ends.
+*/
+static int freshen_chunks(const char* object_id) {
+    unsigned char* list = NULL;
+    size_t count = 0;
+    int chunked = object_chunk_list(object_id, &list, &count);
+    if (chunked <= 0) return chunked;
+
+    int status = 0;
+    for (size_t i = 0; i < count && status == 0; i++) {
+        char chunk_id[MAX_HASH_LEN];
+        hash_to_hex(list + i * CHUNK_ENTRY_SIZE, chunk_id);
+        status = freshen_object(chunk_id);
+    }
+    free(list);
+    return status;
+}
+
+/*
+The function store_object adds a file's contents to the object store, unless identical content is already stored.
+Returns 0 on success (object stored or already present), -1 on failure.
+It takes const char* filepath (file to store), const char* object_id (the file's content hash, as computed by hash_file)
+and const RepoConfig* config (the hot codec compresses the new object).
+The content is first written to .vcs/temp and then renamed into place, so a partially written object never
+becomes visible under its id. What was written is hashed again before the rename: if the file changed since
+object_id was computed, nothing is stored and -1 is returned.
+*/
+int store_object(const char* filepath, const char* object_id, const RepoConfig* config) {
+    // Identical content has been stored before, nothing to write
+    if (freshen_object(object_id) == 0) return 0;
+
+    char temp_file[MAX_PATH_LEN];
+
+    if (create_fanout_directory(object_id) != 0) return -1;
+
+    // Large files are split into chunks that later versions can share
+    struct stat st;
+    if (config->chunk_threshold > 0 && stat(filepath, &st) == 0 && st.st_size >= config->chunk_threshold) {
+        int chunked = store_chunked(filepath, object_id, config);
+        if (chunked != 0) return (chunked == 1) ? 0 : -1;
+    }
+
+    // Compress with the hot codec; incompressible contents fall through to a plain copy
+    if (config->hot_codec != CODEC_NONE) {
+        int stored = store_compressed(filepath, object_id, config->hot_codec, config->hot_level);
+        if (stored != 0) return (stored == 1) ? 0 : -1;
+    }
+
+    // Contents that look like an encoded object get a header so they cannot be mistaken for one
+    char prefix[sizeof(object_magic)];
+    FILE* source = fopen(filepath, "rb");
+    if (!source) return -1;
+    size_t prefix_len = fread(prefix, 1, sizeof(prefix), source);
+    fclose(source);
+    if (prefix_len == sizeof(prefix) && memcmp(prefix, object_magic, sizeof(prefix)) == 0) {
+        unsigned char* data = NULL;
+        size_t len = 0;
+        char stored_id[MAX_HASH_LEN];
+        if (read_file_contents(filepath, &data, &len) != 0) return -1;
+        int status = (hash_buffer(data, len, stored_id) == 0 && stored_id_matches(filepath, stored_id, object_id))
+                     ? write_encoded_object(object_id, OBJECT_FULL, CODEC_NONE, 0, data, len) : -1;
+        free(data);
+        return status;
+    }
+
+    // Reserve a unique temporary file inside .vcs/temp to copy the content into
+    if (create_temp_file(temp_file, sizeof(temp_file)) != 0) return -1;
+
+    // The copy may be a reflink, so it is hashed rather than the source: it is what gets published
+    char stored_id[MAX_HASH_LEN];
+    if (copy_file(filepath, temp_file) != 0 || hash_file(temp_file, stored_id, NULL) != 0 ||
+        !stored_id_matches(filepath, stored_id, object_id)) {
+        unlink(temp_file);
+        return -1;
+    }
+
+    // Publish the object under its id
+    return publish_object(temp_file, object_id);
+}
+
+#define PIPELINE_PROBE_SIZE (64 * 1024)     // Bytes of the first block compressed to decide whether compressing pays
+
+// Writing stage of store_object_pipelined
+typedef struct ObjectWriter {
+    FILE* out;
+    int codec;
+    int level;
+    int started;                // The first block decided the form of the object
+    int encoded;                // The object has a header, whose size is filled in at the end
+    Compressor* compressor;     // Set while the contents are compressed
+} ObjectWriter;
+
+/*
+The function hash_stage feeds a block into the digest (pipeline stage).
+*/
+static int hash_stage(void* context, const unsigned char* data, size_t len) {
+    return hash_update(context, data, len);
+}
+
+/*
+The function write_stage writes a block of the new object, compressed or as it is (pipeline stage).
+The first block decides: the hot codec is used if it shrinks the start of the file noticeably, otherwise the
+contents are stored plain, with a header only if they would look like an encoded object.
+*/
+static int write_stage(void* context, const unsigned char* data, size_t len) {
+    ObjectWriter* writer = context;
+    if (!writer->started) {
+        writer->started = 1;
+        if (writer->codec != CODEC_NONE) {
+            size_t probe = (len < PIPELINE_PROBE_SIZE) ? len : PIPELINE_PROBE_SIZE;
+            unsigned char* compressed = NULL;
+            size_t compressed_len = 0;
+            if (compress_buffer(writer->codec, writer->level, data, probe, &compressed, &compressed_len) != 0 ||
+                compressed_len >= probe - probe / 64) {
+                writer->codec = CODEC_NONE;
+            }
+            free(compressed);
+        }
+        writer->encoded = writer->codec != CODEC_NONE ||
+                          (len >= sizeof(object_magic) && memcmp(data, object_magic, sizeof(object_magic)) == 0);
+        if (writer->encoded) {
+            unsigned char header[OBJECT_HEADER_SIZE];
+            encode_header(header, OBJECT_FULL, writer->codec, 0);
+            if (fwrite(header, 1, sizeof(header), writer->out) != sizeof(header)) return -1;
+        }
+        if (writer->codec != CODEC_NONE) {
+            writer->compressor = compressor_begin(writer->codec, writer->level, writer->out);
+            if (!writer->compressor) return -1;
+        }
+    }
+    if (writer->compressor) return compressor_update(writer->compressor, data, len);
+    return (fwrite(data, 1, len, writer->out) == len) ? 0 : -1;
+}
+
+/*
+The function store_object_pipelined hashes a file and stores it in the object store in a single read pass.
+Returns 0 on success (object stored, or already present), -1 on failure.
+It takes const char* filepath, char* object_id (receives the content hash, MAX_HASH_LEN bytes),
+long* size_out (receives the file size) and const RepoConfig* config (the hot codec compresses the object).
+The file is read once by pipeline_file; hashing and compressing/writing run as two stages on threads of their own.
+The id is only known at the end, so the object is written to .vcs/temp first and dropped if the same contents
+are stored already. Check-in stores all new contents this way: the id comes from the very bytes written, so a
+file rewritten meanwhile cannot end up under the wrong id.
+*/
+int store_object_pipelined(const char* filepath, char* object_id, long* size_out, const RepoConfig* config) {
+    long long started = stats_clock();
+    char temp_file[MAX_PATH_LEN];
+    if (create_temp_file(temp_file, sizeof(temp_file)) != 0) return -1;
+    FILE* out = fopen(temp_file, "wb");
+    HashState digest;
+    if (!out || hash_begin(&digest) != 0) {
+        if (out) fclose(out);
+        unlink(temp_file);
+        return -1;
+    }
+
+    ObjectWriter writer = {out, config->hot_codec, config->hot_level, 0, 0, NULL};
+    PipelineStage stages[2] = {{hash_stage, &digest}, {write_stage, &writer}};
+    long total = 0;
+    long long reads = 0;
+    int status = pipeline_file(filepath, stages, 2, &total, &reads);
+    if (writer.compressor && compressor_finish(writer.compressor) != 0) status = -1;
+
+    // The header carries the size of the contents, known now
+    if (status == 0 && writer.encoded) {
+        unsigned char header[OBJECT_HEADER_SIZE];
+        encode_header(header, OBJECT_FULL, writer.codec, (uint64_t)total);
+        if (fseek(out, 0, SEEK_SET) != 0 || fwrite(header, 1, sizeof(header), out) != sizeof(header)) status = -1;
+    }
+    long long written = (status == 0 && fseek(out, 0, SEEK_END) == 0) ? (long long)ftell(out) : 0;
+    if (fclose(out) != 0) status = -1;
+    if (status == 0) {
+        status = hash_finish(&digest, object_id);
+    } else {
+        hash_abort(&digest);
+    }
+
+    // Identical contents stored before win; otherwise the new object goes into place
+    if (status == 0 && freshen_object(object_id) == 0) {
+        unlink(temp_file);
+        written = 0;
+    } else if (status == 0) {
+        status = (create_fanout_directory(object_id) == 0) ? publish_object(temp_file, object_id) : -1;
+    }
+    if (status != 0) unlink(temp_file);
+    if (size_out) *size_out = total;
+    stats_add(STAT_STORE, started, total, written, reads);
+    return status;
+}
+
+/*
+The function object_store_buffer adds in-memory contents to the object store, unless they are already stored.
+Returns 0 on success (object stored or already present), -1 on failure.
+It takes const char* object_id (hash of the contents), the contents and const RepoConfig* config (the hot codec
+compresses the new object). Safe to call from several threads for different objects.
+*/
+int object_store_buffer(const char* object_id, const unsigned char* data, size_t len, const RepoConfig* config) {
+    if (freshen_object(object_id) == 0) return 0;
+    return write_encoded_object(object_id, OBJECT_FULL, config->hot_codec, config->hot_level, data, len);
+}
+
+/*
+The function object_store_chunks writes the chunk list of a large file as its object.
+Returns 0 on success, -1 on failure.
+It takes const char* object_id (hash of the whole file) and the list (CHUNK_ENTRY_SIZE bytes per chunk).
+The chunks must be stored already.
+*/
+int object_store_chunks(const char* object_id, const unsigned char* list, size_t len) {
+    return write_encoded_object(object_id, OBJECT_CHUNKS, CODEC_NONE, 0, list, len);
+}
+
+/*
+The function restore_object writes the contents of a stored object to a destination file.
+Returns 0 on success, -1 on failure (object missing, corrupt or file write errors).
+It takes const char* object_id (id of the object to restore) and const char* dest (destination file path).
+Plain objects are copied directly and compressed full objects are decompressed while streaming (packed objects
+straight from the pack mapping); chunked objects are written chunk by chunk and delta objects are rebuilt in
+memory first.
+*/
+int restore_object(const char* object_id, const char* dest) {
+    char object_file[MAX_PATH_LEN];
+    if (object_path(object_id, object_file, sizeof(object_file)) != 0) return -1;
+
+    ObjectHeader header;
+    int encoded = object_read_header(object_id, &header);
+    if (encoded < 0) {
+        return -1;  // The requested object does not exist
+    }
+    const unsigned char* packed = NULL;
+    size_t packed_len = 0;
+    if (!file_exists(object_file) && !pack_lookup(object_id, &packed, &packed_len)) return -1;
+    if (encoded == 0) {
+        return packed ? write_file_contents(dest, packed, packed_len) : copy_file(object_file, dest);
+    }
+
+    if (header.type == OBJECT_FULL && header.codec != CODEC_NONE) {
+        // fmemopen() only reads the mapping, the cast drops const for its signature
+        FILE* src = packed ? fmemopen((void*)packed, packed_len, "rb") : fopen(object_file, "rb");
+        if (!src) return -1;
+        FILE* dst = fopen(dest, "wb");
+        int status = -1;
+        if (dst) {
+            if (fseek(src, OBJECT_HEADER_SIZE, SEEK_SET) == 0) {
+                status = decompress_stream(header.codec, src, dst);
+            }
+            if (fclose(dst) != 0) status = -1;
+        }
+        fclose(src);
+        return status;
+    }
+
+    if (header.type == OBJECT_CHUNKS) {
+        unsigned char* list = NULL;
+        size_t count = 0;
+        if (object_chunk_list(object_id, &list, &count) != 1) return -1;
+        int status = chunks_restore(list, count * CHUNK_ENTRY_SIZE, dest);
+        free(list);
+        return status;
+    }
+
+    unsigned char* data = NULL;
+    size_t len = 0;
+    if (object_read(object_id, &data, &len) != 0) return -1;
+    int status = write_file_contents(dest, data, len);
+    free(data);
+    return status;
+}
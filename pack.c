@@ -0,0 +1,745 @@
+#include "vcs.h"
+#include <stdint.h>     // Provides fixed-width integer types for the pack and index layout
+#include <fcntl.h>      // Provides open() flags and AT_FDCWD
+#include <sys/mman.h>   // Provides mmap() to map packs and their indexes
+#include <pthread.h>    // Provides the mutex guarding the list of mapped packs
+
+/*
+Packs bundle many objects into one file, so a large store does not need an inode and a directory entry per object
+and backups copy a few large files instead of millions of small ones. Each pack is a pair of files in
+.vcs/objects/pack:
+    pack-<id>.pack  - PACK_MAGIC, u32 format version, u32 object count, then the objects back to back, each exactly
+                      as a loose object file holds it (plain contents or an encoded object, see objects.c)
+    pack-<id>.idx   - IDX_MAGIC, u32 format version, u32 object count, u32 generation, u32 reserved,
+                      u32 fanout[256] (fanout[b] = number of objects whose id starts with a byte <= b),
+                      then one PackIndexEntry per object, sorted by id
+<id> is the SHA-256 of the sorted object ids and all integers are in host byte order. Both files are mapped on
+first use; a lookup narrows the range with the fanout table and binary-searches it. The index is renamed into
+place last, so a pack without an index is incomplete and ignored.
+New objects are written loose (except those copied in by push and pull, which arrive as a pack, see remote.c),
+and objects are rewritten loose (as deltas, or recompressed), so a loose object takes precedence over a packed
+copy with the same id, and a pack with a higher generation over an older one. pack_objects moves the loose objects into a new pack, on demand (vcs pack) or once a check-in finds more
+than config.auto_pack of them.
+*/
+
+#define PACK_DIR "pack"                 // Sub-directory of .vcs/objects holding the packs
+#define PACK_MAGIC "VCSPACK1"
+#define IDX_MAGIC "VCSIDX1\n"
+#define PACK_FORMAT_VERSION 1
+#define PACK_HEADER_SIZE 16
+#define IDX_HEADER_SIZE 24
+#define PACK_FANOUT_SIZE (256 * sizeof(uint32_t))
+#define PACK_NAME_LEN (5 + MAX_HASH_LEN)    // "pack-" and the hex id with its terminator
+#define PACK_AUTO_MERGE 16              // Automatic packing merges all packs into one once there are this many
+#define PACK_SAMPLE_DIR 0x17            // Fan-out directory counted to estimate the number of loose objects
+
+// Index entry of one packed object (48 bytes)
+typedef struct PackIndexEntry {
+    unsigned char id[HASH_RAW_LEN];
+    uint64_t offset;                    // Position of the object in the pack
+    uint64_t length;                    // Size of the object
+} PackIndexEntry;
+
+// A mapped pack and its index
+typedef struct Pack {
+    char name[PACK_NAME_LEN];           // "pack-<id>", without extension
+    const unsigned char* data;          // Mapped .pack
+    size_t size;
+    void* index_map;                    // Mapped .idx
+    size_t index_size;
+    const uint32_t* fanout;
+    const PackIndexEntry* entries;
+    uint32_t count;
+    uint32_t generation;
+} Pack;
+
+// One object to be written into a new pack
+typedef struct PackSource {
+    unsigned char id[HASH_RAW_LEN];
+    int priority;                       // 0 for loose objects, then the position of the pack holding it
+    char* path;                         // Loose object file (owned), or NULL
+    const unsigned char* data;          // Packed copy, if path is NULL
+    size_t length;
+    int written;                        // Set once the object is in the new pack
+} PackSource;
+
+// Packs mapped by this process, highest generation first. Mappings are kept until the object store changes
+// (benchmarks switch between repositories), so pointers handed out by pack_lookup stay valid.
+static Pack* packs = NULL;
+static int pack_count = 0;
+static int pack_cap = 0;
+static char packs_dir[MAX_PATH_LEN];    // Directory the list was read from
+static struct timespec packs_seen;      // Its modification time when it was last read
+static pthread_mutex_t pack_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+The function pack_directory builds the path of .vcs/objects/pack of the repository in the current directory.
+*/
+static void pack_directory(char* path, size_t size) {
+    char current_dir[MAX_PATH_LEN];
+    getcwd(current_dir, sizeof(current_dir));
+    snprintf(path, size, "%s/%s/%s/%s", current_dir, VCS_DIR, OBJECTS_DIR, PACK_DIR);
+}
+
+/*
+The function map_whole_file maps a file read-only.
+Returns 0 on success, -1 on failure.
+*/
+static int map_whole_file(const char* path, void** base, size_t* size) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return -1;
+    }
+    *base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (*base == MAP_FAILED) return -1;
+    *size = (size_t)st.st_size;
+    return 0;
+}
+
+/*
+The function unmap_packs drops every mapped pack.
+*/
+static void unmap_packs(void) {
+    for (int i = 0; i < pack_count; i++) {
+        munmap((void*)packs[i].data, packs[i].size);
+        munmap(packs[i].index_map, packs[i].index_size);
+    }
+    pack_count = 0;
+}
+
+/*
+The function load_pack maps a pack and its index and adds it to the list, keeping the list ordered by generation.
+Returns 0 on success, -1 if the pack is unreadable or corrupt (it is skipped).
+*/
+static int load_pack(const char* dir, const char* name) {
+    char path[MAX_PATH_LEN];
+    Pack pack;
+    memset(&pack, 0, sizeof(pack));
+    snprintf(pack.name, sizeof(pack.name), "%s", name);
+
+    snprintf(path, sizeof(path), "%s/%s.idx", dir, name);
+    if (map_whole_file(path, &pack.index_map, &pack.index_size) != 0) return -1;
+    const unsigned char* index = pack.index_map;
+    uint32_t header[4];
+    int valid = pack.index_size >= IDX_HEADER_SIZE + PACK_FANOUT_SIZE && memcmp(index, IDX_MAGIC, 8) == 0;
+    if (valid) {
+        memcpy(header, index + 8, sizeof(header));
+        pack.count = header[1];
+        pack.generation = header[2];
+        pack.fanout = (const uint32_t*)(index + IDX_HEADER_SIZE);
+        pack.entries = (const PackIndexEntry*)(index + IDX_HEADER_SIZE + PACK_FANOUT_SIZE);
+        valid = header[0] == PACK_FORMAT_VERSION && pack.fanout[255] == pack.count &&
+                pack.index_size == IDX_HEADER_SIZE + PACK_FANOUT_SIZE + (size_t)pack.count * sizeof(PackIndexEntry);
+    }
+    void* data = NULL;
+    snprintf(path, sizeof(path), "%s/%s.pack", dir, name);
+    if (valid && map_whole_file(path, &data, &pack.size) != 0) valid = 0;
+    pack.data = data;
+    if (valid && (pack.size < PACK_HEADER_SIZE || memcmp(pack.data, PACK_MAGIC, 8) != 0)) valid = 0;
+    if (valid && pack_count == pack_cap) {
+        int cap = pack_cap ? pack_cap * 2 : 8;
+        Pack* grown = realloc(packs, (size_t)cap * sizeof(Pack));
+        if (grown) {
+            packs = grown;
+            pack_cap = cap;
+        } else {
+            valid = 0;
+        }
+    }
+    if (!valid) {
+        trace("pack: ignoring unreadable pack %s", name);
+        if (data) munmap(data, pack.size);
+        munmap(pack.index_map, pack.index_size);
+        return -1;
+    }
+
+    int at = pack_count++;
+    while (at > 0 && packs[at - 1].generation < pack.generation) {
+        packs[at] = packs[at - 1];
+        at--;
+    }
+    packs[at] = pack;
+    return 0;
+}
+
+/*
+The function scan_packs maps the packs that appeared since the pack directory was last read.
+Returns the number of packs added. Called with pack_mutex held.
+It takes int force (read the directory even if its modification time did not change).
+*/
+static int scan_packs(int force) {
+    char dir_path[MAX_PATH_LEN];
+    pack_directory(dir_path, sizeof(dir_path));
+    if (strcmp(dir_path, packs_dir) != 0) {
+        unmap_packs();
+        snprintf(packs_dir, sizeof(packs_dir), "%s", dir_path);
+        force = 1;
+    }
+
+    struct stat st;
+    if (stat(dir_path, &st) != 0) return 0;
+    // Directory times are coarse, so a directory changed within the last second is read again regardless
+    if (!force && st.st_mtim.tv_sec == packs_seen.tv_sec && st.st_mtim.tv_nsec == packs_seen.tv_nsec &&
+        st.st_mtim.tv_sec < time(NULL) - 1) {
+        return 0;
+    }
+    packs_seen = st.st_mtim;
+
+    DIR* dir = opendir(dir_path);
+    if (!dir) return 0;
+    int added = 0;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        size_t len = strlen(entry->d_name);
+        if (len <= 4 || len - 4 >= PACK_NAME_LEN || strcmp(entry->d_name + len - 4, ".idx") != 0) continue;
+        char name[PACK_NAME_LEN];
+        snprintf(name, sizeof(name), "%.*s", (int)(len - 4), entry->d_name);
+        int known = 0;
+        for (int i = 0; i < pack_count && !known; i++) known = strcmp(packs[i].name, name) == 0;
+        if (!known && load_pack(dir_path, name) == 0) added++;
+    }
+    closedir(dir);
+    return added;
+}
+
+/*
+The function pack_search finds an object in one pack.
+Returns the index of its entry, or -1 if the pack does not hold it.
+*/
+static int pack_search(const Pack* pack, const unsigned char* id) {
+    uint32_t low = id[0] ? pack->fanout[id[0] - 1] : 0;
+    uint32_t high = pack->fanout[id[0]];
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        int cmp = memcmp(pack->entries[mid].id, id, HASH_RAW_LEN);
+        if (cmp == 0) {
+            const PackIndexEntry* e = &pack->entries[mid];
+            return (e->offset <= pack->size && e->length <= pack->size - e->offset) ? (int)mid : -1;
+        }
+        if (cmp < 0) low = mid + 1;
+        else high = mid;
+    }
+    return -1;
+}
+
+/*
+The function find_packed looks up an object in the mapped packs, reading the pack directory again once on a miss.
+Returns the pack holding it (the entry index in *entry), or NULL. Called with pack_mutex held.
+*/
+static const Pack* find_packed(const unsigned char* id, int* entry) {
+    for (int attempt = 0; attempt < 2; attempt++) {
+        for (int i = 0; i < pack_count; i++) {
+            *entry = pack_search(&packs[i], id);
+            if (*entry >= 0) return &packs[i];
+        }
+        if (attempt == 0 && scan_packs(0) == 0) break;
+    }
+    return NULL;
+}
+
+/*
+The function pack_lookup finds a packed object.
+Returns 1 if a pack holds the object (*data / *len point at its bytes in the mapping, valid for the rest of the
+process), 0 if no pack does.
+It takes const char* object_id (hex id), const unsigned char** data and size_t* len. It is safe to call from
+worker threads.
+*/
+int pack_lookup(const char* object_id, const unsigned char** data, size_t* len) {
+    unsigned char id[HASH_RAW_LEN];
+    if (hash_from_hex(object_id, id) != 0) return 0;
+
+    pthread_mutex_lock(&pack_mutex);
+    int entry = -1;
+    const Pack* pack = find_packed(id, &entry);
+    if (pack) {
+        *data = pack->data + pack->entries[entry].offset;
+        *len = (size_t)pack->entries[entry].length;
+    }
+    pthread_mutex_unlock(&pack_mutex);
+    return pack != NULL;
+}
+
+/*
+The function pack_freshen updates the modification time of the pack holding an object, so a gc running at the same
+time keeps the pack as it is (see gc.c).
+Returns 0 if a pack holds the object and was touched, -1 otherwise.
+It takes const char* object_id.
+*/
+int pack_freshen(const char* object_id) {
+    unsigned char id[HASH_RAW_LEN];
+    if (hash_from_hex(object_id, id) != 0) return -1;
+
+    pthread_mutex_lock(&pack_mutex);
+    int entry = -1;
+    const Pack* pack = find_packed(id, &entry);
+    int status = -1;
+    if (pack) {
+        char path[MAX_PATH_LEN];
+        snprintf(path, sizeof(path), "%s/%s.pack", packs_dir, pack->name);
+        status = (utimensat(AT_FDCWD, path, NULL, 0) == 0) ? 0 : -1;
+    }
+    pthread_mutex_unlock(&pack_mutex);
+    return status;
+}
+
+/*
+The function pack_visit hands the id of every object in the packs last modified before older_than to a callback.
+Returns the number of objects visited.
+It takes time_t older_than, the callback visit and its void* context. Objects held by several packs are
+visited once per pack.
+*/
+long pack_visit(time_t older_than, void (*visit)(void* context, const unsigned char* id), void* context) {
+    pthread_mutex_lock(&pack_mutex);
+    scan_packs(1);
+    long visited = 0;
+    for (int p = 0; p < pack_count; p++) {
+        char path[MAX_PATH_LEN];
+        struct stat st;
+        snprintf(path, sizeof(path), "%s/%s.pack", packs_dir, packs[p].name);
+        if (stat(path, &st) != 0 || st.st_mtime >= older_than) continue;
+        for (uint32_t i = 0; i < packs[p].count; i++) visit(context, packs[p].entries[i].id);
+        visited += (long)packs[p].count;
+    }
+    pthread_mutex_unlock(&pack_mutex);
+    return visited;
+}
+
+/*
+The function compare_sources orders pack sources by id, preferred copies first (qsort callback).
+*/
+static int compare_sources(const void* a, const void* b) {
+    const PackSource* x = a;
+    const PackSource* y = b;
+    int cmp = memcmp(x->id, y->id, HASH_RAW_LEN);
+    if (cmp != 0) return cmp;
+    return (x->priority > y->priority) - (x->priority < y->priority);
+}
+
+/*
+The function add_source appends an object to a growable array of pack sources.
+Returns 0 on success, -1 if memory allocation fails (path is freed then).
+*/
+static int add_source(PackSource** sources, size_t* count, size_t* cap, const PackSource* source) {
+    if (*count == *cap) {
+        size_t grown_cap = *cap ? *cap * 2 : 1024;
+        PackSource* grown = realloc(*sources, grown_cap * sizeof(PackSource));
+        if (!grown) {
+            free(source->path);
+            return -1;
+        }
+        *sources = grown;
+        *cap = grown_cap;
+    }
+    (*sources)[(*count)++] = *source;
+    return 0;
+}
+
+/*
+The function collect_loose_objects adds every loose object of the store to the sources.
+Returns 0 on success, -1 on failure.
+*/
+static int collect_loose_objects(PackSource** sources, size_t* count, size_t* cap) {
+    char current_dir[MAX_PATH_LEN];
+    getcwd(current_dir, sizeof(current_dir));
+    for (int fanout = 0; fanout < 256; fanout++) {
+        char dir_path[MAX_PATH_LEN];
+        snprintf(dir_path, sizeof(dir_path), "%s/%s/%s/%02x", current_dir, VCS_DIR, OBJECTS_DIR, fanout);
+        DIR* dir = opendir(dir_path);
+        if (!dir) continue;
+        struct dirent* entry;
+        while ((entry = readdir(dir)) != NULL) {
+            char hex[MAX_HASH_LEN];
+            PackSource source;
+            memset(&source, 0, sizeof(source));
+            if (strlen(entry->d_name) != MAX_HASH_LEN - 3) continue;
+            snprintf(hex, sizeof(hex), "%02x%s", fanout, entry->d_name);
+            if (hash_from_hex(hex, source.id) != 0) continue;
+            source.path = malloc(MAX_PATH_LEN);
+            if (!source.path) {
+                closedir(dir);
+                return -1;
+            }
+            snprintf(source.path, MAX_PATH_LEN, "%s/%s", dir_path, entry->d_name);
+            if (add_source(sources, count, cap, &source) != 0) {
+                closedir(dir);
+                return -1;
+            }
+        }
+        closedir(dir);
+    }
+    return 0;
+}
+
+/*
+The function write_pack writes sources (sorted by id, without duplicates) as a new pack and index.
+Returns the number of objects in the new pack (0 if none could be read, in which case nothing is written),
+or -1 on failure. Loose objects that vanished in the meantime are skipped; the others are marked as written.
+It takes PackSource* sources / size_t count, uint32_t generation (of the new pack) and char* name (receives
+the pack's name, PACK_NAME_LEN bytes).
+*/
+static int write_pack(PackSource* sources, size_t count, uint32_t generation, char* name) {
+    char current_dir[MAX_PATH_LEN], dir_path[MAX_PATH_LEN];
+    char pack_temp[MAX_PATH_LEN], index_temp[MAX_PATH_LEN];
+    getcwd(current_dir, sizeof(current_dir));
+    pack_directory(dir_path, sizeof(dir_path));
+    snprintf(pack_temp, sizeof(pack_temp), "%s/%s/temp/pack.XXXXXX", current_dir, VCS_DIR);
+    snprintf(index_temp, sizeof(index_temp), "%s/%s/temp/idx.XXXXXX", current_dir, VCS_DIR);
+
+    PackIndexEntry* entries = malloc((count + 1) * sizeof(PackIndexEntry));
+    int pack_fd = mkstemp(pack_temp);
+    FILE* pack = (pack_fd >= 0) ? fdopen(pack_fd, "wb") : NULL;
+    if (!entries || !pack) {
+        free(entries);
+        if (pack) fclose(pack);
+        else if (pack_fd >= 0) close(pack_fd);
+        if (pack_fd >= 0) unlink(pack_temp);
+        return -1;
+    }
+    setvbuf(pack, NULL, _IOFBF, HASH_BLOCK_SIZE);
+
+    // Objects are copied back to back behind the header; the count is filled in at the end
+    unsigned char header[PACK_HEADER_SIZE] = {0};
+    memcpy(header, PACK_MAGIC, 8);
+    uint32_t fields[2] = {PACK_FORMAT_VERSION, 0};
+    int status = (fwrite(header, 1, sizeof(header), pack) == sizeof(header)) ? 0 : -1;
+    uint64_t offset = PACK_HEADER_SIZE;
+    uint32_t written = 0;
+    HashState digest;
+    if (status == 0 && hash_begin(&digest) != 0) status = -1;
+    for (size_t i = 0; status == 0 && i < count; i++) {
+        PackSource* s = &sources[i];
+        unsigned char* loaded = NULL;
+        const unsigned char* bytes = s->data;
+        size_t length = s->length;
+        if (s->path && read_file_contents(s->path, &loaded, &length) != 0) continue;    // Removed meanwhile
+        if (s->path) bytes = loaded;
+        if (length > 0 && fwrite(bytes, 1, length, pack) != length) status = -1;
+        free(loaded);
+        if (status != 0) break;
+
+        PackIndexEntry* e = &entries[written++];
+        memcpy(e->id, s->id, HASH_RAW_LEN);
+        e->offset = offset;
+        e->length = length;
+        offset += length;
+        s->written = 1;
+        hash_update(&digest, s->id, HASH_RAW_LEN);
+    }
+    char id[MAX_HASH_LEN] = "";
+    if (status == 0) hash_finish(&digest, id);
+    else hash_abort(&digest);
+
+    fields[1] = written;
+    memcpy(header + 8, fields, sizeof(fields));
+    if (status == 0 && (fflush(pack) != 0 || pwrite(pack_fd, header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+                        fsync(pack_fd) != 0)) {
+        status = -1;
+    }
+    if (fclose(pack) != 0) status = -1;
+
+    // The index: header, fanout table and the entries, which are already sorted by id
+    int index_fd = (status == 0 && written > 0) ? mkstemp(index_temp) : -1;
+    if (index_fd >= 0) {
+        uint32_t idx_fields[4] = {PACK_FORMAT_VERSION, written, generation, 0};
+        uint32_t fanout[256] = {0};
+        for (uint32_t i = 0; i < written; i++) fanout[entries[i].id[0]]++;
+        for (int b = 1; b < 256; b++) fanout[b] += fanout[b - 1];
+        unsigned char index_header[IDX_HEADER_SIZE];
+        memcpy(index_header, IDX_MAGIC, 8);
+        memcpy(index_header + 8, idx_fields, sizeof(idx_fields));
+        FILE* index = fdopen(index_fd, "wb");
+        if (!index) {
+            close(index_fd);
+            status = -1;
+        } else {
+            if (fwrite(index_header, 1, sizeof(index_header), index) != sizeof(index_header) ||
+                fwrite(fanout, 1, sizeof(fanout), index) != sizeof(fanout) ||
+                fwrite(entries, sizeof(PackIndexEntry), written, index) != written ||
+                fflush(index) != 0 || fsync(fileno(index)) != 0) {
+                status = -1;
+            }
+            if (fclose(index) != 0) status = -1;
+        }
+    } else if (status == 0 && written > 0) {
+        status = -1;
+    }
+    free(entries);
+
+    // The pack goes into place first; the index makes it visible
+    if (status == 0 && written > 0) {
+        char path[MAX_PATH_LEN];
+        snprintf(name, PACK_NAME_LEN, "pack-%s", id);
+        create_directory(dir_path);
+        snprintf(path, sizeof(path), "%s/%s.pack", dir_path, name);
+        if (rename(pack_temp, path) != 0) status = -1;
+        snprintf(path, sizeof(path), "%s/%s.idx", dir_path, name);
+        if (status == 0 && rename(index_temp, path) != 0) status = -1;
+        int dir_fd = open(dir_path, O_RDONLY);
+        if (dir_fd >= 0) {
+            fsync(dir_fd);
+            close(dir_fd);
+        }
+    }
+    if (status != 0 || written == 0) {
+        unlink(pack_temp);
+        if (index_fd >= 0) unlink(index_temp);
+    }
+    return (status == 0) ? (int)written : -1;
+}
+
+/*
+The function remove_pack deletes a pack, its index first so no reader picks up a pack that is going away.
+Processes that already mapped it keep reading their mapping.
+*/
+static void remove_pack(const Pack* pack) {
+    char path[MAX_PATH_LEN];
+    snprintf(path, sizeof(path), "%s/%s.idx", packs_dir, pack->name);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/%s.pack", packs_dir, pack->name);
+    unlink(path);
+}
+
+/*
+The function next_generation returns the generation for a new pack (one above every mapped pack).
+Called with pack_mutex held.
+*/
+static uint32_t next_generation(void) {
+    return (pack_count > 0) ? packs[0].generation + 1 : 1;
+}
+
+/*
+The function pack_objects moves the loose objects into a new pack and deletes them.
+Returns 0 on success, -1 on failure (the loose objects are kept then).
+It takes Repository* repo, int all (1 also merges every existing pack into the new one, dropping copies that
+loose objects or newer packs replaced) and PackStats* stats (optional, receives the counts).
+Runs under the object lock, so no object is rewritten as a delta while it is copied.
+*/
+int pack_objects(Repository* repo, int all, PackStats* stats) {
+    if (!repo) return -1;
+    PackStats counts;
+    memset(&counts, 0, sizeof(counts));
+
+    int lock = lock_repository(repo->base_path, OBJECTS_LOCK_FILE, 1);
+    if (lock < 0) return -1;
+    pthread_mutex_lock(&pack_mutex);
+    scan_packs(1);
+
+    PackSource* sources = NULL;
+    size_t count = 0, cap = 0;
+    int status = collect_loose_objects(&sources, &count, &cap);
+    size_t loose = count;
+    int merged = all ? pack_count : 0;
+    for (int p = 0; status == 0 && p < merged; p++) {
+        for (uint32_t i = 0; status == 0 && i < packs[p].count; i++) {
+            const PackIndexEntry* e = &packs[p].entries[i];
+            if (e->offset > packs[p].size || e->length > packs[p].size - e->offset) continue;
+            PackSource source;
+            memset(&source, 0, sizeof(source));
+            memcpy(source.id, e->id, HASH_RAW_LEN);
+            source.priority = p + 1;
+            source.data = packs[p].data + e->offset;
+            source.length = (size_t)e->length;
+            status = add_source(&sources, &count, &cap, &source);
+        }
+    }
+
+    // Nothing to do unless there are loose objects, or several packs to merge
+    char name[PACK_NAME_LEN] = "";
+    if (status == 0 && (loose > 0 || merged > 1)) {
+        qsort(sources, count, sizeof(PackSource), compare_sources);
+        size_t unique = 0;
+        for (size_t i = 0; i < count; i++) {
+            if (unique > 0 && memcmp(sources[unique - 1].id, sources[i].id, HASH_RAW_LEN) == 0) {
+                free(sources[i].path);      // A preferred copy of the same object is already listed
+                continue;
+            }
+            sources[unique++] = sources[i];
+        }
+        int written = write_pack(sources, unique, next_generation(), name);
+        if (written < 0) {
+            status = -1;
+        } else {
+            counts.objects_packed = written;
+            // The objects are durable in the new pack: drop the loose copies and the merged packs
+            for (size_t i = 0; i < unique; i++) {
+                if (sources[i].path && sources[i].written && unlink(sources[i].path) == 0) counts.loose_removed++;
+            }
+            for (int p = 0; p < merged; p++) {
+                if (strcmp(packs[p].name, name) == 0) continue;
+                remove_pack(&packs[p]);
+                counts.packs_removed++;
+            }
+            count = unique;
+        }
+    }
+    for (size_t i = 0; i < count; i++) free(sources[i].path);
+    free(sources);
+
+    // Fan-out directories left empty are removed, they are created again when needed
+    if (status == 0 && counts.loose_removed > 0) {
+        for (int fanout = 0; fanout < 256; fanout++) {
+            char dir_path[MAX_PATH_LEN];
+            snprintf(dir_path, sizeof(dir_path), "%s/%s/%s/%02x", repo->base_path, VCS_DIR, OBJECTS_DIR, fanout);
+            rmdir(dir_path);
+        }
+    }
+    if (name[0]) {
+        struct stat st;
+        char path[MAX_PATH_LEN];
+        snprintf(path, sizeof(path), "%s/%s.pack", packs_dir, name);
+        if (stat(path, &st) == 0) counts.pack_bytes = (long long)st.st_size;
+        trace("pack: wrote %s with %ld objects", name, counts.objects_packed);
+    }
+    pthread_mutex_unlock(&pack_mutex);
+    unlock_repository(lock);
+    if (stats) *stats = counts;
+    return status;
+}
+
+/*
+The function pack_store writes objects copied from another repository into a new pack.
+Returns the number of objects written, or -1 on failure.
+It takes Repository* repo, const unsigned char* ids (count raw ids of HASH_RAW_LEN bytes, back to back),
+const unsigned char* const* data / const size_t* lengths (each object's bytes as a loose object file holds them)
+and size_t count (an id listed twice is written once). The new pack gets the highest generation.
+*/
+int pack_store(Repository* repo, const unsigned char* ids, const unsigned char* const* data, const size_t* lengths,
+               size_t count) {
+    if (!repo || (count > 0 && (!ids || !data || !lengths))) return -1;
+    if (count == 0) return 0;
+    PackSource* sources = calloc(count, sizeof(PackSource));
+    if (!sources) return -1;
+    for (size_t i = 0; i < count; i++) {
+        memcpy(sources[i].id, ids + i * HASH_RAW_LEN, HASH_RAW_LEN);
+        sources[i].data = data[i];
+        sources[i].length = lengths[i];
+    }
+    qsort(sources, count, sizeof(PackSource), compare_sources);
+    size_t unique = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (unique > 0 && memcmp(sources[unique - 1].id, sources[i].id, HASH_RAW_LEN) == 0) continue;
+        sources[unique++] = sources[i];
+    }
+
+    int lock = lock_repository(repo->base_path, OBJECTS_LOCK_FILE, 1);
+    if (lock < 0) {
+        free(sources);
+        return -1;
+    }
+    pthread_mutex_lock(&pack_mutex);
+    scan_packs(1);
+    char name[PACK_NAME_LEN] = "";
+    int written = write_pack(sources, unique, next_generation(), name);
+    if (written > 0) {
+        scan_packs(1);      // Lookups in this process see the new pack right away
+        trace("pack: stored %d received objects in %s", written, name);
+    }
+    pthread_mutex_unlock(&pack_mutex);
+    unlock_repository(lock);
+    free(sources);
+    return written;
+}
+
+/*
+The function prune_packs rewrites the packs that hold unreachable objects without them (used by gc).
+Packs modified at or after older_than are left alone, since a check-in may just have reused one of their objects.
+Returns 0 on success, -1 on failure.
+It takes Repository* repo, the callback reachable (1 if an object id must be kept) with its context,
+time_t older_than, int dry_run (only count), long* removed / long long* bytes (incremented by what was dropped)
+and long* kept (incremented by the packed objects that stay).
+Call it with the exclusive metadata lock held, so no check-in can record one of the dropped objects meanwhile.
+*/
+int prune_packs(Repository* repo, int (*reachable)(void* context, const unsigned char* id), void* context,
+                time_t older_than, int dry_run, long* removed, long long* bytes, long* kept) {
+    if (!repo || !reachable) return -1;
+    int lock = lock_repository(repo->base_path, OBJECTS_LOCK_FILE, 1);
+    if (lock < 0) return -1;
+    pthread_mutex_lock(&pack_mutex);
+    scan_packs(1);
+
+    int status = 0;
+    int existing = pack_count;      // Packs written below are not looked at again
+    for (int p = 0; status == 0 && p < existing; p++) {
+        const Pack* pack = &packs[p];
+        char path[MAX_PATH_LEN];
+        struct stat st;
+        snprintf(path, sizeof(path), "%s/%s.pack", packs_dir, pack->name);
+        if (stat(path, &st) != 0) continue;
+        if (st.st_mtime >= older_than) {
+            *kept += (long)pack->count;     // Written or reused while the gc runs
+            continue;
+        }
+
+        long dropped = 0;
+        long long dropped_bytes = 0;
+        for (uint32_t i = 0; i < pack->count; i++) {
+            if (!reachable(context, pack->entries[i].id)) {
+                dropped++;
+                dropped_bytes += (long long)pack->entries[i].length;
+            }
+        }
+        *kept += (long)pack->count - dropped;
+        if (dropped == 0) continue;
+        *removed += dropped;
+        *bytes += dropped_bytes;
+        if (dry_run) continue;
+
+        // Copy the objects that stay into a new pack of the same generation, then drop the old one
+        PackSource* sources = calloc((size_t)pack->count + 1, sizeof(PackSource));
+        if (!sources) {
+            status = -1;
+            break;
+        }
+        size_t count = 0;
+        for (uint32_t i = 0; i < pack->count; i++) {
+            const PackIndexEntry* e = &pack->entries[i];
+            if (!reachable(context, e->id) || e->offset > pack->size || e->length > pack->size - e->offset) continue;
+            memcpy(sources[count].id, e->id, HASH_RAW_LEN);
+            sources[count].data = pack->data + e->offset;
+            sources[count].length = (size_t)e->length;
+            count++;
+        }
+        char name[PACK_NAME_LEN] = "";
+        if (count > 0 && write_pack(sources, count, pack->generation, name) < 0) status = -1;
+        if (status == 0 && strcmp(name, pack->name) != 0) remove_pack(pack);
+        trace("pack: dropped %ld objects from %s", dropped, pack->name);
+        free(sources);
+    }
+    pthread_mutex_unlock(&pack_mutex);
+    unlock_repository(lock);
+    return status;
+}
+
+/*
+The function pack_auto packs the loose objects when there are more than config.auto_pack of them.
+The number is estimated from one fan-out directory, which holds about 1/256 of the loose objects since ids are
+uniformly distributed, so the check costs one directory read. Once there are PACK_AUTO_MERGE packs they are
+merged as well.
+It takes Repository* repo.
+*/
+void pack_auto(Repository* repo) {
+    if (!repo || repo->config.auto_pack <= 0) return;
+
+    char dir_path[MAX_PATH_LEN];
+    snprintf(dir_path, sizeof(dir_path), "%s/%s/%s/%02x", repo->base_path, VCS_DIR, OBJECTS_DIR, PACK_SAMPLE_DIR);
+    DIR* dir = opendir(dir_path);
+    if (!dir) return;
+    long sampled = 0;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] != '.') sampled++;
+    }
+    closedir(dir);
+    if (sampled * 256 <= repo->config.auto_pack) return;
+
+    pthread_mutex_lock(&pack_mutex);
+    scan_packs(1);
+    int merge = pack_count + 1 >= PACK_AUTO_MERGE;
+    pthread_mutex_unlock(&pack_mutex);
+    trace("pack: about %ld loose objects, packing them", sampled * 256);
+    pack_objects(repo, merge, NULL);
+}
@@ -0,0 +1,242 @@
+#include "vcs.h"
+#include <pthread.h>    // Provides the worker threads
+#include <fcntl.h>      // Provides open() flags and posix_fadvise() for the file pipeline
+
+/*
+The parallel runner spreads independent work items over a small pool of worker threads.
+Items are handed out one at a time from a shared counter, so slow items (large files) do not hold up a worker's
+whole share of the batch. The calling thread works on items too, and a batch of one item or a pool of one thread
+runs without creating any threads.
+*/
+
+// State shared by the workers of one parallel_for call
+typedef struct ParallelJob {
+    pthread_mutex_t lock;           // Protects next
+    int next;                       // Index of the next item to hand out
+    int count;                      // Number of items
+    void (*work)(void* context, int index);
+    void* context;
+} ParallelJob;
+
+/*
+The function parallel_worker processes items until none are left.
+*/
+static void* parallel_worker(void* arg) {
+    ParallelJob* job = arg;
+    for (;;) {
+        pthread_mutex_lock(&job->lock);
+        int index = job->next++;
+        pthread_mutex_unlock(&job->lock);
+        if (index >= job->count) break;
+        job->work(job->context, index);
+    }
+    return NULL;
+}
+
+/*
+The function parallel_threads returns the number of worker threads to use for a setting of 0 or less:
+the number of online CPUs.
+*/
+int parallel_threads(int requested) {
+    if (requested > 0) return requested;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return (cpus > 0) ? (int)cpus : 1;
+}
+
+/*
+The function parallel_for calls work(context, index) for every index in [0, count), spread over up to threads threads.
+Returns once every item has been processed. If threads cannot be created, the remaining items run on the caller.
+It takes int count, int threads (0 or less uses every CPU), the work function and its context.
+The work function must be safe to run concurrently with itself for different indexes.
+*/
+void parallel_for(int count, int threads, void (*work)(void* context, int index), void* context) {
+    if (count <= 0 || !work) return;
+    threads = parallel_threads(threads);
+    if (threads > count) threads = count;
+
+    ParallelJob job;
+    pthread_mutex_init(&job.lock, NULL);
+    job.next = 0;
+    job.count = count;
+    job.work = work;
+    job.context = context;
+
+    // The calling thread is one of the workers
+    pthread_t* workers = (threads > 1) ? malloc((threads - 1) * sizeof(pthread_t)) : NULL;
+    int started = 0;
+    for (int i = 0; workers && i < threads - 1; i++) {
+        if (pthread_create(&workers[i], NULL, parallel_worker, &job) != 0) break;
+        started++;
+    }
+    parallel_worker(&job);
+    for (int i = 0; i < started; i++) pthread_join(workers[i], NULL);
+
+    free(workers);
+    pthread_mutex_destroy(&job.lock);
+}
+
+/*
+The file pipeline reads a file once and hands every block to several stages (hashing, compressing and writing,
+...) that run on threads of their own. The blocks go through a ring of PIPELINE_SLOTS buffers: the reader fills
+the next slot as soon as every stage is done with what it held before, so reading and the stages overlap and
+at most PIPELINE_SLOTS blocks are in memory, whatever the size of the file.
+*/
+
+#define PIPELINE_SLOTS 8                    // Blocks in flight between the reader and the slowest stage
+#define PIPELINE_BLOCK_SIZE HASH_BLOCK_SIZE // Size of each read
+#define PIPELINE_ALIGN 4096                 // Alignment of the block buffers
+#define PIPELINE_MAX_STAGES 4
+
+// State shared by the reader and the stage threads of one pipeline_file call
+typedef struct Pipeline {
+    pthread_mutex_t lock;           // Protects produced, done, failed and consumed
+    pthread_cond_t changed;         // Signalled whenever any of them changes
+    unsigned char* slots[PIPELINE_SLOTS];
+    size_t lengths[PIPELINE_SLOTS];
+    long produced;                  // Number of blocks read so far
+    int done;                       // The reader has read its last block
+    int failed;                     // A read or a stage failed; everyone stops
+    long consumed[PIPELINE_MAX_STAGES];     // Number of blocks each stage has finished
+    int threaded[PIPELINE_MAX_STAGES];      // The stage runs on its own thread (else on the reader's)
+    const PipelineStage* stages;
+    int stage_count;
+} Pipeline;
+
+// Argument of one stage thread
+typedef struct PipelineWorker {
+    Pipeline* pipeline;
+    int stage;
+} PipelineWorker;
+
+/*
+The function pipeline_stage feeds every block to one stage, in order, until the file ends or something fails.
+*/
+static void* pipeline_stage(void* arg) {
+    PipelineWorker* worker = arg;
+    Pipeline* p = worker->pipeline;
+    const PipelineStage* stage = &p->stages[worker->stage];
+    for (long block = 0;; block++) {
+        pthread_mutex_lock(&p->lock);
+        while (block >= p->produced && !p->done && !p->failed) pthread_cond_wait(&p->changed, &p->lock);
+        int stop = p->failed || block >= p->produced;
+        pthread_mutex_unlock(&p->lock);
+        if (stop) break;
+
+        int slot = (int)(block % PIPELINE_SLOTS);
+        int status = stage->consume(stage->context, p->slots[slot], p->lengths[slot]);
+        pthread_mutex_lock(&p->lock);
+        if (status != 0) p->failed = 1;
+        p->consumed[worker->stage] = block + 1;
+        pthread_cond_broadcast(&p->changed);
+        pthread_mutex_unlock(&p->lock);
+        if (status != 0) break;
+    }
+    return NULL;
+}
+
+/*
+The function slot_free checks whether every threaded stage is done with the block a slot held before.
+Called with the pipeline's lock held.
+*/
+static int slot_free(const Pipeline* p, long block) {
+    for (int i = 0; i < p->stage_count; i++) {
+        if (p->threaded[i] && p->consumed[i] <= block - PIPELINE_SLOTS) return 0;
+    }
+    return 1;
+}
+
+/*
+The function read_block reads up to len bytes, retrying short reads and interrupted calls.
+Returns the number of bytes read (less than len only at the end of the file), or -1 on failure.
+*/
+static ssize_t read_block(int fd, unsigned char* buffer, size_t len, long long* reads) {
+    size_t total = 0;
+    while (total < len) {
+        ssize_t bytes = read(fd, buffer + total, len - total);
+        (*reads)++;
+        if (bytes < 0 && errno == EINTR) continue;
+        if (bytes < 0) return -1;
+        if (bytes == 0) break;
+        total += (size_t)bytes;
+    }
+    return (ssize_t)total;
+}
+
+/*
+The function pipeline_file reads a file once, in PIPELINE_BLOCK_SIZE blocks, and passes every block to each stage.
+Returns 0 once every stage consumed the whole file, -1 on failure (the file could not be read or a stage failed).
+It takes const char* filepath, const PipelineStage* stages / int count (at most PIPELINE_MAX_STAGES; each sees
+the blocks in file order, on a thread of its own) and long* size_out / long long* reads_out (optional, receive the
+file size and the number of read calls).
+A stage whose thread cannot be created runs on the reading thread instead.
+*/
+int pipeline_file(const char* filepath, const PipelineStage* stages, int count, long* size_out, long long* reads_out) {
+    if (!filepath || !stages || count <= 0 || count > PIPELINE_MAX_STAGES) return -1;
+    int fd = open(filepath, O_RDONLY);
+    if (fd < 0) return -1;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    Pipeline p;
+    memset(&p, 0, sizeof(p));
+    p.stages = stages;
+    p.stage_count = count;
+    for (int i = 0; i < PIPELINE_SLOTS; i++) {
+        void* buffer = NULL;
+        if (posix_memalign(&buffer, PIPELINE_ALIGN, PIPELINE_BLOCK_SIZE) != 0) p.failed = 1;
+        p.slots[i] = buffer;
+    }
+    pthread_mutex_init(&p.lock, NULL);
+    pthread_cond_init(&p.changed, NULL);
+
+    pthread_t threads[PIPELINE_MAX_STAGES];
+    PipelineWorker workers[PIPELINE_MAX_STAGES];
+    for (int i = 0; i < count && !p.failed; i++) {
+        workers[i].pipeline = &p;
+        workers[i].stage = i;
+        p.threaded[i] = pthread_create(&threads[i], NULL, pipeline_stage, &workers[i]) == 0;
+    }
+
+    long total = 0;
+    long long reads = 0;
+    for (long block = 0;; block++) {
+        int slot = (int)(block % PIPELINE_SLOTS);
+        pthread_mutex_lock(&p.lock);
+        while (!p.failed && !slot_free(&p, block)) pthread_cond_wait(&p.changed, &p.lock);
+        int stop = p.failed;
+        pthread_mutex_unlock(&p.lock);
+        if (stop) break;
+
+        ssize_t bytes = read_block(fd, p.slots[slot], PIPELINE_BLOCK_SIZE, &reads);
+        int status = (bytes < 0) ? -1 : 0;
+        if (bytes > 0) p.lengths[slot] = (size_t)bytes;
+        for (int i = 0; i < count && status == 0 && bytes > 0; i++) {
+            if (!p.threaded[i]) status = stages[i].consume(stages[i].context, p.slots[slot], (size_t)bytes);
+        }
+
+        pthread_mutex_lock(&p.lock);
+        if (status != 0) p.failed = 1;
+        if (status == 0 && bytes > 0) p.produced = block + 1;
+        if (status != 0 || bytes < PIPELINE_BLOCK_SIZE) p.done = 1;     // A short block is the end of the file
+        pthread_cond_broadcast(&p.changed);
+        pthread_mutex_unlock(&p.lock);
+        if (bytes > 0) total += (long)bytes;
+        if (p.done) break;
+    }
+
+    pthread_mutex_lock(&p.lock);
+    p.done = 1;
+    pthread_cond_broadcast(&p.changed);
+    pthread_mutex_unlock(&p.lock);
+    for (int i = 0; i < count; i++) {
+        if (p.threaded[i]) pthread_join(threads[i], NULL);
+    }
+    close(fd);
+
+    int status = p.failed ? -1 : 0;
+    for (int i = 0; i < PIPELINE_SLOTS; i++) free(p.slots[i]);
+    pthread_cond_destroy(&p.changed);
+    pthread_mutex_destroy(&p.lock);
+    if (size_out) *size_out = total;
+    if (reads_out) *reads_out = reads;
+    return status;
+}
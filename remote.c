@@ -0,0 +1,1143 @@
+#include "vcs.h"
+#include <stdint.h>     // Provides fixed-width integers for the frame header
+#include <fcntl.h>      // Provides fcntl() to keep the pipe ends out of later transport processes
+#include <signal.h>     // Provides signal() to ignore SIGPIPE when the other side goes away
+#include <sys/wait.h>   // Provides waitpid() for the transport process
+#include <pthread.h>    // Provides the threads driving parallel connections
+
+/*
+push and pull copy versions between two repositories. The client starts the other side as "vcs serve <path>",
+directly for a local path or over ssh for host:path, and talks to it over that process's stdin and stdout:
+  1. KEYS: the server lists the object id, version number and filename of every version it has
+  2. the client works out which versions the receiving side lacks. The same version number with other contents
+     is a conflict: nothing is rewritten, and the file's later versions are left out
+  3. HAVE / CLOSURE: the object ids of those versions are checked against the receiving side and expanded with the
+     delta bases and chunks they depend on, so only the objects the receiver lacks travel
+  4. PUT / GET: the objects are streamed exactly as they are stored (deltas stay deltas), batched into frames and
+     split over parallel connections; the receiver checks full objects against their ids and writes every
+     REMOTE_PACK_SIZE bytes of them into a new pack
+  5. MERGE / RECORDS: the metadata records go last, so a version is only recorded once its objects are stored; the
+     receiver adds them under the metadata lock and appends them to its journal
+Every message is a frame: u32 payload length, u8 type, u8 codec, u32 uncompressed length (little-endian), then the
+payload, compressed with zlib when that makes it smaller. Lists longer than a frame are sent as several frames of
+the same type followed by an END frame. Snapshots are not copied.
+*/
+
+#define REMOTE_FRAME_HEADER 10
+#define REMOTE_FRAME_MAX (512u << 20)       // Largest payload accepted in one frame
+#define REMOTE_BATCH_SIZE (4u << 20)        // Payload collected into one frame before it is sent
+#define REMOTE_PACK_SIZE (64u << 20)        // Received object bytes written into one pack
+#define REMOTE_COMPRESS_MIN 256             // Smaller payloads are sent uncompressed
+#define REMOTE_MAX_CONNECTIONS 16
+#define OBJECT_ENTRY_HEADER (HASH_RAW_LEN + 8)  // Raw id and u64 length in front of each object of a batch
+
+// Frame types: requests from the client are upper case, replies and data frames lower case
+enum {
+    MSG_KEYS = 'K', MSG_HAVE = 'H', MSG_CLOSURE = 'C', MSG_GET = 'G', MSG_PUT = 'P', MSG_RECORDS = 'R',
+    MSG_MERGE = 'M', MSG_QUIT = 'Q',
+    MSG_KEY_LIST = 'k', MSG_HAVE_LIST = 'h', MSG_ID_LIST = 'c', MSG_OBJECTS = 'o', MSG_RECORD_LIST = 'r',
+    MSG_DONE = 'a', MSG_END = 'e', MSG_ERROR = 'x'
+};
+
+// One side of a conversation
+typedef struct Connection {
+    FILE* in;
+    FILE* out;
+    pid_t pid;                      // Transport process (0 on the serving side)
+    long long wire_bytes;           // Frame bytes sent and received
+} Connection;
+
+// Growable byte buffer, kept terminated so text payloads can be parsed in place
+typedef struct Buffer {
+    unsigned char* data;
+    size_t len;
+    size_t cap;
+    int failed;                     // Memory allocation failed
+} Buffer;
+
+// Set of raw object ids (open addressing, the ids are uniformly distributed)
+typedef struct IdSet {
+    unsigned char (*slots)[HASH_RAW_LEN];
+    unsigned char* used;
+    size_t cap;                     // Power of two
+    size_t count;
+} IdSet;
+
+// One version listed by the other side
+typedef struct RemoteKey {
+    const char* filename;           // Points into the received key list
+    int version;
+    int has_object;
+    unsigned char object_id[HASH_RAW_LEN];
+} RemoteKey;
+
+// The objects one connection copies
+typedef struct Transfer {
+    Repository* repo;
+    Connection* connection;
+    Buffer ids;
+    int push;                       // 1 sends the objects, 0 receives them
+    SyncStats stats;
+    int status;
+} Transfer;
+
+/*
+The function buffer_add appends bytes to a buffer.
+*/
+static void buffer_add(Buffer* buffer, const void* data, size_t len) {
+    if (buffer->failed) return;
+    if (buffer->len + len + 1 > buffer->cap) {
+        size_t cap = buffer->cap ? buffer->cap : 4096;
+        while (cap < buffer->len + len + 1) cap *= 2;
+        unsigned char* grown = realloc(buffer->data, cap);
+        if (!grown) {
+            buffer->failed = 1;
+            return;
+        }
+        buffer->data = grown;
+        buffer->cap = cap;
+    }
+    if (len > 0) memcpy(buffer->data + buffer->len, data, len);
+    buffer->len += len;
+    buffer->data[buffer->len] = '\0';
+}
+
+/*
+The function id_set_insert adds an id to a set.
+Returns 1 if it was not in the set yet, 0 if it was, -1 if memory allocation fails.
+*/
+static int id_set_insert(IdSet* set, const unsigned char* id) {
+    if ((set->count + 1) * 2 > set->cap) {
+        size_t cap = set->cap ? set->cap * 2 : 1024;
+        unsigned char (*slots)[HASH_RAW_LEN] = malloc(cap * HASH_RAW_LEN);
+        unsigned char* used = calloc(cap, 1);
+        if (!slots || !used) {
+            free(slots);
+            free(used);
+            return -1;
+        }
+        for (size_t i = 0; i < set->cap; i++) {
+            if (!set->used[i]) continue;
+            size_t slot;
+            memcpy(&slot, set->slots[i], sizeof(slot));
+            for (slot &= cap - 1; used[slot]; slot = (slot + 1) & (cap - 1)) {}
+            memcpy(slots[slot], set->slots[i], HASH_RAW_LEN);
+            used[slot] = 1;
+        }
+        free(set->slots);
+        free(set->used);
+        set->slots = slots;
+        set->used = used;
+        set->cap = cap;
+    }
+    size_t slot;
+    memcpy(&slot, id, sizeof(slot));
+    for (slot &= set->cap - 1; set->used[slot]; slot = (slot + 1) & (set->cap - 1)) {
+        if (memcmp(set->slots[slot], id, HASH_RAW_LEN) == 0) return 0;
+    }
+    memcpy(set->slots[slot], id, HASH_RAW_LEN);
+    set->used[slot] = 1;
+    set->count++;
+    return 1;
+}
+
+/*
+The function compare_ids orders raw object ids (qsort callback).
+*/
+static int compare_ids(const void* a, const void* b) {
+    return memcmp(a, b, HASH_RAW_LEN);
+}
+
+/*
+The function sort_ids sorts a buffer of raw ids and drops the duplicates.
+*/
+static void sort_ids(Buffer* ids) {
+    size_t count = ids->len / HASH_RAW_LEN;
+    if (count < 2) return;
+    qsort(ids->data, count, HASH_RAW_LEN, compare_ids);
+    size_t unique = 1;
+    for (size_t i = 1; i < count; i++) {
+        if (memcmp(ids->data + (unique - 1) * HASH_RAW_LEN, ids->data + i * HASH_RAW_LEN, HASH_RAW_LEN) == 0) continue;
+        memmove(ids->data + unique * HASH_RAW_LEN, ids->data + i * HASH_RAW_LEN, HASH_RAW_LEN);
+        unique++;
+    }
+    ids->len = unique * HASH_RAW_LEN;
+}
+
+/*
+The functions put_u32 / get_u32 and put_u64 / get_u64 store and load little-endian integers of the wire format.
+*/
+static void put_u32(unsigned char* p, uint32_t value) {
+    for (int i = 0; i < 4; i++) p[i] = (unsigned char)(value >> (8 * i));
+}
+
+static uint32_t get_u32(const unsigned char* p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void put_u64(unsigned char* p, uint64_t value) {
+    for (int i = 0; i < 8; i++) p[i] = (unsigned char)(value >> (8 * i));
+}
+
+static uint64_t get_u64(const unsigned char* p) {
+    return (uint64_t)get_u32(p) | (uint64_t)get_u32(p + 4) << 32;
+}
+
+/*
+The function send_frame writes one frame, compressing the payload when that makes it smaller.
+Returns 0 on success, -1 on failure. The frame is buffered; flush the connection before waiting for a reply.
+*/
+static int send_frame(Connection* c, int type, const void* payload, size_t len) {
+    if (len > REMOTE_FRAME_MAX) return -1;
+    const unsigned char* body = payload;
+    size_t body_len = len;
+    unsigned char* packed = NULL;
+    size_t packed_len = 0;
+    int codec = CODEC_NONE;
+    if (len >= REMOTE_COMPRESS_MIN && compress_buffer(CODEC_ZLIB, 1, payload, len, &packed, &packed_len) == 0) {
+        if (packed_len < len) {
+            codec = CODEC_ZLIB;
+            body = packed;
+            body_len = packed_len;
+        }
+    }
+
+    unsigned char header[REMOTE_FRAME_HEADER];
+    put_u32(header, (uint32_t)body_len);
+    header[4] = (unsigned char)type;
+    header[5] = (unsigned char)codec;
+    put_u32(header + 6, (uint32_t)len);
+    int status = (fwrite(header, 1, sizeof(header), c->out) == sizeof(header) &&
+                  (body_len == 0 || fwrite(body, 1, body_len, c->out) == body_len)) ? 0 : -1;
+    c->wire_bytes += (long long)(sizeof(header) + body_len);
+    free(packed);
+    return status;
+}
+
+/*
+The function send_error tells the other side why a request failed.
+*/
+static int send_error(Connection* c, const char* message) {
+    return send_frame(c, MSG_ERROR, message, strlen(message));
+}
+
+/*
+The function receive_frame reads one frame.
+Returns 0 on success (*payload receives the malloc'd, uncompressed and terminated payload), -1 if the connection
+closed or the frame is malformed.
+*/
+static int receive_frame(Connection* c, int* type, unsigned char** payload, size_t* len) {
+    unsigned char header[REMOTE_FRAME_HEADER];
+    if (fread(header, 1, sizeof(header), c->in) != sizeof(header)) return -1;
+    uint32_t body_len = get_u32(header);
+    uint32_t raw_len = get_u32(header + 6);
+    int codec = header[5];
+    if (body_len > REMOTE_FRAME_MAX || raw_len > REMOTE_FRAME_MAX) return -1;
+    if ((codec != CODEC_NONE && codec != CODEC_ZLIB) || (codec == CODEC_NONE && raw_len != body_len)) return -1;
+
+    unsigned char* body = malloc((size_t)body_len + 1);
+    if (!body) return -1;
+    if (body_len > 0 && fread(body, 1, body_len, c->in) != body_len) {
+        free(body);
+        return -1;
+    }
+    c->wire_bytes += (long long)(sizeof(header) + body_len);
+    if (codec == CODEC_ZLIB) {
+        unsigned char* plain = malloc((size_t)raw_len + 1);
+        if (!plain || decompress_buffer(CODEC_ZLIB, body, body_len, plain, raw_len) != 0) {
+            free(plain);
+            free(body);
+            return -1;
+        }
+        free(body);
+        body = plain;
+    }
+    body[raw_len] = '\0';
+    *type = header[4];
+    *payload = body;
+    *len = raw_len;
+    return 0;
+}
+
+/*
+The function report_reply prints why a reply was not the one expected.
+*/
+static void report_reply(int type, const unsigned char* payload) {
+    if (type == MSG_ERROR) fprintf(stderr, "vcs: remote: %s\n", (const char*)payload);
+    else fprintf(stderr, "vcs: unexpected reply from the remote repository\n");
+}
+
+/*
+The function expect_frame reads the reply to a request and checks its type.
+Returns 0 on success, -1 if the other side reported an error (printed to stderr) or the reply is something else.
+*/
+static int expect_frame(Connection* c, int type, unsigned char** payload, size_t* len) {
+    int received;
+    if (receive_frame(c, &received, payload, len) != 0) {
+        fprintf(stderr, "vcs: lost the connection to the remote repository\n");
+        return -1;
+    }
+    if (received == type) return 0;
+    report_reply(received, *payload);
+    free(*payload);
+    return -1;
+}
+
+/*
+The function send_list sends data as frames of the given type, REMOTE_BATCH_SIZE at a time, and an END frame.
+Returns 0 on success, -1 on failure.
+*/
+static int send_list(Connection* c, int type, const unsigned char* data, size_t len) {
+    for (size_t pos = 0; pos < len; pos += REMOTE_BATCH_SIZE) {
+        size_t n = (len - pos < REMOTE_BATCH_SIZE) ? len - pos : REMOTE_BATCH_SIZE;
+        if (send_frame(c, type, data + pos, n) != 0) return -1;
+    }
+    return send_frame(c, MSG_END, NULL, 0);
+}
+
+/*
+The function receive_list collects the frames of a list sent with send_list.
+Returns 0 on success, -1 on failure. out receives the data, terminated even if it is empty.
+*/
+static int receive_list(Connection* c, int type, Buffer* out) {
+    buffer_add(out, "", 0);
+    for (;;) {
+        int received;
+        unsigned char* payload;
+        size_t len;
+        if (receive_frame(c, &received, &payload, &len) != 0) {
+            fprintf(stderr, "vcs: lost the connection to the remote repository\n");
+            return -1;
+        }
+        if (received == type) buffer_add(out, payload, len);
+        else if (received != MSG_END) report_reply(received, payload);
+        free(payload);
+        if (received == MSG_END) return out->failed ? -1 : 0;
+        if (received != type) return -1;
+    }
+}
+
+/*
+The function build_keys lists every version of the repository as "<object id> <version> <filename>" lines
+("-" for versions stored as .vcs/versions/filename/vN, which are not copied).
+Returns 0 on success, -1 if memory allocation fails.
+*/
+static int build_keys(Repository* repo, Buffer* out) {
+    FileVersion** versions = NULL;
+    int count = collect_all_versions(repo, &versions);
+    if (count < 0) return -1;
+    buffer_add(out, "", 0);
+    for (int i = 0; i < count; i++) {
+        const FileVersion* v = versions[i];
+        if (strchr(v->filename, '\n')) continue;
+        char id[MAX_HASH_LEN] = "-";
+        char line[MAX_HASH_LEN + MAX_FILENAME_LEN + 16];
+        if (v->flags & VERSION_HAS_OBJECT) hash_to_hex(v->object_id, id);
+        int len = snprintf(line, sizeof(line), "%s %d %s\n", id, v->version_number, v->filename);
+        buffer_add(out, line, (size_t)len < sizeof(line) ? (size_t)len : sizeof(line) - 1);
+    }
+    free(versions);
+    return out->failed ? -1 : 0;
+}
+
+/*
+The function compare_keys orders keys by filename, then version number (qsort and bsearch callback).
+*/
+static int compare_keys(const void* a, const void* b) {
+    const RemoteKey* x = a;
+    const RemoteKey* y = b;
+    int cmp = strcmp(x->filename, y->filename);
+    if (cmp != 0) return cmp;
+    return (x->version > y->version) - (x->version < y->version);
+}
+
+/*
+The function parse_keys splits a key list received from the other side.
+Returns the number of keys (*out receives the malloc'd array, sorted with compare_keys), or -1 on failure.
+It takes char* text (modified; the keys point into it).
+*/
+static int parse_keys(char* text, RemoteKey** out) {
+    int lines = 0;
+    for (char* p = text; *p; p++) {
+        if (*p == '\n') lines++;
+    }
+    RemoteKey* keys = malloc(((size_t)lines + 1) * sizeof(RemoteKey));
+    if (!keys) return -1;
+
+    int count = 0;
+    char* line = text;
+    for (char* end; (end = strchr(line, '\n')) != NULL; line = end + 1) {
+        *end = '\0';
+        char* version = strchr(line, ' ');
+        char* filename = version ? strchr(version + 1, ' ') : NULL;
+        if (!filename) continue;
+        *version++ = '\0';
+        *filename++ = '\0';
+        RemoteKey* key = &keys[count];
+        key->filename = filename;
+        key->version = atoi(version);
+        key->has_object = hash_from_hex(line, key->object_id) == 0;
+        count++;
+    }
+    qsort(keys, (size_t)count, sizeof(RemoteKey), compare_keys);
+    *out = keys;
+    return count;
+}
+
+/*
+The function find_key looks up the key of a version (NULL if the other side does not have it).
+*/
+static const RemoteKey* find_key(const RemoteKey* keys, int count, const char* filename, int version) {
+    RemoteKey wanted;
+    wanted.filename = filename;
+    wanted.version = version;
+    return bsearch(&wanted, keys, (size_t)count, sizeof(RemoteKey), compare_keys);
+}
+
+/*
+The function local_missing keeps the ids that are not stored in this repository.
+*/
+static void local_missing(Buffer* ids) {
+    size_t kept = 0;
+    for (size_t pos = 0; pos + HASH_RAW_LEN <= ids->len; pos += HASH_RAW_LEN) {
+        char hex[MAX_HASH_LEN];
+        hash_to_hex(ids->data + pos, hex);
+        if (object_exists(hex)) continue;
+        memmove(ids->data + kept, ids->data + pos, HASH_RAW_LEN);
+        kept += HASH_RAW_LEN;
+    }
+    ids->len = kept;
+}
+
+/*
+The function local_closure adds the given objects and everything they depend on (delta bases, chunks) to out.
+Objects this repository does not have are left out; the receiving side then skips the versions stored in them.
+Returns 0 on success, -1 if memory allocation fails.
+It takes const unsigned char* ids / size_t count (raw ids) and Buffer* out (receives the raw ids).
+*/
+static int local_closure(const unsigned char* ids, size_t count, Buffer* out) {
+    IdSet seen;
+    memset(&seen, 0, sizeof(seen));
+    Buffer queue;
+    memset(&queue, 0, sizeof(queue));
+    buffer_add(&queue, ids, count * HASH_RAW_LEN);
+    buffer_add(out, "", 0);
+
+    int status = 0;
+    for (size_t pos = 0; status == 0 && pos + HASH_RAW_LEN <= queue.len; pos += HASH_RAW_LEN) {
+        unsigned char id[HASH_RAW_LEN];
+        memcpy(id, queue.data + pos, HASH_RAW_LEN);
+        int added = id_set_insert(&seen, id);
+        if (added < 0) status = -1;
+        if (added <= 0) continue;
+
+        char hex[MAX_HASH_LEN];
+        ObjectHeader header;
+        hash_to_hex(id, hex);
+        if (!object_exists(hex)) continue;
+        buffer_add(out, id, HASH_RAW_LEN);
+        if (object_read_header(hex, &header) != 1) continue;   // Plain contents depend on nothing
+        if (header.type == OBJECT_DELTA) {
+            char base[MAX_HASH_LEN];
+            unsigned char raw[HASH_RAW_LEN];
+            if (object_delta_base(hex, base) == 1 && hash_from_hex(base, raw) == 0) buffer_add(&queue, raw, HASH_RAW_LEN);
+        } else if (header.type == OBJECT_CHUNKS) {
+            unsigned char* list = NULL;
+            size_t chunks = 0;
+            if (object_chunk_list(hex, &list, &chunks) == 1) {
+                for (size_t i = 0; i < chunks; i++) buffer_add(&queue, list + i * CHUNK_ENTRY_SIZE, HASH_RAW_LEN);
+                free(list);
+            }
+        }
+        if (queue.failed || out->failed) status = -1;
+    }
+    free(queue.data);
+    free(seen.slots);
+    free(seen.used);
+    return status;
+}
+
+/*
+The function send_objects streams objects exactly as they are stored, as OBJECTS frames and an END frame.
+Objects that disappeared in the meantime are left out. Returns 0 on success, -1 on failure.
+It takes Connection* c, const unsigned char* ids / size_t count (raw ids) and SyncStats* stats (counts them).
+*/
+static int send_objects(Connection* c, const unsigned char* ids, size_t count, SyncStats* stats) {
+    Buffer batch;
+    memset(&batch, 0, sizeof(batch));
+    int status = 0;
+    for (size_t i = 0; status == 0 && i < count; i++) {
+        char hex[MAX_HASH_LEN];
+        unsigned char* data = NULL;
+        size_t len = 0;
+        hash_to_hex(ids + i * HASH_RAW_LEN, hex);
+        if (object_read_stored(hex, &data, &len) != 0) continue;
+        if (len > REMOTE_FRAME_MAX - OBJECT_ENTRY_HEADER) {
+            fprintf(stderr, "vcs: object %s is too large to send\n", hex);
+            free(data);
+            continue;
+        }
+
+        // An object that does not fit into the current batch goes into the next frame
+        if (batch.len > 0 && batch.len + OBJECT_ENTRY_HEADER + len > REMOTE_BATCH_SIZE) {
+            status = send_frame(c, MSG_OBJECTS, batch.data, batch.len);
+            batch.len = 0;
+        }
+        unsigned char entry[OBJECT_ENTRY_HEADER];
+        memcpy(entry, ids + i * HASH_RAW_LEN, HASH_RAW_LEN);
+        put_u64(entry + HASH_RAW_LEN, (uint64_t)len);
+        buffer_add(&batch, entry, sizeof(entry));
+        buffer_add(&batch, data, len);
+        free(data);
+        if (batch.failed) status = -1;
+        stats->objects++;
+        stats->bytes += (long long)len;
+    }
+    if (status == 0 && batch.len > 0) status = send_frame(c, MSG_OBJECTS, batch.data, batch.len);
+    if (status == 0) status = send_frame(c, MSG_END, NULL, 0);
+    free(batch.data);
+    return status;
+}
+
+/*
+The function verify_object checks received object bytes: plain and full objects must hash to their id.
+Deltas and chunk lists are only checked for a valid header here (vcs fsck rehashes them).
+Returns 0 if the object is fine, -1 if it is not.
+*/
+static int verify_object(const unsigned char* id, const unsigned char* raw, size_t len) {
+    const unsigned char* data;
+    size_t data_len;
+    unsigned char* owned;
+    int decoded = object_decode_full(raw, len, &data, &data_len, &owned);
+    if (decoded != 0) return (decoded == 1) ? 0 : -1;
+    char digest[MAX_HASH_LEN], expected[MAX_HASH_LEN];
+    int status = hash_buffer(data, data_len, digest);
+    free(owned);
+    hash_to_hex(id, expected);
+    return (status == 0 && strcmp(digest, expected) == 0) ? 0 : -1;
+}
+
+/*
+The function store_received writes the objects collected so far into a new pack and empties the batch.
+Returns 0 on success, -1 on failure.
+It takes Repository* repo, Buffer* ids (raw ids), Buffer* blob (the objects back to back) and Buffer* lengths
+(a size_t per object).
+*/
+static int store_received(Repository* repo, Buffer* ids, Buffer* blob, Buffer* lengths) {
+    size_t count = ids->len / HASH_RAW_LEN;
+    if (count == 0) return 0;
+    const unsigned char** data = malloc(count * sizeof(unsigned char*));
+    if (!data) return -1;
+    const size_t* sizes = (const size_t*)lengths->data;
+    size_t offset = 0;
+    for (size_t i = 0; i < count; i++) {
+        data[i] = blob->data + offset;
+        offset += sizes[i];
+    }
+    int written = pack_store(repo, ids->data, data, sizes, count);
+    free(data);
+    ids->len = blob->len = lengths->len = 0;
+    return (written < 0) ? -1 : 0;
+}
+
+/*
+The function receive_objects reads OBJECTS frames up to the END frame and stores the objects in new packs.
+Returns 0 on success, -1 on failure (a broken connection, an object that does not match its id, or a pack that
+could not be written). What was stored before the failure is kept; gc removes it if nothing refers to it.
+It takes Repository* repo, Connection* c and SyncStats* stats (counts the objects).
+*/
+static int receive_objects(Repository* repo, Connection* c, SyncStats* stats) {
+    Buffer ids, blob, lengths;
+    memset(&ids, 0, sizeof(ids));
+    memset(&blob, 0, sizeof(blob));
+    memset(&lengths, 0, sizeof(lengths));
+    int status = 0;
+    for (;;) {
+        int type;
+        unsigned char* payload;
+        size_t len;
+        if (receive_frame(c, &type, &payload, &len) != 0) {
+            status = -1;
+            break;
+        }
+        if (type == MSG_END) {
+            free(payload);
+            break;
+        }
+        if (type != MSG_OBJECTS) {
+            report_reply(type, payload);
+            free(payload);
+            status = -1;
+            break;
+        }
+
+        // Keep reading up to END after a bad object, so the conversation stays in step
+        size_t pos = 0;
+        while (status == 0 && pos + OBJECT_ENTRY_HEADER <= len) {
+            const unsigned char* id = payload + pos;
+            uint64_t size = get_u64(payload + pos + HASH_RAW_LEN);
+            pos += OBJECT_ENTRY_HEADER;
+            if (size > len - pos || verify_object(id, payload + pos, (size_t)size) != 0) {
+                char hex[MAX_HASH_LEN];
+                hash_to_hex(id, hex);
+                fprintf(stderr, "vcs: received object %s does not match its id\n", hex);
+                status = -1;
+                break;
+            }
+            size_t length = (size_t)size;
+            buffer_add(&ids, id, HASH_RAW_LEN);
+            buffer_add(&blob, payload + pos, length);
+            buffer_add(&lengths, &length, sizeof(length));
+            pos += length;
+            stats->objects++;
+            stats->bytes += (long long)length;
+        }
+        free(payload);
+        if (ids.failed || blob.failed || lengths.failed) status = -1;
+        if (status == 0 && blob.len >= REMOTE_PACK_SIZE) status = store_received(repo, &ids, &blob, &lengths);
+    }
+    if (status == 0) status = store_received(repo, &ids, &blob, &lengths);
+    free(ids.data);
+    free(blob.data);
+    free(lengths.data);
+    return status;
+}
+
+/*
+The function build_records formats the records of the requested versions ("<version> <filename>" lines).
+Returns 0 on success, -1 if memory allocation fails. Versions that are gone are left out.
+*/
+static int build_records(Repository* repo, char* request, Buffer* out) {
+    buffer_add(out, "", 0);
+    char* line = request;
+    for (char* end; (end = strchr(line, '\n')) != NULL; line = end + 1) {
+        *end = '\0';
+        char* filename = strchr(line, ' ');
+        if (!filename) continue;
+        FileVersion* v = find_file_version(repo, filename + 1, atoi(line));
+        if (!v) continue;
+        char record[METADATA_LINE_MAX];
+        int len = format_version_record(v, record, sizeof(record) - 1);
+        if ((size_t)len >= sizeof(record) - 1) continue;     // Truncated
+        record[len++] = '\n';
+        buffer_add(out, record, (size_t)len);
+    }
+    return out->failed ? -1 : 0;
+}
+
+/*
+The function merge_records adds the versions of received text records that this repository lacks.
+A version number the repository already has with other contents is a conflict: the file's remaining records are
+skipped, so no history is rewritten. Versions whose objects are not stored are skipped as well.
+Returns 0 on success, -1 if the metadata could not be locked or saved.
+It takes Repository* repo, char* text (records separated by newlines, modified) and SyncStats* stats.
+*/
+static int merge_records(Repository* repo, char* text, SyncStats* stats) {
+    int lock = lock_repository(repo->base_path, LOCK_FILE, 1);
+    if (lock < 0) return -1;
+    if (refresh_metadata(repo) != 0) {
+        unlock_repository(lock);
+        return -1;
+    }
+
+    long added = 0;
+    const char* conflicted = NULL;      // Filenames are interned, so the pointer identifies the file
+    char* line = text;
+    for (char* end; line && *line; line = end ? end + 1 : NULL) {
+        end = strchr(line, '\n');
+        if (end) *end = '\0';
+        if (strncmp(line, "FILE=", 5) != 0) continue;
+        FileVersion* v = parse_version_record(repo, line + 5);
+        if (!v || !(v->flags & VERSION_HAS_OBJECT) || v->filename == conflicted) continue;
+
+        FileVersion* existing = find_file_version(repo, v->filename, v->version_number);
+        if (existing) {
+            if ((existing->flags & VERSION_HAS_OBJECT) && memcmp(existing->object_id, v->object_id, HASH_RAW_LEN) == 0) continue;
+            conflicted = v->filename;
+            stats->conflicts++;
+            continue;
+        }
+        char hex[MAX_HASH_LEN];
+        hash_to_hex(v->object_id, hex);
+        if (!object_exists(hex)) {
+            stats->skipped++;
+            continue;
+        }
+        if (add_file_version(repo, v) != 0) break;
+        repo->total_versions++;
+        added++;
+    }
+    int status = (added > 0) ? save_metadata(repo) : 0;
+    unlock_repository(lock);
+    if (status == 0) stats->records += added;
+    return status;
+}
+
+/*
+The function serve_request answers one request of the client.
+Returns 0 if the conversation can go on (failures the client can report are sent as ERROR frames),
+-1 if the connection broke.
+*/
+static int serve_request(Repository* repo, Connection* c, int type, unsigned char* payload, size_t len) {
+    SyncStats stats;
+    memset(&stats, 0, sizeof(stats));
+    Buffer out;
+    memset(&out, 0, sizeof(out));
+    size_t count = len / HASH_RAW_LEN;
+    int status = 0;
+
+    switch (type) {
+    case MSG_KEYS:
+        if (build_keys(repo, &out) != 0) status = send_error(c, "cannot list the versions");
+        else status = send_list(c, MSG_KEY_LIST, out.data, out.len);
+        break;
+    case MSG_HAVE: {
+        unsigned char* have = malloc(count + 1);
+        if (!have) {
+            status = send_error(c, "out of memory");
+            break;
+        }
+        for (size_t i = 0; i < count; i++) {
+            char hex[MAX_HASH_LEN];
+            hash_to_hex(payload + i * HASH_RAW_LEN, hex);
+            have[i] = (unsigned char)object_exists(hex);
+        }
+        status = send_frame(c, MSG_HAVE_LIST, have, count);
+        free(have);
+        break;
+    }
+    case MSG_CLOSURE:
+        if (local_closure(payload, count, &out) != 0) status = send_error(c, "out of memory");
+        else status = send_list(c, MSG_ID_LIST, out.data, out.len);
+        break;
+    case MSG_GET:
+        status = send_objects(c, payload, count, &stats);
+        break;
+    case MSG_PUT:
+        // A failure cannot be reported before the client finished sending, so the connection ends then
+        if (receive_objects(repo, c, &stats) != 0) status = -1;
+        else status = send_frame(c, MSG_DONE, NULL, 0);
+        break;
+    case MSG_RECORDS:
+        if (build_records(repo, (char*)payload, &out) != 0) status = send_error(c, "out of memory");
+        else status = send_list(c, MSG_RECORD_LIST, out.data, out.len);
+        break;
+    case MSG_MERGE: {
+        char reply[64];
+        if (receive_list(c, MSG_RECORD_LIST, &out) != 0) {
+            status = -1;
+        } else if (merge_records(repo, (char*)out.data, &stats) != 0) {
+            status = send_error(c, "cannot record the versions");
+        } else {
+            int n = snprintf(reply, sizeof(reply), "%ld %ld %ld", stats.records, stats.conflicts, stats.skipped);
+            status = send_frame(c, MSG_DONE, reply, (size_t)n);
+        }
+        break;
+    }
+    default:
+        status = send_error(c, "unknown request");
+        break;
+    }
+    free(out.data);
+    if (status == 0 && fflush(c->out) != 0) status = -1;
+    return status;
+}
+
+/*
+The function remote_serve answers the requests of a push or pull run in another repository ("vcs serve").
+Returns 0 once the client said goodbye, -1 if the connection broke.
+It takes Repository* repo and int in_fd / int out_fd (the connection; normally stdin and the original stdout).
+*/
+int remote_serve(Repository* repo, int in_fd, int out_fd) {
+    if (!repo) return -1;
+    signal(SIGPIPE, SIG_IGN);
+    Connection c;
+    memset(&c, 0, sizeof(c));
+    c.in = fdopen(in_fd, "rb");
+    c.out = fdopen(out_fd, "wb");
+    int status = (c.in && c.out) ? 0 : -1;
+    while (status == 0) {
+        int type;
+        unsigned char* payload;
+        size_t len;
+        if (receive_frame(&c, &type, &payload, &len) != 0) {
+            status = -1;
+            break;
+        }
+        if (type == MSG_QUIT) {
+            free(payload);
+            break;
+        }
+        status = serve_request(repo, &c, type, payload, len);
+        free(payload);
+    }
+    if (c.in) fclose(c.in);
+    if (c.out) fclose(c.out);
+    return status;
+}
+
+/*
+The function connection_open starts "vcs serve" for a remote and connects to its stdin and stdout.
+host:path (a colon before the first slash) runs it over ssh, anything else is a local path. The program started
+on the other side is VCS_REMOTE_PROGRAM, or vcs (this executable for a local path).
+Returns 0 on success, -1 on failure.
+*/
+static int connection_open(const char* remote, Connection* c) {
+    memset(c, 0, sizeof(*c));
+    const char* colon = strchr(remote, ':');
+    const char* slash = strchr(remote, '/');
+    int ssh = colon && colon != remote && (!slash || colon < slash);
+    const char* program = getenv("VCS_REMOTE_PROGRAM");
+    if (program && !*program) program = NULL;
+
+    // The remote shell parses the command line, so the path is quoted
+    char host[MAX_PATH_LEN], command[4 * MAX_PATH_LEN];
+    if (ssh) {
+        snprintf(host, sizeof(host), "%.*s", (int)(colon - remote), remote);
+        const char* path = colon[1] ? colon + 1 : ".";
+        size_t pos = (size_t)snprintf(command, sizeof(command), "%s serve '", program ? program : "vcs");
+        for (const char* p = path; *p && pos + 6 < sizeof(command); p++) {
+            if (*p == '\'') {
+                memcpy(command + pos, "'\\''", 4);
+                pos += 4;
+            } else {
+                command[pos++] = *p;
+            }
+        }
+        snprintf(command + pos, sizeof(command) - pos, "'");
+    }
+
+    int to_child[2], from_child[2];
+    if (pipe(to_child) != 0) return -1;
+    if (pipe(from_child) != 0) {
+        close(to_child[0]);
+        close(to_child[1]);
+        return -1;
+    }
+    // Transport processes started later must not hold on to this connection's pipes
+    fcntl(to_child[1], F_SETFD, FD_CLOEXEC);
+    fcntl(from_child[0], F_SETFD, FD_CLOEXEC);
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(to_child[0], STDIN_FILENO);
+        dup2(from_child[1], STDOUT_FILENO);
+        close(to_child[0]);
+        close(from_child[1]);
+        if (ssh) {
+            execlp("ssh", "ssh", host, command, (char*)NULL);
+        } else if (program) {
+            execlp(program, program, "serve", remote, (char*)NULL);
+        } else {
+            execl("/proc/self/exe", "vcs", "serve", remote, (char*)NULL);
+            execlp("vcs", "vcs", "serve", remote, (char*)NULL);
+        }
+        fprintf(stderr, "vcs: cannot run %s\n", ssh ? "ssh" : (program ? program : "vcs"));
+        _exit(127);
+    }
+    close(to_child[0]);
+    close(from_child[1]);
+    if (pid < 0) {
+        close(to_child[1]);
+        close(from_child[0]);
+        return -1;
+    }
+    c->pid = pid;
+    c->out = fdopen(to_child[1], "wb");
+    c->in = fdopen(from_child[0], "rb");
+    if (!c->out || !c->in) {
+        if (c->out) fclose(c->out);
+        else close(to_child[1]);
+        if (c->in) fclose(c->in);
+        else close(from_child[0]);
+        waitpid(pid, NULL, 0);
+        return -1;
+    }
+    setvbuf(c->out, NULL, _IOFBF, 1 << 16);
+    return 0;
+}
+
+/*
+The function connection_close says goodbye, closes the pipes and waits for the transport process.
+*/
+static void connection_close(Connection* c) {
+    if (c->out) {
+        send_frame(c, MSG_QUIT, NULL, 0);
+        fclose(c->out);
+    }
+    if (c->in) fclose(c->in);
+    if (c->pid > 0) waitpid(c->pid, NULL, 0);
+    memset(c, 0, sizeof(*c));
+}
+
+/*
+The function request sends a request frame and flushes it.
+Returns 0 on success, -1 on failure.
+*/
+static int request(Connection* c, int type, const void* payload, size_t len) {
+    if (send_frame(c, type, payload, len) != 0 || fflush(c->out) != 0) {
+        fprintf(stderr, "vcs: lost the connection to the remote repository\n");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+The function remote_missing keeps the ids the other side does not have.
+Returns 0 on success, -1 on failure.
+*/
+static int remote_missing(Connection* c, Buffer* ids) {
+    size_t count = ids->len / HASH_RAW_LEN;
+    if (count == 0) return 0;
+    unsigned char* have;
+    size_t len;
+    if (request(c, MSG_HAVE, ids->data, ids->len) != 0 || expect_frame(c, MSG_HAVE_LIST, &have, &len) != 0) return -1;
+    if (len != count) {
+        free(have);
+        return -1;
+    }
+    size_t kept = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (have[i]) continue;
+        memmove(ids->data + kept * HASH_RAW_LEN, ids->data + i * HASH_RAW_LEN, HASH_RAW_LEN);
+        kept++;
+    }
+    ids->len = kept * HASH_RAW_LEN;
+    free(have);
+    return 0;
+}
+
+/*
+The function receive_keys asks the other side for its key list.
+Returns the number of keys (*keys points into *text, both malloc'd), or -1 on failure.
+*/
+static int receive_keys(Connection* c, Buffer* text, RemoteKey** keys) {
+    if (request(c, MSG_KEYS, NULL, 0) != 0 || receive_list(c, MSG_KEY_LIST, text) != 0) return -1;
+    return parse_keys((char*)text->data, keys);
+}
+
+/*
+The function transfer_worker copies the objects of one connection (thread start routine).
+*/
+static void* transfer_worker(void* arg) {
+    Transfer* t = arg;
+    Connection* c = t->connection;
+    size_t count = t->ids.len / HASH_RAW_LEN;
+    if (t->push) {
+        // The objects stream behind the request; the server acknowledges once they are in a pack
+        unsigned char* reply;
+        size_t len;
+        t->status = (send_frame(c, MSG_PUT, NULL, 0) == 0 && send_objects(c, t->ids.data, count, &t->stats) == 0 &&
+                     fflush(c->out) == 0 && expect_frame(c, MSG_DONE, &reply, &len) == 0) ? 0 : -1;
+        if (t->status == 0) free(reply);
+    } else {
+        t->status = (request(c, MSG_GET, t->ids.data, t->ids.len) == 0 &&
+                     receive_objects(t->repo, c, &t->stats) == 0) ? 0 : -1;
+    }
+    return NULL;
+}
+
+/*
+The function transfer_objects copies objects over up to connections parallel connections, dealing the ids out
+round-robin. Connection 0 is already open; the others are opened here and closed again afterwards.
+Returns 0 on success, -1 on failure.
+It takes Repository* repo, const char* remote, Connection* first, const Buffer* ids, int push / int connections
+and SyncStats* stats (receives the object counts).
+*/
+static int transfer_objects(Repository* repo, const char* remote, Connection* first, const Buffer* ids, int push,
+                            int connections, SyncStats* stats) {
+    size_t count = ids->len / HASH_RAW_LEN;
+    if (count == 0) return 0;
+    if (connections < 1) connections = 1;
+    if (connections > REMOTE_MAX_CONNECTIONS) connections = REMOTE_MAX_CONNECTIONS;
+    if ((size_t)connections > count) connections = (int)count;
+
+    Connection extra[REMOTE_MAX_CONNECTIONS];
+    Transfer transfers[REMOTE_MAX_CONNECTIONS];
+    memset(transfers, 0, sizeof(transfers));
+    int opened = 1;
+    while (opened < connections && connection_open(remote, &extra[opened]) == 0) opened++;
+    for (int i = 0; i < opened; i++) {
+        transfers[i].repo = repo;
+        transfers[i].connection = (i == 0) ? first : &extra[i];
+        transfers[i].push = push;
+    }
+    for (size_t i = 0; i < count; i++) buffer_add(&transfers[i % (size_t)opened].ids, ids->data + i * HASH_RAW_LEN, HASH_RAW_LEN);
+
+    pthread_t threads[REMOTE_MAX_CONNECTIONS];
+    int started[REMOTE_MAX_CONNECTIONS] = {0};
+    for (int i = 1; i < opened; i++) started[i] = pthread_create(&threads[i], NULL, transfer_worker, &transfers[i]) == 0;
+    for (int i = 1; i < opened; i++) {
+        if (!started[i]) transfer_worker(&transfers[i]);     // Runs on this thread instead
+    }
+    transfer_worker(&transfers[0]);
+
+    int status = 0;
+    for (int i = 0; i < opened; i++) {
+        if (i > 0 && started[i]) pthread_join(threads[i], NULL);
+        if (transfers[i].ids.failed || transfers[i].status != 0) status = -1;
+        stats->objects += transfers[i].stats.objects;
+        stats->bytes += transfers[i].stats.bytes;
+        if (i > 0) {
+            stats->wire_bytes += extra[i].wire_bytes;
+            connection_close(&extra[i]);
+        }
+        free(transfers[i].ids.data);
+    }
+    return status;
+}
+
+/*
+The function remote_push copies the versions another repository lacks to it, with the objects they need.
+Files whose histories differ are reported and left alone. Returns 0 on success, -1 on failure.
+It takes Repository* repo, const char* remote (host:path or a local path), int connections (parallel connections
+for the objects) and SyncStats* stats (receives what was copied).
+*/
+int remote_push(Repository* repo, const char* remote, int connections, SyncStats* stats) {
+    if (!repo || !remote || !stats) return -1;
+    memset(stats, 0, sizeof(*stats));
+    signal(SIGPIPE, SIG_IGN);
+    Connection c;
+    if (connection_open(remote, &c) != 0) return -1;
+
+    Buffer text, ids, closure, records;
+    memset(&text, 0, sizeof(text));
+    memset(&ids, 0, sizeof(ids));
+    memset(&closure, 0, sizeof(closure));
+    memset(&records, 0, sizeof(records));
+    RemoteKey* keys = NULL;
+    FileVersion** versions = NULL;
+    int key_count = receive_keys(&c, &text, &keys);
+    int count = (key_count >= 0) ? collect_all_versions(repo, &versions) : -1;
+    int status = (count >= 0) ? 0 : -1;
+
+    // The versions the other side lacks, up to the first conflict of each file
+    int selected = 0;
+    const char* conflicted = NULL;
+    for (int i = 0; i < count; i++) {
+        FileVersion* v = versions[i];
+        if (!(v->flags & VERSION_HAS_OBJECT) || strchr(v->filename, '\n') || v->filename == conflicted) continue;
+        const RemoteKey* key = find_key(keys, key_count, v->filename, v->version_number);
+        if (key) {
+            if (key->has_object && memcmp(key->object_id, v->object_id, HASH_RAW_LEN) == 0) continue;
+            printf("Conflict: '%s' version %d differs on %s, later versions not pushed\n", v->filename, v->version_number, remote);
+            conflicted = v->filename;
+            stats->conflicts++;
+            continue;
+        }
+        versions[selected++] = v;
+        buffer_add(&ids, v->object_id, HASH_RAW_LEN);
+    }
+
+    // Objects the other side lacks, with the bases and chunks it lacks as well
+    sort_ids(&ids);
+    if (status == 0 && remote_missing(&c, &ids) != 0) status = -1;
+    if (status == 0 && local_closure(ids.data, ids.len / HASH_RAW_LEN, &closure) != 0) status = -1;
+    if (status == 0 && remote_missing(&c, &closure) != 0) status = -1;
+    if (status == 0) status = transfer_objects(repo, remote, &c, &closure, 1, connections, stats);
+
+    // The records go last, once their objects are stored
+    for (int i = 0; status == 0 && i < selected; i++) {
+        char record[METADATA_LINE_MAX];
+        int len = format_version_record(versions[i], record, sizeof(record) - 1);
+        if ((size_t)len >= sizeof(record) - 1) continue;
+        record[len++] = '\n';
+        buffer_add(&records, record, (size_t)len);
+    }
+    if (status == 0 && selected > 0) {
+        unsigned char* reply;
+        size_t len;
+        long added = 0, conflicts = 0, skipped = 0;
+        if (records.failed || send_frame(&c, MSG_MERGE, NULL, 0) != 0 ||
+            send_list(&c, MSG_RECORD_LIST, records.data, records.len) != 0 || fflush(c.out) != 0 ||
+            expect_frame(&c, MSG_DONE, &reply, &len) != 0) {
+            status = -1;
+        } else {
+            sscanf((char*)reply, "%ld %ld %ld", &added, &conflicts, &skipped);
+            free(reply);
+            stats->records += added;
+            stats->conflicts += conflicts;
+            stats->skipped += skipped;
+        }
+    }
+    stats->wire_bytes += c.wire_bytes;
+    connection_close(&c);
+    free(versions);
+    free(keys);
+    free(text.data);
+    free(ids.data);
+    free(closure.data);
+    free(records.data);
+    return status;
+}
+
+/*
+The function remote_pull copies the versions this repository lacks from another one, with the objects they need.
+Files whose histories differ are reported and left alone. Returns 0 on success, -1 on failure.
+It takes Repository* repo, const char* remote (host:path or a local path), int connections (parallel connections
+for the objects) and SyncStats* stats (receives what was copied).
+*/
+int remote_pull(Repository* repo, const char* remote, int connections, SyncStats* stats) {
+    if (!repo || !remote || !stats) return -1;
+    memset(stats, 0, sizeof(*stats));
+    signal(SIGPIPE, SIG_IGN);
+    Connection c;
+    if (connection_open(remote, &c) != 0) return -1;
+
+    Buffer text, ids, closure, wanted, records;
+    memset(&text, 0, sizeof(text));
+    memset(&ids, 0, sizeof(ids));
+    memset(&closure, 0, sizeof(closure));
+    memset(&wanted, 0, sizeof(wanted));
+    memset(&records, 0, sizeof(records));
+    RemoteKey* keys = NULL;
+    int count = receive_keys(&c, &text, &keys);
+    int status = (count >= 0) ? 0 : -1;
+
+    // The versions this repository lacks, up to the first conflict of each file
+    const char* conflicted = NULL;
+    for (int i = 0; i < count; i++) {
+        const RemoteKey* key = &keys[i];
+        if (!key->has_object || (conflicted && strcmp(conflicted, key->filename) == 0)) continue;
+        FileVersion* existing = find_file_version(repo, key->filename, key->version);
+        if (existing) {
+            if ((existing->flags & VERSION_HAS_OBJECT) && memcmp(existing->object_id, key->object_id, HASH_RAW_LEN) == 0) continue;
+            printf("Conflict: '%s' version %d differs on %s, later versions not pulled\n", key->filename, key->version, remote);
+            conflicted = key->filename;
+            stats->conflicts++;
+            continue;
+        }
+        char line[MAX_FILENAME_LEN + 16];
+        int len = snprintf(line, sizeof(line), "%d %s\n", key->version, key->filename);
+        buffer_add(&wanted, line, ((size_t)len < sizeof(line)) ? (size_t)len : sizeof(line) - 1);
+        buffer_add(&ids, key->object_id, HASH_RAW_LEN);
+    }
+
+    // The other side expands the missing objects with their bases and chunks; the ones stored here are dropped
+    sort_ids(&ids);
+    local_missing(&ids);
+    if (status == 0 && ids.len > 0) {
+        if (request(&c, MSG_CLOSURE, ids.data, ids.len) != 0 || receive_list(&c, MSG_ID_LIST, &closure) != 0) status = -1;
+        else local_missing(&closure);
+    }
+    if (status == 0) status = transfer_objects(repo, remote, &c, &closure, 0, connections, stats);
+
+    // The records are recorded only once their objects are stored
+    if (status == 0 && wanted.len > 0) {
+        if (wanted.failed || request(&c, MSG_RECORDS, wanted.data, wanted.len) != 0 ||
+            receive_list(&c, MSG_RECORD_LIST, &records) != 0 ||
+            merge_records(repo, (char*)records.data, stats) != 0) {
+            status = -1;
+        }
+    }
+    stats->wire_bytes += c.wire_bytes;
+    connection_close(&c);
+    free(keys);
+    free(text.data);
+    free(ids.data);
+    free(closure.data);
+    free(wanted.data);
+    free(records.data);
+    return status;
+}
@@ -2,7 +2,7 @@
 
 /*
 The function init_repository initializes a new VCS repository at the specified path by creating the .vcs directory,
-its subdirectories (versions and temp), and an initial metadata file (versions.meta).
+its subdirectories (versions, objects and temp), an empty metadata file (versions.bin) and the default configuration (config).
 Returns -1 if the .vcs directory creation fails.
 Returns 0 to indicate successful initialization.
 */
@@ -27,44 +27,51 @@ int init_repository(const char* path) {
 
     // Arrays to store paths for subdirectories: versions (to store versioned files) and temp (for temporary files during operations)
     char versions_path[MAX_PATH_LEN];
+    char objects_path[MAX_PATH_LEN];
     char temp_path[MAX_PATH_LEN];
 
     snprintf(versions_path, sizeof(versions_path), "%s/versions", vcs_path);    // Constructs the path to the versions subdirectory
+    snprintf(objects_path, sizeof(objects_path), "%s/%s", vcs_path, OBJECTS_DIR);     // Constructs the path to the object store
     snprintf(temp_path, sizeof(temp_path), "%s/temp", vcs_path);    // Constructs the path to the temp subdirectory
     
-    // Creates the versions and temp subdirectories with 0755 permissions (read/write/execute for owner, read/execute for group and others)
+    // Creates the versions, objects and temp subdirectories with 0755 permissions (read/write/execute for owner, read/execute for group and others)
     // mkdir(versions_path, 0755);
     // mkdir(temp_path, 0755);
     if (mkdir(versions_path, 0755) != 0) {
         perror("Failed to create versions subdirectory");
         return -1;
     }
+    if (mkdir(objects_path, 0755) != 0) {
+        perror("Failed to create objects subdirectory");
+        return -1;
+    }
     if (mkdir(temp_path, 0755) != 0) {
         perror("Failed to create temp subdirectory");
         return -1;
     }
 
-    // Create initial metadata file
-    
-    char metadata_path[MAX_PATH_LEN];   // array for the path to the metadata file (e.g., /home/rahul/project/.vcs/versions.meta)
-    snprintf(metadata_path, sizeof(metadata_path), "%s/%s", vcs_path, METADATA_FILE);   // Constructs the path to versions.meta (METADATA_FILE is defined as "versions.meta" in vcs.h)
+    // Create the initial (empty) metadata file versions.bin by compacting a repository without versions
+    Repository* repo = load_repository(path);
+    if (!repo || compact_metadata(repo) != 0) {
+        perror("Failed to create metadata file");
+        cleanup_repository(repo);
+        return -1;
+    }
+    cleanup_repository(repo);
     
-    // Opens versions.meta in write mode ("w"), creating it if it doesn’t exist or overwriting it if it does.
-    // Returns a FILE* pointer or NULL if the operation fails (e.g., due to permissions)
-    FILE* metadata_file = fopen(metadata_path, "w");
-
-    //Checks if the file was opened successfully
-    if (metadata_file) {    
-        fprintf(metadata_file, "# VCS Metadata File\n");    // We write a comment to versions.meta to indicate it’s a VCS metadata file
-        fprintf(metadata_file, "TOTAL_VERSIONS=0\n");       // Set initial total versions count (0, since no files are versioned yet)
-        fclose(metadata_file);      // Closes the metadata file to ensure changes are saved
+    // Write the default configuration so it can be tuned per repository
+    RepoConfig config;
+    config_defaults(&config);
+    if (save_config(path, &config) != 0) {
+        perror("Failed to write repository configuration");
+        return -1;
     }
     
     return 0;   // Returns 0 to indicate successful initialization
 }
 
 /*
-The function load_repository loads an existing repository’s state from the specified path into a Repository structure, initializing its fields and loading metadata from versions.meta.
+The function load_repository loads an existing repository’s state from the specified path into a Repository structure, initializing its fields and mapping the metadata in versions.bin.
 It takes a const char* path (the repository’s root directory) parameter and returns a Repository* (pointer to a Repository structure or NULL on failure).
 */
 Repository* load_repository(const char* path) {
@@ -76,11 +83,25 @@ Repository* load_repository(const char* path) {
     repo->base_path[MAX_PATH_LEN - 1] = '\0';   // Ensures the base_path is null-terminated
     repo->total_versions = 0;
     repo->version_list = NULL;
+    arena_init(&repo->arena, 64 * 1024);
+    repo->metadata_map = NULL;
+    repo->journal_head = NULL;
+    repo->journal_entries = 0;
+    repo->journal_size = 0;
+    repo->file_index = NULL;
+    repo->metadata_generation = 0;
     
-    // Call load_metadata (defined in metadata.c) to read metadata from versions.meta and update repo->version_list and repo->total_versions
+    // Read the repository settings from .vcs/config (defaults apply to anything not set there)
+    load_config(repo->base_path, &repo->config);
+    
+    // Call load_metadata (defined in metadata.c) to map versions.bin and set repo->total_versions
+    // The shared lock lets other readers load at the same time but waits for a check-in that is writing the journal
     // If load_metadata returns non-zero (indicating failure), free the allocated repo memory and returns NULL to indicate failure
-    if (load_metadata(repo) != 0) {
-        free(repo);
+    int lock = lock_repository(path, LOCK_FILE, 0);
+    int status = load_metadata(repo);
+    unlock_repository(lock);
+    if (status != 0) {
+        cleanup_repository(repo);
         return NULL;
     }
     
@@ -89,20 +110,14 @@ Repository* load_repository(const char* path) {
 
 
 /*
-The function cleanup_repository frees all memory associated with a Repository structure, including its version_list linked list, to prevent memory leaks.
+The function cleanup_repository frees all memory associated with a Repository structure, including its versions and the metadata mapping, to prevent memory leaks.
 It takes a Repository* repo parameter and returns void (no return value).
 */
 void cleanup_repository(Repository* repo) {
     if (!repo) return;  // If repo is NULL (e.g., if load_repository failed or repo was already freed), exit
     
-    // Initializing current to point to the head of the version_list linked list, which contains FileVersion nodes
-    FileVersion* current = repo->version_list;
-    // Loops through the linked list until current is NULL (end of the list)
-    while (current) {
-        FileVersion* next = current->next;
-        free(current);
-        current = next; 
-    }
+    close_metadata(repo);   // Unmaps versions.bin
+    arena_free(&repo->arena);   // Releases every FileVersion, filename and comment at once
     
     free(repo); // Frees the memory for the Repository structure after all FileVersion nodes are freed
 }
@@ -0,0 +1,466 @@
+#include "vcs.h"
+#include <fcntl.h>      // Provides open() flags for appending to the snapshot list
+
+/*
+A snapshot ties the versions of many files together, so a whole tree can be checked out or rolled back at once.
+Its manifest lists one tracked file per line, sorted by filename:
+    VERSION <tab> OBJECT <tab> FILENAME
+(OBJECT is "-" for versions of older repositories that are not in the object store) and is stored in the object
+store like file contents. .vcs/snapshots records every snapshot, one line each, in the style of versions.meta:
+    SNAPSHOT=id|TIMESTAMP=time|FILES=count|MANIFEST=object id|COMMENT=text
+Restoring a snapshot compares every file with its snapshot version through the stat cache (see status.c) and
+restores only the files that differ, in parallel.
+*/
+
+#define SNAPSHOT_LINE_MAX 2048      // Longest line of .vcs/snapshots
+
+// State shared by the workers of restore_snapshot
+typedef struct SnapshotRestore {
+    StatusItem* items;
+    int* pending;               // Indexes of the items to restore
+    int* results;               // restore_version_file result for each pending item
+    int* retry;                 // Indexes into pending of the items the io_uring batches left over
+} SnapshotRestore;
+
+/*
+The function snapshots_path builds the path of .vcs/snapshots.
+*/
+static void snapshots_path(const Repository* repo, char* path, size_t size) {
+    snprintf(path, size, "%s/%s/%s", repo->base_path, VCS_DIR, SNAPSHOTS_FILE);
+}
+
+/*
+The function parse_snapshot parses one line of .vcs/snapshots.
+Returns 0 on success, -1 if the line is not a snapshot record.
+It takes char* line (modified) and Snapshot* snapshot (receives the fields).
+*/
+static int parse_snapshot(char* line, Snapshot* snapshot) {
+    if (strncmp(line, "SNAPSHOT=", 9) != 0) return -1;
+    line[strcspn(line, "\n")] = '\0';
+    memset(snapshot, 0, sizeof(*snapshot));
+    snapshot->id = atoi(line + 9);
+
+    // The comment is the last field and may itself contain '|'
+    char* comment = strstr(line, "|COMMENT=");
+    if (comment) {
+        snprintf(snapshot->comment, sizeof(snapshot->comment), "%s", comment + 9);
+        *comment = '\0';
+    }
+    for (char* field = strchr(line, '|'); field; field = strchr(field, '|')) {
+        *field++ = '\0';
+        if (strncmp(field, "TIMESTAMP=", 10) == 0) snapshot->timestamp = (time_t)atol(field + 10);
+        else if (strncmp(field, "FILES=", 6) == 0) snapshot->file_count = atoi(field + 6);
+        else if (strncmp(field, "MANIFEST=", 9) == 0) snprintf(snapshot->manifest, sizeof(snapshot->manifest), "%.*s", (int)strcspn(field + 9, "|"), field + 9);
+    }
+    return (snapshot->id > 0 && snapshot->manifest[0]) ? 0 : -1;
+}
+
+/*
+The function read_snapshots loads every snapshot recorded in .vcs/snapshots, oldest first.
+Returns the number of snapshots (0 if there are none), or -1 if memory allocation fails.
+It takes const Repository* repo and Snapshot** out (receives a malloc'd array the caller frees).
+*/
+static int read_snapshots(const Repository* repo, Snapshot** out) {
+    *out = NULL;
+    char path[MAX_PATH_LEN];
+    snapshots_path(repo, path, sizeof(path));
+    FILE* file = fopen(path, "r");
+    if (!file) return 0;
+
+    int count = 0, cap = 0;
+    Snapshot* snapshots = NULL;
+    char line[SNAPSHOT_LINE_MAX];
+    while (fgets(line, sizeof(line), file)) {
+        Snapshot snapshot;
+        if (parse_snapshot(line, &snapshot) != 0) continue;
+        if (count == cap) {
+            cap = cap ? cap * 2 : 16;
+            Snapshot* grown = realloc(snapshots, cap * sizeof(Snapshot));
+            if (!grown) {
+                free(snapshots);
+                fclose(file);
+                return -1;
+            }
+            snapshots = grown;
+        }
+        snapshots[count++] = snapshot;
+    }
+    fclose(file);
+    *out = snapshots;
+    return count;
+}
+
+/*
+The function find_snapshot looks up a snapshot by id.
+Returns 0 if it exists, -1 otherwise.
+It takes const Repository* repo, int id and Snapshot* snapshot (receives the snapshot).
+*/
+int find_snapshot(const Repository* repo, int id, Snapshot* snapshot) {
+    if (!repo || !snapshot) return -1;
+    Snapshot* snapshots = NULL;
+    int count = read_snapshots(repo, &snapshots);
+    int found = -1;
+    for (int i = 0; i < count; i++) {
+        if (snapshots[i].id == id) {
+            *snapshot = snapshots[i];
+            found = 0;
+        }
+    }
+    free(snapshots);
+    return found;
+}
+
+/*
+The function compare_names orders filenames (qsort callback on char* pointers).
+*/
+static int compare_names(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+/*
+The function store_manifest writes the manifest of the latest versions of the given files into the object store.
+Returns 0 on success, -1 on failure.
+It takes Repository* repo, char** names / int count (sorted, without duplicates) and char* manifest_id
+(receives the object id, MAX_HASH_LEN bytes).
+*/
+static int store_manifest(Repository* repo, char** names, int count, char* manifest_id) {
+    char temp_dir[MAX_PATH_LEN], temp_path[MAX_PATH_LEN];
+    snprintf(temp_dir, sizeof(temp_dir), "%s/%s/temp", repo->base_path, VCS_DIR);
+    snprintf(temp_path, sizeof(temp_path), "%s/manifest.XXXXXX", temp_dir);
+    create_directory(temp_dir);
+    int fd = mkstemp(temp_path);
+    if (fd < 0) return -1;
+    FILE* file = fdopen(fd, "w");
+    if (!file) {
+        close(fd);
+        unlink(temp_path);
+        return -1;
+    }
+
+    int status = 0;
+    for (int i = 0; i < count; i++) {
+        FileVersion* version = find_file_version(repo, names[i], get_latest_version(repo, names[i]));
+        if (!version) continue;
+        char object_id[MAX_HASH_LEN] = "-";
+        if (version->flags & VERSION_HAS_OBJECT) hash_to_hex(version->object_id, object_id);
+        fprintf(file, "%d\t%s\t%s\n", version->version_number, object_id, version->filename);
+    }
+    if (ferror(file)) status = -1;
+    if (fclose(file) != 0) status = -1;
+
+    if (status == 0 && (hash_file(temp_path, manifest_id, NULL) != 0 ||
+                        store_object(temp_path, manifest_id, &repo->config) != 0)) {
+        status = -1;
+    }
+    unlink(temp_path);
+    return status;
+}
+
+/*
+The function append_snapshot adds a snapshot record to .vcs/snapshots and flushes it to disk.
+Returns 0 on success, -1 on failure.
+*/
+static int append_snapshot(const Repository* repo, const Snapshot* snapshot) {
+    char path[MAX_PATH_LEN];
+    snapshots_path(repo, path, sizeof(path));
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0666);
+    if (fd < 0) return -1;
+
+    // Comments are a single line
+    char comment[MAX_COMMENT_LEN];
+    snprintf(comment, sizeof(comment), "%s", snapshot->comment);
+    for (char* c = comment; *c; c++) {
+        if (*c == '\n' || *c == '\r') *c = ' ';
+    }
+
+    char line[SNAPSHOT_LINE_MAX];
+    int len = snprintf(line, sizeof(line), "SNAPSHOT=%d|TIMESTAMP=%ld|FILES=%d|MANIFEST=%s|COMMENT=%s\n",
+                       snapshot->id, (long)snapshot->timestamp, snapshot->file_count, snapshot->manifest, comment);
+    if (len >= (int)sizeof(line)) len = (int)sizeof(line) - 1;
+    int status = (write(fd, line, len) == len && fsync(fd) == 0) ? 0 : -1;
+    if (close(fd) != 0) status = -1;
+    return status;
+}
+
+/*
+The function create_snapshot checks in every tracked file that changed, plus the given files, and records the
+latest version of all of them as a new snapshot.
+Tracked files that are missing from the working tree are left out of the snapshot.
+Returns the id of the new snapshot, or -1 on failure.
+It takes Repository* repo, char** files / int count (files to add besides the tracked ones, may be empty),
+const char* comment and int* checked_in (optional, receives the number of new file versions).
+*/
+int create_snapshot(Repository* repo, char** files, int count, const char* comment, int* checked_in) {
+    if (!repo || (count > 0 && !files)) return -1;
+    if (checked_in) *checked_in = 0;
+
+    // The stat cache finds the changed files without reading the unchanged ones
+    StatusItem* items = NULL;
+    int tracked = status_scan(repo, &items);
+    if (tracked < 0) return -1;
+
+    char** names = malloc((tracked + count + 1) * sizeof(char*));       // Every file of the snapshot
+    char** changed = malloc((tracked + count + 1) * sizeof(char*));     // Files to check in
+    CheckinItem* checkins = calloc(tracked + count + 1, sizeof(CheckinItem));
+    int status = -1;
+    if (!names || !changed || !checkins) goto done;
+
+    int name_count = 0, changed_count = 0;
+    for (int i = 0; i < tracked; i++) {
+        if (items[i].state == STATUS_CLEAN) {
+            names[name_count++] = (char*)items[i].version->filename;
+        } else if (items[i].state == STATUS_MODIFIED) {
+            changed[changed_count++] = (char*)items[i].version->filename;
+        }
+    }
+    for (int i = 0; i < count; i++) changed[changed_count++] = files[i];
+
+    if (changed_count > 0) {
+        int added = checkin_files(repo, changed, changed_count, comment, checkins);
+        if (added < 0) goto done;
+        if (checked_in) *checked_in = added;
+        for (int i = 0; i < changed_count; i++) {
+            if (checkins[i].status >= 0) names[name_count++] = changed[i];
+        }
+    }
+
+    // The manifest is sorted by filename; a file given twice is listed once
+    qsort(names, name_count, sizeof(char*), compare_names);
+    int unique = 0;
+    for (int i = 0; i < name_count; i++) {
+        if (unique == 0 || strcmp(names[unique - 1], names[i]) != 0) names[unique++] = names[i];
+    }
+
+    Snapshot snapshot;
+    memset(&snapshot, 0, sizeof(snapshot));
+    snapshot.timestamp = time(NULL);
+    snapshot.file_count = unique;
+    snprintf(snapshot.comment, sizeof(snapshot.comment), "%s", comment ? comment : "");
+    if (store_manifest(repo, names, unique, snapshot.manifest) != 0) goto done;
+
+    // The id is taken and recorded under the metadata lock, so concurrent snapshots get different ids
+    int lock = lock_repository(repo->base_path, LOCK_FILE, 1);
+    if (lock < 0) goto done;
+    Snapshot* snapshots = NULL;
+    int existing = read_snapshots(repo, &snapshots);
+    snapshot.id = (existing > 0) ? snapshots[existing - 1].id + 1 : 1;
+    free(snapshots);
+    if (existing >= 0 && append_snapshot(repo, &snapshot) == 0) status = snapshot.id;
+    unlock_repository(lock);
+
+done:
+    free(items);
+    free(names);
+    free(changed);
+    free(checkins);
+    return status;
+}
+
+/*
+The function read_manifest reads and parses a manifest object.
+Returns the number of entries, or -1 on failure (missing or unreadable manifest).
+It takes const char* manifest_id, unsigned char** data (receives the manifest contents, freed by the caller)
+and ManifestEntry** entries (receives the malloc'd entries, freed by the caller, pointing into *data).
+*/
+static int read_manifest(const char* manifest_id, unsigned char** data, ManifestEntry** entries) {
+    size_t len = 0;
+    if (object_read(manifest_id, data, &len) != 0) return -1;
+
+    size_t lines = 0;
+    for (size_t i = 0; i < len; i++) {
+        if ((*data)[i] == '\n') lines++;
+    }
+    *entries = malloc((lines + 1) * sizeof(ManifestEntry));
+    if (!*entries) {
+        free(*data);
+        return -1;
+    }
+
+    // Every line is "version<tab>object<tab>filename"; the contents are edited in place into strings
+    int count = 0;
+    char* line = (char*)*data;
+    char* end = line + len;
+    while (line < end) {
+        char* newline = memchr(line, '\n', (size_t)(end - line));
+        if (!newline) break;
+        *newline = '\0';
+        char* object = strchr(line, '\t');
+        char* filename = object ? strchr(object + 1, '\t') : NULL;
+        if (filename && filename[1]) {
+            *filename = '\0';
+            (*entries)[count].version = atoi(line);
+            (*entries)[count].object = object + 1;
+            (*entries)[count].filename = filename + 1;
+            count++;
+        }
+        line = newline + 1;
+    }
+    return count;
+}
+
+/*
+The function load_manifest reads the manifest of a snapshot.
+Returns the number of entries, or -1 on failure (missing snapshot or unreadable manifest).
+It takes const Repository* repo, int id and the outputs of read_manifest.
+*/
+static int load_manifest(const Repository* repo, int id, unsigned char** data, ManifestEntry** entries) {
+    Snapshot snapshot;
+    if (find_snapshot(repo, id, &snapshot) != 0) return -1;
+    return read_manifest(snapshot.manifest, data, entries);
+}
+
+/*
+The function visit_snapshots hands every snapshot and the files of its manifest to a callback, oldest first.
+Returns the number of snapshots, or -1 if the list or one of the manifests cannot be read.
+It takes const Repository* repo, the callback visit (its entries are only valid during the call) and void* context.
+*/
+int visit_snapshots(const Repository* repo, void (*visit)(void* context, const Snapshot* snapshot, const ManifestEntry* entries, int count), void* context) {
+    if (!repo || !visit) return -1;
+    Snapshot* snapshots = NULL;
+    int count = read_snapshots(repo, &snapshots);
+    for (int i = 0; i < count; i++) {
+        unsigned char* data = NULL;
+        ManifestEntry* entries = NULL;
+        int files = read_manifest(snapshots[i].manifest, &data, &entries);
+        if (files < 0) {
+            count = -1;
+            break;
+        }
+        visit(context, &snapshots[i], entries, files);
+        free(entries);
+        free(data);
+    }
+    free(snapshots);
+    return count;
+}
+
+/*
+The function restore_snapshot_item restores one file of a snapshot (parallel_for callback).
+*/
+static void restore_snapshot_item(void* context, int index) {
+    SnapshotRestore* restore = context;
+    int slot = restore->retry[index];
+    const FileVersion* version = restore->items[restore->pending[slot]].version;
+    restore->results[slot] = restore_version_file(version);
+}
+
+/*
+The function restore_snapshot brings the working files of a snapshot back to their snapshot versions.
+Only files whose contents differ (according to the stat cache, or a rehash) are restored, on config.threads threads.
+Files that are not part of the snapshot are left alone.
+Returns the number of files that could not be restored, or -1 on failure (unknown snapshot, unreadable manifest).
+It takes Repository* repo, int id, and int* restored / int* unchanged (optional, receive the counts).
+*/
+int restore_snapshot(Repository* repo, int id, int* restored, int* unchanged) {
+    if (!repo) return -1;
+    if (restored) *restored = 0;
+    if (unchanged) *unchanged = 0;
+
+    unsigned char* data = NULL;
+    ManifestEntry* entries = NULL;
+    int count = load_manifest(repo, id, &data, &entries);
+    if (count < 0) return -1;
+
+    StatusItem* items = calloc(count + 1, sizeof(StatusItem));
+    int* pending = malloc((count + 1) * sizeof(int));
+    int* results = calloc(count + 1, sizeof(int));
+    int* retry = malloc((count + 1) * sizeof(int));
+    const FileVersion** versions = malloc((count + 1) * sizeof(FileVersion*));
+    int failed = -1;
+    if (!items || !pending || !results || !retry || !versions) goto done;
+
+    int missing = 0, n = 0;
+    for (int i = 0; i < count; i++) {
+        FileVersion* version = find_file_version(repo, entries[i].filename, entries[i].version);
+        if (!version) {
+            printf("Version %d of '%s' not found\n", entries[i].version, entries[i].filename);
+            missing++;
+            continue;
+        }
+        items[n++].version = version;
+    }
+
+    // Compare the working files with their snapshot versions, then restore the ones that differ
+    if (status_compare(repo, items, n) != 0) goto done;
+    int pending_count = 0;
+    for (int i = 0; i < n; i++) {
+        if (items[i].state != STATUS_CLEAN) pending[pending_count++] = i;
+    }
+
+    default_file_mode();    // Reads the umask once, before there are threads
+
+    // Small files go through io_uring batches; whatever they leave over is restored file by file on threads
+    int retry_count = 0;
+    for (int i = 0; i < pending_count; i++) retry[retry_count++] = i;
+    if (repo->config.io_uring && pending_count > 0) {
+        for (int i = 0; i < pending_count; i++) versions[i] = items[pending[i]].version;
+        if (uring_restore_versions(versions, pending_count, results) >= 0) {
+            retry_count = 0;
+            for (int i = 0; i < pending_count; i++) {
+                if (results[i] > 0) retry[retry_count++] = i;
+            }
+        }
+    }
+    SnapshotRestore restore = {items, pending, results, retry};
+    parallel_for(retry_count, repo->config.threads, restore_snapshot_item, &restore);
+
+    failed = missing;
+    for (int i = 0; i < pending_count; i++) {
+        if (results[i] != 0) {
+            printf("Failed to restore '%s'\n", items[pending[i]].version->filename);
+            failed++;
+        } else if (restored) {
+            (*restored)++;
+        }
+    }
+    if (unchanged) *unchanged = n - pending_count;
+
+done:
+    free(items);
+    free(pending);
+    free(results);
+    free(retry);
+    free(versions);
+    free(entries);
+    free(data);
+    return failed;
+}
+
+/*
+The function rollback_snapshot restores a snapshot and records the result as new versions and a new snapshot.
+Like rollback_to_version, history is kept: every restored file whose contents differ from its latest version
+gets a new version, all with one metadata write.
+Returns the id of the new snapshot, or -1 on failure.
+It takes Repository* repo, int id (snapshot to roll back to) and int* restored (optional, receives the number
+of files that were restored).
+*/
+int rollback_snapshot(Repository* repo, int id, int* restored) {
+    if (restore_snapshot(repo, id, restored, NULL) != 0) return -1;
+
+    char comment[MAX_COMMENT_LEN];
+    snprintf(comment, sizeof(comment), "Rollback to snapshot %d", id);
+    return create_snapshot(repo, NULL, 0, comment, NULL);
+}
+
+/*
+The function list_snapshots prints every snapshot, newest first.
+Returns 0 if snapshots were found and displayed, -1 if there are none.
+It takes Repository* repo (the VCS repository).
+*/
+int list_snapshots(Repository* repo) {
+    if (!repo) return -1;
+    Snapshot* snapshots = NULL;
+    int count = read_snapshots(repo, &snapshots);
+    if (count <= 0) return -1;
+
+    printf("%-9s %-20s %-7s %s\n", "Snapshot", "Timestamp", "Files", "Comment");
+    printf("%-9s %-20s %-7s %s\n", "--------", "---------", "-----", "-------");
+    for (int i = count - 1; i >= 0; i--) {
+        char time_str[20];
+        struct tm* tm_info = localtime(&snapshots[i].timestamp);
+        strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M", tm_info);
+        printf("%-9d %-20s %-7d %s\n", snapshots[i].id, time_str, snapshots[i].file_count, snapshots[i].comment);
+    }
+    free(snapshots);
+    return 0;
+}
@@ -0,0 +1,172 @@
+#include "vcs.h"
+#include <pthread.h>    // Provides the mutex guarding the counters
+
+/*
+Lightweight instrumentation of the hot paths, enabled per command with the global option --stats
+(--stats=json for JSON) or the VCS_STATS environment variable (1 or json).
+Instrumented functions take a monotonic timestamp with stats_clock() on entry and hand it to stats_add() on exit
+together with the bytes they read and wrote and the I/O system calls they issued. While statistics are off
+stats_clock() returns 0 without reading the clock and stats_add() returns at once, so the probes cost a branch.
+Phases can nest: copies made while storing an object count towards both "store" and "copy", and work done on
+worker threads adds up, so the times of parallel phases can exceed the wall time.
+The report also shows the totals the kernel counted for the whole process (/proc/self/io on Linux).
+*/
+
+// Counters of one phase
+typedef struct PhaseStats {
+    long long calls;
+    long long nanoseconds;
+    long long bytes_read;
+    long long bytes_written;
+    long long syscalls;         // I/O system calls issued by the instrumented code
+} PhaseStats;
+
+// I/O totals of the process as counted by the kernel
+typedef struct ProcessIo {
+    long long read_bytes;       // rchar: bytes passed to read-like calls, cached or not
+    long long write_bytes;      // wchar
+    long long read_syscalls;    // syscr
+    long long write_syscalls;   // syscw
+} ProcessIo;
+
+static const char* phase_names[STAT_PHASES] = {
+    "load_metadata", "save_metadata", "lookup", "hash", "copy", "store", "restore", "lock"
+};
+
+static int stats_format = 0;            // STATS_TEXT or STATS_JSON while enabled, 0 while off
+static long long stats_started;         // When statistics were enabled
+static ProcessIo stats_io_start;        // Process totals at that time
+static PhaseStats phases[STAT_PHASES];
+static pthread_mutex_t stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+The function monotonic_ns reads the monotonic clock in nanoseconds.
+*/
+static long long monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*
+The function read_process_io reads the process's I/O totals from /proc/self/io.
+Returns 0 on success, -1 where the file is not available (the totals are left at 0).
+*/
+static int read_process_io(ProcessIo* io) {
+    memset(io, 0, sizeof(*io));
+    FILE* file = fopen("/proc/self/io", "r");
+    if (!file) return -1;
+    char key[32];
+    long long value;
+    while (fscanf(file, "%31[^:]: %lld\n", key, &value) == 2) {
+        if (strcmp(key, "rchar") == 0) io->read_bytes = value;
+        else if (strcmp(key, "wchar") == 0) io->write_bytes = value;
+        else if (strcmp(key, "syscr") == 0) io->read_syscalls = value;
+        else if (strcmp(key, "syscw") == 0) io->write_syscalls = value;
+    }
+    fclose(file);
+    return 0;
+}
+
+/*
+The function stats_option recognizes the --stats option.
+Returns STATS_TEXT for "--stats", STATS_JSON for "--stats=json" and 0 for anything else.
+*/
+int stats_option(const char* arg) {
+    if (!arg) return 0;
+    if (strcmp(arg, "--stats") == 0) return STATS_TEXT;
+    if (strcmp(arg, "--stats=json") == 0) return STATS_JSON;
+    return 0;
+}
+
+/*
+The function stats_from_environment returns the format requested through VCS_STATS (0 if unset or "0").
+*/
+int stats_from_environment(void) {
+    const char* setting = getenv("VCS_STATS");
+    if (!setting || setting[0] == '\0' || strcmp(setting, "0") == 0) return 0;
+    return (strcmp(setting, "json") == 0) ? STATS_JSON : STATS_TEXT;
+}
+
+/*
+The function stats_enable clears the counters and starts collecting statistics.
+It takes int format (STATS_TEXT or STATS_JSON; 0 turns statistics off). Call it before starting threads.
+*/
+void stats_enable(int format) {
+    memset(phases, 0, sizeof(phases));
+    stats_format = format;
+    if (!format) return;
+    read_process_io(&stats_io_start);
+    stats_started = monotonic_ns();
+}
+
+/*
+The function stats_clock returns the timestamp an instrumented function starts at, or 0 while statistics are off.
+*/
+long long stats_clock(void) {
+    return stats_format ? monotonic_ns() : 0;
+}
+
+/*
+The function stats_add charges one call to a phase. It is safe to call from worker threads.
+It takes int phase (STAT_*), long long started (from stats_clock; 0 ignores the call), the bytes read and
+written and the number of I/O system calls issued.
+*/
+void stats_add(int phase, long long started, long long bytes_read, long long bytes_written, long long syscalls) {
+    if (!started || phase < 0 || phase >= STAT_PHASES) return;
+    long long elapsed = monotonic_ns() - started;
+    pthread_mutex_lock(&stats_mutex);
+    phases[phase].calls++;
+    phases[phase].nanoseconds += elapsed;
+    phases[phase].bytes_read += bytes_read;
+    phases[phase].bytes_written += bytes_written;
+    phases[phase].syscalls += syscalls;
+    pthread_mutex_unlock(&stats_mutex);
+}
+
+/*
+The function stats_report prints the statistics collected since stats_enable and turns them off.
+Phases that were never entered are left out of the text report.
+It takes FILE* out (normally stderr, so the command's own output stays parseable).
+*/
+void stats_report(FILE* out) {
+    if (!stats_format) return;
+    double wall_ms = (monotonic_ns() - stats_started) / 1e6;
+    ProcessIo now;
+    int have_io = read_process_io(&now) == 0;
+    ProcessIo io = {
+        now.read_bytes - stats_io_start.read_bytes, now.write_bytes - stats_io_start.write_bytes,
+        now.read_syscalls - stats_io_start.read_syscalls, now.write_syscalls - stats_io_start.write_syscalls
+    };
+
+    if (stats_format == STATS_JSON) {
+        fprintf(out, "{\"wall_ms\": %.3f, \"phases\": {", wall_ms);
+        for (int i = 0; i < STAT_PHASES; i++) {
+            const PhaseStats* p = &phases[i];
+            fprintf(out, "%s\"%s\": {\"calls\": %lld, \"ms\": %.3f, \"bytes_read\": %lld, \"bytes_written\": %lld, \"syscalls\": %lld}",
+                    i ? ", " : "", phase_names[i], p->calls, p->nanoseconds / 1e6, p->bytes_read, p->bytes_written, p->syscalls);
+        }
+        fprintf(out, "}");
+        if (have_io) {
+            fprintf(out, ", \"process\": {\"bytes_read\": %lld, \"bytes_written\": %lld, \"read_syscalls\": %lld, \"write_syscalls\": %lld}",
+                    io.read_bytes, io.write_bytes, io.read_syscalls, io.write_syscalls);
+        }
+        fprintf(out, "}\n");
+    } else {
+        fprintf(out, "%-14s %8s %10s %14s %14s %9s\n", "phase", "calls", "ms", "bytes read", "bytes written", "syscalls");
+        for (int i = 0; i < STAT_PHASES; i++) {
+            const PhaseStats* p = &phases[i];
+            if (p->calls == 0) continue;
+            fprintf(out, "%-14s %8lld %10.3f %14lld %14lld %9lld\n",
+                    phase_names[i], p->calls, p->nanoseconds / 1e6, p->bytes_read, p->bytes_written, p->syscalls);
+        }
+        fprintf(out, "wall time %.3f ms", wall_ms);
+        if (have_io) {
+            fprintf(out, "; process read %lld bytes in %lld syscalls, wrote %lld bytes in %lld syscalls",
+                    io.read_bytes, io.read_syscalls, io.write_bytes, io.write_syscalls);
+        }
+        fprintf(out, "\n");
+    }
+    fflush(out);
+    stats_format = 0;
+}
@@ -0,0 +1,377 @@
+#include "vcs.h"
+#include <stdint.h>     // Provides the fixed-width integer types of the index format
+
+/*
+The working tree status compares every tracked file with its latest version without reading file contents
+whenever the file's stat data proves it unchanged.
+The proof comes from .vcs/index, a cache (like git's index) holding for each tracked file the stat data it had
+and the SHA-256 of its contents at that moment:
+    header:  char magic[8] = "VCSINDX1", u32 entry count, u32 reserved
+    entry:   IndexRecord (88 bytes), then the filename with its terminator, padded to a multiple of 8 bytes
+Entries are sorted by filename and all integers are in host byte order.
+A file whose modification time, change time, size and inode all match its entry still has the hashed contents,
+unless it was modified within the same second the entry was recorded (the entry is not trusted then).
+Anything else is rehashed and the entry refreshed. The index is only a cache: a missing or damaged index
+just makes the next status read every file once.
+*/
+
+#define INDEX_MAGIC "VCSINDX1"
+#define INDEX_HEADER_SIZE 16
+
+// Stat data and content hash of one tracked file in .vcs/index
+typedef struct IndexRecord {
+    int64_t mtime;
+    int64_t ctime;
+    int64_t size;
+    uint64_t inode;
+    int64_t checked;            // When the hash was computed; modifications in that second are not detectable
+    int32_t mtime_nsec;
+    int32_t ctime_nsec;
+    uint32_t name_length;       // Length of the filename that follows the record (without the terminator)
+    uint32_t reserved;
+    unsigned char hash[HASH_RAW_LEN];
+} IndexRecord;
+
+// Entry of a loaded index
+typedef struct IndexEntry {
+    const char* filename;       // Points into the loaded file
+    const IndexRecord* record;
+} IndexEntry;
+
+// State shared by the workers of compare_items
+typedef struct StatusScan {
+    Repository* repo;
+    StatusItem* items;
+} StatusScan;
+
+/*
+The function index_padded_length returns the space a filename of the given length takes in the index.
+*/
+static size_t index_padded_length(size_t length) {
+    return (length + 1 + 7) & ~(size_t)7;
+}
+
+/*
+The function load_index reads .vcs/index into memory.
+Returns the number of entries (0 when there is no valid index), or -1 if memory allocation fails.
+It takes const Repository* repo, unsigned char** data (receives the file contents, freed by the caller)
+and IndexEntry** entries (receives the malloc'd entries, freed by the caller, pointing into *data).
+*/
+static int load_index(const Repository* repo, unsigned char** data, IndexEntry** entries) {
+    *data = NULL;
+    *entries = NULL;
+
+    char path[MAX_PATH_LEN];
+    snprintf(path, sizeof(path), "%s/%s/%s", repo->base_path, VCS_DIR, INDEX_FILE);
+    size_t len = 0;
+    if (read_file_contents(path, data, &len) != 0) return 0;
+
+    uint32_t count = 0;
+    if (len >= INDEX_HEADER_SIZE && memcmp(*data, INDEX_MAGIC, 8) == 0) memcpy(&count, *data + 8, sizeof(count));
+    if (count == 0 || count > len / sizeof(IndexRecord)) {
+        free(*data);
+        *data = NULL;
+        return 0;
+    }
+
+    IndexEntry* list = malloc(count * sizeof(IndexEntry));
+    if (!list) {
+        free(*data);
+        *data = NULL;
+        return -1;
+    }
+
+    // Every entry is validated, a damaged index is ignored as a whole
+    size_t pos = INDEX_HEADER_SIZE;
+    for (uint32_t i = 0; i < count; i++) {
+        if (len - pos < sizeof(IndexRecord)) goto damaged;
+        const IndexRecord* record = (const IndexRecord*)(*data + pos);
+        pos += sizeof(IndexRecord);
+        size_t padded = index_padded_length(record->name_length);
+        if (record->name_length >= MAX_FILENAME_LEN || len - pos < padded || (*data)[pos + record->name_length] != '\0') goto damaged;
+        list[i].filename = (const char*)(*data + pos);
+        list[i].record = record;
+        if (i > 0 && strcmp(list[i - 1].filename, list[i].filename) >= 0) goto damaged;
+        pos += padded;
+    }
+
+    *entries = list;
+    return (int)count;
+
+damaged:
+    free(list);
+    free(*data);
+    *data = NULL;
+    return 0;
+}
+
+/*
+The function write_index_entry appends one entry to an index file being written.
+*/
+static void write_index_entry(FILE* file, const IndexRecord* record, const char* filename) {
+    static const char padding[8] = {0};
+    fwrite(record, sizeof(*record), 1, file);
+    fwrite(filename, 1, record->name_length, file);
+    fwrite(padding, 1, index_padded_length(record->name_length) - record->name_length, file);
+}
+
+/*
+The function save_index writes a new index from the examined files (deleted ones are dropped).
+Entries of the old index for files that were not examined are kept, unless prune is set.
+The new index is written to .vcs/temp and renamed into place, so a reader never sees it half written.
+Returns 0 on success, -1 on failure.
+It takes const Repository* repo, const StatusItem* items / int count (sorted by filename),
+const IndexEntry* entries / int entry_count (the old index) and int prune.
+*/
+static int save_index(const Repository* repo, const StatusItem* items, int count,
+                      const IndexEntry* entries, int entry_count, int prune) {
+    char temp_dir[MAX_PATH_LEN], temp_path[MAX_PATH_LEN], path[MAX_PATH_LEN];
+    snprintf(temp_dir, sizeof(temp_dir), "%s/%s/temp", repo->base_path, VCS_DIR);
+    snprintf(temp_path, sizeof(temp_path), "%s/index.XXXXXX", temp_dir);
+    snprintf(path, sizeof(path), "%s/%s/%s", repo->base_path, VCS_DIR, INDEX_FILE);
+
+    create_directory(temp_dir);
+    int fd = mkstemp(temp_path);
+    if (fd < 0) return -1;
+    FILE* file = fdopen(fd, "wb");
+    if (!file) {
+        close(fd);
+        unlink(temp_path);
+        return -1;
+    }
+
+    // The entry count is filled in once all entries are written
+    uint32_t written = 0, reserved = 0;
+    fwrite(INDEX_MAGIC, 1, 8, file);
+    fwrite(&written, sizeof(written), 1, file);
+    fwrite(&reserved, sizeof(reserved), 1, file);
+
+    // Merge the examined files into the old entries, both sorted by filename
+    int e = 0;
+    for (int i = 0; i <= count; i++) {
+        const char* filename = (i < count) ? items[i].version->filename : NULL;
+        while (e < entry_count && (!filename || strcmp(entries[e].filename, filename) < 0)) {
+            if (!prune) {
+                write_index_entry(file, entries[e].record, entries[e].filename);
+                written++;
+            }
+            e++;
+        }
+        if (!filename) break;
+        if (e < entry_count && strcmp(entries[e].filename, filename) == 0) e++;    // Replaced by the new entry
+
+        const StatusItem* item = &items[i];
+        if (item->state != STATUS_CLEAN && item->state != STATUS_MODIFIED) continue;
+
+        IndexRecord record;
+        memset(&record, 0, sizeof(record));
+        record.mtime = item->st.st_mtim.tv_sec;
+        record.mtime_nsec = (int32_t)item->st.st_mtim.tv_nsec;
+        record.ctime = item->st.st_ctim.tv_sec;
+        record.ctime_nsec = (int32_t)item->st.st_ctim.tv_nsec;
+        record.size = item->st.st_size;
+        record.inode = item->st.st_ino;
+        record.checked = item->checked;
+        record.name_length = (uint32_t)strlen(filename);
+        memcpy(record.hash, item->hash, HASH_RAW_LEN);
+        write_index_entry(file, &record, filename);
+        written++;
+    }
+
+    int failed = fseek(file, 8, SEEK_SET) != 0 || fwrite(&written, sizeof(written), 1, file) != 1 || ferror(file);
+    if (fclose(file) != 0) failed = 1;
+    if (failed || rename(temp_path, path) != 0) {
+        unlink(temp_path);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+The function index_matches_stat checks whether a file still has the stat data of its index entry.
+Returns 1 if the entry's hash can be trusted for the file, 0 otherwise.
+*/
+static int index_matches_stat(const IndexRecord* record, const struct stat* st) {
+    if (record->size != (int64_t)st->st_size || record->inode != (uint64_t)st->st_ino) return 0;
+    if (record->mtime != st->st_mtim.tv_sec || record->mtime_nsec != st->st_mtim.tv_nsec) return 0;
+    if (record->ctime != st->st_ctim.tv_sec || record->ctime_nsec != st->st_ctim.tv_nsec) return 0;
+    return record->mtime < record->checked;
+}
+
+/*
+The function version_content_hash returns the SHA-256 of a version's contents.
+Returns 0 on success, -1 if it cannot be determined.
+Versions of older repositories have no SHA-256 recorded; their stored copy is hashed instead.
+*/
+static int version_content_hash(const Repository* repo, const FileVersion* version, unsigned char* hash) {
+    if (version->flags & VERSION_HAS_HASH) {
+        memcpy(hash, version->hash, HASH_RAW_LEN);
+        return 0;
+    }
+
+    char path[MAX_PATH_LEN], hex[MAX_HASH_LEN];
+    snprintf(path, sizeof(path), "%s/%s/versions/%s/v%d", repo->base_path, VCS_DIR, version->filename, version->version_number);
+    if (hash_file(path, hex, NULL) != 0) return -1;
+    return hash_from_hex(hex, hash);
+}
+
+/*
+The function status_scan_item compares one working file with its version (parallel_for callback).
+The file is only read when neither its index entry nor the version's own stat data proves the contents unchanged.
+*/
+static void status_scan_item(void* context, int index) {
+    StatusScan* scan = context;
+    StatusItem* item = &scan->items[index];
+    const char* filename = item->version->filename;
+
+    if (stat(filename, &item->st) != 0) {
+        item->state = (errno == ENOENT || errno == ENOTDIR) ? STATUS_DELETED : STATUS_ERROR;
+        return;
+    }
+    if (!S_ISREG(item->st.st_mode)) {
+        item->state = STATUS_DELETED;
+        return;
+    }
+
+    if (item->cached && index_matches_stat(item->cached, &item->st)) {
+        memcpy(item->hash, item->cached->hash, HASH_RAW_LEN);
+        item->checked = (time_t)item->cached->checked;
+    } else if ((item->version->flags & VERSION_HAS_HASH) && version_matches_stat(item->version, &item->st)) {
+        // Unchanged since its check-in, as far as its size and modification time show
+        memcpy(item->hash, item->version->hash, HASH_RAW_LEN);
+        item->checked = item->version->timestamp;
+    } else {
+        char hex[MAX_HASH_LEN];
+        trace("status: hashing %s", filename);
+        item->checked = time(NULL);
+        if (hash_file(filename, hex, NULL) != 0 || hash_from_hex(hex, item->hash) != 0) {
+            item->state = STATUS_ERROR;
+            return;
+        }
+        item->rehashed = 1;
+    }
+
+    unsigned char expected[HASH_RAW_LEN];
+    if (version_content_hash(scan->repo, item->version, expected) != 0) {
+        item->state = STATUS_MODIFIED;
+        return;
+    }
+    item->state = (memcmp(item->hash, expected, HASH_RAW_LEN) == 0) ? STATUS_CLEAN : STATUS_MODIFIED;
+}
+
+/*
+The function compare_items fills in the state of every item, using and refreshing .vcs/index.
+Returns 0 on success, -1 on failure (memory allocation errors).
+It takes Repository* repo, StatusItem* items / int count (sorted by filename, with version set)
+and int prune (1 to drop index entries of files that are not among the items).
+The files are examined on config.threads threads, so stat calls of large trees overlap.
+*/
+static int compare_items(Repository* repo, StatusItem* items, int count, int prune) {
+    unsigned char* data = NULL;
+    IndexEntry* entries = NULL;
+    int entry_count = load_index(repo, &data, &entries);
+    if (entry_count < 0) return -1;
+
+    // Both lists are sorted by filename, so one merge pass pairs files with their index entries
+    int e = 0;
+    for (int i = 0; i < count; i++) {
+        const char* filename = items[i].version->filename;
+        while (e < entry_count && strcmp(entries[e].filename, filename) < 0) e++;
+        if (e < entry_count && strcmp(entries[e].filename, filename) == 0) items[i].cached = entries[e++].record;
+    }
+
+    StatusScan scan = {repo, items};
+    parallel_for(count, repo->config.threads, status_scan_item, &scan);
+
+    // The index is rewritten when an entry changed or belongs to a file that is gone
+    int kept = 0, dirty = 0;
+    for (int i = 0; i < count; i++) {
+        if (items[i].state != STATUS_CLEAN && items[i].state != STATUS_MODIFIED) {
+            if (items[i].cached) dirty = 1;
+            continue;
+        }
+        kept++;
+        if (!items[i].cached || !index_matches_stat(items[i].cached, &items[i].st) ||
+            memcmp(items[i].cached->hash, items[i].hash, HASH_RAW_LEN) != 0) {
+            dirty = 1;
+        }
+    }
+    if (dirty || (prune && kept != entry_count)) save_index(repo, items, count, entries, entry_count, prune);
+
+    // The items must not point into the index buffer once it is freed
+    for (int i = 0; i < count; i++) items[i].cached = NULL;
+    free(entries);
+    free(data);
+    return 0;
+}
+
+/*
+The function status_compare compares working files with given versions of them, using and refreshing .vcs/index.
+Returns 0 on success, -1 on failure (memory allocation errors).
+It takes Repository* repo and StatusItem* items / int count (zeroed items sorted by filename, with version set;
+receive the results).
+*/
+int status_compare(Repository* repo, StatusItem* items, int count) {
+    if (!repo || (!items && count > 0)) return -1;
+    return compare_items(repo, items, count, 0);
+}
+
+/*
+The function status_scan compares every tracked file with its latest version, using and refreshing .vcs/index.
+Returns the number of tracked files, or -1 on failure (memory allocation errors).
+It takes Repository* repo and StatusItem** out (receives a malloc'd array sorted by filename, freed by the caller).
+*/
+int status_scan(Repository* repo, StatusItem** out) {
+    if (!repo || !out) return -1;
+
+    FileVersion** latest = NULL;
+    int count = collect_latest_versions(repo, &latest);
+    if (count < 0) return -1;
+
+    StatusItem* items = calloc(count + 1, sizeof(StatusItem));
+    if (!items) {
+        free(latest);
+        return -1;
+    }
+    for (int i = 0; i < count; i++) items[i].version = latest[i];
+    free(latest);
+
+    if (compare_items(repo, items, count, 1) != 0) {
+        free(items);
+        return -1;
+    }
+    *out = items;
+    return count;
+}
+
+/*
+The function show_status prints the tracked files whose working copy differs from their latest version.
+Returns 0 on success, -1 on failure.
+It takes Repository* repo (the VCS repository to examine).
+*/
+int show_status(Repository* repo) {
+    StatusItem* items = NULL;
+    int count = status_scan(repo, &items);
+    if (count < 0) return -1;
+
+    int changed = 0;
+    for (int i = 0; i < count; i++) {
+        const char* label;
+        switch (items[i].state) {
+            case STATUS_MODIFIED: label = "modified:"; break;
+            case STATUS_DELETED: label = "deleted:"; break;
+            case STATUS_ERROR: label = "unreadable:"; break;
+            default: continue;
+        }
+        printf("%-12s%s\n", label, items[i].version->filename);
+        changed++;
+    }
+
+    if (changed == 0) {
+        printf("All %d tracked files are unchanged\n", count);
+    } else {
+        printf("%d of %d tracked files changed\n", changed, count);
+    }
+    free(items);
+    return 0;
+}
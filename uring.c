@@ -0,0 +1,494 @@
+#define _GNU_SOURCE     // syscall() and struct statx are GNU extensions
+#include "vcs.h"
+#include <fcntl.h>          // Provides open() flags and AT_FDCWD
+#include <errno.h>          // Provides the error codes io_uring completions carry
+#include <stdint.h>         // Provides uintptr_t for completion tags
+
+// io_uring is used through its system calls, so only the kernel header is needed (no liburing)
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define VCS_HAVE_URING
+#endif
+#endif
+
+#ifdef VCS_HAVE_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>       // Provides mmap() for the shared rings
+#include <sys/syscall.h>    // Provides the io_uring system call numbers
+#include <sys/uio.h>        // Provides struct iovec for buffer registration
+#ifndef __NR_io_uring_setup
+#define __NR_io_uring_setup 425
+#define __NR_io_uring_enter 426
+#define __NR_io_uring_register 427
+#endif
+#endif
+
+/*
+Restoring a snapshot of many small files is dominated by system calls, not by data: every file takes an lstat,
+two opens, a read, a write, an fsync, two closes and a rename. uring_restore_versions hands these to the kernel
+through io_uring instead, URING_BATCH files at a time, in four submissions per batch:
+    1. statx the working file, open the object
+    2. create the temporary file next to the working file, read the object into a registered buffer
+    3. write the contents and fsync (linked, so the fsync only runs after a complete write), close the object
+    4. close the temporary file and rename it over the working file (linked), or remove it
+Objects that are not loose are taken from the mapped packs, and compressed ones are decompressed between steps
+2 and 3; the missing directories of new files are created before step 2. Anything the batches cannot handle
+(deltas, chunked or large files, symbolic links, or any failed step) is left to the caller, which restores it with
+restore_version_file as before. When the kernel has no io_uring (older than 5.11, or disabled by sysctl or a
+seccomp filter) nothing is restored this way.
+*/
+
+#ifdef VCS_HAVE_URING
+
+#define URING_ENTRIES 256               // Submission queue size; a batch queues at most three entries per file
+#define URING_BATCH 64                  // Files per batch, one registered buffer each
+#define URING_BUFFER_SIZE (128 * 1024)  // Registered buffer size; larger objects are left to the caller
+
+// The mapped rings of one io_uring instance
+typedef struct Ring {
+    int fd;
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    struct io_uring_sqe* sqes;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_cqe* cqes;
+    void* sq_map;
+    size_t sq_map_size;
+    void* cq_map;                       // Same as sq_map when the kernel maps both rings at once
+    size_t cq_map_size;
+    size_t sqes_size;
+    unsigned queued;                    // Entries queued since the last submission
+    unsigned inflight;                  // Entries submitted whose completions have not been reaped
+    long long submissions;              // io_uring_enter calls made
+    int fixed;                          // The buffers are registered (READ_FIXED/WRITE_FIXED can be used)
+} Ring;
+
+// One file of a batch
+typedef struct RestoreSlot {
+    const FileVersion* version;
+    int* result;                        // Caller's result: 0 once restored
+    int usable;                         // Still on the io_uring path
+    char object_file[MAX_PATH_LEN];
+    char temp_path[MAX_PATH_LEN];
+    struct statx st;
+    mode_t mode;
+    unsigned char* buffer;              // Registered buffer the object is read into
+    const unsigned char* data;          // Contents to write (in buffer, a pack mapping or owned)
+    size_t len;
+    unsigned char* owned;               // Decompressed contents
+    // Completion results (file descriptors or negated error codes)
+    int stat_res, source_fd, temp_fd, read_res, write_res, sync_res, source_close_res, temp_close_res;
+    int rename_res, unlink_res;
+} RestoreSlot;
+
+/*
+The function ring_close unmaps the rings and closes the io_uring instance.
+*/
+static void ring_close(Ring* ring) {
+    if (ring->sqes && ring->sqes != MAP_FAILED) munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_map && ring->cq_map != MAP_FAILED && ring->cq_map != ring->sq_map) munmap(ring->cq_map, ring->cq_map_size);
+    if (ring->sq_map && ring->sq_map != MAP_FAILED) munmap(ring->sq_map, ring->sq_map_size);
+    if (ring->fd >= 0) close(ring->fd);
+}
+
+/*
+The function ring_supports checks that the kernel implements every operation the batches use.
+*/
+static int ring_supports(int fd) {
+    static const int needed[] = {IORING_OP_STATX, IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_READ_FIXED,
+                                 IORING_OP_WRITE, IORING_OP_WRITE_FIXED, IORING_OP_FSYNC, IORING_OP_CLOSE,
+                                 IORING_OP_RENAMEAT, IORING_OP_UNLINKAT};
+    size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe* probe = calloc(1, size);
+    if (!probe) return 0;
+    int supported = syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) == 0;
+    for (size_t i = 0; supported && i < sizeof(needed) / sizeof(needed[0]); i++) {
+        supported = needed[i] <= probe->last_op && (probe->ops[needed[i]].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(probe);
+    return supported;
+}
+
+/*
+The function ring_open sets up an io_uring instance and maps its rings.
+Returns 0 on success, -1 if io_uring is unavailable or lacks an operation the batches use.
+*/
+static int ring_open(Ring* ring) {
+    memset(ring, 0, sizeof(*ring));
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring->fd = (int)syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+    if (ring->fd < 0) return -1;
+    if (!ring_supports(ring->fd)) {
+        ring_close(ring);
+        return -1;
+    }
+
+    ring->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_map_size > ring->sq_map_size) ring->sq_map_size = ring->cq_map_size;
+        ring->cq_map_size = ring->sq_map_size;
+    }
+    ring->sq_map = mmap(NULL, ring->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_map == MAP_FAILED) {
+        ring_close(ring);
+        return -1;
+    }
+    ring->cq_map = (params.features & IORING_FEAT_SINGLE_MMAP) ? ring->sq_map :
+                   mmap(NULL, ring->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, IORING_OFF_SQES);
+    if (ring->cq_map == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        ring_close(ring);
+        return -1;
+    }
+
+    char* sq = ring->sq_map;
+    char* cq = ring->cq_map;
+    ring->sq_head = (unsigned*)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned*)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned*)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    return 0;
+}
+
+/*
+The function ring_queue adds an operation to the submission queue.
+Returns the entry to fill in; its completion result is stored in *result.
+*/
+static struct io_uring_sqe* ring_queue(Ring* ring, int opcode, int fd, int* result) {
+    unsigned tail = *ring->sq_tail;     // Only this thread moves the tail
+    unsigned index = tail & *ring->sq_mask;
+    struct io_uring_sqe* sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = (unsigned char)opcode;
+    sqe->fd = fd;
+    sqe->user_data = (uintptr_t)result;
+    *result = -ECANCELED;
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->queued++;
+    return sqe;
+}
+
+/*
+The function ring_reap stores the results of the completions the kernel has posted.
+*/
+static void ring_reap(Ring* ring) {
+    unsigned head = *ring->cq_head;
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++, ring->inflight--) {
+        struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cq_mask];
+        *(int*)(uintptr_t)cqe->user_data = cqe->res;
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+/*
+The function ring_run submits the queued operations and waits for all of them to complete.
+Returns 0 on success (the results are stored, failed operations included), -1 if io_uring_enter fails
+(operations already submitted may still be running; see ring_drain).
+*/
+static int ring_run(Ring* ring) {
+    unsigned unsubmitted = ring->queued;
+    ring->queued = 0;
+    while (unsubmitted > 0 || ring->inflight > 0) {
+        // The kernel only waits when it took every entry, so asking for all outstanding completions is safe
+        long submitted = syscall(__NR_io_uring_enter, ring->fd, unsubmitted, unsubmitted + ring->inflight,
+                                 IORING_ENTER_GETEVENTS, NULL, 0);
+        ring->submissions++;
+        if (submitted < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        unsubmitted -= (unsigned)submitted;
+        ring->inflight += (unsigned)submitted;
+        ring_reap(ring);
+    }
+    return 0;
+}
+
+/*
+The function ring_drain waits for the operations still running after ring_run failed.
+Entries the kernel never took are not submitted again; they are dropped with the ring.
+Returns 0 once nothing is in flight, -1 if waiting fails too.
+*/
+static int ring_drain(Ring* ring) {
+    while (ring->inflight > 0) {
+        long waited = syscall(__NR_io_uring_enter, ring->fd, 0, ring->inflight, IORING_ENTER_GETEVENTS, NULL, 0);
+        ring->submissions++;
+        if (waited < 0 && errno != EINTR) return -1;
+        ring_reap(ring);
+    }
+    return 0;
+}
+
+/*
+The function slot_prepare decides whether a file can go through a batch and builds its paths.
+*/
+static void slot_prepare(RestoreSlot* slot, const FileVersion* version, int* result, unsigned char* buffer,
+                         unsigned serial) {
+    memset(slot, 0, sizeof(*slot));
+    slot->version = version;
+    slot->result = result;
+    slot->buffer = buffer;
+    slot->source_fd = slot->temp_fd = -1;
+    slot->stat_res = slot->read_res = slot->write_res = slot->sync_res = -1;
+    slot->source_close_res = slot->temp_close_res = slot->rename_res = slot->unlink_res = -1;
+    *result = 1;
+
+    if (!(version->flags & VERSION_HAS_OBJECT)) return;
+    if (version->file_size < 0 || version->file_size + OBJECT_HEADER_SIZE >= URING_BUFFER_SIZE) return;
+    char object_id[MAX_HASH_LEN];
+    hash_to_hex(version->object_id, object_id);
+    object_path(object_id, slot->object_file, sizeof(slot->object_file));
+
+    // Same names as mkstemp() would pick, made unique by the process id and a counter
+    sibling_temp_path(version->filename, slot->temp_path, sizeof(slot->temp_path));
+    size_t length = strlen(slot->temp_path);
+    if (length < 6) return;
+    snprintf(slot->temp_path + length - 6, 7, "%06x", ((unsigned)getpid() * 2654435761u + serial) & 0xffffff);
+    slot->usable = 1;
+}
+
+/*
+The function restore_batch restores up to URING_BATCH files with four submissions.
+Returns the number of files restored, or -1 if the ring failed (the caller then stops using it).
+*/
+static int restore_batch(Ring* ring, RestoreSlot* slots, int count, long long* written) {
+    // 1. Look at the working files and open the objects
+    for (int i = 0; i < count; i++) {
+        RestoreSlot* slot = &slots[i];
+        if (!slot->usable) continue;
+        struct io_uring_sqe* sqe = ring_queue(ring, IORING_OP_STATX, AT_FDCWD, &slot->stat_res);
+        sqe->addr = (uintptr_t)slot->version->filename;
+        sqe->statx_flags = AT_SYMLINK_NOFOLLOW;
+        sqe->len = STATX_TYPE | STATX_MODE;
+        sqe->off = (uintptr_t)&slot->st;
+        sqe = ring_queue(ring, IORING_OP_OPENAT, AT_FDCWD, &slot->source_fd);
+        sqe->addr = (uintptr_t)slot->object_file;
+        sqe->open_flags = O_RDONLY | O_CLOEXEC;
+    }
+    if (ring_run(ring) != 0) return -1;
+
+    // 2. Create the temporary files and read the loose objects; packed ones are already mapped
+    for (int i = 0; i < count; i++) {
+        RestoreSlot* slot = &slots[i];
+        if (!slot->usable) continue;
+        if (slot->stat_res == 0 && S_ISREG(slot->st.stx_mode)) {
+            slot->mode = slot->st.stx_mode & 07777;     // The file keeps its permissions
+        } else if (slot->stat_res == -ENOENT) {
+            slot->mode = default_file_mode();
+            if (strchr(slot->version->filename, '/')) create_parent_directories(slot->version->filename);
+        } else {
+            slot->usable = 0;                           // Symbolic links and odd files take the usual path
+        }
+        if (slot->source_fd == -ENOENT) {
+            char object_id[MAX_HASH_LEN];
+            hash_to_hex(slot->version->object_id, object_id);
+            size_t len = 0;
+            if (!pack_lookup(object_id, &slot->data, &len)) slot->usable = 0;
+            slot->len = len;
+        } else if (slot->source_fd < 0) {
+            slot->usable = 0;
+        }
+        if (!slot->usable) continue;
+
+        struct io_uring_sqe* sqe = ring_queue(ring, IORING_OP_OPENAT, AT_FDCWD, &slot->temp_fd);
+        sqe->addr = (uintptr_t)slot->temp_path;
+        sqe->open_flags = O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC;
+        sqe->len = slot->mode;
+        if (slot->source_fd >= 0) {
+            sqe = ring_queue(ring, ring->fixed ? IORING_OP_READ_FIXED : IORING_OP_READ, slot->source_fd, &slot->read_res);
+            sqe->addr = (uintptr_t)slot->buffer;
+            sqe->len = URING_BUFFER_SIZE;
+            sqe->buf_index = (unsigned short)i;
+        }
+    }
+    if (ring_run(ring) != 0) return -1;
+
+    // 3. Decode the objects, then write and flush the temporary files and close the objects
+    mode_t mask = file_creation_mask();
+    for (int i = 0; i < count; i++) {
+        RestoreSlot* slot = &slots[i];
+        if (slot->usable && slot->temp_fd < 0) slot->usable = 0;
+        if (slot->usable && slot->source_fd >= 0) {
+            // A full buffer may not hold the whole object
+            if (slot->read_res < 0 || slot->read_res >= URING_BUFFER_SIZE) slot->usable = 0;
+            slot->data = slot->buffer;
+            slot->len = (slot->read_res > 0) ? (size_t)slot->read_res : 0;
+        }
+        if (slot->usable) {
+            const unsigned char* raw = slot->data;
+            if (object_decode_full(raw, slot->len, &slot->data, &slot->len, &slot->owned) != 0 ||
+                slot->len != (size_t)slot->version->file_size) slot->usable = 0;
+        }
+        // The umask applies to the mode given to open(); only permissions it filtered out need a chmod
+        if (slot->usable && ((slot->mode & mask) || (slot->mode & ~0777)) && fchmod(slot->temp_fd, slot->mode) != 0) {
+            slot->usable = 0;
+        }
+
+        if (slot->usable) {
+            struct io_uring_sqe* sqe;
+            if (slot->len > 0) {
+                int fixed = ring->fixed && slot->data >= slot->buffer && slot->data < slot->buffer + URING_BUFFER_SIZE;
+                sqe = ring_queue(ring, fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE, slot->temp_fd, &slot->write_res);
+                sqe->addr = (uintptr_t)slot->data;
+                sqe->len = (unsigned)slot->len;
+                sqe->buf_index = (unsigned short)i;
+                sqe->flags = IOSQE_IO_LINK;     // A short write cancels the fsync
+            } else {
+                slot->write_res = 0;
+            }
+            ring_queue(ring, IORING_OP_FSYNC, slot->temp_fd, &slot->sync_res);
+        }
+        if (slot->source_fd >= 0) ring_queue(ring, IORING_OP_CLOSE, slot->source_fd, &slot->source_close_res);
+    }
+    if (ring_run(ring) != 0) return -1;
+
+    // 4. Close the temporary files and swap them into place, or remove them
+    for (int i = 0; i < count; i++) {
+        RestoreSlot* slot = &slots[i];
+        if (slot->temp_fd < 0) continue;
+        if (slot->usable && (slot->write_res != (int)slot->len || slot->sync_res != 0)) slot->usable = 0;
+        struct io_uring_sqe* sqe = ring_queue(ring, IORING_OP_CLOSE, slot->temp_fd, &slot->temp_close_res);
+        if (slot->usable) {
+            sqe->flags = IOSQE_IO_LINK;         // A failed close cancels the rename
+            sqe = ring_queue(ring, IORING_OP_RENAMEAT, AT_FDCWD, &slot->rename_res);
+            sqe->addr = (uintptr_t)slot->temp_path;
+            sqe->len = (unsigned)AT_FDCWD;
+            sqe->addr2 = (uintptr_t)slot->version->filename;
+        } else {
+            sqe = ring_queue(ring, IORING_OP_UNLINKAT, AT_FDCWD, &slot->unlink_res);
+            sqe->addr = (uintptr_t)slot->temp_path;
+        }
+    }
+    if (ring_run(ring) != 0) return -1;
+
+    int restored = 0;
+    for (int i = 0; i < count; i++) {
+        RestoreSlot* slot = &slots[i];
+        if (slot->usable && slot->rename_res == 0) {
+            *slot->result = 0;
+            *written += (long long)slot->len;
+            restored++;
+        } else if (slot->usable && slot->temp_fd >= 0) {
+            unlink(slot->temp_path);            // The rename was cancelled or failed
+        }
+        free(slot->owned);
+        slot->owned = NULL;
+    }
+    return restored;
+}
+
+/*
+The function batch_abandon cleans up after a batch whose ring failed, once the kernel is done with it.
+Open descriptors are closed and leftover temporary files removed; files the batch renamed into place count as
+restored and the rest are left to the caller.
+Returns the number of files restored, or -1 if the ring could not be drained: the batch's files are then marked
+failed (-1), since an operation still in flight could complete after the caller rewrote the same path.
+*/
+static int batch_abandon(Ring* ring, RestoreSlot* slots, int count, long long* written) {
+    if (ring_drain(ring) != 0) {
+        for (int i = 0; i < count; i++) *slots[i].result = -1;
+        return -1;
+    }
+    int restored = 0;
+    for (int i = 0; i < count; i++) {
+        RestoreSlot* slot = &slots[i];
+        // A close that never ran is still -1 (not queued) or -ECANCELED (queued, not submitted or cancelled)
+        if (slot->source_fd >= 0 && (slot->source_close_res == -1 || slot->source_close_res == -ECANCELED)) {
+            close(slot->source_fd);
+        }
+        if (slot->temp_fd >= 0 && (slot->temp_close_res == -1 || slot->temp_close_res == -ECANCELED)) {
+            close(slot->temp_fd);
+        }
+        if (slot->temp_fd >= 0 && slot->rename_res == 0) {
+            *slot->result = 0;
+            *written += (long long)slot->len;
+            restored++;
+        } else if (slot->temp_fd >= 0 && slot->unlink_res != 0) {
+            unlink(slot->temp_path);
+        }
+        free(slot->owned);
+        slot->owned = NULL;
+    }
+    return restored;
+}
+
+#endif
+
+/*
+The function uring_restore_versions restores a set of versions to the working directory in io_uring batches.
+Returns the number of versions restored, or -1 if io_uring is not available (nothing was restored).
+It takes const FileVersion** versions / int count and int* results (receives 0 for each version restored, 1 for
+each version left to the caller, which should restore it with restore_version_file, and -1 for each version that
+failed and must not be retried).
+Restored files are replaced atomically, fsynced and keep their permissions, exactly as restore_version_file does.
+Call it from one thread, after default_file_mode().
+*/
+int uring_restore_versions(const FileVersion** versions, int count, int* results) {
+    for (int i = 0; i < count; i++) results[i] = 1;
+#ifdef VCS_HAVE_URING
+    if (count <= 0) return 0;
+    long long started = stats_clock();
+    Ring ring;
+    if (ring_open(&ring) != 0) {
+        trace("uring: not available, restoring file by file");
+        return -1;
+    }
+
+    RestoreSlot* slots = malloc(URING_BATCH * sizeof(RestoreSlot));
+    unsigned char* buffers = NULL;
+    if (!slots || posix_memalign((void**)&buffers, 4096, (size_t)URING_BATCH * URING_BUFFER_SIZE) != 0) {
+        free(slots);
+        ring_close(&ring);
+        return -1;
+    }
+    // Registered buffers spare the kernel mapping the pages on every read and write; plain ones work too
+    struct iovec iov[URING_BATCH];
+    for (int i = 0; i < URING_BATCH; i++) {
+        iov[i].iov_base = buffers + (size_t)i * URING_BUFFER_SIZE;
+        iov[i].iov_len = URING_BUFFER_SIZE;
+    }
+    ring.fixed = syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_BUFFERS, iov, URING_BATCH) == 0;
+
+    int restored = 0;
+    long long written = 0;
+    unsigned serial = 0;
+    for (int first = 0; first < count; first += URING_BATCH) {
+        int batch = (count - first < URING_BATCH) ? count - first : URING_BATCH;
+        for (int i = 0; i < batch; i++) {
+            slot_prepare(&slots[i], versions[first + i], &results[first + i], iov[i].iov_base, serial++);
+        }
+        int done = restore_batch(&ring, slots, batch, &written);
+        if (done < 0) {
+            // The rest is restored file by file, but only once nothing of this batch can still complete
+            trace("uring: the ring failed, restoring the remaining files file by file");
+            done = batch_abandon(&ring, slots, batch, &written);
+            if (done > 0) restored += done;
+            break;
+        }
+        restored += done;
+    }
+    trace("uring: restored %d of %d files with %lld submissions", restored, count, ring.submissions);
+    stats_add(STAT_RESTORE, started, 0, written, ring.submissions);
+
+    ring_close(&ring);
+    free(buffers);
+    free(slots);
+    return restored;
+#else
+    (void)versions;
+    return -1;
+#endif
+}
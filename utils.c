@@ -1,4 +1,5 @@
 #include "vcs.h"
+#include <stdarg.h>     // Provides va_list for trace()
 
 int create_directory(const char* path) {
     // 0755 sets permissions: owner can read/write/execute, group and others can read/execute
@@ -19,6 +20,122 @@ int file_exists(const char* filepath) {
     return (stat(filepath, &st) == 0);
 }
 
+/*
+The function read_file_contents reads a whole file into a newly allocated buffer.
+Returns 0 on success, -1 on failure (file open/read errors or allocation failure).
+It takes const char* filepath and unsigned char** data / size_t* len (receive the buffer, freed by the caller).
+*/
+int read_file_contents(const char* filepath, unsigned char** data, size_t* len) {
+    FILE* file = fopen(filepath, "rb");
+    if (!file) return -1;
+
+    struct stat st;
+    if (fstat(fileno(file), &st) != 0) {
+        fclose(file);
+        return -1;
+    }
+
+    size_t size = (size_t)st.st_size;
+    unsigned char* buffer = malloc(size ? size : 1);    // Allocate at least one byte so empty files get a valid buffer
+    if (!buffer) {
+        fclose(file);
+        return -1;
+    }
+    if (fread(buffer, 1, size, file) != size) {
+        free(buffer);
+        fclose(file);
+        return -1;
+    }
+
+    fclose(file);
+    *data = buffer;
+    *len = size;
+    return 0;
+}
+
+/*
+The function write_file_contents writes a buffer to a file, creating or overwriting it.
+Returns 0 on success, -1 on failure (file open/write errors).
+It takes const char* filepath and const unsigned char* data / size_t len (the bytes to write).
+*/
+int write_file_contents(const char* filepath, const unsigned char* data, size_t len) {
+    FILE* file = fopen(filepath, "wb");
+    if (!file) return -1;
+
+    int status = (fwrite(data, 1, len, file) == len) ? 0 : -1;
+    if (fclose(file) != 0) status = -1;
+    return status;
+}
+
+/*
+The function collect_files appends the paths of all regular files below a directory to a growable array.
+The .vcs directory is skipped and symbolic links are not followed. Paths under "." are returned without the "./".
+Returns 0 on success, -1 if a directory cannot be read or memory allocation fails.
+It takes const char* dir, char*** files and int* count (the array and its length, extended in place; start with
+NULL and 0 and only grow the array through collect_files; the caller frees every path and the array).
+*/
+int collect_files(const char* dir, char*** files, int* count) {
+    DIR* handle = opendir(dir);
+    if (!handle) {
+        perror(dir);
+        return -1;
+    }
+
+    int status = 0;
+    struct dirent* entry;
+    while (status == 0 && (entry = readdir(handle)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0 ||
+            strcmp(entry->d_name, VCS_DIR) == 0) {
+            continue;
+        }
+
+        char path[MAX_PATH_LEN];
+        if (strcmp(dir, ".") == 0) snprintf(path, sizeof(path), "%s", entry->d_name);
+        else snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+
+        struct stat st;
+        if (lstat(path, &st) != 0) continue;   // Vanished while scanning
+        if (S_ISDIR(st.st_mode)) {
+            status = collect_files(path, files, count);
+        } else if (S_ISREG(st.st_mode)) {
+            // Grow the array in powers of two, starting at 16
+            if (*count == 0 || (*count >= 16 && (*count & (*count - 1)) == 0)) {
+                char** grown = realloc(*files, (*count ? *count * 2 : 16) * sizeof(char*));
+                if (!grown) {
+                    status = -1;
+                    break;
+                }
+                *files = grown;
+            }
+            char* copy = strdup(path);
+            if (!copy) {
+                status = -1;
+                break;
+            }
+            (*files)[(*count)++] = copy;
+        }
+    }
+
+    closedir(handle);
+    return status;
+}
+
+/*
+The function trace prints a diagnostic line to stderr when the VCS_TRACE environment variable is set.
+It takes a printf-style format and its arguments.
+*/
+void trace(const char* format, ...) {
+    const char* setting = getenv("VCS_TRACE");
+    if (!setting || setting[0] == '\0' || strcmp(setting, "0") == 0) return;
+
+    va_list args;
+    va_start(args, format);
+    fprintf(stderr, "vcs: ");
+    vfprintf(stderr, format, args);
+    fprintf(stderr, "\n");
+    va_end(args);
+}
+
 void print_timestamp(time_t timestamp) {
     struct tm* tm_info = localtime(&timestamp);
     printf("%04d-%02d-%02d %02d:%02d:%02d",
@@ -35,13 +152,37 @@ void print_help() {
     printf("Usage:\n");
     printf("  vcs init                    - Initialize a new repository\n");
     printf("  vcs checkin <file> [comment] - Check in a file with optional comment\n");
+    printf("  vcs checkin [-m comment] [-r dir]... <file>... - Check in several files or directory trees at once\n");
     printf("  vcs checkout <file> [version] - Check out a file (latest version if not specified)\n");
-    printf("  vcs list <file>             - List all versions of a file\n");
+    printf("  vcs list <file>             - List all versions of a file, newest first\n");
+    printf("  vcs list [--limit N] [--since t] [--until t] [--grep text] [--format table|tsv|json] <file> - List selected versions\n");
     printf("  vcs rollback <file> <version> - Rollback a file to a specific version\n");
+    printf("  vcs status                  - Show tracked files that were modified or deleted\n");
+    printf("  vcs snapshot [-m comment] [-r dir]... [file]... - Check in changed files and record all tracked files as a snapshot\n");
+    printf("  vcs snapshots               - List all snapshots\n");
+    printf("  vcs checkout -s <snapshot>  - Check out every file of a snapshot\n");
+    printf("  vcs rollback -s <snapshot>  - Rollback every file of a snapshot\n");
+    printf("  vcs diff <file> [v1] [v2]   - Show changes from v1 (default latest) to v2 (default the working file)\n");
+    printf("  vcs gc [--keep-last N] [--keep-since t] [--keep-daily] [--dry-run] - Expire old versions and remove unreferenced objects\n");
+    printf("  vcs pack [--all]            - Move loose objects into a pack file (--all merges the existing packs too)\n");
+    printf("  vcs fsck [--sample pct] [--incremental] - Rehash stored versions and report missing, corrupt and orphaned objects\n");
+    printf("  vcs watch [-m comment] [--debounce ms] [dir]... - Check in files as they change (default: the whole tree)\n");
+    printf("  vcs push [-j N] <remote>    - Copy the versions the remote lacks to it (remote: host:path over ssh, or a path)\n");
+    printf("  vcs pull [-j N] <remote>    - Copy the versions this repository lacks from the remote (-j: parallel connections)\n");
+    printf("  vcs export-meta [path]      - Write the metadata as text (default .vcs/versions.meta)\n");
+    printf("  vcs import-meta [path]      - Replace the metadata with a text metadata file\n");
+    printf("  vcs daemon [-f]             - Keep the repository loaded and serve commands (-f: stay in the foreground)\n");
+    printf("  vcs daemon stop|status      - Stop or check the running daemon\n");
+    printf("\nOptions:\n");
+    printf("  vcs --stats <command>       - Print time, bytes and syscalls per phase to stderr (--stats=json for JSON, or VCS_STATS=1|json)\n");
     printf("\nExamples:\n");
     printf("  vcs init\n");
     printf("  vcs checkin myfile.txt \"Initial version\"\n");
+    printf("  vcs checkin -m \"Import sources\" -r src README.md\n");
     printf("  vcs checkout myfile.txt 1\n");
     printf("  vcs list myfile.txt\n");
+    printf("  vcs list --limit 20 --since 7d --grep fix --format json myfile.txt\n");
+    printf("  vcs diff myfile.txt 1 2\n");
     printf("  vcs rollback myfile.txt 2\n");
+    printf("  vcs push backup.example.com:/srv/vcs/project\n");
 }
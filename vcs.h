@@ -24,27 +24,242 @@ The #ifndef VCS_H ensures that the contents of vcs.h are processed only once dur
 #define MAX_PATH_LEN 512        // Maximum length for file paths
 #define MAX_FILENAME_LEN 256    // Maximum length for file names
 #define MAX_COMMENT_LEN 512     // Maximum length for version comments
-#define MAX_HASH_LEN 64         // Maximum length for file hashes (Hashes uniquely identify file contents)
+#define MAX_HASH_LEN 65         // Maximum length for file hashes (64 hex characters of a SHA-256 digest plus the terminator)
+#define HASH_BLOCK_SIZE (1 << 20)   // Read size used when streaming files through the hash engine (1MB)
 #define VCS_DIR ".vcs"          // Name of the hidden directory (.vcs) where the VCS stores versioned files and metadata
-#define METADATA_FILE "versions.meta"   // Name of the file that stores metadata about all versions
+#define OBJECTS_DIR "objects"   // Sub-directory of .vcs holding the content-addressed object store
+#define METADATA_FILE "versions.meta"   // Name of the text metadata file (export format, and the format of older repositories)
+#define METADATA_BIN_FILE "versions.bin"    // Name of the memory-mapped binary file that stores metadata about all versions
+#define JOURNAL_FILE "versions.journal"     // Name of the append-only journal of versions not yet compacted into versions.bin
+#define METADATA_LINE_MAX 2048  // Longest text metadata record (filename, hashes and comment included)
+#define CONFIG_FILE "config"    // Name of the repository configuration file inside .vcs
+#define OBJECT_HEADER_SIZE 24   // Size of the header in front of encoded (delta) objects
+#define OBJECT_FULL 1           // Encoded object holding the complete contents
+#define OBJECT_DELTA 2          // Encoded object holding a delta against a newer object
+#define OBJECT_CHUNKS 3         // Encoded object listing the chunks a large file is stored in (see chunk.c)
+#define CHUNK_ENTRY_SIZE 40     // Size of one chunk list entry: raw chunk id and 8-byte length
+#define CODEC_NONE 0            // Payload stored uncompressed
+#define CODEC_ZLIB 1            // Payload compressed with zlib (always available)
+#define CODEC_LZ4 2             // Payload compressed with LZ4 frames (built with WITH_LZ4=1)
+#define CODEC_ZSTD 3            // Payload compressed with Zstandard (built with WITH_ZSTD=1)
+#define CHECKIN_UNCHANGED 0     // Returned by checkin_file when the file matches its latest version
+#define COPY_REFLINK 1          // copy_fd cloned the file (FICLONE)
+#define COPY_RANGE 2            // copy_fd copied in the kernel with copy_file_range()
+#define COPY_SENDFILE 3         // copy_fd copied in the kernel with sendfile()
+#define COPY_BUFFERED 4         // copy_fd copied through a userspace buffer
+#define STATUS_CLEAN 0          // Working file matches its latest version
+#define STATUS_MODIFIED 1       // Working file differs from its latest version
+#define STATUS_DELETED 2        // Working file is missing (or no longer a regular file)
+#define STATUS_ERROR -1         // Working file could not be examined
+#define SNAPSHOTS_FILE "snapshots"  // Name of the list of snapshots inside .vcs (see snapshot.c)
+#define INDEX_FILE "index"      // Name of the stat cache of the working files inside .vcs (see status.c)
+#define LOCK_FILE "lock"        // Name of the lock file guarding the metadata inside .vcs (see lock.c)
+#define OBJECTS_LOCK_FILE "objects.lock"    // Name of the lock file guarding rewrites of stored objects inside .vcs
+#define LIST_TABLE 0            // list output: aligned table for people
+#define LIST_TSV 1              // list output: tab-separated values with a header row
+#define LIST_JSON 2             // list output: JSON array of versions
+#define STATS_TEXT 1            // --stats: print a table of the phases to stderr
+#define STATS_JSON 2            // --stats=json: print the phases as one JSON object to stderr
+#define STAT_LOAD_METADATA 0    // Phases measured by --stats (see stats.c)
+#define STAT_SAVE_METADATA 1
+#define STAT_LOOKUP 2
+#define STAT_HASH 3
+#define STAT_COPY 4
+#define STAT_STORE 5
+#define STAT_RESTORE 6
+#define STAT_LOCK 7
+#define STAT_PHASES 8
 #define CURRENT_FILE "current.info"     // Name of the file that tracks the current state of the repository, such as which files are being tracked
 
+#define HASH_RAW_LEN 32         // Size of a SHA-256 digest in bytes
+#define VERSION_HAS_HASH 0x01   // FileVersion flag: hash holds the SHA-256 of the contents (unset for versions of older repositories)
+#define VERSION_HAS_OBJECT 0x02 // FileVersion flag: object_id names an object in .vcs/objects (unset for versions stored as .vcs/versions/filename/vN)
+
 // Structure to represent a file version. It stores metadata about a specific version of a file.
+// FileVersions are allocated from the repository's arena; strings are shared or stored there as well.
 typedef struct FileVersion {
-    char filename[MAX_FILENAME_LEN];
-    char hash[MAX_HASH_LEN];
+    const char* filename;       // Interned: all versions of a file share one copy of the name
+    const char* comment;        // Stored in the repository's arena
+    const char* legacy_hash;    // Hash string of versions from older repositories that is not a SHA-256, NULL otherwise
     int version_number;
+    int flags;                  // VERSION_HAS_HASH, VERSION_HAS_OBJECT
     time_t timestamp;
-    char comment[MAX_COMMENT_LEN];
     long file_size;
+    time_t mtime;               // Modification time of the working file when it was checked in (seconds)
+    long mtime_nsec;            // Nanosecond part of the modification time
+    unsigned char hash[HASH_RAW_LEN];       // SHA-256 of the contents
+    unsigned char object_id[HASH_RAW_LEN];  // Id of the stored content in .vcs/objects
     struct FileVersion* next;   // Pointer to the next FileVersion in linked list format. So, multiple versions of a file are chained together.
 } FileVersion;
 
+// Structure of a bump allocator whose memory is released all at once (see arena.c).
+typedef struct Arena {
+    struct ArenaBlock* head;    // Block currently being filled
+    size_t block_size;          // Size of newly allocated blocks
+} Arena;
+
+// Structure describing one file of a check-in while it is prepared and committed (see version.c).
+typedef struct CheckinItem {
+    const char* filename;           // File to check in
+    const FileVersion* latest;      // Latest version of the file before the check-in, NULL if none
+    int status;                     // Result: new version number, CHECKIN_UNCHANGED or -1
+    long file_size;
+    time_t mtime;
+    long mtime_nsec;
+    char object_id[MAX_HASH_LEN];   // Content hash, which is also the id of the stored object
+    unsigned char digest[HASH_RAW_LEN];     // Content hash as raw bytes
+} CheckinItem;
+
+// Structure describing one tracked file while the working tree status is computed (see status.c).
+typedef struct StatusItem {
+    const FileVersion* version;     // Version the working file is compared with (usually the latest)
+    const struct IndexRecord* cached;   // The file's entry in .vcs/index, NULL if it has none
+    int state;                      // STATUS_CLEAN, STATUS_MODIFIED, STATUS_DELETED or STATUS_ERROR
+    int rehashed;                   // The contents were read because the stat data proved nothing
+    struct stat st;                 // Stat data of the working file
+    time_t checked;                 // When hash was known to describe the file's contents
+    unsigned char hash[HASH_RAW_LEN];   // SHA-256 of the working file
+} StatusItem;
+
+// Structure selecting versions for list (see select_file_versions).
+typedef struct VersionFilter {
+    int limit;                  // Most versions to select, newest first (0 for no limit)
+    time_t since;               // Only versions created at or after this time (0 for no bound)
+    time_t until;               // Only versions created at or before this time (0 for no bound)
+    const char* grep;           // Only versions whose comment contains this text (NULL for any comment)
+} VersionFilter;
+
+// Structure describing the versions gc keeps (see gc.c). The latest version of every file and the versions of
+// snapshots are always kept; without any of the keep_* settings no version is expired.
+typedef struct GcPolicy {
+    int keep_last;              // Keep the newest N versions of each file (0 for no count limit)
+    time_t keep_since;          // Keep the versions created at or after this time (0 for no age limit)
+    int keep_daily;             // Beyond those, keep the newest version of each day
+    int dry_run;                // Only count what would be removed
+} GcPolicy;
+
+// Structure receiving what a gc run removed (see collect_garbage).
+typedef struct GcStats {
+    int versions_removed;
+    int versions_kept;
+    long objects_removed;
+    long objects_kept;
+    long objects_rebased;       // Kept versions rewritten so they no longer depend on expired objects
+    long files_removed;         // Copies of expired versions of older repositories and stale temporary files
+    long long bytes_freed;
+} GcStats;
+
+// Structure selecting what fsck checks (see fsck.c).
+typedef struct FsckOptions {
+    int sample_percent;         // Share of the objects to check (0 or 100 checks all of them)
+    int incremental;            // Only check what was recorded since the last clean run
+} FsckOptions;
+
+// Structure receiving what an fsck run found (see fsck_repository).
+typedef struct FsckStats {
+    long versions_checked;
+    long objects_checked;
+    long long bytes_hashed;
+    long missing;               // Objects (or copies) that are gone
+    long corrupt;               // Objects whose contents do not match their id or the metadata
+    long orphaned;              // Objects nothing refers to
+} FsckStats;
+
+// Structure configuring vcs watch (see watch.c).
+typedef struct WatchOptions {
+    const char* comment;        // Comment of the versions checked in
+    int debounce_ms;            // Quiet time after the last change before a batch is checked in
+    int max_delay_ms;           // Longest a change waits while the tree keeps changing
+} WatchOptions;
+
+// Structure receiving what a push or pull copied (see remote.c).
+typedef struct SyncStats {
+    long records;               // Versions recorded on the receiving side
+    long conflicts;             // Files whose histories differ (their later versions are not copied)
+    long skipped;               // Versions left out because their objects could not be copied
+    long objects;               // Objects copied
+    long long bytes;            // Stored size of the copied objects
+    long long wire_bytes;       // Bytes sent and received, after compression
+} SyncStats;
+
+// Structure receiving what pack_objects did (see pack.c).
+typedef struct PackStats {
+    long objects_packed;        // Objects in the new pack
+    long loose_removed;         // Loose object files deleted
+    long packs_removed;         // Packs merged into the new one
+    long long pack_bytes;       // Size of the new pack
+} PackStats;
+
+// Structure describing a snapshot of many files recorded in .vcs/snapshots (see snapshot.c).
+typedef struct Snapshot {
+    int id;
+    time_t timestamp;
+    int file_count;
+    char manifest[MAX_HASH_LEN];    // Object holding the list of files and versions
+    char comment[MAX_COMMENT_LEN];
+} Snapshot;
+
+// Structure describing one file of a loaded snapshot manifest (see snapshot.c).
+typedef struct ManifestEntry {
+    int version;
+    const char* object;         // Object id of the version ("-" for versions outside the object store), in the manifest contents
+    const char* filename;       // Points into the manifest contents
+} ManifestEntry;
+
+// Structure describing one consumer of the blocks of a file read by pipeline_file (see parallel.c).
+typedef struct PipelineStage {
+    int (*consume)(void* context, const unsigned char* data, size_t len);   // Returns 0, or -1 to stop the pipeline
+    void* context;
+} PipelineStage;
+
+// Incremental compressor writing to a FILE* (opaque, see compress.c).
+typedef struct Compressor Compressor;
+
+// Structure holding a streaming SHA-256 digest in progress (see hash.c).
+typedef struct HashState {
+    void* ctx;      // Digest context owned by the hash engine
+} HashState;
+
+// Structure holding the decoded header of an encoded object (see objects.c).
+typedef struct ObjectHeader {
+    int type;                   // OBJECT_FULL, OBJECT_DELTA or OBJECT_CHUNKS
+    int codec;                  // Compression codec of the payload
+    unsigned long long size;    // Size of the payload in bytes
+} ObjectHeader;
+
+// Structure holding the repository settings stored in .vcs/config.
+typedef struct RepoConfig {
+    int delta_enabled;          // Store older versions as deltas against the next newer version (1) or in full (0)
+    int delta_max_chain;        // Maximum number of deltas applied to rebuild any version
+    long delta_max_size;        // Files larger than this (bytes) are never delta-compressed
+    int hot_codec;              // Codec for the newest version of each file (favours restore speed)
+    int hot_level;              // Compression level for the hot codec
+    int cold_codec;             // Codec for older versions and deltas (favours size)
+    int cold_level;             // Compression level for the cold codec
+    int journal_compact;        // Journal entries after which the metadata is compacted into versions.bin (0 compacts on every save)
+    int threads;                // Worker threads for batch operations (0 uses every CPU)
+    long auto_pack;             // Loose objects above which a check-in packs them (0 never packs automatically)
+    long chunk_threshold;       // Files at least this large (bytes) are stored as content-defined chunks (0 never)
+    long chunk_size;            // Average chunk size in bytes (chunks range from a quarter to four times this)
+    int io_uring;               // Restore small files in io_uring batches where the kernel supports it (0 never)
+} RepoConfig;
+
 // Structure to represent repository state. It manages the overall state of the VCS.
+struct MetadataMap;     // Opaque view of the mapped metadata file (metadata.c)
+struct FileIndex;       // Opaque per-file lookup index (metadata.c)
+
 typedef struct Repository {
     char base_path[MAX_PATH_LEN];   // Stores the root directory path of the repository
     int total_versions;             // Tracks the total number of versions across all files in the repository
-    FileVersion* version_list;      // Pointer to the head of a linked list of FileVersion structures, representing all versions of all files in the repository
+    RepoConfig config;              // Settings loaded from .vcs/config
+    FileVersion* version_list;      // Linked list of versions not in versions.bin (journaled, or added since the last save)
+    Arena arena;                    // Owns all FileVersion structures, filenames and comments
+    struct MetadataMap* metadata_map;   // Memory-mapped versions.bin (private to metadata.c), NULL if there is none yet
+    FileVersion* journal_head;      // Newest entry of version_list already written to the journal
+    int journal_entries;            // Number of entries in the journal
+    long journal_size;              // Length of the intact part of the journal in bytes
+    struct FileIndex* file_index;   // Lookup index from filename to the file's versions (private to metadata.c)
+    int metadata_generation;        // Incremented whenever versions.bin is mapped, so callers can notice a reload
 } Repository;
 
 // Function declarations
@@ -55,28 +270,192 @@ Repository* load_repository(const char* path);  // Loads an existing repository
 void cleanup_repository(Repository* repo);      // Frees memory allocated for the Repository structure and its associated FileVersion linked list
 int repository_exists(const char* path);        // Checks if a VCS repository exists at the specified path
 
+// Locking between processes (lock.c)
+int lock_repository(const char* base_path, const char* name, int exclusive);   // Takes a shared or exclusive lock (returns its descriptor)
+void unlock_repository(int fd);                                                 // Releases a lock taken with lock_repository
+
 // File operations (fileops.c)  
-char* generate_file_hash(const char* filepath);                 // Generates a hash (djb2) for the file at filepath
+char* generate_file_hash(const char* filepath);                 // Generates the SHA-256 content hash for the file at filepath
 int copy_file(const char* source, const char* dest);            // Copies a file from source to dest within the .vcs directory
-int create_version_file(const char* filepath, int version);     // Creates a versioned copy of a file in the .vcs directory
-int restore_version_file(const char* filename, int version);    // Restores a specific version of a file to the working directory
+int copy_fd(int in_fd, int out_fd);                             // Copies between open files by the fastest available method (returns COPY_*)
+const char* copy_method_name(int method);                       // Printable name of a COPY_* method
+int create_version_file(const char* filepath, const char* object_id, const RepoConfig* config);  // Stores a file's contents in the object store under its content hash
+int restore_version_file(const FileVersion* version);           // Restores a specific version of a file to the working directory
+int read_version_contents(const FileVersion* version, unsigned char** data, size_t* len);    // Loads a version's contents into memory
+mode_t default_file_mode(void);                                  // Permissions of a newly created file (0666 minus the umask)
+mode_t file_creation_mask(void);                                 // The process umask, read once
+void sibling_temp_path(const char* path, char* temp_path, size_t size);     // mkstemp() template next to path
+void create_parent_directories(const char* filename);            // Creates the missing directories on the way to a file
+
+// Object store (objects.c)
+int object_path(const char* object_id, char* path, size_t size);    // Builds the path of an object (.vcs/objects/xx/yyyy...)
+int object_exists(const char* object_id);                           // Checks whether an object is already stored
+int store_object(const char* filepath, const char* object_id, const RepoConfig* config);    // Stores a file's contents once, keyed by content id
+int store_object_pipelined(const char* filepath, char* object_id, long* size_out, const RepoConfig* config);   // Hashes and stores a file in one read pass
+int restore_object(const char* object_id, const char* dest);        // Writes a stored object's contents to dest
+int object_read_header(const char* object_id, ObjectHeader* header);    // Reads an encoded object's header (0 for plain objects)
+int object_is_delta(const char* object_id);                         // Checks whether an object is stored as a delta
+int object_delta_base(const char* object_id, char* base_id);        // Reads the base id of a delta object (1 if it is a delta)
+int object_read(const char* object_id, unsigned char** data, size_t* len);  // Loads an object's contents, applying deltas
+int object_read_stored(const char* object_id, unsigned char** data, size_t* len);  // Loads an object's bytes as they are stored
+int object_make_full(const char* object_id, const RepoConfig* config);  // Rewrites a delta object in full with the hot codec
+int object_make_cold(const char* object_id, const RepoConfig* config);  // Recompresses a full object with the cold codec
+int object_deltify(const char* object_id, const char* base_id, const RepoConfig* config);  // Rewrites an object as a delta against base_id
+int object_rebase(const char* object_id, const char* base_id, const RepoConfig* config);   // Rewrites a delta against another (possibly delta) base
+int object_store_buffer(const char* object_id, const unsigned char* data, size_t len, const RepoConfig* config);   // Stores in-memory contents unless already stored
+int object_store_chunks(const char* object_id, const unsigned char* list, size_t len);   // Writes a chunk list object
+int stored_id_matches(const char* filepath, const char* stored_id, const char* object_id);  // Checks written contents against the id they get
+int object_chunk_list(const char* object_id, unsigned char** list, size_t* count);      // Loads the chunk list of a chunked object
+void object_prefetch(const char* object_id);    // Asks the kernel to read an object ahead of its use
+int object_decode_full(const unsigned char* raw, size_t raw_len, const unsigned char** data, size_t* len,
+                       unsigned char** owned);   // Finds the contents in a plain or full object's raw bytes
+
+// Content-defined chunking (chunk.c)
+int store_chunked(const char* filepath, const char* object_id, const RepoConfig* config);  // Stores a large file as chunks
+int chunks_read(const unsigned char* list, size_t len, unsigned char** data, size_t* data_len);   // Reassembles chunked contents in memory
+int chunks_restore(const unsigned char* list, size_t len, const char* dest);   // Streams chunked contents into a file
+
+// Integrity checks (fsck.c)
+int fsck_repository(Repository* repo, const FsckOptions* options, FsckStats* stats);   // Rehashes stored versions and reports problems
+
+// Batched I/O (uring.c)
+int uring_restore_versions(const FileVersion** versions, int count, int* results);  // Restores versions in io_uring batches (-1 if unavailable)
+
+// Watch mode (watch.c)
+int watch_tree(Repository* repo, char** dirs, int count, const WatchOptions* options);  // Checks in files below dirs as they change, until interrupted
+
+// Replication (remote.c)
+int remote_push(Repository* repo, const char* remote, int connections, SyncStats* stats);  // Copies the versions another repository lacks to it
+int remote_pull(Repository* repo, const char* remote, int connections, SyncStats* stats);  // Copies the versions this repository lacks from another one
+int remote_serve(Repository* repo, int in_fd, int out_fd);     // Answers the requests of a push or pull on the other side
+
+// Pack files (pack.c)
+int pack_lookup(const char* object_id, const unsigned char** data, size_t* len);   // Finds a packed object in the mapped packs
+int pack_freshen(const char* object_id);    // Touches the pack holding an object
+int pack_objects(Repository* repo, int all, PackStats* stats);     // Moves the loose objects into a new pack
+int prune_packs(Repository* repo, int (*reachable)(void* context, const unsigned char* id), void* context,
+                time_t older_than, int dry_run, long* removed, long long* bytes, long* kept);  // Drops unreachable objects from old packs
+void pack_auto(Repository* repo);           // Packs the loose objects once there are more than config.auto_pack
+int pack_store(Repository* repo, const unsigned char* ids, const unsigned char* const* data, const size_t* lengths,
+               size_t count);  // Writes objects copied from another repository into a new pack
+long pack_visit(time_t older_than, void (*visit)(void* context, const unsigned char* id), void* context);   // Walks the ids of packed objects
+
+// Compression (compress.c)
+int codec_from_name(const char* name);  // Maps a codec name from .vcs/config to its CODEC_* value (-1 if unknown)
+const char* codec_name(int codec);      // Returns the config name of a codec
+int codec_available(int codec);         // Checks whether a codec is compiled into this build
+int compress_buffer(int codec, int level, const unsigned char* in, size_t len,
+                    unsigned char** out, size_t* out_len);    // Compresses a buffer
+int decompress_buffer(int codec, const unsigned char* in, size_t len,
+                      unsigned char* out, size_t out_len);    // Decompresses a buffer of known original size
+int compress_stream(int codec, int level, FILE* in, FILE* out); // Compresses a stream
+Compressor* compressor_begin(int codec, int level, FILE* out);  // Starts compressing pieces handed over one at a time
+int compressor_update(Compressor* c, const unsigned char* data, size_t len);  // Compresses the next piece
+int compressor_finish(Compressor* c);   // Ends the compressed stream and releases the compressor
+int decompress_stream(int codec, FILE* in, FILE* out);          // Decompresses a stream
+
+// Delta encoding (delta.c)
+int delta_create(const unsigned char* base, size_t base_len, const unsigned char* target, size_t target_len,
+                 unsigned char** delta, size_t* delta_len);    // Encodes target as copy/insert instructions against base
+int delta_apply(const unsigned char* base, size_t base_len, const unsigned char* delta, size_t delta_len,
+                unsigned char** target, size_t* target_len);   // Rebuilds target from base and a delta
+
+// Repository configuration (config.c)
+void config_defaults(RepoConfig* config);                           // Fills in the default settings
+int load_config(const char* base_path, RepoConfig* config);         // Reads .vcs/config (defaults for missing keys)
+int save_config(const char* base_path, const RepoConfig* config);   // Writes .vcs/config
+
+// Content hashing (hash.c)
+int hash_begin(HashState* state);                                   // Starts a streaming SHA-256 digest
+int hash_update(HashState* state, const void* data, size_t len);    // Feeds a block of data into the digest
+int hash_finish(HashState* state, char* hex_out);                   // Completes the digest as a hex string
+void hash_abort(HashState* state);                                  // Releases a digest without completing it
+int hash_buffer(const void* data, size_t len, char* hex_out);       // Hashes an in-memory buffer
+int hash_file(const char* filepath, char* hex_out, long* size_out); // Hashes a file's contents in large blocks
+void hash_to_hex(const unsigned char* raw, char* hex_out);          // Converts a raw digest to lowercase hex (MAX_HASH_LEN bytes)
+int hash_from_hex(const char* hex, unsigned char* raw_out);         // Parses a hex SHA-256 into a raw digest (-1 if it is not one)
 
 // Version management (version.c)
-int checkin_file(Repository* repo, const char* filename, const char* comment);  // Commits a new version of a file to the repository
+int checkin_file(Repository* repo, const char* filename, const char* comment);  // Commits a new version of a file to the repository (CHECKIN_UNCHANGED if nothing changed)
+int checkin_files(Repository* repo, char** filenames, int count, const char* comment, CheckinItem* items); // Checks in a batch of files in parallel with one metadata write
+int checkin_prepare(const RepoConfig* config, CheckinItem* item);              // Hashes and stores a file for check-in (thread-safe)
+int checkin_commit(Repository* repo, CheckinItem* item, const char* comment);  // Records a prepared file as a new version
+int version_matches_stat(const FileVersion* version, const struct stat* st);    // Checks whether a file's stat data proves it unchanged since the version
 int checkout_file(Repository* repo, const char* filename, int version);         // Retrieves a specific version of a file from the repository to the working directory
-int list_versions(Repository* repo, const char* filename);                      // Lists all versions of a file, including version numbers, timestamps, and comments
+int list_versions(Repository* repo, const char* filename, const VersionFilter* filter, int format);  // Lists a file's versions newest first (LIST_* format)
 int rollback_to_version(Repository* repo, const char* filename, int version);   // Reverts a file to a specific version, potentially discarding newer versions
 
+// Working tree status (status.c)
+int status_scan(Repository* repo, StatusItem** out);   // Compares every tracked file with its latest version (caller frees the array)
+int status_compare(Repository* repo, StatusItem* items, int count);   // Compares working files with the versions set in items
+int show_status(Repository* repo);                      // Prints the tracked files that were modified or deleted
+
+// Snapshots (snapshot.c)
+int create_snapshot(Repository* repo, char** files, int count, const char* comment, int* checked_in);  // Checks in changed files and records all tracked files as a snapshot
+int find_snapshot(const Repository* repo, int id, Snapshot* snapshot);     // Looks up a snapshot by id
+int restore_snapshot(Repository* repo, int id, int* restored, int* unchanged);     // Brings the files of a snapshot back, skipping unchanged ones
+int rollback_snapshot(Repository* repo, int id, int* restored);     // Restores a snapshot and records it as new versions and a new snapshot
+int list_snapshots(Repository* repo);   // Prints all snapshots, newest first
+int visit_snapshots(const Repository* repo, void (*visit)(void* context, const Snapshot* snapshot, const ManifestEntry* entries, int count), void* context);  // Walks every snapshot manifest
+
+// Garbage collection (gc.c)
+int collect_garbage(Repository* repo, const GcPolicy* policy, GcStats* stats);  // Expires versions by policy and removes unreferenced objects
+
+// Resident daemon (daemon.c)
+int run_daemon(const char* base_path, int argc, char* argv[], int (*handler)(Repository* repo, int argc, char* argv[]));  // Serves commands from a loaded repository over .vcs/daemon.sock
+int daemon_request(int argc, char* argv[], int* exit_status);   // Runs a command through the daemon (-1 if none is running)
+
+// Line diff (diff.c)
+int diff_file(Repository* repo, const char* filename, int from_version, int to_version);  // Prints a unified diff between two versions (0: latest / working file)
+
 // Metadata operations (metadata.c)
-int save_metadata(Repository* repo);    // Saves the repository's metadata to versions.meta
-int load_metadata(Repository* repo);    // Loads metadata from versions.meta into the Repository structure
+int save_metadata(Repository* repo);    // Appends new versions to the journal (compacting it when it grows too long)
+int compact_metadata(Repository* repo); // Folds the journal and new versions into versions.bin (atomically replaced)
+int rewrite_metadata(Repository* repo, FileVersion** versions, int count);  // Replaces the metadata with exactly these versions
+int load_metadata(Repository* repo);    // Maps versions.bin, importing versions.meta first in older repositories
+int refresh_metadata(Repository* repo); // Picks up versions other processes recorded since the metadata was loaded
+void close_metadata(Repository* repo);  // Unmaps versions.bin
+int add_file_version(Repository* repo, FileVersion* version);   // Adds a new version to the repository (persisted by save_metadata)
 FileVersion* find_file_version(Repository* repo, const char* filename, int version);    // Finds a specific version of a file in the repository
 int get_latest_version(Repository* repo, const char* filename);     // Retrieves the latest version number for a file
+int collect_file_versions(Repository* repo, const char* filename, FileVersion*** out);  // Array of a file's versions, oldest first (caller frees the array)
+int collect_all_versions(Repository* repo, FileVersion*** out);     // Array of all versions, by filename and version (caller frees the array)
+int collect_latest_versions(Repository* repo, FileVersion*** out);  // Array of the latest version of each file, by filename (caller frees the array)
+int select_file_versions(Repository* repo, const char* filename, const VersionFilter* filter, FileVersion*** out);  // A file's versions passing a filter, newest first (caller frees the array)
+int export_metadata_text(Repository* repo, const char* path);       // Writes the metadata in the versions.meta text format
+int import_metadata_text(Repository* repo, const char* path);       // Replaces the metadata with the contents of a text metadata file
+FileVersion* new_file_version(Repository* repo, const char* filename, const char* comment);    // Allocates a FileVersion in the repository's arena
+void version_hash_string(const FileVersion* version, char* out);    // Writes the version's hash as text (MAX_HASH_LEN bytes, "" if unknown)
+int format_version_record(const FileVersion* version, char* buffer, size_t size);  // Writes a version as a text metadata record ("FILE=...")
+FileVersion* parse_version_record(Repository* repo, char* record);     // Parses a text metadata record (the part after "FILE=")
+
+// Parallel execution (parallel.c)
+int parallel_threads(int requested);    // Resolves a thread count setting (0 or less means one per CPU)
+void parallel_for(int count, int threads, void (*work)(void* context, int index), void* context);  // Runs work for every index on a thread pool
+int pipeline_file(const char* filepath, const PipelineStage* stages, int count, long* size_out, long long* reads_out);   // Reads a file once, feeding each block to every stage
+
+// Instrumentation (stats.c)
+int stats_option(const char* arg);      // Recognizes --stats and --stats=json (returns STATS_TEXT, STATS_JSON or 0)
+int stats_from_environment(void);       // Format requested through VCS_STATS (0 if none)
+void stats_enable(int format);          // Clears the counters and starts collecting (0 turns statistics off)
+long long stats_clock(void);            // Start timestamp for an instrumented call (0 while statistics are off)
+void stats_add(int phase, long long started, long long bytes_read, long long bytes_written, long long syscalls);    // Charges a call to a phase
+void stats_report(FILE* out);           // Prints the collected statistics and turns them off
+
+// Arena allocator (arena.c)
+void arena_init(Arena* arena, size_t block_size);       // Prepares an empty arena
+void* arena_alloc(Arena* arena, size_t size);           // Allocates zeroed memory that lives until arena_free
+char* arena_strndup(Arena* arena, const char* str, size_t max_len);    // Copies a string into the arena
+void arena_free(Arena* arena);                          // Releases everything allocated from the arena
 
 // Utility functions (utils.c)
 int create_directory(const char* path);    // Creates a directory at the specified path
 int file_exists(const char* filepath);      // Checks if a file exists at the specified filepath
+int read_file_contents(const char* filepath, unsigned char** data, size_t* len);        // Reads a whole file into memory
+int write_file_contents(const char* filepath, const unsigned char* data, size_t len);   // Writes a buffer to a file
+int collect_files(const char* dir, char*** files, int* count);     // Appends the regular files below dir (skipping .vcs) to a growable array
 void print_timestamp(time_t timestamp);     // Prints a time_t timestamp in readable format
+void trace(const char* format, ...);        // Prints a diagnostic line to stderr when VCS_TRACE is set
 void print_help();                          // Prints usage instructions or help text for the VCS program
 
 /*
@@ -1,73 +1,318 @@
 #include "vcs.h"
+#include <stdarg.h>     // Provides va_list for list_printf()
 
 /*
-The function checkin_file creates a new version of a file in the VCS repository.
-Records file metadata, creates a physical copy, and updates the repository's version list.
-Returns the new version number on success, -1 on failure.
-It takes Repository* repo (the VCS repository), const char* filename (file to check in),
-and const char* comment (user comment describing the changes).
-This is the primary function for adding new file versions to version control.
+The function version_matches_stat checks whether a file's stat data still matches the version it was checked in as.
+Returns 1 if size and modification time are identical, 0 otherwise.
+It takes const FileVersion* version (the version to compare against) and const struct stat* st (the file's current stat data).
+A file modified in the same second as its check-in could have changed without its mtime moving,
+so such versions are never trusted and the caller falls back to comparing hashes.
 */
-int checkin_file(Repository* repo, const char* filename, const char* comment) {
-    // Validate input parameters - both repo and filename must be non-NULL
-    if (!repo || !filename) return -1;
+int version_matches_stat(const FileVersion* version, const struct stat* st) {
+    if (version->file_size != (long)st->st_size) return 0;
+    if (version->mtime != st->st_mtim.tv_sec || version->mtime_nsec != st->st_mtim.tv_nsec) return 0;
+    return version->mtime < version->timestamp;
+}
+
+/*
+The function deltify_previous_version shrinks the previous latest version of a file into a reverse delta
+compressed with the cold codec.
+The newest version stays in full and every older version is stored as a delta against the next newer one.
+It takes Repository* repo, const FileVersion* previous (the version that was the latest before this check-in)
+and const char* object_id (object holding the new latest version).
+Checking out an old version applies one delta per newer version, so whenever the chain running through the
+previous version would exceed delta_max_chain, that version is kept in full and starts a new chain.
+*/
+static void deltify_previous_version(Repository* repo, const FileVersion* previous, const char* object_id) {
+    if (!previous || !(previous->flags & VERSION_HAS_OBJECT)) return;
+    char previous_id[MAX_HASH_LEN];
+    hash_to_hex(previous->object_id, previous_id);
+    if (strcmp(previous_id, object_id) == 0) return;
+
+    // Without delta storage the previous version is only moved to cold compression
+    if (!repo->config.delta_enabled) {
+        object_make_cold(previous_id, &repo->config);
+        return;
+    }
+
+    // The new latest version must be stored in full; content seen before may currently be kept as a delta
+    if (object_make_full(object_id, &repo->config) != 0) return;
+
+    // Count the older versions that already form a delta chain ending at the previous version
+    int chain = 0;
+    for (int v = previous->version_number - 1; v > 0 && chain < repo->config.delta_max_chain; v--) {
+        FileVersion* older = find_file_version(repo, previous->filename, v);
+        if (!older || !(older->flags & VERSION_HAS_OBJECT)) break;
+        char older_id[MAX_HASH_LEN];
+        hash_to_hex(older->object_id, older_id);
+        if (!object_is_delta(older_id)) break;
+        chain++;
+    }
+
+    // Turning the previous version into a delta adds one step to every chain that passes through it
+    // Versions kept in full become history and are recompressed with the cold codec instead
+    if (chain + 1 > repo->config.delta_max_chain ||
+        object_deltify(previous_id, object_id, &repo->config) == 0) {
+        object_make_cold(previous_id, &repo->config);
+    }
+}
+
+/*
+The function checkin_begin starts the check-in of one file: it records the file's latest version.
+It takes Repository* repo, CheckinItem* item (the item to fill) and const char* filename (file to check in).
+Looking up versions may allocate from the repository, so this runs on the calling thread before checkin_prepare.
+*/
+static void checkin_begin(Repository* repo, CheckinItem* item, const char* filename) {
+    memset(item, 0, sizeof(*item));
+    item->filename = filename;
+    item->latest = find_file_version(repo, filename, get_latest_version(repo, filename));
+    item->status = -1;
+}
+
+/*
+The function checkin_prepare does the expensive part of a check-in: it compares the file with its latest version
+and stores new contents in the object store.
+Returns 1 if the file needs a new version, CHECKIN_UNCHANGED (0) if it is identical to its latest version,
+and -1 on failure. The result is also kept in item->status.
+It takes const RepoConfig* config (storage settings) and CheckinItem* item (started with checkin_begin).
+It does not touch the repository's metadata, so items of different files can be prepared in parallel.
+*/
+int checkin_prepare(const RepoConfig* config, CheckinItem* item) {
+    if (!config || !item || !item->filename) return -1;
+    item->status = -1;
+    const FileVersion* latest = item->latest;
     
-    // Get next version number for this file by finding the latest version and incrementing
-    int next_version = get_latest_version(repo, filename) + 1;
+    // Get the file's size and modification time using stat system call
+    struct stat st;
+    if (stat(item->filename, &st) != 0) return -1;
+    item->mtime = st.st_mtim.tv_sec;
+    item->mtime_nsec = st.st_mtim.tv_nsec;
+    
+    // Same size and modification time as the latest version: the file has not been touched since
+    if (latest && version_matches_stat(latest, &st)) {
+        return item->status = CHECKIN_UNCHANGED;
+    }
+    
+    // A file of the same size was most likely only touched, so it is hashed first and nothing is written if
+    // its contents are unchanged
+    int chunked = config->chunk_threshold > 0 && st.st_size >= config->chunk_threshold;
+    if (!chunked && latest && latest->file_size == (long)st.st_size) {
+        char hex[MAX_HASH_LEN];
+        unsigned char digest[HASH_RAW_LEN];
+        if (hash_file(item->filename, hex, NULL) != 0 || hash_from_hex(hex, digest) != 0) return -1;
+        if ((latest->flags & VERSION_HAS_HASH) && memcmp(latest->hash, digest, HASH_RAW_LEN) == 0) {
+            return item->status = CHECKIN_UNCHANGED;
+        }
+    }
+
+    // New contents are hashed and stored in one read pass, so the id always belongs to the bytes stored, even
+    // when the file is rewritten meanwhile (large files are chunked instead)
+    if (!chunked) {
+        if (store_object_pipelined(item->filename, item->object_id, &item->file_size, config) != 0 ||
+            hash_from_hex(item->object_id, item->digest) != 0) {
+            return -1;
+        }
+        if (latest && (latest->flags & VERSION_HAS_HASH) && latest->file_size == item->file_size &&
+            memcmp(latest->hash, item->digest, HASH_RAW_LEN) == 0) {
+            return item->status = CHECKIN_UNCHANGED;    // Changed back while it was being read
+        }
+        return item->status = 1;
+    }
     
-    // Create physical version file in the VCS directory structure
-    // This copies the current file to .vcs/versions/filename/vN
-    if (create_version_file(filename, next_version) != 0) {
+    // The stat data changed, so compare the actual contents through their hash; store_object checks that the
+    // chunks it stores still hash to this id
+    if (hash_file(item->filename, item->object_id, &item->file_size) != 0 ||
+        hash_from_hex(item->object_id, item->digest) != 0) {
+        return -1;  // Return error if the file cannot be read
+    }
+    if (latest && (latest->flags & VERSION_HAS_HASH) && latest->file_size == item->file_size &&
+        memcmp(latest->hash, item->digest, HASH_RAW_LEN) == 0) {
+        return item->status = CHECKIN_UNCHANGED;
+    }
+    
+    // Store the file's contents in the object store
+    // Identical contents are stored only once, so repeated contents cost no extra copy
+    if (create_version_file(item->filename, item->object_id, config) != 0) {
         return -1;  // Return error if file creation fails
     }
+    return item->status = 1;
+}
+
+/*
+The function checkin_commit records a prepared file as a new version in the repository's metadata.
+Returns the new version number on success, -1 on failure. The metadata is not saved; call save_metadata afterwards.
+It takes Repository* repo, CheckinItem* item (prepared with result 1) and const char* comment.
+The version number follows the latest version in memory, so callers hold the exclusive metadata lock and have
+refreshed the metadata (see checkin_record). The previous version is not turned into a delta here.
+*/
+int checkin_commit(Repository* repo, CheckinItem* item, const char* comment) {
+    if (!repo || !item || item->status != 1) return -1;
+    item->status = -1;
+    
+    // Get next version number for this file by finding the latest version and incrementing
+    int next_version = get_latest_version(repo, item->filename) + 1;
     
-    // Allocate memory for new version metadata entry
-    FileVersion* new_version = malloc(sizeof(FileVersion));
+    // Allocate the new version metadata entry; the filename is interned and the comment copied
+    FileVersion* new_version = new_file_version(repo, item->filename, comment);
     if (!new_version) return -1;    // Return error if memory allocation fails
     
-    // Copy filename to the version entry, ensuring null termination
-    strncpy(new_version->filename, filename, MAX_FILENAME_LEN - 1);
-    new_version->filename[MAX_FILENAME_LEN - 1] = '\0';
-    
-    // Generate and store the file hash for integrity checking
-    char* hash = generate_file_hash(filename);
-    if (hash) {
-        // Copy the generated hash, ensuring null termination
-        strncpy(new_version->hash, hash, MAX_HASH_LEN - 1);
-        new_version->hash[MAX_HASH_LEN - 1] = '\0';
-        free(hash);     // Free the dynamically allocated hash string
-    } else {
-        // If hash generation fails, use a default value
-        strcpy(new_version->hash, "unknown");
-    }
+    // The object id is the content hash, so the file does not need to be hashed a second time
+    memcpy(new_version->hash, item->digest, HASH_RAW_LEN);
+    memcpy(new_version->object_id, item->digest, HASH_RAW_LEN);     // Record which object holds this version's contents
+    new_version->flags = VERSION_HAS_HASH | VERSION_HAS_OBJECT;
     
     // Set the version number for this entry
     new_version->version_number = next_version;
     // Record the current timestamp when this version was created
     new_version->timestamp = time(NULL);
     
-    // Copy the user's comment, ensuring null termination
-    strncpy(new_version->comment, comment, MAX_COMMENT_LEN - 1);
-    new_version->comment[MAX_COMMENT_LEN - 1] = '\0';
+    // Store the size and modification time so the next check-in can detect an untouched file with a single stat
+    new_version->file_size = item->file_size;
+    new_version->mtime = item->mtime;
+    new_version->mtime_nsec = item->mtime_nsec;
     
-    // Get and store the file size using stat system call
-    struct stat st;
-    if (stat(filename, &st) == 0) {
-        new_version->file_size = st.st_size;    // Store actual file size
-    } else {
-        new_version->file_size = 0;             // Default to 0 if stat fails
+    // Add the new version to the repository's version list and lookup index
+    if (add_file_version(repo, new_version) != 0) return -1;
+    repo->total_versions++;                    // Increment total version count
+    
+    return item->status = next_version;
+}
+
+/*
+The function checkin_record records prepared files as new versions and makes them durable.
+Only this step holds the exclusive metadata lock. It first picks up the versions other processes recorded since
+the repository was loaded, so version numbers follow the current history and concurrent check-ins never hand
+out the same number; a file another process already checked in with the same contents is left unchanged.
+The previous versions are turned into deltas afterwards, under the object lock instead of the metadata lock.
+Returns the number of new versions, or -1 if the lock could not be taken or the metadata could not be saved.
+It takes Repository* repo, CheckinItem* items / int count (prepared with checkin_prepare) and const char* comment.
+*/
+static int checkin_record(Repository* repo, CheckinItem* items, int count, const char* comment) {
+    int prepared = 0;
+    for (int i = 0; i < count; i++) {
+        if (items[i].status == 1) prepared++;
     }
+    if (prepared == 0) return 0;
     
-    // Add the new version to the front of the repository's linked list
-    new_version->next = repo->version_list;     // Point to current head
-    repo->version_list = new_version;          // Make this the new head
-    repo->total_versions++;                    // Increment total version count
+    int lock = lock_repository(repo->base_path, LOCK_FILE, 1);
+    if (lock < 0) return -1;
+    if (refresh_metadata(repo) != 0) {
+        unlock_repository(lock);
+        return -1;
+    }
+    
+    int added = 0;
+    for (int i = 0; i < count; i++) {
+        CheckinItem* item = &items[i];
+        if (item->status != 1) continue;
+        
+        // The latest version may have changed while the file was hashed
+        item->latest = find_file_version(repo, item->filename, get_latest_version(repo, item->filename));
+        // A gc may have removed the object if it was stored before and unreferenced; store the file again
+        if (!object_exists(item->object_id) && checkin_prepare(&repo->config, item) != 1) continue;
+        if (item->latest && (item->latest->flags & VERSION_HAS_HASH) && item->latest->file_size == item->file_size &&
+            memcmp(item->latest->hash, item->digest, HASH_RAW_LEN) == 0) {
+            item->status = CHECKIN_UNCHANGED;
+            continue;
+        }
+        if (checkin_commit(repo, item, comment) > 0) added++;
+    }
+    int status = (added > 0) ? save_metadata(repo) : 0;
+    unlock_repository(lock);
+    if (status != 0) return -1;
+    
+    // Keep only the newest version in full; the previous one becomes a delta against it
+    // Two processes rewriting the same objects could make them deltas of each other, so this is serialized
+    lock = lock_repository(repo->base_path, OBJECTS_LOCK_FILE, 1);
+    if (lock >= 0) {
+        for (int i = 0; i < count; i++) {
+            if (items[i].status > 0) deltify_previous_version(repo, items[i].latest, items[i].object_id);
+        }
+        unlock_repository(lock);
+    }
+    pack_auto(repo);
+    return added;
+}
+
+/*
+The function checkin_file creates a new version of a file in the VCS repository.
+Records file metadata, creates a physical copy, and updates the repository's version list.
+Returns the new version number on success, CHECKIN_UNCHANGED (0) if the file is identical to its latest version,
+and -1 on failure.
+It takes Repository* repo (the VCS repository), const char* filename (file to check in),
+and const char* comment (user comment describing the changes).
+This is the primary function for adding new file versions to version control.
+*/
+int checkin_file(Repository* repo, const char* filename, const char* comment) {
+    // Validate input parameters - both repo and filename must be non-NULL
+    if (!repo || !filename) return -1;
+    
+    CheckinItem item;
+    checkin_begin(repo, &item, filename);
+    int status = checkin_prepare(&repo->config, &item);
+    if (status != 1) return status;     // Unchanged, or the file could not be read or stored
+    
+    // Record the new version and persist the updated metadata to disk
+    if (checkin_record(repo, &item, 1, comment) < 0) return -1;
+    
+    // Return the new version number (or CHECKIN_UNCHANGED) to indicate success
+    return item.status;
+}
+
+// Work shared by the threads of checkin_files
+typedef struct CheckinBatch {
+    const RepoConfig* config;
+    CheckinItem* items;
+} CheckinBatch;
+
+/*
+The function checkin_prepare_item prepares one item of a batch (parallel_for callback).
+*/
+static void checkin_prepare_item(void* context, int index) {
+    CheckinBatch* batch = context;
+    if (batch->items[index].status == CHECKIN_UNCHANGED) return;   // Listed twice, handled by its first occurrence
+    checkin_prepare(batch->config, &batch->items[index]);
+}
+
+/*
+The function compare_items_by_name orders CheckinItem pointers by filename (qsort callback).
+*/
+static int compare_items_by_name(const void* a, const void* b) {
+    const CheckinItem* x = *(CheckinItem* const*)a;
+    const CheckinItem* y = *(CheckinItem* const*)b;
+    int cmp = strcmp(x->filename, y->filename);
+    return cmp ? cmp : (x > y) - (x < y);
+}
+
+/*
+The function checkin_files checks in a batch of files with a single metadata write.
+Files are hashed and stored in parallel on config.threads worker threads; the new versions are then recorded one
+after another in the order given. A file listed more than once is checked in once.
+Returns the number of new versions, or -1 if the metadata could not be saved.
+It takes Repository* repo, char** filenames / int count (files to check in), const char* comment,
+and CheckinItem* items (array of count entries, receives each file's result in status).
+*/
+int checkin_files(Repository* repo, char** filenames, int count, const char* comment, CheckinItem* items) {
+    if (!repo || !filenames || !items || count < 0) return -1;
     
-    // Persist the updated metadata to disk
-    save_metadata(repo);
+    // Resolve every file's latest version up front: the workers must not touch the metadata
+    for (int i = 0; i < count; i++) checkin_begin(repo, &items[i], filenames[i]);
     
-    // Return the new version number to indicate success
-    return next_version;
+    // Only the first occurrence of a repeated filename is checked in
+    CheckinItem** sorted = malloc((count + 1) * sizeof(CheckinItem*));
+    if (!sorted) return -1;
+    for (int i = 0; i < count; i++) sorted[i] = &items[i];
+    qsort(sorted, count, sizeof(CheckinItem*), compare_items_by_name);
+    for (int i = 1; i < count; i++) {
+        if (strcmp(sorted[i]->filename, sorted[i - 1]->filename) == 0) sorted[i]->status = CHECKIN_UNCHANGED;
+    }
+    free(sorted);
+    
+    CheckinBatch batch = {&repo->config, items};
+    parallel_for(count, repo->config.threads, checkin_prepare_item, &batch);
+    
+    // Record the new versions with one metadata write for the whole batch; deltifying stays on this thread
+    return checkin_record(repo, items, count, comment);
 }
 
 /*
@@ -89,62 +334,158 @@ int checkout_file(Repository* repo, const char* filename, int version) {
     }
     
     // Restore the file from the VCS storage to the working directory
-    // This copies .vcs/versions/filename/vN back to filename
-    return restore_version_file(filename, version);
+    // This copies the version's object (or legacy .vcs/versions/filename/vN) back to filename
+    return restore_version_file(file_version);
+}
+
+// Output of list is gathered in a large buffer and handed to stdio in few writes
+#define LIST_BUFFER_SIZE (64 * 1024)
+
+typedef struct ListWriter {
+    char data[LIST_BUFFER_SIZE];
+    size_t length;
+    time_t cached_minute;       // Minute whose local time text is in cached_time (-1 for none)
+    char cached_time[20];
+} ListWriter;
+
+/*
+The function list_flush hands the buffered output to stdout.
+*/
+static void list_flush(ListWriter* writer) {
+    if (writer->length) fwrite(writer->data, 1, writer->length, stdout);
+    writer->length = 0;
+}
+
+/*
+The function list_write appends bytes to the output buffer, flushing it when it fills.
+*/
+static void list_write(ListWriter* writer, const char* text, size_t length) {
+    if (writer->length + length > sizeof(writer->data)) {
+        list_flush(writer);
+        if (length > sizeof(writer->data)) {
+            fwrite(text, 1, length, stdout);
+            return;
+        }
+    }
+    memcpy(writer->data + writer->length, text, length);
+    writer->length += length;
+}
+
+/*
+The function list_printf formats a piece of output into the buffer.
+*/
+static void list_printf(ListWriter* writer, const char* format, ...) {
+    char line[MAX_PATH_LEN + 512];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (length < 0) return;
+    if ((size_t)length >= sizeof(line)) length = sizeof(line) - 1;
+    list_write(writer, line, (size_t)length);
+}
+
+/*
+The function list_escaped writes a comment with the characters that would break a TSV field or a JSON string escaped.
+It takes ListWriter* writer, const char* text and int json (1 for JSON escaping, 0 for TSV).
+*/
+static void list_escaped(ListWriter* writer, const char* text, int json) {
+    for (const char* p = text; *p; p++) {
+        unsigned char c = (unsigned char)*p;
+        if (c == '\\') list_write(writer, "\\\\", 2);
+        else if (c == '\t') list_write(writer, "\\t", 2);
+        else if (c == '\n') list_write(writer, "\\n", 2);
+        else if (c == '\r') list_write(writer, "\\r", 2);
+        else if (json && c == '"') list_write(writer, "\\\"", 2);
+        else if (json && c < 0x20) list_printf(writer, "\\u%04x", c);
+        else list_write(writer, (const char*)&c, 1);
+    }
+}
+
+/*
+The function list_local_time returns a timestamp as local time text ("YYYY-MM-DD HH:MM").
+Consecutive versions are usually checked in within the same minute, so the text of the last minute is reused
+instead of converting every row with localtime.
+*/
+static const char* list_local_time(ListWriter* writer, time_t timestamp) {
+    time_t minute = timestamp - (timestamp % 60);
+    if (minute != writer->cached_minute) {
+        struct tm tm_info;
+        localtime_r(&timestamp, &tm_info);
+        strftime(writer->cached_time, sizeof(writer->cached_time), "%Y-%m-%d %H:%M", &tm_info);
+        writer->cached_minute = minute;
+    }
+    return writer->cached_time;
 }
 
 /*
-The function list_versions displays all versions of a specific file in a formatted table.
-Shows version numbers, timestamps, file sizes, hashes, and comments for each version.
-Returns 0 if versions found and displayed, -1 if no versions exist.
-It takes Repository* repo (the VCS repository) and const char* filename (file to list versions for).
-Provides a comprehensive view of a file's version history for users.
+The function list_versions displays the versions of a specific file, newest first.
+Shows version numbers, timestamps, file sizes, hashes, and comments for each version, either as a table for
+people or as TSV or JSON for tools (timestamps there are seconds since the epoch and hashes are complete).
+Only the versions passing the filter are read from the metadata, up to its limit.
+Returns 0 if the file has versions (even if the filter selects none of them), -1 if no versions exist.
+It takes Repository* repo (the VCS repository), const char* filename (file to list versions for),
+const VersionFilter* filter (NULL lists every version) and int format (LIST_TABLE, LIST_TSV or LIST_JSON).
 */
-int list_versions(Repository* repo, const char* filename) {
+int list_versions(Repository* repo, const char* filename, const VersionFilter* filter, int format) {
     // Validate input parameters
     if (!repo || !filename) return -1;
     
-    // Print header information and table column headers
-    printf("\nVersions for file: %s\n", filename);
-    printf("%-8s %-20s %-10s %-12s %s\n", "Version", "Timestamp", "Size", "Hash", "Comment");
-    printf("%-8s %-20s %-10s %-12s %s\n", "-------", "----------", "----", "----", "-------");
-    
-    // Start traversing the repository's version list from the head
-    FileVersion* current = repo->version_list;
-    int found = 0;  // Flag to track if any versions were found
-    
-    // Iterate through all versions in the repository
-    while (current) {
-        // Check if this version entry matches the requested filename
-        if (strcmp(current->filename, filename) == 0) {
-            // Print version number in 8-character field
-            printf("%-8d ", current->version_number);
-            
-            // Format and print timestamp in human-readable format
-            char time_str[20];
-            struct tm* tm_info = localtime(&current->timestamp);
-            strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M", tm_info);
-            printf("%-20s ", time_str);
-            
-            // Print file size in 10-character field
-            printf("%-10ld ", current->file_size);
-            // Print first 12 characters of hash for identification
-            printf("%-12.12s ", current->hash);
-            // Print the full comment
-            printf("%s\n", current->comment);
-            
-            found = 1;  // Mark that we found at least one version
-        }
-        current = current->next;    // Move to next version in the list
+    // Gather the selected versions (newest first) from the metadata
+    FileVersion** versions = NULL;
+    int count = select_file_versions(repo, filename, filter, &versions);
+    if (count < 0) {
+        if (format == LIST_TABLE) printf("\nVersions for file: %s\nNo versions found.\n", filename);
+        return -1;
     }
     
-    // If no versions were found for this file, inform the user
-    if (!found) {
-        printf("No versions found.\n");
+    ListWriter* writer = malloc(sizeof(ListWriter));
+    if (!writer) {
+        free(versions);
         return -1;
     }
+    writer->length = 0;
+    writer->cached_minute = -1;
     
-    return 0;   // Return success
+    // Print header information and table column headers
+    if (format == LIST_TABLE) {
+        list_printf(writer, "\nVersions for file: %s\n", filename);
+        list_printf(writer, "%-8s %-20s %-10s %-12s %s\n", "Version", "Timestamp", "Size", "Hash", "Comment");
+        list_printf(writer, "%-8s %-20s %-10s %-12s %s\n", "-------", "----------", "----", "----", "-------");
+    } else if (format == LIST_TSV) {
+        list_printf(writer, "version\ttimestamp\tsize\thash\tcomment\n");
+    } else {
+        list_printf(writer, "[");
+    }
+    
+    for (int i = 0; i < count; i++) {
+        FileVersion* current = versions[i];
+        char hash[MAX_HASH_LEN];
+        version_hash_string(current, hash);
+        
+        if (format == LIST_TABLE) {
+            // Version, local time, size, first 12 characters of the hash and the full comment
+            list_printf(writer, "%-8d %-20s %-10ld %-12.12s %s\n", current->version_number,
+                        list_local_time(writer, current->timestamp), current->file_size, hash, current->comment);
+        } else if (format == LIST_TSV) {
+            list_printf(writer, "%d\t%lld\t%ld\t%s\t", current->version_number,
+                        (long long)current->timestamp, current->file_size, hash);
+            list_escaped(writer, current->comment, 0);
+            list_write(writer, "\n", 1);
+        } else {
+            list_printf(writer, "%s\n  {\"version\": %d, \"timestamp\": %lld, \"size\": %ld, \"hash\": \"%s\", \"comment\": \"",
+                        i ? "," : "", current->version_number, (long long)current->timestamp, current->file_size, hash);
+            list_escaped(writer, current->comment, 1);
+            list_write(writer, "\"}", 2);
+        }
+    }
+    
+    if (format == LIST_TABLE && count == 0) list_printf(writer, "No matching versions.\n");
+    if (format == LIST_JSON) list_printf(writer, "%s]\n", count ? "\n" : "");
+    list_flush(writer);
+    free(writer);
+    free(versions);
+    return 0;
 }
 
 /*
@@ -154,6 +495,9 @@ Returns 0 on success, -1 on failure (version not found or rollback failed).
 It takes Repository* repo (the VCS repository), const char* filename (file to rollback),
 and int version (version number to rollback to).
 Creates a new version entry with an automatic comment indicating the rollback operation.
+The contents are already stored, so the new version refers to the same object: the file is restored once
+(a reflink where the filesystem supports it) and neither hashed nor stored again. Versions of older
+repositories that have no object are checked in from the restored file instead.
 */
 int rollback_to_version(Repository* repo, const char* filename, int version) {
     // Validate input parameters
@@ -167,7 +511,7 @@ int rollback_to_version(Repository* repo, const char* filename, int version) {
     }
     
     // Restore the file from the VCS storage to the working directory
-    if (restore_version_file(filename, version) != 0) {
+    if (restore_version_file(file_version) != 0) {
         return -1;  // Return error if file restoration fails
     }
     
@@ -178,8 +522,23 @@ int rollback_to_version(Repository* repo, const char* filename, int version) {
     
     // Create a new version entry for the rollback
     // This ensures the rollback is permanently recorded in version history
-    int new_version = checkin_file(repo, filename, rollback_comment);
+    if (!(file_version->flags & VERSION_HAS_OBJECT)) {
+        int new_version = checkin_file(repo, filename, rollback_comment);
+        return (new_version >= 0) ? 0 : -1;
+    }
+    
+    // The restored file holds exactly the object's contents, whose id is their hash
+    CheckinItem item;
+    checkin_begin(repo, &item, filename);
+    struct stat st;
+    if (stat(filename, &st) != 0) return -1;
+    hash_to_hex(file_version->object_id, item.object_id);
+    memcpy(item.digest, file_version->object_id, HASH_RAW_LEN);
+    item.file_size = (long)st.st_size;
+    item.mtime = st.st_mtim.tv_sec;
+    item.mtime_nsec = st.st_mtim.tv_nsec;
+    item.status = 1;
     
-    // Return success (0) if new version was created, error (-1) otherwise
-    return (new_version > 0) ? 0 : -1;
+    // Return success (0) if a new version was created or the file already matched the latest version, error (-1) otherwise
+    return (checkin_record(repo, &item, 1, rollback_comment) >= 0) ? 0 : -1;
 }
\ No newline at end of file
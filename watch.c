@@ -0,0 +1,369 @@
+#include "vcs.h"
+#include <signal.h>     // Provides sigaction() to stop on SIGINT and SIGTERM
+#include <poll.h>       // Provides poll() to sleep until an event arrives or a batch is due
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<sys/inotify.h>)
+#define VCS_HAVE_INOTIFY
+#include <sys/inotify.h>
+#endif
+#endif
+
+/*
+vcs watch keeps the repository loaded and checks files in as they change, instead of polling the tree from cron.
+Every directory below the watched ones gets an inotify watch (the .vcs directory excepted); a file counts as
+changed when it is closed after writing or renamed into place, so half-written files are not captured. Changed
+paths are collected until the tree has been quiet for debounce_ms (or max_delay_ms passed since the first one),
+then checked in as one batch through checkin_files, which skips files whose stat data shows them unchanged. On
+start, and when the kernel's event queue overflows, the tracked files below the watched directories are queued
+(cheap thanks to the stat check); untracked files there are only picked up by events of their own, so build
+outputs and logs that were already lying around stay out. A directory created or moved in while watching gets
+watched and its files are queued. Between batches the process sleeps in poll() without a timeout. Editor backup
+and swap files (name~, .#name, *.swp, *.swx) are ignored.
+*/
+
+#define WATCH_EVENT_BUFFER 65536    // Bytes of inotify events read at once
+#define WATCH_BATCH_MAX 4096        // A batch is checked in at once when this many paths are queued
+#define WATCH_MASK (IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK)
+
+#ifdef VCS_HAVE_INOTIFY
+
+static volatile sig_atomic_t watch_stopping = 0;
+
+/*
+The function watch_stop asks the watch loop to check in what is queued and return (signal handler).
+*/
+static void watch_stop(int signal_number) {
+    (void)signal_number;
+    watch_stopping = 1;
+}
+
+// State of one watch run
+typedef struct Watch {
+    Repository* repo;
+    const WatchOptions* options;
+    int fd;                         // inotify instance
+    char** dirs;                    // Path of each watched directory, indexed by watch descriptor
+    int dir_cap;
+    char** pending;                 // Paths waiting to be checked in (owned, may repeat)
+    int pending_count;
+    int pending_cap;
+    long long first_change;         // When the oldest queued change arrived (ms)
+    long long last_change;          // When the newest one arrived (ms)
+    int limit_reported;             // The watch limit message was printed
+} Watch;
+
+/*
+The function now_ms reads the monotonic clock in milliseconds.
+*/
+static long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+The function ignored_name checks whether a filename belongs to an editor's backup or swap file.
+*/
+static int ignored_name(const char* name) {
+    size_t len = strlen(name);
+    if (len == 0 || name[len - 1] == '~' || strncmp(name, ".#", 2) == 0) return 1;
+    return len > 4 && (strcmp(name + len - 4, ".swp") == 0 || strcmp(name + len - 4, ".swx") == 0);
+}
+
+/*
+The function join_path builds dir/name, without a leading "./" for the repository root (the form collect_files
+and check-in use). Returns 0 on success, -1 if the path is too long.
+*/
+static int join_path(const char* dir, const char* name, char* path, size_t size) {
+    int len = (strcmp(dir, ".") == 0) ? snprintf(path, size, "%s", name) : snprintf(path, size, "%s/%s", dir, name);
+    return (len > 0 && (size_t)len < size) ? 0 : -1;
+}
+
+/*
+The function queue_path adds a changed file to the next batch.
+Returns 0 on success, -1 if memory allocation fails.
+*/
+static int queue_path(Watch* w, const char* path) {
+    if (w->pending_count == w->pending_cap) {
+        int cap = w->pending_cap ? w->pending_cap * 2 : 64;
+        char** grown = realloc(w->pending, (size_t)cap * sizeof(char*));
+        if (!grown) return -1;
+        w->pending = grown;
+        w->pending_cap = cap;
+    }
+    char* copy = strdup(path);
+    if (!copy) return -1;
+    long long now = now_ms();
+    if (w->pending_count == 0) w->first_change = now;
+    w->last_change = now;
+    w->pending[w->pending_count++] = copy;
+    return 0;
+}
+
+/*
+The function watch_directory adds an inotify watch on a directory and everything below it.
+With queue_files set the files found there are queued as well: a directory that appeared while watching may have
+been filled before its watch existed.
+Returns 0 on success, -1 on failure (directories that vanished or exceed the watch limit are skipped).
+*/
+static int watch_directory(Watch* w, const char* dir, int queue_files) {
+    int wd = inotify_add_watch(w->fd, dir, WATCH_MASK);
+    if (wd < 0) {
+        if (errno == ENOSPC && !w->limit_reported) {
+            fprintf(stderr, "vcs: inotify watch limit reached, raise fs.inotify.max_user_watches to watch '%s'\n", dir);
+            w->limit_reported = 1;
+        }
+        return (errno == ENOSPC || errno == ENOENT || errno == ENOTDIR || errno == EACCES) ? 0 : -1;
+    }
+    if (wd >= w->dir_cap) {
+        int cap = w->dir_cap ? w->dir_cap : 64;
+        while (cap <= wd) cap *= 2;
+        char** grown = realloc(w->dirs, (size_t)cap * sizeof(char*));
+        if (!grown) return -1;
+        memset(grown + w->dir_cap, 0, (size_t)(cap - w->dir_cap) * sizeof(char*));
+        w->dirs = grown;
+        w->dir_cap = cap;
+    }
+    free(w->dirs[wd]);      // A directory watched again keeps its descriptor
+    w->dirs[wd] = strdup(dir);
+    if (!w->dirs[wd]) return -1;
+
+    DIR* handle = opendir(dir);
+    if (!handle) return 0;
+    int status = 0;
+    struct dirent* entry;
+    while (status == 0 && (entry = readdir(handle)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0 || strcmp(entry->d_name, VCS_DIR) == 0) continue;
+        char path[MAX_PATH_LEN];
+        struct stat st;
+        if (join_path(dir, entry->d_name, path, sizeof(path)) != 0 || lstat(path, &st) != 0) continue;
+        if (S_ISDIR(st.st_mode)) status = watch_directory(w, path, queue_files);
+        else if (queue_files && S_ISREG(st.st_mode) && !ignored_name(entry->d_name)) status = queue_path(w, path);
+    }
+    closedir(handle);
+    return status;
+}
+
+/*
+The function below_directory checks whether a repository path lies below a watched directory.
+*/
+static int below_directory(const char* path, const char* dir) {
+    while (dir[0] == '.' && dir[1] == '/') dir += 2;
+    size_t len = strlen(dir);
+    while (len > 0 && dir[len - 1] == '/') len--;
+    if (len == 0 || (len == 1 && dir[0] == '.')) return 1;
+    return strncmp(path, dir, len) == 0 && (path[len] == '/' || path[len] == '\0');
+}
+
+/*
+The function queue_tracked queues the tracked files below the watched directories, to catch up with changes no
+event reported (made before the watches existed, or lost when the event queue overflowed).
+Returns 0 on success, -1 if the versions could not be collected or memory allocation fails.
+*/
+static int queue_tracked(Watch* w, char** roots, int root_count) {
+    FileVersion** versions = NULL;
+    int count = collect_latest_versions(w->repo, &versions);
+    if (count < 0) return -1;
+    int status = 0;
+    for (int i = 0; status == 0 && i < count; i++) {
+        const char* filename = versions[i]->filename;
+        const char* name = strrchr(filename, '/');
+        if (ignored_name(name ? name + 1 : filename)) continue;
+        for (int r = 0; r < root_count; r++) {
+            if (below_directory(filename, roots[r])) {
+                status = queue_path(w, filename);
+                break;
+            }
+        }
+    }
+    free(versions);
+    return status;
+}
+
+/*
+The function compare_paths orders strings (qsort callback).
+*/
+static int compare_paths(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+/*
+The function check_in_pending checks in the queued files as one batch and empties the queue.
+Files that were removed again before the batch are dropped. Returns 0 on success, -1 if the metadata could not be
+saved (the queue is emptied anyway; the next change of a file queues it again).
+*/
+static int check_in_pending(Watch* w) {
+    if (w->pending_count == 0) return 0;
+
+    // Coalesce repeated changes of a file, and drop what is no longer a regular file
+    qsort(w->pending, (size_t)w->pending_count, sizeof(char*), compare_paths);
+    int count = 0;
+    for (int i = 0; i < w->pending_count; i++) {
+        struct stat st;
+        if ((count > 0 && strcmp(w->pending[count - 1], w->pending[i]) == 0) ||
+            lstat(w->pending[i], &st) != 0 || !S_ISREG(st.st_mode)) {
+            free(w->pending[i]);
+            continue;
+        }
+        w->pending[count++] = w->pending[i];
+    }
+    w->pending_count = 0;
+
+    int status = 0;
+    CheckinItem* items = (count > 0) ? calloc((size_t)count, sizeof(CheckinItem)) : NULL;
+    if (count > 0) {
+        int added = items ? checkin_files(w->repo, w->pending, count, w->options->comment, items) : -1;
+        if (added < 0) {
+            printf("Failed to check in %d changed files.\n", count);
+            status = -1;
+        } else {
+            for (int i = 0; i < count; i++) {
+                if (items[i].status > 0) printf("Checked in '%s' as version %d\n", w->pending[i], items[i].status);
+                else if (items[i].status != CHECKIN_UNCHANGED) printf("Failed to check in '%s'\n", w->pending[i]);
+            }
+        }
+        fflush(stdout);
+    }
+    for (int i = 0; i < count; i++) free(w->pending[i]);
+    free(items);
+    return status;
+}
+
+/*
+The function handle_events reads the available inotify events and queues what they changed.
+Returns 0 on success, -1 on failure.
+*/
+static int handle_events(Watch* w, char** roots, int root_count) {
+    // inotify events are aligned like the struct; the buffer must be as well
+    union {
+        struct inotify_event event;
+        char bytes[WATCH_EVENT_BUFFER];
+    } buffer;
+    ssize_t len = read(w->fd, buffer.bytes, sizeof(buffer.bytes));
+    if (len < 0) return (errno == EINTR || errno == EAGAIN) ? 0 : -1;
+
+    int status = 0;
+    for (ssize_t pos = 0; status == 0 && pos + (ssize_t)sizeof(struct inotify_event) <= len;) {
+        const struct inotify_event* event = (const struct inotify_event*)(buffer.bytes + pos);
+        pos += (ssize_t)sizeof(struct inotify_event) + (ssize_t)event->len;
+
+        if (event->mask & IN_Q_OVERFLOW) {
+            // Events were lost: watch directories that may have been missed and queue the tracked files,
+            // the stat check finds what changed
+            for (int i = 0; status == 0 && i < root_count; i++) status = watch_directory(w, roots[i], 0);
+            if (status == 0) status = queue_tracked(w, roots, root_count);
+            continue;
+        }
+        if (event->wd < 0 || event->wd >= w->dir_cap || !w->dirs[event->wd]) continue;
+        if (event->mask & IN_IGNORED) {
+            free(w->dirs[event->wd]);       // The directory is gone
+            w->dirs[event->wd] = NULL;
+            continue;
+        }
+        if (event->len == 0 || strcmp(event->name, VCS_DIR) == 0) continue;
+
+        char path[MAX_PATH_LEN];
+        if (join_path(w->dirs[event->wd], event->name, path, sizeof(path)) != 0) continue;
+        if (event->mask & IN_ISDIR) {
+            if (event->mask & (IN_CREATE | IN_MOVED_TO)) status = watch_directory(w, path, 1);
+        } else if ((event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) && !ignored_name(event->name)) {
+            status = queue_path(w, path);
+        }
+    }
+    return status;
+}
+
+/*
+The function watch_tree watches directories and checks their files in as they change, until SIGINT or SIGTERM.
+What is queued when the signal arrives is checked in before it returns.
+Returns 0 once stopped, -1 on failure (inotify unavailable, a directory that cannot be watched, or memory
+allocation failures).
+It takes Repository* repo (stays loaded for the whole run), char** dirs / int count (relative to the repository
+root) and const WatchOptions* options.
+*/
+int watch_tree(Repository* repo, char** dirs, int count, const WatchOptions* options) {
+    if (!repo || !dirs || count <= 0 || !options) return -1;
+    Watch w;
+    memset(&w, 0, sizeof(w));
+    w.repo = repo;
+    w.options = options;
+    w.fd = inotify_init();
+    if (w.fd < 0) {
+        perror("inotify_init");
+        return -1;
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = watch_stop;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    watch_stopping = 0;
+
+    // The first batch catches up with the tracked files that changed while nothing was watching
+    int status = 0;
+    for (int i = 0; status == 0 && i < count; i++) {
+        struct stat st;
+        if (stat(dirs[i], &st) != 0 || !S_ISDIR(st.st_mode)) {
+            printf("'%s' is not a directory.\n", dirs[i]);
+            status = -1;
+        } else {
+            status = watch_directory(&w, dirs[i], 0);
+        }
+    }
+    if (status == 0) status = queue_tracked(&w, dirs, count);
+    if (status == 0) {
+        printf("Watching %d %s for changes (Ctrl-C stops)\n", count, count == 1 ? "directory" : "directories");
+        status = check_in_pending(&w);
+    }
+
+    while (status == 0 && !watch_stopping) {
+        // Sleep until an event arrives, or until the queued changes are due
+        int timeout = -1;
+        if (w.pending_count > 0) {
+            long long now = now_ms();
+            long long due = w.last_change + options->debounce_ms;
+            if (w.first_change + options->max_delay_ms < due) due = w.first_change + options->max_delay_ms;
+            timeout = (due > now) ? (int)(due - now) : 0;
+        }
+        struct pollfd p = {w.fd, POLLIN, 0};
+        int ready = poll(&p, 1, timeout);
+        if (ready < 0 && errno != EINTR) {
+            status = -1;
+            break;
+        }
+        if (ready > 0) status = handle_events(&w, dirs, count);
+
+        long long now = now_ms();
+        if (status == 0 && w.pending_count > 0 &&
+            (now - w.last_change >= options->debounce_ms || now - w.first_change >= options->max_delay_ms ||
+             w.pending_count >= WATCH_BATCH_MAX)) {
+            check_in_pending(&w);   // A failed batch is reported; watching goes on
+        }
+    }
+    if (watch_stopping) check_in_pending(&w);
+
+    for (int i = 0; i < w.pending_count; i++) free(w.pending[i]);
+    free(w.pending);
+    for (int i = 0; i < w.dir_cap; i++) free(w.dirs[i]);
+    free(w.dirs);
+    close(w.fd);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    return status;
+}
+
+#else
+
+int watch_tree(Repository* repo, char** dirs, int count, const WatchOptions* options) {
+    (void)repo;
+    (void)dirs;
+    (void)count;
+    (void)options;
+    fprintf(stderr, "vcs: watch needs inotify, which this system does not provide\n");
+    return -1;
+}
+
+#endif